@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# compare.sh: Flag benchmarks whose ns/op regressed beyond a threshold
+
+if [ $# -lt 2 ] || [ $# -gt 4 ]; then
+    echo "Usage: $0 BASELINE.json RESULTS.json [THRESHOLD_PERCENT] [FLOOR_NS]"
+    exit 2
+fi
+
+BASELINE=$1
+RESULTS=$2
+THRESHOLD=${3:-10}
+FLOOR=${4:-2}
+
+for file in $BASELINE $RESULTS; do
+    if [ ! -r $file ]; then
+	echo "Unable to read $file"
+	exit 2
+    fi
+done
+
+# results are written one object per line: key them by name and image blocks
+extract() {
+    sed -n 's/.*"name": "\([^"]*\)", "blocks": \([0-9]*\),.*"ns_per_op": \([0-9.]*\),.*/\1 \2 \3/p' $1
+}
+
+# a benchmark regresses only if it slowed down by more than the threshold and
+# by more than the floor, so timer noise on operations of a few ns is ignored
+awk -v threshold=$THRESHOLD -v floor=$FLOOR '
+    NR == FNR { base[$1 " " $2] = $3; next }
+    {
+	key = $1 " " $2
+	if (!(key in base) || base[key] == 0) {
+	    printf "%-16s %8s blocks %12s -> %12.1f ns/op  (new)\n", $1, $2, "-", $3
+	    next
+	}
+
+	change = 100.0 * ($3 - base[key]) / base[key]
+	regressed = change > threshold && $3 - base[key] > floor
+	status = regressed ? "REGRESSION" : "ok"
+	failures += regressed
+	printf "%-16s %8s blocks %12.1f -> %12.1f ns/op %+7.1f%%  %s\n", $1, $2, base[key], $3, change, status
+    }
+    END { exit failures > 0 }
+' <(extract $BASELINE) <(extract $RESULTS)
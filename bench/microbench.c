@@ -0,0 +1,496 @@
+/* microbench.c: SimpleFS microbenchmarks */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/simd.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/* Constants */
+
+#define BENCH_SCALES        "1024,8192,32768"   /* Default image sizes (blocks) */
+#define BENCH_ROUNDS        (3)                 /* Default rounds over every scale */
+#define BENCH_FILE_BLOCKS   (4)                 /* Data blocks per benchmark file */
+#define BENCH_FILE_RATIO    (8)                 /* One file per this many image blocks */
+#define BENCH_PASSES        (5)                 /* Minimum passes per benchmark (fastest reported) */
+#define BENCH_PASSES_MAX    (1000)              /* Maximum passes per benchmark */
+#define BENCH_MIN_TIME      (50)                /* Minimum total time per benchmark (ms) */
+
+/* Structures */
+
+typedef struct BenchResult BenchResult;
+struct BenchResult {
+    char        name[64];                       /* Benchmark name */
+    size_t      blocks;                         /* Image size (blocks) */
+    size_t      files;                          /* Number of files */
+    size_t      ops;                            /* Operations per pass */
+    size_t      bytes;                          /* Bytes transferred per pass */
+    size_t      passes;                         /* Passes over all rounds */
+    uint64_t    best;                           /* Fastest pass over all rounds (ns) */
+};
+
+typedef struct Bench Bench;
+struct Bench {
+    FILE       *stream;                         /* JSON output stream */
+    BenchResult *result;                        /* Results (one per benchmark and scale) */
+    size_t      results;                        /* Number of results */
+    size_t      capacity;                       /* Capacity of results */
+    uint64_t    start;                          /* Start of current pass */
+    uint64_t    best;                           /* Fastest pass of current measurement (ns) */
+    uint64_t    elapsed;                        /* Total time of current measurement (ns) */
+    size_t      passes;                         /* Passes of current measurement */
+};
+
+/* Prototypes */
+
+void    bench_start(Bench *bench);
+bool    bench_lap(Bench *bench);
+void    bench_stop(Bench *bench, const char *name, size_t blocks, size_t files, size_t ops, size_t bytes);
+void    bench_write(Bench *bench);
+void    bench_shuffle(size_t *items, size_t n);
+bool    bench_disk(Bench *bench, const char *path, size_t blocks);
+bool    bench_fs(Bench *bench, const char *path, size_t blocks);
+bool    bench_simd(Bench *bench, size_t blocks);
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    -s SCALES      Comma separated image sizes in blocks (default: %s)\n", BENCH_SCALES);
+    fprintf(stderr, "    -d DIRECTORY   Directory for generated images (default: /tmp)\n");
+    fprintf(stderr, "    -o PATH        Write JSON results to PATH (default: stdout)\n");
+    fprintf(stderr, "    -r ROUNDS      Rounds over every scale, fastest kept (default: %d)\n", BENCH_ROUNDS);
+    exit(status);
+}
+
+// start a pass of the current measurement
+void    bench_start(Bench *bench) {
+    bench->start = stats_now();
+}
+
+// end a pass, keeping the fastest, and return whether another pass is needed
+bool    bench_lap(Bench *bench) {
+    uint64_t elapsed = stats_now() - bench->start;
+    if (!bench->passes || elapsed < bench->best) {
+        bench->best = elapsed;
+    }
+    bench->elapsed += elapsed;
+    bench->passes++;
+
+    return bench->passes < BENCH_PASSES_MAX &&
+           (bench->passes < BENCH_PASSES || bench->elapsed < BENCH_MIN_TIME * 1000000ULL);
+}
+
+// stop measurement and keep the fastest pass of any round for each benchmark
+void    bench_stop(Bench *bench, const char *name, size_t blocks, size_t files, size_t ops, size_t bytes) {
+    BenchResult *result = NULL;
+    for (size_t r = 0; r < bench->results; r++) {
+        if (bench->result[r].blocks == blocks && !strcmp(bench->result[r].name, name)) {
+            result = &bench->result[r];
+            break;
+        }
+    }
+
+    if (!result) {
+        if (bench->results == bench->capacity) {
+            size_t       capacity = bench->capacity ? 2 * bench->capacity : 64;
+            BenchResult *table    = realloc(bench->result, capacity * sizeof(BenchResult));
+            if (!table) {
+                fprintf(stderr, "bench_stop: realloc: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            bench->result   = table;
+            bench->capacity = capacity;
+        }
+
+        result = &bench->result[bench->results++];
+        snprintf(result->name, sizeof(result->name), "%s", name);
+        result->blocks = blocks;
+        result->files  = files;
+        result->ops    = ops;
+        result->bytes  = bytes;
+        result->passes = 0;
+        result->best   = bench->best;
+    }
+
+    if (bench->best < result->best) {
+        result->best = bench->best;
+    }
+    result->passes += bench->passes;
+
+    fprintf(stderr, "%-16s %8lu blocks %8lu files %10.1f ns/op (%lu passes)\n",
+        name, blocks, files, ops ? bench->best / (double)ops : 0.0, bench->passes);
+
+    bench->passes  = 0;
+    bench->elapsed = 0;
+}
+
+// write every result as one JSON object per line
+void    bench_write(Bench *bench) {
+    fprintf(bench->stream, "{\n  \"benchmarks\": [\n");
+    for (size_t r = 0; r < bench->results; r++) {
+        BenchResult *result  = &bench->result[r];
+        double       seconds = result->best / 1e9;
+
+        fprintf(bench->stream, "%s    {\"name\": \"%s\", \"blocks\": %lu, \"files\": %lu, \"ops\": %lu, \"passes\": %lu, "
+            "\"seconds\": %.6f, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f}",
+            r ? ",\n" : "", result->name, result->blocks, result->files, result->ops, result->passes, seconds,
+            result->ops ? seconds * 1e9 / result->ops : 0.0,
+            seconds > 0 ? result->ops / seconds : 0.0,
+            seconds > 0 ? result->bytes / seconds / (1 << 20) : 0.0);
+    }
+    fprintf(bench->stream, "\n  ]\n}\n");
+}
+
+// shuffle items in place (Fisher-Yates)
+void    bench_shuffle(size_t *items, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = rand() % i;
+        size_t t = items[i - 1];
+        items[i - 1] = items[j];
+        items[j]     = t;
+    }
+}
+
+// benchmark raw block transfers (the image is overwritten)
+bool    bench_disk(Bench *bench, const char *path, size_t blocks) {
+    Disk *disk = disk_open(path, blocks);
+    if (!disk) {
+        return false;
+    }
+
+    char    data[BLOCK_SIZE];
+    size_t *order = calloc(blocks, sizeof(size_t));
+    for (size_t b = 0; b < blocks; b++) {
+        order[b] = b;
+    }
+    bench_shuffle(order, blocks);
+    memset(data, 'x', BLOCK_SIZE);
+
+    do {
+        bench_start(bench);
+        for (size_t b = 0; b < blocks; b++) {
+            disk_write(disk, b, data);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "disk_write_seq", blocks, 0, blocks, blocks * BLOCK_SIZE);
+
+    do {
+        bench_start(bench);
+        for (size_t b = 0; b < blocks; b++) {
+            disk_read(disk, b, data);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "disk_read_seq", blocks, 0, blocks, blocks * BLOCK_SIZE);
+
+    do {
+        bench_start(bench);
+        for (size_t b = 0; b < blocks; b++) {
+            disk_read(disk, order[b], data);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "disk_read_rand", blocks, 0, blocks, blocks * BLOCK_SIZE);
+
+    // the same reads with every block verified against its CRC32C
+    char checksums[BUFSIZ];
+    snprintf(checksums, sizeof(checksums), "%s.crc", path);
+    if (disk_checksum(disk, checksums, true)) {
+        do {
+            bench_start(bench);
+            for (size_t b = 0; b < blocks; b++) {
+                disk_read(disk, b, data);
+            }
+        } while (bench_lap(bench));
+        bench_stop(bench, "disk_read_seq_crc", blocks, 0, blocks, blocks * BLOCK_SIZE);
+        disk_checksum(disk, NULL, false);
+    }
+    unlink(checksums);
+
+    free(order);
+    disk_close(disk);
+    return true;
+}
+
+// benchmark file system operations on a freshly formatted image
+bool    bench_fs(Bench *bench, const char *path, size_t blocks) {
+    Disk *disk = disk_open(path, blocks);
+    if (!disk) {
+        return false;
+    }
+
+    FileSystem fs = {0};
+    if (!fs_format(&fs, disk)) {
+        disk_close(disk);
+        return false;
+    }
+
+    // every pass after the first remounts the image (unmount is untimed)
+    bool mounted = false;
+    do {
+        if (mounted) {
+            fs_unmount(&fs);
+        }
+        bench_start(bench);
+        mounted = fs_mount(&fs, disk);
+    } while (bench_lap(bench) && mounted);
+    bench_stop(bench, "fs_mount", blocks, 0, 1, 0);
+    if (!mounted) {
+        disk_close(disk);
+        return false;
+    }
+
+    size_t  files  = min(blocks / BENCH_FILE_RATIO, fs.meta_data.inodes);
+    size_t  length = BENCH_FILE_BLOCKS * BLOCK_SIZE;
+    size_t *inodes = calloc(files, sizeof(size_t));
+    size_t *order  = calloc(files * BENCH_FILE_BLOCKS, sizeof(size_t));
+    char   *data   = malloc(length + 1);
+    memset(data, 'x', length);
+    data[length] = 0;
+
+    // every pass after the first starts by removing the files (untimed)
+    do {
+        for (size_t f = 0; bench->passes && f < files; f++) {
+            fs_remove(&fs, inodes[f]);
+        }
+        bench_start(bench);
+        for (size_t f = 0; f < files; f++) {
+            inodes[f] = fs_create(&fs);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_create", blocks, files, files, 0);
+
+    do {
+        bench_start(bench);
+        for (size_t f = 0; f < files; f++) {
+            fs_stat(&fs, inodes[f]);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_stat", blocks, files, files, 0);
+
+    // fs_write always rewrites a file from its start, so the random variant
+    // writes whole files in random order (second half of the files)
+    size_t half = files / 2;
+    do {
+        bench_start(bench);
+        for (size_t f = 0; f < half; f++) {
+            fs_write(&fs, inodes[f], data, length, 0);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_write_seq", blocks, half, half, half * length);
+
+    for (size_t f = half; f < files; f++) {
+        order[f - half] = inodes[f];
+    }
+    bench_shuffle(order, files - half);
+    do {
+        bench_start(bench);
+        for (size_t f = 0; f < files - half; f++) {
+            fs_write(&fs, order[f], data, length, 0);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_write_rand", blocks, files - half, files - half, (files - half) * length);
+
+    // read every block of every file, in order and then in random order
+    size_t reads = files * BENCH_FILE_BLOCKS;
+    do {
+        bench_start(bench);
+        for (size_t r = 0; r < reads; r++) {
+            fs_read(&fs, inodes[r / BENCH_FILE_BLOCKS], data, BLOCK_SIZE, (r % BENCH_FILE_BLOCKS) * BLOCK_SIZE);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_read_seq", blocks, files, reads, reads * BLOCK_SIZE);
+
+    for (size_t r = 0; r < reads; r++) {
+        order[r] = r;
+    }
+    bench_shuffle(order, reads);
+    do {
+        bench_start(bench);
+        for (size_t r = 0; r < reads; r++) {
+            fs_read(&fs, inodes[order[r] / BENCH_FILE_BLOCKS], data, BLOCK_SIZE, (order[r] % BENCH_FILE_BLOCKS) * BLOCK_SIZE);
+        }
+    } while (bench_lap(bench));
+    bench_stop(bench, "fs_read_rand", blocks, files, reads, reads * BLOCK_SIZE);
+
+    // mount time grows with the number of files whose blocks must be marked
+    do {
+        if (mounted) {
+            fs_unmount(&fs);
+        }
+        bench_start(bench);
+        mounted = fs_mount(&fs, disk);
+    } while (bench_lap(bench) && mounted);
+    bench_stop(bench, "fs_mount_files", blocks, files, 1, 0);
+
+    if (mounted) {
+        // every pass after the first recreates the files (untimed)
+        do {
+            for (size_t f = 0; bench->passes && f < files; f++) {
+                inodes[f] = fs_create(&fs);
+                fs_write(&fs, inodes[f], data, length, 0);
+            }
+            bench_start(bench);
+            for (size_t f = 0; f < files; f++) {
+                fs_remove(&fs, inodes[f]);
+            }
+        } while (bench_lap(bench));
+        bench_stop(bench, "fs_remove", blocks, files, files, 0);
+
+        // the same files compressed: each file is a single cluster stored in
+        // one block instead of BENCH_FILE_BLOCKS
+        memset(data, 'x', length);
+        for (size_t f = 0; f < files; f++) {
+            inodes[f] = fs_create(&fs);
+            fs_compress(&fs, inodes[f]);
+            fs_write(&fs, inodes[f], data, length, 0);
+        }
+
+        do {
+            bench_start(bench);
+            for (size_t r = 0; r < reads; r++) {
+                fs_read(&fs, inodes[r / BENCH_FILE_BLOCKS], data, BLOCK_SIZE, (r % BENCH_FILE_BLOCKS) * BLOCK_SIZE);
+            }
+        } while (bench_lap(bench));
+        bench_stop(bench, "fs_read_seq_lz", blocks, files, reads, reads * BLOCK_SIZE);
+
+        for (size_t f = 0; f < files; f++) {
+            fs_remove(&fs, inodes[f]);
+        }
+        fs_unmount(&fs);
+    }
+
+    free(data);
+    free(order);
+    free(inodes);
+    disk_close(disk);
+    return mounted;
+}
+
+// benchmark metadata scanning kernels at every SIMD level the processor has
+bool    bench_simd(Bench *bench, size_t blocks) {
+    Block    *table   = calloc(blocks, sizeof(Block));
+    bool     *bitmap  = calloc(blocks, sizeof(bool));
+    uint32_t *indices = malloc(POINTERS_PER_BLOCK * sizeof(uint32_t));
+    if (!table || !bitmap || !indices) {
+        free(table);
+        free(bitmap);
+        free(indices);
+        return false;
+    }
+
+    // pointer blocks filled to a random depth, like partially written files
+    for (size_t b = 0; b < blocks; b++) {
+        size_t used = rand() % POINTERS_PER_BLOCK;
+        for (size_t p = 0; p < used; p++) {
+            table[b].pointers[p] = 1 + rand() % (blocks - 1);
+        }
+    }
+
+    int  previous = simd_level();
+    char name[BUFSIZ];
+    for (int level = SIMD_SCALAR; level <= simd_supported(); level++) {
+        simd_use(level);
+
+        do {
+            bench_start(bench);
+            for (size_t b = 0; b < blocks; b++) {
+                simd_mark(bitmap, table[b].pointers, POINTERS_PER_BLOCK, blocks, false);
+            }
+        } while (bench_lap(bench));
+        snprintf(name, sizeof(name), "simd_mark_%s", simd_level_name(level));
+        bench_stop(bench, name, blocks, 0, blocks, blocks * BLOCK_SIZE);
+
+        do {
+            bench_start(bench);
+            for (size_t b = 0; b < blocks; b++) {
+                simd_nonzero(&table[b].inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, indices);
+            }
+        } while (bench_lap(bench));
+        snprintf(name, sizeof(name), "simd_inodes_%s", simd_level_name(level));
+        bench_stop(bench, name, blocks, 0, blocks, blocks * BLOCK_SIZE);
+
+        do {
+            bench_start(bench);
+            for (size_t b = 0; b < blocks; b++) {
+                simd_zero(bitmap, blocks);
+            }
+        } while (bench_lap(bench));
+        snprintf(name, sizeof(name), "simd_zero_%s", simd_level_name(level));
+        bench_stop(bench, name, blocks, 0, blocks, blocks * blocks);
+    }
+    simd_use(previous);
+
+    free(indices);
+    free(bitmap);
+    free(table);
+    return true;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    const char *scales    = BENCH_SCALES;
+    const char *directory = "/tmp";
+    const char *output    = NULL;
+    size_t      rounds    = BENCH_ROUNDS;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:d:o:r:h")) != -1) {
+        switch (option) {
+            case 's': scales    = optarg; break;
+            case 'd': directory = optarg; break;
+            case 'o': output    = optarg; break;
+            case 'r': rounds    = strtoul(optarg, NULL, 10); break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default:  usage(argv[0], EXIT_FAILURE); break;
+        }
+    }
+
+    Bench bench = {stdout, NULL, 0, 0, 0, 0, 0, 0};
+    if (output && !(bench.stream = fopen(output, "w"))) {
+        fprintf(stderr, "Unable to open %s: %s\n", output, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // whole rounds over every scale, so a slow period of the machine only
+    // affects the passes of one round rather than every pass of a benchmark
+    int status = EXIT_SUCCESS;
+    for (size_t round = 0; round < rounds && status == EXIT_SUCCESS; round++) {
+        srand(0);
+
+        char *list = strdup(scales);
+        for (char *scale = strtok(list, ","); scale; scale = strtok(NULL, ",")) {
+            size_t blocks = strtoul(scale, NULL, 10);
+            if (blocks < 2 * BENCH_FILE_RATIO) {
+                fprintf(stderr, "Invalid scale: %s\n", scale);
+                status = EXIT_FAILURE;
+                continue;
+            }
+
+            char path[BUFSIZ];
+            snprintf(path, sizeof(path), "%s/sfs-microbench.%d.%lu", directory, getpid(), blocks);
+
+            if (!bench_disk(&bench, path, blocks) || !bench_fs(&bench, path, blocks) || !bench_simd(&bench, blocks)) {
+                fprintf(stderr, "Benchmark failed at %lu blocks\n", blocks);
+                status = EXIT_FAILURE;
+            }
+            unlink(path);
+        }
+        free(list);
+    }
+
+    bench_write(&bench);
+    free(bench.result);
+    if (output) {
+        fclose(bench.stream);
+    }
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
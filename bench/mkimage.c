@@ -0,0 +1,353 @@
+/* mkimage.c: SimpleFS synthetic image generator (sfs-mkimage) */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define DIST_FIXED      (0)
+#define DIST_UNIFORM    (1)
+#define DIST_EXP        (2)
+
+#define MAX_FILE_SIZE   ((POINTERS_PER_INODE + POINTERS_PER_BLOCK) * BLOCK_SIZE)
+#define CHUNK_BLOCKS    (256)                   /* Blocks per sequential write (1 MiB) */
+#define OWNER_INDIRECT  (1U << 31)              /* Owner flag: block is an indirect block */
+
+/* Structures */
+
+typedef struct Options Options;
+struct Options {
+    size_t      blocks;                         /* Blocks of image */
+    size_t      files;                          /* Number of files (0 to fill image) */
+    int         dist;                           /* File size distribution (DIST_*) */
+    size_t      size_min;                       /* Minimum (or fixed, or mean) file size */
+    size_t      size_max;                       /* Maximum file size */
+    unsigned    fragmentation;                  /* Percent of allocations at a random position */
+    unsigned    fill;                           /* Percent of data blocks to use at most */
+    unsigned    seed;                           /* Random number seed */
+};
+
+typedef struct File File;
+struct File {
+    uint32_t    inode;                          /* Inode number */
+    uint32_t    size;                           /* File size */
+    uint32_t    first;                          /* Index of first data block in Pointers */
+    uint32_t    count;                          /* Number of data blocks */
+    uint32_t    indirect;                       /* Indirect block (0 if none) */
+};
+
+/* Globals */
+
+static Options      Opts = {
+    .blocks         = 1 << 20,
+    .dist           = DIST_FIXED,
+    .size_min       = 16 * BLOCK_SIZE,
+    .size_max       = 16 * BLOCK_SIZE,
+    .fill           = 90,
+};
+
+static SuperBlock   Super;                      /* Superblock of image */
+static File        *Files      = NULL;
+static size_t       NFiles     = 0;             /* Number of planned files */
+static uint32_t    *Pointers   = NULL;          /* Data blocks of all files (in file order) */
+static size_t       NPointers  = 0;             /* Number of planned data blocks */
+static size_t       Used       = 0;             /* Number of planned data and indirect blocks */
+static uint32_t    *Owner      = NULL;          /* File (plus one) owning each block (0 if free) */
+static uint32_t    *Slots      = NULL;          /* File (plus one) in each inode (0 if free) */
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [options] <image>\n", program);
+    fprintf(stderr, "    -b BLOCKS      Blocks of image (default: %lu)\n", Opts.blocks);
+    fprintf(stderr, "    -f FILES       Number of files (default: fill image)\n");
+    fprintf(stderr, "    -z SIZE        File sizes: N, MIN-MAX (uniform) or exp:MEAN (default: %lu)\n", Opts.size_min);
+    fprintf(stderr, "    -F PERCENT     Fragmentation: allocations at a random position (default: 0)\n");
+    fprintf(stderr, "    -u PERCENT     Data blocks to use at most when filling (default: %u)\n", Opts.fill);
+    fprintf(stderr, "    -s SEED        Random number seed (default: 0)\n");
+    exit(status);
+}
+
+// parse size with optional K, M or G suffix
+size_t  parse_size(const char *s) {
+    char  *end;
+    size_t size = strtoul(s, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+        case 'g': case 'G': size <<= 30; break;
+    }
+    return size;
+}
+
+// parse file size distribution (empty files are allowed, to fill the inode table)
+bool    parse_dist(const char *s) {
+    const char *dash = strchr(s, '-');
+
+    if (strncmp(s, "exp:", 4) == 0) {
+        Opts.dist     = DIST_EXP;
+        Opts.size_min = parse_size(s + 4);
+        Opts.size_max = MAX_FILE_SIZE;
+        return Opts.size_min > 0;
+    } else if (dash) {
+        Opts.dist     = DIST_UNIFORM;
+        Opts.size_min = parse_size(s);
+        Opts.size_max = parse_size(dash + 1);
+    } else {
+        Opts.dist     = DIST_FIXED;
+        Opts.size_min = Opts.size_max = parse_size(s);
+    }
+
+    return Opts.size_min <= Opts.size_max && Opts.size_max <= MAX_FILE_SIZE;
+}
+
+// draw a file size from the configured distribution
+size_t  draw_size(void) {
+    double u = (rand_r(&Opts.seed) + 1.0) / ((double)RAND_MAX + 2.0);
+
+    switch (Opts.dist) {
+        case DIST_UNIFORM:
+            return Opts.size_min + (size_t)(u * (Opts.size_max - Opts.size_min + 1));
+        case DIST_EXP:
+            return min(max((size_t)(-log(u) * Opts.size_min), 1), MAX_FILE_SIZE);
+        default:
+            return Opts.size_min;
+    }
+}
+
+// draw a random number in [0, n) (rand_r only yields 31 bits)
+size_t  draw_index(size_t n) {
+    size_t r = ((size_t)rand_r(&Opts.seed) << 31) | rand_r(&Opts.seed);
+    return r % n;
+}
+
+// claim the first free slot at or after cursor (jumping to a random slot when fragmenting)
+size_t  claim(uint32_t *slots, size_t start, size_t end, size_t *cursor, uint32_t owner) {
+    if (Opts.fragmentation && (unsigned)(rand_r(&Opts.seed) % 100) < Opts.fragmentation) {
+        *cursor = start + draw_index(end - start);
+    }
+
+    // the caller guarantees a free slot exists, so the scan wraps at most once
+    size_t slot = *cursor;
+    while (slots[slot]) {
+        if (++slot == end) {
+            slot = start;
+        }
+    }
+
+    slots[slot] = owner;
+    *cursor     = (slot + 1 == end) ? start : slot + 1;
+    return slot;
+}
+
+// plan inode table and block allocation of every file in memory
+bool    plan(void) {
+    size_t data_start  = 1 + Super.inode_blocks;
+    size_t data_blocks = Super.blocks - data_start;
+    size_t budget      = Opts.files ? data_blocks : data_blocks * Opts.fill / 100;
+    size_t limit       = Opts.files ? Opts.files : Super.inodes;
+    size_t block       = data_start;
+    size_t inode       = 0;
+
+    Files    = calloc(limit, sizeof(File));
+    Pointers = calloc(max(budget, 1), sizeof(uint32_t));
+    Owner    = calloc(Super.blocks, sizeof(uint32_t));
+    Slots    = calloc(Super.inodes, sizeof(uint32_t));
+    if (!Files || !Pointers || !Owner || !Slots) {
+        fprintf(stderr, "Unable to allocate plan for %u blocks\n", Super.blocks);
+        return false;
+    }
+
+    while (NFiles < limit) {
+        size_t size   = draw_size();
+        size_t count  = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        size_t needed = count + (count > POINTERS_PER_INODE);
+        if (Used + needed > budget) {
+            break;
+        }
+
+        File *file  = &Files[NFiles++];
+        file->inode = claim(Slots, 0, Super.inodes, &inode, NFiles);
+        file->size  = size;
+        file->first = NPointers;
+        file->count = count;
+
+        // the indirect block is allocated when the first indirect data block is
+        for (size_t b = 0; b < count; b++) {
+            if (b == POINTERS_PER_INODE) {
+                file->indirect = claim(Owner, data_start, Super.blocks, &block, NFiles | OWNER_INDIRECT);
+            }
+            Pointers[NPointers++] = claim(Owner, data_start, Super.blocks, &block, NFiles);
+        }
+        Used += needed;
+    }
+
+    if (Opts.files && NFiles < Opts.files) {
+        fprintf(stderr, "Only %lu of %lu files fit in %u blocks\n", NFiles, Opts.files, Super.blocks);
+        return false;
+    }
+
+    return true;
+}
+
+// render contents of block from the plan
+void    render(size_t b, char *data) {
+    memset(data, 0, BLOCK_SIZE);
+
+    // superblock
+    if (b == 0) {
+        memcpy(data, &Super, sizeof(Super));
+        return;
+    }
+
+    // inode table
+    if (b <= Super.inode_blocks) {
+        Inode *inodes = (Inode *)data;
+        for (size_t i = 0; i < INODES_PER_BLOCK; i++) {
+            uint32_t slot = Slots[(b - 1) * INODES_PER_BLOCK + i];
+            if (!slot) {
+                continue;
+            }
+
+            File *file = &Files[slot - 1];
+            inodes[i].valid    = 1;
+            inodes[i].size     = file->size;
+            inodes[i].indirect = file->indirect;
+            for (size_t d = 0; d < min(file->count, POINTERS_PER_INODE); d++) {
+                inodes[i].direct[d] = Pointers[file->first + d];
+            }
+        }
+        return;
+    }
+
+    uint32_t owner = Owner[b];
+    if (!owner) {
+        return;
+    }
+
+    File *file = &Files[(owner & ~OWNER_INDIRECT) - 1];
+
+    // indirect block
+    if (owner & OWNER_INDIRECT) {
+        memcpy(data, &Pointers[file->first + POINTERS_PER_INODE],
+            (file->count - POINTERS_PER_INODE) * sizeof(uint32_t));
+        return;
+    }
+
+    // data block: printable filler tagged with its location, so blocks differ
+    size_t length = BLOCK_SIZE;
+    if (b == Pointers[file->first + file->count - 1] && file->size % BLOCK_SIZE) {
+        length = file->size % BLOCK_SIZE;
+    }
+
+    char tag[64];
+    int  tagged = snprintf(tag, sizeof(tag), "inode %u block %lu\n", file->inode, b);
+    memset(data, 'a' + file->inode % 26, length);
+    memcpy(data, tag, min((size_t)tagged, length));
+}
+
+// write whole buffer, retrying short writes
+bool    write_all(int fd, const char *data, size_t length) {
+    while (length) {
+        ssize_t nwritten = write(fd, data, length);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data   += nwritten;
+        length -= nwritten;
+    }
+    return true;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "b:f:z:F:u:s:h")) != -1) {
+        switch (option) {
+            case 'b': Opts.blocks        = strtoul(optarg, NULL, 10); break;
+            case 'f': Opts.files         = strtoul(optarg, NULL, 10); break;
+            case 'z': if (!parse_dist(optarg)) usage(argv[0], EXIT_FAILURE); break;
+            case 'F': Opts.fragmentation = min(strtoul(optarg, NULL, 10), 100); break;
+            case 'u': Opts.fill          = min(strtoul(optarg, NULL, 10), 100); break;
+            case 's': Opts.seed          = strtoul(optarg, NULL, 10); break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default:  usage(argv[0], EXIT_FAILURE); break;
+        }
+    }
+
+    if (optind + 1 != argc || Opts.blocks < 3 || Opts.blocks > UINT32_MAX) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    // same layout as fs_format: 10% (rounded up) of blocks hold inodes
+    Super.magic_number = MAGIC_NUMBER;
+    Super.blocks       = Opts.blocks;
+    Super.inode_blocks = Opts.blocks / 10 + (Opts.blocks % 10 != 0);
+    Super.inodes       = Super.inode_blocks * INODES_PER_BLOCK;
+
+    if (Opts.files > Super.inodes) {
+        fprintf(stderr, "%lu files exceed %u inodes\n", Opts.files, Super.inodes);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = stats_now();
+    if (!plan()) {
+        return EXIT_FAILURE;
+    }
+    double planned = (stats_now() - start) / 1e9;
+
+    const char *path = argv[optind];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // render and write the image front to back in large sequential chunks
+    char *chunk = malloc(CHUNK_BLOCKS * BLOCK_SIZE);
+    bool  success = chunk != NULL;
+    start = stats_now();
+    for (size_t b = 0; success && b < Opts.blocks; b += CHUNK_BLOCKS) {
+        size_t n = min(CHUNK_BLOCKS, Opts.blocks - b);
+        for (size_t i = 0; i < n; i++) {
+            render(b + i, chunk + i * BLOCK_SIZE);
+        }
+        success = write_all(fd, chunk, n * BLOCK_SIZE);
+    }
+
+    if (!success || close(fd) < 0) {
+        fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    double written = (stats_now() - start) / 1e9;
+
+    printf("%s: %u blocks, %u inodes, %lu files, %lu data blocks, %.1f%% used\n",
+        path, Super.blocks, Super.inodes, NFiles, NPointers,
+        100.0 * Used / (Super.blocks - 1 - Super.inode_blocks));
+    printf("planned in %.3f s, written in %.3f s (%.1f MB/s)\n",
+        planned, written, written > 0 ? Opts.blocks * (double)BLOCK_SIZE / written / (1 << 20) : 0.0);
+
+    free(chunk);
+    free(Slots);
+    free(Owner);
+    free(Pointers);
+    free(Files);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
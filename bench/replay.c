@@ -0,0 +1,369 @@
+/* replay.c: SimpleFS workload replay (sfs-replay) */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/record.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Structures */
+
+typedef struct Options Options;
+struct Options {
+    bool        timed;                          /* Replay at recorded timing */
+    bool        in_place;                       /* Replay on image itself (not a copy) */
+    const char *directory;                      /* Directory for image copy */
+    const char *model;                          /* Device timing model (NULL for none) */
+};
+
+typedef struct Result Result;
+struct Result {
+    uint64_t   *latency;                        /* Replayed latency (ns) of each call */
+    size_t      count;                          /* Number of calls */
+    size_t      errors;                         /* Failed calls */
+    size_t      mismatches;                     /* Calls whose result differs from recorded */
+    uint64_t    recorded_ns;                    /* Sum of recorded latencies */
+};
+
+typedef struct Buffer Buffer;
+struct Buffer {
+    char       *data;                           /* Buffer contents */
+    size_t      capacity;                       /* Size of buffer */
+};
+
+/* Globals */
+
+static Options      Opts = {
+    .directory  = "/tmp",
+};
+
+static FileSystem   FS      = {0};
+static uint32_t    *Inodes  = NULL;             /* Replayed inode plus one of recorded inode (0 if same) */
+static size_t       NInodes = 0;
+static Buffer       Reads   = {0};              /* Read buffer */
+static Buffer       Writes  = {0};              /* Write source buffer */
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [options] <record> <image>\n", program);
+    fprintf(stderr, "    -t             Replay at recorded timing (default: as fast as possible)\n");
+    fprintf(stderr, "    -w             Replay on the image itself (default: on a copy)\n");
+    fprintf(stderr, "    -d DIRECTORY   Directory for the image copy (default: %s)\n", Opts.directory);
+    fprintf(stderr, "    -M MODEL       Simulate device timing: hdd or ssd[:KEY=VALUE,...]\n");
+    exit(status);
+}
+
+// load all entries of record file
+RecordEntry *   load_record(const char *path, size_t *count) {
+    FILE *stream = fopen(path, "r");
+    if (!stream) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    RecordHeader header;
+    if (fread(&header, sizeof(header), 1, stream) != 1 || header.magic != RECORD_MAGIC || header.version != RECORD_VERSION) {
+        fprintf(stderr, "%s is not a record file\n", path);
+        fclose(stream);
+        return NULL;
+    }
+
+    RecordEntry *entries  = NULL;
+    size_t       capacity = 0;
+    *count = 0;
+    while (true) {
+        if (*count == capacity) {
+            capacity = max(capacity * 2, 1024);
+            entries  = realloc(entries, capacity * sizeof(RecordEntry));
+        }
+        if (fread(&entries[*count], sizeof(RecordEntry), 1, stream) != 1) {
+            break;
+        }
+        (*count)++;
+    }
+
+    fclose(stream);
+    return entries;
+}
+
+// order entries by start time (calls of different threads were serialized)
+int     compare_entries(const void *a, const void *b) {
+    uint64_t x = ((const RecordEntry *)a)->timestamp;
+    uint64_t y = ((const RecordEntry *)b)->timestamp;
+    return (x > y) - (x < y);
+}
+
+// copy image to path
+bool    copy_image(const char *source, const char *target) {
+    int  src = open(source, O_RDONLY);
+    int  dst = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool success = src >= 0 && dst >= 0;
+
+    char    buffer[1 << 16];
+    ssize_t nread = 0;
+    while (success && (nread = read(src, buffer, sizeof(buffer))) > 0) {
+        success = write(dst, buffer, nread) == nread;
+    }
+    success = success && nread == 0;
+
+    if (!success) {
+        fprintf(stderr, "Unable to copy %s to %s: %s\n", source, target, strerror(errno));
+    }
+    if (src >= 0) {
+        close(src);
+    }
+    if (dst >= 0 && close(dst) < 0) {
+        success = false;
+    }
+    return success;
+}
+
+// read number of blocks from superblock of image
+size_t  image_blocks(const char *path) {
+    Block super;
+    int   fd = open(path, O_RDONLY);
+    bool  valid = fd >= 0 && pread(fd, super.data, BLOCK_SIZE, 0) == BLOCK_SIZE &&
+                  super.super.magic_number == MAGIC_NUMBER;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return valid ? super.super.blocks : 0;
+}
+
+// map recorded inode to replayed inode (files created during recording may land elsewhere)
+size_t  map_inode(uint32_t inode) {
+    return (inode < NInodes && Inodes[inode]) ? Inodes[inode] - 1 : inode;
+}
+
+// grow buffer to hold length bytes rounded up to whole blocks, filled and
+// terminated (fs_write copies whole blocks, so the filler must extend past length)
+char *  buffer(Buffer *buffer, size_t length) {
+    size_t needed = (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE + 1;
+    if (needed > buffer->capacity) {
+        buffer->capacity = needed;
+        buffer->data     = realloc(buffer->data, needed);
+        memset(buffer->data, 'x', needed - 1);
+        buffer->data[needed - 1] = 0;
+    }
+    return buffer->data;
+}
+
+// wait until recorded offset of call (relative to first call) has elapsed
+void    wait_until(uint64_t start, uint64_t offset) {
+    uint64_t now = stats_now() - start;
+    if (now < offset) {
+        struct timespec delay = {(offset - now) / 1000000000ULL, (offset - now) % 1000000000ULL};
+        nanosleep(&delay, NULL);
+    }
+}
+
+// replay single call and return its result
+ssize_t replay(RecordEntry *entry, Disk *disk) {
+    size_t inode = map_inode(entry->inode);
+
+    // recording may have started on an already mounted file system
+    if (!FS.disk && entry->op != RECORD_FORMAT && entry->op != RECORD_MOUNT && entry->op != RECORD_UNMOUNT &&
+        entry->op != RECORD_SNAPSHOT_MOUNT) {
+        fs_mount(&FS, disk);
+    }
+
+    switch (entry->op) {
+        case RECORD_FORMAT:
+            return fs_format(&FS, disk) ? 0 : -1;
+        case RECORD_MOUNT:
+            return fs_mount(&FS, disk) ? 0 : -1;
+        case RECORD_UNMOUNT:
+            fs_unmount(&FS);
+            return 0;
+        case RECORD_CREATE: {
+            ssize_t created = fs_create(&FS);
+            if (created >= 0 && entry->result >= 0 && (size_t)entry->result < NInodes) {
+                Inodes[entry->result] = created + 1;
+            }
+            return created;
+        }
+        case RECORD_REMOVE: {
+            bool removed = fs_remove(&FS, inode);
+            if (entry->inode < NInodes) {
+                Inodes[entry->inode] = 0;
+            }
+            return removed ? 0 : -1;
+        }
+        case RECORD_STAT:
+            return fs_stat(&FS, inode);
+        case RECORD_READ:
+            return fs_read(&FS, inode, buffer(&Reads, entry->length), entry->length, entry->offset);
+        case RECORD_WRITE:
+            return fs_write(&FS, inode, buffer(&Writes, entry->length), entry->length, entry->offset);
+        case RECORD_ADVISE:
+            return fs_advise(&FS, inode, entry->offset, entry->length, entry->advice) ? 0 : -1;
+        case RECORD_COMPRESS:
+            return fs_compress(&FS, inode) ? 0 : -1;
+        case RECORD_CLONE: {
+            ssize_t cloned = fs_clone(&FS, inode);
+            if (cloned >= 0 && entry->result >= 0 && (size_t)entry->result < NInodes) {
+                Inodes[entry->result] = cloned + 1;
+            }
+            return cloned;
+        }
+        case RECORD_SNAPSHOT:
+            return fs_snapshot(&FS);
+        case RECORD_SNAPSHOT_DELETE:
+            return fs_snapshot_delete(&FS, entry->inode) ? 0 : -1;
+        case RECORD_SNAPSHOT_MOUNT:
+            return fs_snapshot_mount(&FS, disk, entry->inode) ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+// compare latencies
+int     compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// report latency distribution of operation
+void    report(const char *name, Result *result) {
+    if (!result->count) {
+        return;
+    }
+
+    uint64_t *latency = result->latency;
+    uint64_t  total   = 0;
+    qsort(latency, result->count, sizeof(uint64_t), compare_latency);
+    for (size_t i = 0; i < result->count; i++) {
+        total += latency[i];
+    }
+
+    printf("%-8s %8lu %6lu %8lu %10.1f %9.1f %9.1f %9.1f %12.1f\n",
+        name, result->count, result->errors, result->mismatches,
+        total / 1e3 / result->count,
+        latency[(size_t)(result->count * 0.50)] / 1e3,
+        latency[min((size_t)(result->count * 0.99), result->count - 1)] / 1e3,
+        latency[result->count - 1] / 1e3,
+        result->recorded_ns / 1e3 / result->count);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "twd:M:h")) != -1) {
+        switch (option) {
+            case 't': Opts.timed     = true; break;
+            case 'w': Opts.in_place  = true; break;
+            case 'd': Opts.directory = optarg; break;
+            case 'M': Opts.model     = optarg; break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default:  usage(argv[0], EXIT_FAILURE); break;
+        }
+    }
+
+    if (optind + 2 != argc) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    size_t       count;
+    RecordEntry *entries = load_record(argv[optind], &count);
+    if (!entries) {
+        return EXIT_FAILURE;
+    }
+    qsort(entries, count, sizeof(RecordEntry), compare_entries);
+
+    const char *image  = argv[optind + 1];
+    size_t      blocks = image_blocks(image);
+    if (!blocks) {
+        fprintf(stderr, "%s is not a SimpleFS image\n", image);
+        free(entries);
+        return EXIT_FAILURE;
+    }
+
+    char path[BUFSIZ];
+    snprintf(path, sizeof(path), "%s/sfs-replay.%d", Opts.directory, getpid());
+    if (!Opts.in_place && !copy_image(image, path)) {
+        unlink(path);
+        free(entries);
+        return EXIT_FAILURE;
+    }
+
+    Disk *disk = disk_open(Opts.in_place ? image : path, blocks);
+    if (!disk) {
+        free(entries);
+        return EXIT_FAILURE;
+    }
+
+    if (Opts.model) {
+        DiskModel *model = model_parse(Opts.model);
+        if (!model) {
+            disk_close(disk);
+            free(entries);
+            return EXIT_FAILURE;
+        }
+        disk_model(disk, model);
+    }
+
+    // inode table size is fixed by the number of blocks (see fs_format)
+    NInodes = (blocks / 10 + (blocks % 10 != 0)) * INODES_PER_BLOCK;
+    Inodes  = calloc(NInodes, sizeof(uint32_t));
+
+    Result results[RECORD_OPS] = {{0}};
+    for (int op = 0; op < RECORD_OPS; op++) {
+        results[op].latency = malloc((count + 1) * sizeof(uint64_t));
+    }
+
+    uint64_t start = stats_now();
+    for (size_t e = 0; e < count; e++) {
+        RecordEntry *entry = &entries[e];
+        if (entry->op >= RECORD_OPS) {
+            continue;
+        }
+
+        if (Opts.timed) {
+            wait_until(start, entry->timestamp - entries[0].timestamp);
+        }
+
+        uint64_t begin   = stats_now();
+        ssize_t  result  = replay(entry, disk);
+        Result  *summary = &results[entry->op];
+
+        summary->latency[summary->count++] = stats_now() - begin;
+        summary->errors      += result < 0;
+        summary->mismatches  += (entry->op == RECORD_CREATE || entry->op == RECORD_CLONE) ? (result < 0) != (entry->result < 0) : result != entry->result;
+        summary->recorded_ns += entry->duration;
+    }
+    double seconds = (stats_now() - start) / 1e9;
+
+    printf("%lu calls replayed in %.3f seconds (%s)\n", count, seconds, Opts.timed ? "recorded timing" : "as fast as possible");
+    printf("%-8s %8s %6s %8s %10s %9s %9s %9s %12s\n",
+        "op", "calls", "errors", "mismatch", "avg(us)", "p50", "p99", "max", "recorded(us)");
+    for (int op = 0; op < RECORD_OPS; op++) {
+        report(record_name(op), &results[op]);
+        free(results[op].latency);
+    }
+    model_report(disk->model, stdout);
+
+    fs_unmount(&FS);
+    disk_close(disk);
+    if (!Opts.in_place) {
+        unlink(path);
+    }
+
+    free(Reads.data);
+    free(Writes.data);
+    free(Inodes);
+    free(entries);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
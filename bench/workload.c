@@ -0,0 +1,601 @@
+/* workload.c: SimpleFS workload generator (sfs-bench) */
+
+#define _GNU_SOURCE                             /* memfd_create */
+
+#include "sfs/disk.h"
+#include "sfs/fs.h"
+#include "sfs/record.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define OP_READ         (0)
+#define OP_WRITE        (1)
+#define OP_CREATE       (2)
+#define OP_DELETE       (3)
+#define OPS             (4)
+
+#define DIST_FIXED      (0)
+#define DIST_UNIFORM    (1)
+#define DIST_EXP        (2)
+
+#define MAX_FILE_SIZE   ((POINTERS_PER_INODE + POINTERS_PER_BLOCK) * BLOCK_SIZE)
+
+/* Structures */
+
+typedef struct Options Options;
+struct Options {
+    size_t      files;                          /* Initial number of files */
+    int         dist;                           /* File size distribution (DIST_*) */
+    size_t      size_min;                       /* Minimum (or fixed, or mean) file size */
+    size_t      size_max;                       /* Maximum file size */
+    unsigned    mix[OPS];                       /* Relative weight of each operation */
+    bool        random;                         /* Random (vs sequential) read offsets */
+    size_t      block_size;                     /* Bytes per read */
+    size_t      threads;                        /* Number of threads */
+    size_t      depth;                          /* Requests in flight per thread */
+    double      seconds;                        /* Run time (0 to use ops) */
+    size_t      ops;                            /* Total operations (if no run time) */
+    size_t      blocks;                         /* Blocks of generated image */
+    const char *image;                          /* Existing image (NULL to generate) */
+    bool        ram;                            /* Run on a RAM-backed copy of the image */
+    const char *record;                         /* Record calls to this file (NULL to disable) */
+    const char *model;                          /* Device timing model (NULL for none) */
+    const char *queue;                          /* Disk queue policy (NULL for none) */
+};
+
+typedef struct File File;
+struct File {
+    ssize_t     inode;                          /* Inode number (-1 if slot is free) */
+    size_t      size;                           /* File size */
+};
+
+typedef struct Worker Worker;
+struct Worker {
+    pthread_t   thread;                         /* Worker thread */
+    unsigned    seed;                           /* Random number state */
+    size_t      cursor;                         /* Sequential read file slot */
+    size_t      offset;                         /* Sequential read offset */
+    char       *buffer;                         /* Read buffer */
+    uint64_t   *latency[OPS];                   /* Latency (ns) of each operation */
+    size_t      count[OPS];                     /* Number of operations */
+    size_t      capacity[OPS];                  /* Capacity of latency arrays */
+    size_t      bytes[OPS];                     /* Bytes moved */
+    size_t      errors[OPS];                    /* Failed operations */
+};
+
+/* Globals */
+
+static Options          Opts = {
+    .files      = 64,
+    .dist       = DIST_FIXED,
+    .size_min   = 16 * BLOCK_SIZE,
+    .size_max   = 16 * BLOCK_SIZE,
+    .mix        = {70, 30, 0, 0},
+    .block_size = BLOCK_SIZE,
+    .threads    = 1,
+    .depth      = 1,
+    .ops        = 10000,
+    .blocks     = 16384,
+};
+
+static FileSystem       FS       = {0};
+static pthread_mutex_t  FSLock   = PTHREAD_MUTEX_INITIALIZER;   /* libsfs is not thread-safe */
+static File            *Files    = NULL;
+static size_t           NFiles   = 0;                           /* Number of file slots */
+static size_t           Live     = 0;                           /* Number of live files */
+static char            *Data     = NULL;                        /* Write source buffer */
+static volatile bool    Stop     = false;
+static size_t           Issued   = 0;                           /* Operations handed out */
+
+static const char      *OpNames[OPS] = {"read", "write", "create", "delete"};
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "    -i IMAGE       Use existing image (default: generate one)\n");
+    fprintf(stderr, "    -b BLOCKS      Blocks of generated image (default: %lu)\n", Opts.blocks);
+    fprintf(stderr, "    -r             Run on a RAM-backed copy of the image\n");
+    fprintf(stderr, "    -f FILES       Initial number of files (default: %lu)\n", Opts.files);
+    fprintf(stderr, "    -z SIZE        File sizes: N, MIN-MAX (uniform) or exp:MEAN (default: %lu)\n", Opts.size_min);
+    fprintf(stderr, "    -m MIX         Operation mix (default: read=70,write=30,create=0,delete=0)\n");
+    fprintf(stderr, "    -a PATTERN     Read pattern: seq or rand (default: seq)\n");
+    fprintf(stderr, "    -B BYTES       Bytes per read, a multiple of %d (default: %d)\n", BLOCK_SIZE, BLOCK_SIZE);
+    fprintf(stderr, "    -t THREADS     Number of threads (default: 1)\n");
+    fprintf(stderr, "    -q DEPTH       Requests in flight per thread (default: 1)\n");
+    fprintf(stderr, "    -n OPS         Total operations (default: %lu)\n", Opts.ops);
+    fprintf(stderr, "    -d SECONDS     Run for SECONDS instead of a number of operations\n");
+    fprintf(stderr, "    -R FILE        Record file system calls to FILE (see sfs-replay)\n");
+    fprintf(stderr, "    -M MODEL       Simulate device timing: hdd or ssd[:KEY=VALUE,...]\n");
+    fprintf(stderr, "    -Q POLICY      Disk queue policy: fifo, merge, cscan or deadline\n");
+    exit(status);
+}
+
+// parse size with optional K or M suffix
+size_t  parse_size(const char *s) {
+    char  *end;
+    size_t size = strtoul(s, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+    }
+    return size;
+}
+
+// parse file size distribution
+bool    parse_dist(const char *s) {
+    const char *dash = strchr(s, '-');
+
+    if (strncmp(s, "exp:", 4) == 0) {
+        Opts.dist     = DIST_EXP;
+        Opts.size_min = parse_size(s + 4);
+        Opts.size_max = MAX_FILE_SIZE;
+    } else if (dash) {
+        Opts.dist     = DIST_UNIFORM;
+        Opts.size_min = parse_size(s);
+        Opts.size_max = parse_size(dash + 1);
+    } else {
+        Opts.dist     = DIST_FIXED;
+        Opts.size_min = Opts.size_max = parse_size(s);
+    }
+
+    return Opts.size_min > 0 && Opts.size_min <= Opts.size_max && Opts.size_max <= MAX_FILE_SIZE;
+}
+
+// parse operation mix (name=weight pairs)
+bool    parse_mix(const char *s) {
+    char *list = strdup(s);
+    memset(Opts.mix, 0, sizeof(Opts.mix));
+
+    bool valid = true;
+    for (char *pair = strtok(list, ","); pair && valid; pair = strtok(NULL, ",")) {
+        char *weight = strchr(pair, '=');
+        valid = false;
+        for (int op = 0; weight && op < OPS; op++) {
+            if (strncmp(pair, OpNames[op], weight - pair) == 0 && strlen(OpNames[op]) == (size_t)(weight - pair)) {
+                Opts.mix[op] = atoi(weight + 1);
+                valid = true;
+            }
+        }
+    }
+
+    free(list);
+    return valid && (Opts.mix[0] + Opts.mix[1] + Opts.mix[2] + Opts.mix[3]) > 0;
+}
+
+// draw a file size from the configured distribution
+size_t  draw_size(unsigned *seed) {
+    double u = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 2.0);
+
+    switch (Opts.dist) {
+        case DIST_UNIFORM:
+            return Opts.size_min + (size_t)(u * (Opts.size_max - Opts.size_min + 1));
+        case DIST_EXP:
+            return min(max((size_t)(-log(u) * Opts.size_min), 1), MAX_FILE_SIZE);
+        default:
+            return Opts.size_min;
+    }
+}
+
+// pick a random live file slot (caller holds FSLock)
+ssize_t pick_file(unsigned *seed) {
+    if (!Live) {
+        return -1;
+    }
+
+    size_t start = rand_r(seed) % NFiles;
+    for (size_t i = 0; i < NFiles; i++) {
+        size_t slot = (start + i) % NFiles;
+        if (Files[slot].inode >= 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// create a file of size bytes in slot (caller holds FSLock)
+bool    create_file(size_t slot, size_t size) {
+    ssize_t inode = fs_create(&FS);
+    if (inode < 0) {
+        return false;
+    }
+
+    if (fs_write(&FS, inode, Data, size, 0) != (ssize_t)size) {
+        fs_remove(&FS, inode);
+        return false;
+    }
+
+    Files[slot].inode = inode;
+    Files[slot].size  = size;
+    Live++;
+    return true;
+}
+
+// remove file in slot (caller holds FSLock)
+void    delete_file(size_t slot) {
+    fs_remove(&FS, Files[slot].inode);
+    Files[slot].inode = -1;
+    Live--;
+}
+
+// perform one operation and return bytes moved (-1 on failure)
+ssize_t do_op(Worker *worker, int op) {
+    ssize_t result = -1;
+
+    pthread_mutex_lock(&FSLock);
+    switch (op) {
+        case OP_READ: {
+            ssize_t slot = Opts.random ? pick_file(&worker->seed) : -1;
+            if (!Opts.random && Live) {
+                // advance the sequential cursor to the next live file when needed
+                while (Files[worker->cursor % NFiles].inode < 0 || worker->offset >= Files[worker->cursor % NFiles].size) {
+                    worker->cursor++;
+                    worker->offset = 0;
+                }
+                slot = worker->cursor % NFiles;
+            }
+            if (slot < 0) {
+                break;
+            }
+
+            size_t offset = worker->offset;
+            if (Opts.random) {
+                offset = (rand_r(&worker->seed) % ((Files[slot].size + Opts.block_size - 1) / Opts.block_size)) * Opts.block_size;
+            }
+
+            // fs_read stops at the end of the file
+            result = fs_read(&FS, Files[slot].inode, worker->buffer, Opts.block_size, offset);
+            worker->offset = offset + Opts.block_size;
+            break;
+        }
+
+        // fs_write rewrites a file from its start (releasing its old
+        // blocks), so a write replaces the contents with a new size
+        case OP_WRITE: {
+            ssize_t slot = pick_file(&worker->seed);
+            if (slot < 0) {
+                break;
+            }
+
+            size_t size = draw_size(&worker->seed);
+            result = fs_write(&FS, Files[slot].inode, Data, size, 0);
+            if (result < 0) {
+                delete_file(slot);
+            } else {
+                Files[slot].size = result;
+            }
+            break;
+        }
+
+        case OP_CREATE: {
+            for (size_t slot = 0; slot < NFiles; slot++) {
+                if (Files[slot].inode < 0) {
+                    size_t size = draw_size(&worker->seed);
+                    result = create_file(slot, size) ? (ssize_t)size : -1;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case OP_DELETE: {
+            ssize_t slot = Live > 1 ? pick_file(&worker->seed) : -1;
+            if (slot >= 0) {
+                delete_file(slot);
+                result = 0;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&FSLock);
+
+    return result;
+}
+
+// record latency of operation
+void    record(Worker *worker, int op, uint64_t latency, ssize_t result) {
+    if (worker->count[op] == worker->capacity[op]) {
+        worker->capacity[op] = max(worker->capacity[op] * 2, 1024);
+        worker->latency[op]  = realloc(worker->latency[op], worker->capacity[op] * sizeof(uint64_t));
+    }
+
+    worker->latency[op][worker->count[op]++] = latency;
+    if (result < 0) {
+        worker->errors[op]++;
+    } else {
+        worker->bytes[op] += result;
+    }
+}
+
+// run operations until the run time or operation budget is exhausted
+void *  worker_thread(void *arg) {
+    Worker  *worker   = arg;
+    unsigned total    = Opts.mix[0] + Opts.mix[1] + Opts.mix[2] + Opts.mix[3];
+    uint64_t deadline = stats_now() + (uint64_t)(Opts.seconds * 1e9);
+
+    while (!Stop) {
+        if (Opts.seconds > 0) {
+            if (stats_now() >= deadline) {
+                break;
+            }
+        } else if (__sync_fetch_and_add(&Issued, 1) >= Opts.ops) {
+            break;
+        }
+
+        unsigned pick = rand_r(&worker->seed) % total;
+        int      op   = 0;
+        while (pick >= Opts.mix[op]) {
+            pick -= Opts.mix[op++];
+        }
+
+        uint64_t start  = stats_now();
+        ssize_t  result = do_op(worker, op);
+        record(worker, op, stats_now() - start, result);
+    }
+
+    return NULL;
+}
+
+// order latencies
+int     compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// print throughput and latency percentiles of merged latencies
+void    report(const char *name, uint64_t *latency, size_t count, size_t bytes, size_t errors, double seconds) {
+    if (!count) {
+        return;
+    }
+
+    qsort(latency, count, sizeof(uint64_t), compare_latency);
+
+    double total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += latency[i];
+    }
+
+    #define PCT(p) (latency[min((size_t)((p) / 100.0 * count), count - 1)] / 1000.0)
+    printf("%-8s %10lu %6lu %12.1f %10.2f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+        name, count, errors, count / seconds, bytes / seconds / (1 << 20),
+        total / count / 1000.0, PCT(50), PCT(90), PCT(99), PCT(99.9), latency[count - 1] / 1000.0);
+    #undef PCT
+}
+
+// open image (copying it into anonymous memory for RAM-backed runs)
+Disk *  open_image(char *path, size_t size, bool *format) {
+    *format = !Opts.image;
+
+    if (!Opts.ram) {
+        if (Opts.image) {
+            snprintf(path, size, "%s", Opts.image);
+        } else {
+            snprintf(path, size, "/tmp/sfs-bench.%d", getpid());
+        }
+    } else {
+        int fd = memfd_create("sfs-bench", 0);
+        if (fd < 0) {
+            fprintf(stderr, "memfd_create: %s\n", strerror(errno));
+            return NULL;
+        }
+
+        if (Opts.image) {
+            int  src = open(Opts.image, O_RDONLY);
+            char buffer[1 << 16];
+            ssize_t nread;
+            while (src >= 0 && (nread = read(src, buffer, sizeof(buffer))) > 0) {
+                if (write(fd, buffer, nread) != nread) {
+                    break;
+                }
+            }
+            if (src >= 0) {
+                close(src);
+            }
+        }
+
+        // the descriptor stays open, so the image lives as long as the process
+        snprintf(path, size, "/proc/self/fd/%d", fd);
+    }
+
+    size_t blocks = Opts.blocks;
+    if (Opts.image) {
+        Block super;
+        int   fd = open(Opts.image, O_RDONLY);
+        bool  valid = fd >= 0 && pread(fd, super.data, BLOCK_SIZE, 0) == BLOCK_SIZE &&
+                      super.super.magic_number == MAGIC_NUMBER;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!valid) {
+            fprintf(stderr, "%s is not a SimpleFS image\n", Opts.image);
+            return NULL;
+        }
+        blocks = super.super.blocks;
+    }
+
+    return disk_open(path, blocks);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "i:b:rf:z:m:a:B:t:q:n:d:R:M:Q:h")) != -1) {
+        switch (option) {
+            case 'i': Opts.image      = optarg; break;
+            case 'b': Opts.blocks     = strtoul(optarg, NULL, 10); break;
+            case 'r': Opts.ram        = true; break;
+            case 'f': Opts.files      = strtoul(optarg, NULL, 10); break;
+            case 'z': if (!parse_dist(optarg)) usage(argv[0], EXIT_FAILURE); break;
+            case 'm': if (!parse_mix(optarg)) usage(argv[0], EXIT_FAILURE); break;
+            case 'a': Opts.random     = strcmp(optarg, "rand") == 0; break;
+            case 'B': Opts.block_size = parse_size(optarg); break;
+            case 't': Opts.threads    = strtoul(optarg, NULL, 10); break;
+            case 'q': Opts.depth      = strtoul(optarg, NULL, 10); break;
+            case 'n': Opts.ops        = strtoul(optarg, NULL, 10); break;
+            case 'd': Opts.seconds    = atof(optarg); break;
+            case 'R': Opts.record     = optarg; break;
+            case 'M': Opts.model      = optarg; break;
+            case 'Q': Opts.queue      = optarg; break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default:  usage(argv[0], EXIT_FAILURE); break;
+        }
+    }
+
+    if (!Opts.files || !Opts.block_size || Opts.block_size % BLOCK_SIZE || !Opts.threads || !Opts.depth || Opts.blocks < 16) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    char path[BUFSIZ];
+    bool format;
+    Disk *disk = open_image(path, sizeof(path), &format);
+    if (!disk) {
+        return EXIT_FAILURE;
+    }
+
+    // record from the start, so a replay on the same image recreates the file set
+    if (Opts.record && !record_start(Opts.record)) {
+        disk_close(disk);
+        return EXIT_FAILURE;
+    }
+
+    if ((format && !fs_format(&FS, disk)) || !fs_mount(&FS, disk)) {
+        fprintf(stderr, "Unable to mount %s\n", Opts.image ? Opts.image : path);
+        disk_close(disk);
+        return EXIT_FAILURE;
+    }
+
+    // time the measured run only (not format, mount or initial file set)
+    DiskModel *model = NULL;
+    if (Opts.model && !(model = model_parse(Opts.model))) {
+        fs_unmount(&FS);
+        disk_close(disk);
+        return EXIT_FAILURE;
+    }
+
+    if (Opts.queue) {
+        DiskQueue *queue = queue_parse(Opts.queue);
+        if (!queue) {
+            model_delete(model);
+            fs_unmount(&FS);
+            disk_close(disk);
+            return EXIT_FAILURE;
+        }
+        disk_queue(disk, queue);
+    }
+
+    // populate initial file set (leaving room for creates)
+    NFiles = 2 * Opts.files;
+    Files  = calloc(NFiles, sizeof(File));
+    Data   = malloc(MAX_FILE_SIZE);
+    memset(Data, 'x', MAX_FILE_SIZE);
+    for (size_t slot = 0; slot < NFiles; slot++) {
+        Files[slot].inode = -1;
+    }
+
+    unsigned seed = 1;
+    for (size_t slot = 0; slot < Opts.files; slot++) {
+        if (!create_file(slot, draw_size(&seed))) {
+            fprintf(stderr, "Image full after %lu files\n", slot);
+            break;
+        }
+    }
+
+    // libsfs is synchronous: each thread keeps depth requests in flight by
+    // running depth workers
+    size_t  nworkers = Opts.threads * Opts.depth;
+    Worker *workers  = calloc(nworkers, sizeof(Worker));
+
+    disk_model(disk, model);
+    stats_reset();
+    uint64_t start = stats_now();
+    for (size_t w = 0; w < nworkers; w++) {
+        workers[w].seed   = w + 1;
+        workers[w].cursor = w;
+        workers[w].buffer = malloc(Opts.block_size + 1);
+        pthread_create(&workers[w].thread, NULL, worker_thread, &workers[w]);
+    }
+    for (size_t w = 0; w < nworkers; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    double seconds = (stats_now() - start) / 1e9;
+
+    printf("%lu threads x %lu depth, %s reads of %lu bytes, %.2f seconds%s\n",
+        Opts.threads, Opts.depth, Opts.random ? "random" : "sequential", Opts.block_size,
+        seconds, Opts.ram ? " (RAM-backed)" : "");
+    printf("%-8s %10s %6s %12s %10s %9s %9s %9s %9s %9s %9s\n",
+        "op", "ops", "errors", "iops", "MB/s", "avg(us)", "p50", "p90", "p99", "p99.9", "max");
+
+    // merge per-worker latencies per operation and overall
+    size_t    total = 0, total_bytes = 0, total_errors = 0;
+    uint64_t *all   = NULL;
+    for (int op = 0; op < OPS; op++) {
+        size_t count = 0, bytes = 0, errors = 0;
+        for (size_t w = 0; w < nworkers; w++) {
+            count += workers[w].count[op];
+        }
+
+        uint64_t *latency = malloc((count + 1) * sizeof(uint64_t));
+        all = realloc(all, (total + count + 1) * sizeof(uint64_t));
+        for (size_t w = 0, n = 0; w < nworkers; w++) {
+            memcpy(latency + n, workers[w].latency[op], workers[w].count[op] * sizeof(uint64_t));
+            n      += workers[w].count[op];
+            bytes  += workers[w].bytes[op];
+            errors += workers[w].errors[op];
+        }
+        memcpy(all + total, latency, count * sizeof(uint64_t));
+
+        report(OpNames[op], latency, count, bytes, errors, seconds);
+        total        += count;
+        total_bytes  += bytes;
+        total_errors += errors;
+        free(latency);
+    }
+    report("total", all, total, total_bytes, total_errors, seconds);
+
+    Stats stats;
+    fs_stats(&FS, &stats);
+    printf("disk     %10lu reads %10lu writes\n", stats.ops[STATS_DISK_READ].count, stats.ops[STATS_DISK_WRITE].count);
+    model_report(disk->model, stdout);
+    if (disk->queue) {
+        QueueStats queue;
+        queue_stats(disk->queue, &queue);
+        printf("queue    %s: %lu submitted, %lu dispatched, %lu merges, %lu reorders, %lu expired, max wait %.1f us\n",
+            queue_name(disk->queue->policy), queue.submitted, queue.dispatched, queue.merges,
+            queue.reorders, queue.expired, queue.max_wait_ns / 1e3);
+    }
+
+    for (size_t w = 0; w < nworkers; w++) {
+        for (int op = 0; op < OPS; op++) {
+            free(workers[w].latency[op]);
+        }
+        free(workers[w].buffer);
+    }
+    free(workers);
+    free(all);
+    free(Files);
+    free(Data);
+
+    fs_unmount(&FS);
+    record_stop();
+    disk_close(disk);
+    if (!Opts.image && !Opts.ram) {
+        unlink(path);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,94 @@
+/* cache.h: SimpleFS block cache */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "sfs/disk.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Cache Constants */
+
+#define CACHE_BLOCKS        (1024)              /* Default number of cached blocks */
+
+#define CACHE_SUPER         (0)                 /* Superblock class */
+#define CACHE_INODE         (1)                 /* Inode table class */
+#define CACHE_INDIRECT      (2)                 /* Indirect pointer block class */
+#define CACHE_DATA          (3)                 /* File data class */
+#define CACHE_CLASSES       (4)                 /* Number of block classes */
+
+#define CACHE_A1IN_SHARE    (4)                 /* A1in holds 1/4 of data entries */
+#define CACHE_A1OUT_SHARE   (2)                 /* A1out remembers 1/2 capacity of evicted ids */
+#define CACHE_META_SHARE    (2)                 /* Metadata may hold 1/2 capacity before data wins */
+
+/* Cache Structures */
+
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    size_t      block;                          /* Disk block number */
+    uint8_t     queue;                          /* Queue the entry is on */
+    uint8_t     class;                          /* Block class (CACHE_*) */
+    bool        cold;                           /* Inserted without reuse expectation */
+    CacheEntry *prev;                           /* Previous entry in queue */
+    CacheEntry *next;                           /* Next entry in queue (or free list) */
+    CacheEntry *chain;                          /* Next entry in hash bucket */
+    char       *data;                           /* Cached block contents (NULL for ghosts) */
+};
+
+typedef struct CacheQueue CacheQueue;
+struct CacheQueue {
+    CacheEntry *head;                           /* Most recently inserted or used entry */
+    CacheEntry *tail;                           /* Next entry to evict */
+    size_t      count;                          /* Number of entries in queue */
+};
+
+typedef struct CacheStats CacheStats;
+struct CacheStats {
+    size_t      hits;                           /* Number of lookup hits */
+    size_t      misses;                         /* Number of lookup misses */
+    size_t      resident;                       /* Number of cached blocks */
+};
+
+typedef struct Cache Cache;
+struct Cache {
+    size_t       capacity;                      /* Maximum number of cached blocks */
+    char        *blocks;                        /* Block contents storage */
+    CacheEntry  *entries;                       /* Entry storage */
+    CacheEntry  *ghosts;                        /* Ghost entry storage (A1out) */
+    CacheEntry  *free_entries;                  /* Unused entries */
+    CacheEntry  *free_ghosts;                   /* Unused ghost entries */
+    CacheEntry **buckets;                       /* Hash table of cached blocks */
+    CacheEntry **ghost_buckets;                 /* Hash table of ghost blocks */
+    size_t       nbuckets;                      /* Number of hash buckets */
+    uint64_t    *stamps;                        /* Sequence of last write to blocks in each bucket */
+    uint64_t     sequence;                      /* Number of writes and invalidations */
+    CacheQueue   a1in;                          /* FIFO of data seen once */
+    CacheQueue   a1out;                         /* FIFO of ids recently evicted from A1in */
+    CacheQueue   am;                            /* LRU of data seen more than once */
+    CacheQueue   meta;                          /* LRU of metadata blocks */
+    CacheStats   stats[CACHE_CLASSES];          /* Per-class statistics */
+    pthread_mutex_t lock;                       /* Protects cache against background fill */
+};
+
+/* Cache Functions */
+
+Cache * cache_create(size_t capacity);
+void    cache_delete(Cache *cache);
+
+bool    cache_lookup(Cache *cache, size_t block, int class, char *data);
+bool    cache_contains(Cache *cache, size_t block);
+void    cache_insert(Cache *cache, size_t block, int class, const char *data);
+void    cache_insert_cold(Cache *cache, size_t block, int class, const char *data);
+uint64_t cache_sequence(Cache *cache);
+bool    cache_fill(Cache *cache, size_t block, int class, const char *data, uint64_t since);
+void    cache_invalidate(Cache *cache, size_t block);
+
+double  cache_hit_rate(Cache *cache, int class);
+size_t  cache_hot(Cache *cache, uint32_t *blocks, uint8_t *classes, size_t max);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
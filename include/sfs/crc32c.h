@@ -0,0 +1,24 @@
+/* crc32c.h: SimpleFS CRC32C (Castagnoli) checksums */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* CRC32C Constants */
+
+#define CRC32C_POLYNOMIAL       (0x82F63B78)    /* Reflected Castagnoli polynomial */
+
+/* CRC32C Functions */
+
+uint32_t    crc32c(uint32_t crc, const void *data, size_t length);
+uint32_t    crc32c_software(uint32_t crc, const void *data, size_t length);
+uint32_t    crc32c_hardware(uint32_t crc, const void *data, size_t length);
+
+bool        crc32c_accelerated(void);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,65 @@
+/* dedup.h: SimpleFS inline block deduplication */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Dedup Constants */
+
+#define DEDUP_MAGIC         (0x44534653)        /* "SFSD" */
+#define DEDUP_BLOOM_BITS    (8)                 /* Bloom filter bits per block */
+#define DEDUP_BLOOM_HASHES  (3)                 /* Bloom filter probes per hash */
+
+/* Dedup Structures */
+
+typedef struct DedupEntry DedupEntry;
+struct DedupEntry {
+    uint64_t    hash;                           /* Content hash of block */
+    uint32_t    block;                          /* Block number (0 for empty slot) */
+    uint32_t    reserved;                       /* Padding */
+};
+
+typedef struct DedupHeader DedupHeader;
+struct DedupHeader {
+    uint32_t    magic;                          /* Index file magic number */
+    uint32_t    blocks;                         /* Number of blocks in file system */
+    uint64_t    entries;                        /* Number of entries that follow */
+};
+
+typedef struct DedupStats DedupStats;
+struct DedupStats {
+    size_t      entries;                        /* Blocks in the hash index */
+    size_t      lookups;                        /* Written blocks looked up */
+    size_t      filtered;                       /* Lookups rejected by the Bloom filter */
+    size_t      hits;                           /* Lookups that shared an existing block */
+    size_t      mismatches;                     /* Index matches whose contents differed */
+};
+
+typedef struct Dedup Dedup;
+struct Dedup {
+    char       *path;                           /* Path to index file (NULL for none) */
+    size_t      blocks;                         /* Number of blocks in file system */
+    DedupEntry *table;                          /* Open addressing hash index */
+    size_t      capacity;                       /* Number of slots in table (power of two) */
+    uint64_t   *bloom;                          /* Bloom filter over indexed hashes */
+    size_t      bloom_bits;                     /* Number of bits in Bloom filter (power of two) */
+    uint64_t   *hashes;                         /* Hash of each indexed block (0 if none) */
+    DedupStats  stats;                          /* Statistics */
+};
+
+/* Dedup Functions */
+
+struct FileSystem;
+
+uint64_t dedup_hash(const char *data);
+ssize_t dedup_lookup(struct FileSystem *fs, const char *data);
+void    dedup_insert(struct FileSystem *fs, size_t block, const char *data);
+void    dedup_forget(struct FileSystem *fs, size_t block);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -3,13 +3,28 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include "sfs/model.h"
+#include "sfs/queue.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 /* Disk Constants */
 
 #define BLOCK_SIZE      (1<<12)
 #define DISK_FAILURE    (-1)
+#define DISK_VECTOR_MAX (1024)  /* Maximum buffers per vectored transfer (IOV_MAX) */
+
+#define DISK_CHECKSUM_MAGIC     (0x43534653)    /* "SFSC" */
+#define DISK_CHECKSUM_VERSION   (1)
+
+#define DISK_TRACK_MAGIC        (0x47534653)    /* "SFSG" */
+#define DISK_TRACK_VERSION      (1)
+
+#define DISK_OVERLAY_MAGIC      (0x4f534653)    /* "SFSO" */
+#define DISK_OVERLAY_VERSION    (1)
 
 /* Disk Structure */
 
@@ -20,16 +35,67 @@ struct Disk {
     size_t  blocks;     /* Number of blocks in disk image	*/
     size_t  reads;      /* Number of reads to disk image	*/
     size_t  writes;     /* Number of writes to disk image	*/
+    DiskModel *model;   /* Simulated device timing (NULL for none) */
+    DiskQueue *queue;   /* Request queue (NULL to issue directly) */
+    int     checksum_fd;    /* Checksum sidecar file (-1 for none) */
+    uint32_t *checksums;    /* CRC32C of each block (NULL for none) */
+    size_t  corrupted;      /* Blocks read that failed verification */
+    int     track_fd;       /* Changed-block tracking sidecar file (-1 for none) */
+    uint64_t *generations;  /* Generation of last write to each block (NULL for none) */
+    uint64_t generation;    /* Current generation (last checkpoint + 1) */
+    int     base_fd;        /* Read-only base image of overlay (-1 for none) */
+    uint32_t *overlay;      /* Delta file slot + 1 of each block written locally (NULL for none) */
+    uint32_t overlay_slots; /* Number of slots in delta file */
 }; 
 
+typedef struct DiskChecksumHeader DiskChecksumHeader;
+
+struct DiskChecksumHeader {
+    uint32_t magic;     /* Must be DISK_CHECKSUM_MAGIC */
+    uint32_t version;   /* Must be DISK_CHECKSUM_VERSION */
+    uint64_t blocks;    /* Number of blocks covered */
+};
+
+typedef struct DiskTrackHeader DiskTrackHeader;
+
+struct DiskTrackHeader {
+    uint32_t magic;     /* Must be DISK_TRACK_MAGIC */
+    uint32_t version;   /* Must be DISK_TRACK_VERSION */
+    uint64_t blocks;    /* Number of blocks covered */
+    uint64_t generation;/* Current generation */
+};
+
+typedef struct DiskOverlayHeader DiskOverlayHeader;
+
+struct DiskOverlayHeader {
+    uint32_t magic;     /* Must be DISK_OVERLAY_MAGIC */
+    uint32_t version;   /* Must be DISK_OVERLAY_VERSION */
+    uint64_t blocks;    /* Number of blocks covered */
+};
+
 /* Disk Functions */
 
 Disk *	disk_open(const char *path, size_t blocks);
+Disk *	disk_overlay(const char *base, const char *delta, size_t blocks);
+bool	disk_clone(const char *src_path, const char *dst_path);
 void	disk_close(Disk *disk);
 
 ssize_t	disk_read(Disk *disk, size_t block, char *data);
 ssize_t	disk_write(Disk *disk, size_t block, char *data);
 
+ssize_t	disk_readv(Disk *disk, size_t block, size_t count, char *data);
+bool	disk_advise(Disk *disk, size_t block, size_t count, int advice);
+
+void	disk_model(Disk *disk, DiskModel *model);
+void	disk_queue(Disk *disk, DiskQueue *queue);
+bool	disk_checksum(Disk *disk, const char *path, bool rebuild);
+
+bool	disk_track(Disk *disk, const char *path);
+uint64_t disk_checkpoint(Disk *disk);
+ssize_t	disk_changed(Disk *disk, uint64_t checkpoint, uint32_t *blocks);
+
+ssize_t	disk_transferv(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, bool write);
+
 #endif
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
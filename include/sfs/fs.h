@@ -3,7 +3,15 @@
 #ifndef FS_H
 #define FS_H
 
+#include "sfs/cache.h"
+#include "sfs/dedup.h"
 #include "sfs/disk.h"
+#include "sfs/lz.h"
+#include "sfs/metrics.h"
+#include "sfs/readahead.h"
+#include "sfs/scrub.h"
+#include "sfs/stats.h"
+#include "sfs/warmup.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,6 +23,30 @@
 #define INODES_PER_BLOCK    (128)               /* Number of inodes per block */
 #define POINTERS_PER_INODE  (5)                 /* Number of direct pointers per inode */
 #define POINTERS_PER_BLOCK  (1024)              /* Number of pointers per block */
+#define HOLE_BLOCK          (0xFFFFFFFF)        /* Pointer to an all-zero block that is not stored */
+#define INODE_WORDS         (8)                 /* Number of 32-bit words per inode */
+#define SNAPSHOTS_MAX       (8)                 /* Number of snapshots in super block */
+
+/* Inode Flags (stored in Inode valid field) */
+
+#define INODE_VALID         (1 << 0)            /* Inode is allocated */
+#define INODE_COMPRESSED    (1 << 1)            /* Data is stored in compressed clusters */
+
+/* Compression Constants */
+
+#define CLUSTER_BLOCKS      (16)                /* Logical blocks per compressed cluster */
+#define CLUSTER_SIZE        (CLUSTER_BLOCKS * BLOCK_SIZE)
+#define CLUSTERS_PER_BLOCK  (341)               /* Number of cluster entries per block */
+#define CLUSTER_RAW         (1 << 0)            /* Cluster did not compress and is stored as is */
+
+/* File Access Advice */
+
+#define FS_ADVICE_NORMAL        (0)             /* No special treatment */
+#define FS_ADVICE_SEQUENTIAL    (1)             /* Expect sequential access (maximum readahead) */
+#define FS_ADVICE_RANDOM        (2)             /* Expect random access (no readahead) */
+#define FS_ADVICE_WILLNEED      (3)             /* Prefetch range into cache now */
+#define FS_ADVICE_DONTNEED      (4)             /* Drop range from cache now */
+#define FS_ADVICE_NOREUSE       (5)             /* Data is used once (insert cold) */
 
 /* File System Structures */
 
@@ -24,6 +56,7 @@ struct SuperBlock {
     uint32_t    blocks;                         /* Number of blocks in file system */
     uint32_t    inode_blocks;                   /* Number of blocks reserved for inodes */
     uint32_t    inodes;                         /* Number of inodes in file system */
+    uint32_t    snapshots[SNAPSHOTS_MAX];       /* Inode table map of each snapshot (0 if none) */
 };
 
 typedef struct Inode      Inode;
@@ -34,19 +67,49 @@ struct Inode {
     uint32_t    indirect;                       /* Indirect pointers */
 };
 
+typedef struct Cluster    Cluster;
+struct Cluster {
+    uint32_t    start;                          /* First physical block of cluster (0 if hole) */
+    uint16_t    blocks;                         /* Number of contiguous physical blocks */
+    uint16_t    flags;                          /* Cluster flags (CLUSTER_RAW) */
+    uint32_t    length;                         /* Number of stored (compressed) bytes */
+};
+
 typedef union  Block      Block;
 union Block {
     SuperBlock  super;                          /* View block as superblock */
     Inode       inodes[INODES_PER_BLOCK];       /* View block as inode */
     uint32_t    pointers[POINTERS_PER_BLOCK];   /* View block as pointers */
+    Cluster     clusters[CLUSTERS_PER_BLOCK];   /* View block as cluster table */
     char        data[BLOCK_SIZE];               /* View block as data */
 };
 
+typedef struct ClusterCache ClusterCache;
+struct ClusterCache {
+    bool        valid;                          /* Whether data holds a decompressed cluster */
+    size_t      inode_number;                   /* Inode of decompressed cluster */
+    size_t      index;                          /* Index of decompressed cluster in file */
+    char        data[CLUSTER_SIZE];             /* Decompressed cluster */
+    char        packed[LZ_BOUND(CLUSTER_SIZE)]; /* Compressed cluster */
+};
+
 typedef struct FileSystem FileSystem;
 struct FileSystem {
     Disk        *disk;                          /* Disk file system is mounted on */
     bool        *free_blocks;                   /* Free block bitmap */
+    uint32_t    *refs;                          /* Data block reference counts */
+    bool        *frozen;                        /* Inode blocks still shared with a snapshot */
+    uint32_t     snapshot;                      /* Inode table map of mounted snapshot (0 for live) */
+    size_t       free_inodes;                   /* Number of free inodes (for metrics) */
     SuperBlock   meta_data;                     /* File system meta data */
+    Cache       *cache;                         /* Block cache */
+    Readahead   *readahead;                     /* Per-file readahead state */
+    Warmup      *warmup;                        /* Background cache warm-up state */
+    const char  *warmup_path;                   /* Warm-up sidecar file (NULL to disable) */
+    Metrics     *metrics;                       /* Periodic metrics export state */
+    Scrub       *scrub;                         /* Integrity scrub state */
+    ClusterCache *clusters;                     /* Last decompressed cluster */
+    Dedup       *dedup;                         /* Inline deduplication state */
 };
 
 /* File System Functions */
@@ -64,6 +127,32 @@ ssize_t fs_stat(FileSystem *fs, size_t inode_number);
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
 
+bool    fs_advise(FileSystem *fs, size_t inode_number, size_t offset, size_t length, int advice);
+bool    fs_compress(FileSystem *fs, size_t inode_number);
+ssize_t fs_clone(FileSystem *fs, size_t inode_number);
+
+ssize_t fs_snapshot(FileSystem *fs);
+bool    fs_snapshot_delete(FileSystem *fs, size_t snapshot);
+bool    fs_snapshot_mount(FileSystem *fs, Disk *disk, size_t snapshot);
+
+bool    fs_warmup_save(FileSystem *fs, const char *path);
+bool    fs_warmup_load(FileSystem *fs, const char *path, bool background);
+void    fs_warmup_wait(FileSystem *fs);
+
+void    fs_stats(FileSystem *fs, Stats *stats);
+
+bool    fs_metrics_write(FileSystem *fs, const char *path);
+bool    fs_metrics_start(FileSystem *fs, const char *path, unsigned int interval);
+void    fs_metrics_stop(FileSystem *fs);
+
+bool    fs_scrub_start(FileSystem *fs, const char *path, uint64_t rate, bool background);
+void    fs_scrub_stop(FileSystem *fs);
+bool    fs_scrub_stats(FileSystem *fs, ScrubStats *stats);
+
+bool    fs_dedup_start(FileSystem *fs, const char *path);
+void    fs_dedup_stop(FileSystem *fs);
+bool    fs_dedup_stats(FileSystem *fs, DedupStats *stats);
+
 #endif
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -3,6 +3,8 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include "sfs/trace.h"
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +25,35 @@
 #define error(M, ...) \
     fprintf(stderr, "ERROR " M "\n", ##__VA_ARGS__)
 
+/* Tracing Macros */
+
+#define TRACE_LEVEL_OFF     (0)
+#define TRACE_LEVEL_ERROR   (1)                 /* Failed operations */
+#define TRACE_LEVEL_INFO    (2)                 /* Per-operation events */
+#define TRACE_LEVEL_DEBUG   (3)                 /* Per-block events */
+
+#ifndef SFS_TRACE_LEVEL
+#define SFS_TRACE_LEVEL     TRACE_LEVEL_OFF
+#endif
+
+#if SFS_TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define trace_error(E, I, B)    trace_record((E), (I), (B))
+#else
+#define trace_error(E, I, B)
+#endif
+
+#if SFS_TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define trace_info(E, I, B)     trace_record((E), (I), (B))
+#else
+#define trace_info(E, I, B)
+#endif
+
+#if SFS_TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define trace_debug(E, I, B)    trace_record((E), (I), (B))
+#else
+#define trace_debug(E, I, B)
+#endif
+
 #endif
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
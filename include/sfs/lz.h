@@ -0,0 +1,26 @@
+/* lz.h: SimpleFS LZ compression codec */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* LZ Constants */
+
+#define LZ_MIN_MATCH        (4)                 /* Shortest encoded match */
+#define LZ_MAX_OFFSET       (65535)             /* Farthest match distance */
+#define LZ_HASH_BITS        (12)                /* Match finder hash table size (log2) */
+
+#define LZ_BOUND(n)         ((n) + (n) / 255 + 16)  /* Worst case compressed size */
+
+/* LZ Functions */
+
+size_t  lz_compress(const void *src, size_t length, void *dst, size_t capacity);
+ssize_t lz_decompress(const void *src, size_t length, void *dst, size_t capacity);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,30 @@
+/* metrics.h: SimpleFS Prometheus textfile exporter */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Metrics Constants */
+
+#define METRICS_INTERVAL    (15)                /* Default seconds between exports */
+
+/* Metrics Structures */
+
+typedef struct Metrics Metrics;
+struct Metrics {
+    pthread_t       thread;                     /* Periodic export thread */
+    pthread_mutex_t lock;                       /* Protects stop flag */
+    pthread_cond_t  wakeup;                     /* Signals thread to stop */
+    bool            stop;                       /* Request export thread to stop */
+    char           *path;                       /* Path to .prom file */
+    unsigned int    interval;                   /* Seconds between exports */
+    size_t          exports;                    /* Number of successful exports */
+};
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,72 @@
+/* model.h: SimpleFS simulated device timing */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Model Constants */
+
+#define MODEL_HDD               (0)             /* Spinning disk: seek + rotation + transfer */
+#define MODEL_SSD               (1)             /* Flash: per-page latency on parallel channels */
+
+#define MODEL_HDD_RPM           (7200)          /* Default spindle speed */
+#define MODEL_HDD_TRACK         (256)           /* Default blocks per track (1 MiB) */
+#define MODEL_HDD_SEEK_MIN      (500)           /* Default track-to-track seek (us) */
+#define MODEL_HDD_SEEK_MAX      (12000)         /* Default full-stroke seek (us) */
+
+#define MODEL_SSD_READ          (50)            /* Default page read latency (us) */
+#define MODEL_SSD_WRITE         (200)           /* Default page program latency (us) */
+#define MODEL_SSD_CHANNELS      (8)             /* Default number of parallel channels */
+#define MODEL_SSD_MAX_CHANNELS  (64)
+
+/* Model Structures */
+
+typedef struct DiskModel DiskModel;
+struct DiskModel {
+    int             type;                       /* Device type (MODEL_*) */
+    size_t          blocks;                     /* Blocks of device (set when attached) */
+
+    uint32_t        rpm;                        /* HDD: spindle speed */
+    uint32_t        track;                      /* HDD: blocks per track */
+    uint64_t        seek_min_ns;                /* HDD: track-to-track seek */
+    uint64_t        seek_max_ns;                /* HDD: full-stroke seek */
+
+    uint64_t        read_ns;                    /* SSD: page read latency */
+    uint64_t        write_ns;                   /* SSD: page program latency */
+    uint32_t        channels;                   /* SSD: parallel channels */
+
+    uint64_t        bandwidth;                  /* Transfer cap in bytes per second (0 for none) */
+
+    pthread_mutex_t lock;                       /* Lock protecting state and counters */
+    uint64_t        clock_ns;                   /* Simulated device time */
+    size_t          head;                       /* HDD: block under head after last request */
+    uint64_t        channel_ns[MODEL_SSD_MAX_CHANNELS]; /* SSD: time each channel is busy until */
+
+    uint64_t        requests;                   /* Requests serviced */
+    uint64_t        blocks_moved;               /* Blocks transferred */
+    uint64_t        seeks;                      /* HDD: requests that moved the head */
+    uint64_t        seek_ns;                    /* HDD: simulated seek time */
+    uint64_t        rotation_ns;                /* HDD: simulated rotational latency */
+    uint64_t        transfer_ns;                /* Simulated transfer time */
+    uint64_t        busy_ns;                    /* Simulated service time of all requests */
+    uint64_t        max_ns;                     /* Longest simulated service time */
+};
+
+/* Model Functions */
+
+DiskModel * model_create(int type);
+DiskModel * model_parse(const char *spec);
+void        model_delete(DiskModel *model);
+
+uint64_t    model_access(DiskModel *model, size_t block, size_t count, bool write);
+void        model_reset(DiskModel *model);
+void        model_report(DiskModel *model, FILE *stream);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,117 @@
+/* queue.h: SimpleFS disk request queue */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Queue Constants */
+
+#define QUEUE_FIFO              (0)             /* Dispatch in arrival order */
+#define QUEUE_MERGE             (1 << 0)        /* Merge adjacent requests into one vectored I/O */
+#define QUEUE_CSCAN             (1 << 1)        /* Dispatch in ascending block order, then wrap */
+#define QUEUE_DEADLINE          (1 << 2)        /* Dispatch expired requests first */
+
+#define QUEUE_READ_DEADLINE     (50)            /* Default read deadline (ms) */
+#define QUEUE_WRITE_DEADLINE    (500)           /* Default write deadline (ms) */
+#define QUEUE_MERGE_MAX         (256)           /* Maximum blocks (and requests) per merged I/O */
+
+#define QUEUE_CLASS_BE          (0)             /* Best-effort: default class */
+#define QUEUE_CLASS_RT          (1)             /* Realtime: always dispatched first */
+#define QUEUE_CLASS_IDLE        (2)             /* Idle: only when no other class is pending */
+#define QUEUE_CLASSES           (3)
+
+#define QUEUE_BURST             (100)           /* Token bucket depth (ms of its rate) */
+
+/* Queue Structures */
+
+typedef struct DiskRequest DiskRequest;
+struct DiskRequest {
+    size_t          block;                      /* First block */
+    size_t          count;                      /* Number of blocks */
+    char           *data;                       /* Data buffer (count * BLOCK_SIZE) */
+    bool            write;                      /* Whether request is a write */
+    uint64_t        sequence;                   /* Arrival order */
+    uint64_t        submitted;                  /* Submission time (ns) */
+    uint64_t        deadline;                   /* Dispatch deadline (ns) */
+    int             priority;                   /* Priority class (QUEUE_CLASS_*) */
+    ssize_t         result;                     /* Bytes transferred (DISK_FAILURE on failure) */
+    bool            done;                       /* Whether request has completed */
+};
+
+typedef struct QueueClassStats QueueClassStats;
+struct QueueClassStats {
+    uint64_t        submitted;                  /* Requests submitted */
+    uint64_t        dispatched;                 /* I/Os issued to the disk */
+    uint64_t        throttled;                  /* Picks skipped for lack of tokens */
+    uint64_t        total_wait_ns;              /* Sum of submission to dispatch times */
+    uint64_t        max_wait_ns;                /* Longest submission to dispatch time */
+};
+
+typedef struct QueueStats QueueStats;
+struct QueueStats {
+    uint64_t        submitted;                  /* Requests submitted */
+    uint64_t        dispatched;                 /* I/Os issued to the disk */
+    uint64_t        merges;                     /* Requests merged into another request's I/O */
+    uint64_t        reorders;                   /* Requests dispatched ahead of an older one */
+    uint64_t        expired;                    /* Requests dispatched because their deadline passed */
+    uint64_t        max_depth;                  /* Most requests pending at once */
+    uint64_t        total_wait_ns;              /* Sum of submission to dispatch times */
+    uint64_t        max_wait_ns;                /* Longest submission to dispatch time */
+    uint64_t        throttled_ns;               /* Time dispatcher slept waiting for tokens */
+    QueueClassStats classes[QUEUE_CLASSES];     /* Per priority class statistics */
+};
+
+typedef struct QueueBucket QueueBucket;
+struct QueueBucket {
+    uint64_t        iops;                       /* I/O rate limit (0 for none) */
+    uint64_t        bandwidth;                  /* Byte rate limit (0 for none) */
+    double          io_tokens;                  /* Available I/Os */
+    double          byte_tokens;                /* Available bytes */
+    uint64_t        refilled;                   /* Time of last refill (ns) */
+};
+
+typedef struct DiskQueue DiskQueue;
+struct DiskQueue {
+    struct Disk    *disk;                       /* Disk requests are issued to */
+    int             policy;                     /* Dispatch policy (QUEUE_* flags) */
+    uint64_t        read_deadline_ns;           /* Read deadline (QUEUE_DEADLINE) */
+    uint64_t        write_deadline_ns;          /* Write deadline (QUEUE_DEADLINE) */
+
+    pthread_mutex_t lock;                       /* Lock protecting queue */
+    pthread_cond_t  completed;                  /* Signaled when requests complete */
+    DiskRequest   **pending;                    /* Pending requests (unordered) */
+    size_t          count;                      /* Number of pending requests */
+    size_t          capacity;                   /* Capacity of pending array */
+    uint64_t        sequence;                   /* Next arrival number */
+    size_t          cursor;                     /* Block after last dispatched I/O */
+    bool            dispatching;                /* Whether a thread is dispatching */
+    QueueBucket     buckets[QUEUE_CLASSES];     /* Per priority class token buckets */
+    QueueStats      stats;                      /* Queue statistics */
+};
+
+/* Queue Functions */
+
+DiskQueue * queue_create(int policy);
+DiskQueue * queue_parse(const char *spec);
+void        queue_delete(DiskQueue *queue);
+
+void        queue_submit(DiskQueue *queue, DiskRequest *request);
+ssize_t     queue_wait(DiskQueue *queue, DiskRequest *request);
+ssize_t     queue_transfer(DiskQueue *queue, size_t block, size_t count, char *data, bool write);
+
+void        queue_limit(DiskQueue *queue, int priority, uint64_t iops, uint64_t bandwidth);
+void        queue_stats(DiskQueue *queue, QueueStats *stats);
+const char *queue_name(int policy);
+
+int         queue_set_priority(int priority);
+int         queue_priority(void);
+const char *queue_class_name(int priority);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
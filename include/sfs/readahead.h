@@ -0,0 +1,58 @@
+/* readahead.h: SimpleFS sequential readahead */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Readahead Constants */
+
+#define READAHEAD_STREAMS   (16)                /* Number of tracked file streams */
+#define READAHEAD_MIN       (4)                 /* Initial readahead window in blocks */
+#define READAHEAD_MAX       (64)                /* Maximum readahead window in blocks */
+
+/* Readahead Structures */
+
+typedef struct Stream Stream;
+struct Stream {
+    bool        valid;                          /* Whether or not stream is in use */
+    size_t      inode_number;                   /* Inode being accessed */
+    size_t      next;                           /* Next expected logical block */
+    size_t      ahead;                          /* End of issued readahead (logical block) */
+    size_t      window;                         /* Current readahead window in blocks */
+    size_t      sequential;                     /* Number of consecutive sequential accesses */
+    size_t      age;                            /* Last access tick (for stream replacement) */
+};
+
+typedef struct Readahead Readahead;
+struct Readahead {
+    Stream      streams[READAHEAD_STREAMS];     /* Per-file access streams */
+    size_t      tick;                           /* Access counter */
+    size_t      issued;                         /* Number of blocks prefetched */
+    uint8_t    *advice;                         /* Access advice of each inode (FS_ADVICE_*) */
+    size_t      inodes;                         /* Number of inodes */
+};
+
+/* Readahead Functions */
+
+struct FileSystem;
+struct Inode;
+
+Readahead *readahead_create(size_t inodes);
+void    readahead_delete(Readahead *ra);
+
+void    readahead_access(struct FileSystem *fs, size_t inode_number, struct Inode *inode, size_t logical);
+void    readahead_prefetch(struct FileSystem *fs, size_t inode_number, struct Inode *inode, size_t start, size_t end);
+size_t  readahead_map(struct FileSystem *fs, struct Inode *inode, size_t start, size_t end, uint32_t *blocks);
+
+void    readahead_advise(struct FileSystem *fs, size_t inode_number, int advice);
+int     readahead_advice(struct FileSystem *fs, size_t inode_number);
+
+void    readahead_reset(struct FileSystem *fs, size_t inode_number);
+void    readahead_forget(struct FileSystem *fs, size_t inode_number);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
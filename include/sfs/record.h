@@ -0,0 +1,65 @@
+/* record.h: SimpleFS workload recording */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "sfs/stats.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Record Constants */
+
+#define RECORD_MAGIC        (0x52534653)        /* "SFSR" */
+#define RECORD_VERSION      (1)
+
+#define RECORD_FORMAT       (0)                 /* fs_format */
+#define RECORD_MOUNT        (1)                 /* fs_mount */
+#define RECORD_UNMOUNT      (2)                 /* fs_unmount */
+#define RECORD_CREATE       (3)                 /* fs_create */
+#define RECORD_REMOVE       (4)                 /* fs_remove */
+#define RECORD_STAT         (5)                 /* fs_stat */
+#define RECORD_READ         (6)                 /* fs_read */
+#define RECORD_WRITE        (7)                 /* fs_write */
+#define RECORD_ADVISE       (8)                 /* fs_advise */
+#define RECORD_COMPRESS     (9)                 /* fs_compress */
+#define RECORD_CLONE        (10)                /* fs_clone */
+#define RECORD_SNAPSHOT     (11)                /* fs_snapshot */
+#define RECORD_SNAPSHOT_DELETE (12)             /* fs_snapshot_delete (inode is snapshot) */
+#define RECORD_SNAPSHOT_MOUNT  (13)             /* fs_snapshot_mount (inode is snapshot) */
+#define RECORD_OPS          (14)                /* Number of recorded operations */
+
+/* Record Structures */
+
+typedef struct RecordHeader RecordHeader;
+struct RecordHeader {
+    uint32_t    magic;                          /* Record file magic number */
+    uint32_t    version;                        /* Record file format version */
+};
+
+typedef struct RecordEntry RecordEntry;
+struct RecordEntry {
+    uint64_t    timestamp;                      /* Monotonic start time (ns) */
+    uint32_t    duration;                       /* Latency (ns, saturated) */
+    uint16_t    thread;                         /* Thread (in order of first call) */
+    uint8_t     op;                             /* Operation (RECORD_*) */
+    uint8_t     advice;                         /* Access advice (fs_advise only) */
+    uint32_t    inode;                          /* Inode number */
+    uint32_t    length;                         /* Length argument (saturated) */
+    uint32_t    offset;                         /* Offset argument (saturated) */
+    int32_t     result;                         /* Return value (-1 on failure) */
+};
+
+/* Record Functions */
+
+bool        record_start(const char *path);
+bool        record_stop(void);
+bool        record_active(void);
+void        record_op(int op, StatsTimer *timer, size_t inode, size_t length, size_t offset, int advice, ssize_t result);
+const char *record_name(int op);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,53 @@
+/* scrub.h: SimpleFS background integrity scrubber */
+
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Scrub Constants */
+
+#define SCRUB_MAGIC         (0x53534653)        /* "SFSS" */
+#define SCRUB_BATCH         (256)               /* Maximum blocks per read (1 MiB) */
+#define SCRUB_CHECKPOINT    (5)                 /* Seconds between checkpoints */
+#define SCRUB_RETRIES       (3)                 /* Reads of a block before it is reported */
+
+/* Scrub Structures */
+
+typedef struct ScrubCheckpoint ScrubCheckpoint;
+struct ScrubCheckpoint {
+    uint32_t    magic;                          /* Checkpoint file magic number */
+    uint32_t    blocks;                         /* Number of blocks in file system */
+    uint32_t    position;                       /* Next block to scrub */
+    uint32_t    passes;                         /* Completed passes */
+};
+
+typedef struct ScrubStats ScrubStats;
+struct ScrubStats {
+    bool        running;                        /* Whether a pass is in progress */
+    size_t      position;                       /* Next block to scrub */
+    size_t      blocks;                         /* Number of blocks in file system */
+    size_t      passes;                         /* Completed passes (kept in checkpoint) */
+    size_t      scanned;                        /* Allocated blocks read by this run */
+    size_t      errors;                         /* Blocks that failed verification in this run */
+    uint64_t    elapsed_ns;                     /* Time spent by this run */
+};
+
+typedef struct Scrub Scrub;
+struct Scrub {
+    pthread_t       thread;                     /* Background scrub thread */
+    bool            threaded;                   /* Whether or not thread was started */
+    pthread_mutex_t lock;                       /* Protects stop flag and statistics */
+    pthread_cond_t  wakeup;                     /* Signals thread to stop */
+    bool            stop;                       /* Request scrub thread to stop */
+    char           *path;                       /* Path to checkpoint file (NULL for none) */
+    uint64_t        rate;                       /* Bytes per second (0 for unlimited) */
+    ScrubStats      stats;                      /* Progress and statistics */
+};
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
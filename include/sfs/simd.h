@@ -0,0 +1,32 @@
+/* simd.h: SimpleFS vectorized block kernels */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* SIMD Levels */
+
+#define SIMD_SCALAR         (0)                 /* Portable C */
+#define SIMD_SSE2           (1)                 /* 128-bit SSE2 */
+#define SIMD_AVX2           (2)                 /* 256-bit AVX2 */
+#define SIMD_LEVELS         (3)                 /* Number of levels */
+
+/* SIMD Functions */
+
+bool        simd_zero(const void *data, size_t length);
+bool        simd_equal(const void *a, const void *b, size_t length);
+void        simd_clear(void *data, size_t length);
+size_t      simd_nonzero(const uint32_t *words, size_t count, size_t stride, uint32_t *indices);
+size_t      simd_mark(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value);
+
+int         simd_level(void);
+int         simd_supported(void);
+int         simd_use(int level);
+const char *simd_level_name(int level);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,69 @@
+/* stats.h: SimpleFS operation statistics */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Stats Constants */
+
+#define STATS_CREATE        (0)
+#define STATS_REMOVE        (1)
+#define STATS_STAT          (2)
+#define STATS_READ          (3)
+#define STATS_WRITE         (4)
+#define STATS_MOUNT         (5)
+#define STATS_DISK_READ     (6)
+#define STATS_DISK_WRITE    (7)
+#define STATS_CLONE         (8)
+#define STATS_COMPRESS      (9)
+#define STATS_SNAPSHOT      (10)
+#define STATS_SNAPSHOT_DELETE (11)
+#define STATS_OPS           (12)                /* Number of tracked operations */
+
+#define STATS_BUCKETS       (40)                /* Bucket i holds latencies in [2^i, 2^(i+1)) ns */
+
+/* Stats Structures */
+
+typedef struct StatsOp StatsOp;
+struct StatsOp {
+    uint64_t    count;                          /* Number of calls */
+    uint64_t    errors;                         /* Number of failed calls */
+    uint64_t    bytes;                          /* Number of bytes moved */
+    uint64_t    disk_reads;                     /* Disk reads issued during calls */
+    uint64_t    disk_writes;                    /* Disk writes issued during calls */
+    uint64_t    total_ns;                       /* Sum of latencies */
+    uint64_t    max_ns;                         /* Maximum latency */
+    uint64_t    histogram[STATS_BUCKETS];       /* Log2-bucketed latencies */
+};
+
+typedef struct Stats Stats;
+struct Stats {
+    StatsOp     ops[STATS_OPS];                 /* Per-operation statistics */
+};
+
+typedef struct StatsTimer StatsTimer;
+struct StatsTimer {
+    uint64_t    start;                          /* Start time (ns) */
+    uint64_t    disk_reads;                     /* Thread disk reads at start */
+    uint64_t    disk_writes;                    /* Thread disk writes at start */
+};
+
+/* Stats Functions */
+
+StatsTimer  stats_start(void);
+void        stats_stop(int op, StatsTimer *timer, ssize_t result);
+
+void        stats_collect(Stats *stats);
+void        stats_reset(void);
+
+const char *stats_name(int op);
+uint64_t    stats_percentile(const StatsOp *op, double percentile);
+uint64_t    stats_now(void);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
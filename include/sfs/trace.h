@@ -0,0 +1,51 @@
+/* trace.h: SimpleFS binary event tracing */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Trace Constants */
+
+#define TRACE_MAGIC             (0x54534653)    /* "SFST" */
+#define TRACE_RING_EVENTS       (4096)          /* Events kept per thread (power of two) */
+
+#define TRACE_INODE_INVALID     (1)             /* Inode could not be loaded */
+#define TRACE_INODE_REMOVE      (2)             /* Inode removed */
+#define TRACE_READ_BLOCK        (3)             /* Data block read by fs_read */
+#define TRACE_READ_RANGE        (4)             /* fs_read offset past last block */
+#define TRACE_WRITE_BLOCK       (5)             /* Data block written by fs_write */
+#define TRACE_WRITE_INDIRECT    (6)             /* Indirect block allocated by fs_write */
+#define TRACE_ALLOC_SCAN        (7)             /* Block examined by allocator */
+#define TRACE_ALLOC_BLOCK       (8)             /* Block allocated */
+#define TRACE_ALLOC_FAIL        (9)             /* No free block left */
+#define TRACE_EVENTS            (10)            /* Number of event types */
+
+/* Trace Structures */
+
+typedef struct TraceEvent TraceEvent;
+struct TraceEvent {
+    uint64_t    timestamp;                      /* Monotonic time (ns) */
+    uint32_t    event;                          /* Event type (TRACE_*) */
+    uint32_t    thread;                         /* Thread (in order of first event) */
+    uint32_t    inode;                          /* Inode number (0 if none) */
+    uint32_t    block;                          /* Block number (0 if none) */
+};
+
+typedef struct TraceHeader TraceHeader;
+struct TraceHeader {
+    uint32_t    magic;                          /* Trace file magic number */
+    uint32_t    count;                          /* Number of events */
+};
+
+/* Trace Functions */
+
+void        trace_record(uint32_t event, uint32_t inode, uint32_t block);
+bool        trace_save(const char *path);
+const char *trace_name(uint32_t event);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
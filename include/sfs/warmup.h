@@ -0,0 +1,45 @@
+/* warmup.h: SimpleFS cache warm-up across remounts */
+
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Warmup Constants */
+
+#define WARMUP_MAGIC        (0x57534653)        /* "SFSW" */
+#define WARMUP_BATCH        (256)               /* Maximum blocks per prefetch request */
+#define WARMUP_GAP          (8)                 /* Maximum hole bridged within a request */
+
+/* Warmup Structures */
+
+typedef struct WarmupHeader WarmupHeader;
+struct WarmupHeader {
+    uint32_t    magic;                          /* Warm-up file magic number */
+    uint32_t    blocks;                         /* Number of blocks in file system */
+    uint32_t    count;                          /* Number of recorded blocks */
+    uint32_t    reserved;                       /* Padding (zero) */
+};
+
+typedef struct WarmupRecord WarmupRecord;
+struct WarmupRecord {
+    uint32_t    block;                          /* Block number */
+    uint32_t    class;                          /* Cache class of block (CACHE_*) */
+};
+
+typedef struct Warmup Warmup;
+struct Warmup {
+    pthread_t       thread;                     /* Background prefetch thread */
+    bool            running;                    /* Whether or not thread was started */
+    volatile bool   stop;                       /* Request prefetch thread to stop */
+    WarmupRecord   *records;                    /* Blocks to prefetch (sorted) */
+    size_t          count;                      /* Number of records */
+    size_t          loaded;                     /* Number of blocks prefetched */
+};
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,568 @@
+/* cache.c: SimpleFS block cache */
+
+#include "sfs/cache.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <string.h>
+
+/* Internal Constants */
+
+#define QUEUE_A1IN  (0)
+#define QUEUE_AM    (1)
+#define QUEUE_META  (2)
+#define QUEUE_A1OUT (3)
+
+/* Internal Prototypes */
+
+CacheEntry **   cache_bucket(Cache *cache, CacheEntry **buckets, size_t block);
+CacheEntry *    cache_find(Cache *cache, CacheEntry **buckets, size_t block);
+void            cache_hash(Cache *cache, CacheEntry **buckets, CacheEntry *entry);
+void            cache_unhash(Cache *cache, CacheEntry **buckets, CacheEntry *entry);
+
+CacheQueue *    cache_queue(Cache *cache, int queue);
+void            cache_unlink(Cache *cache, CacheEntry *entry);
+void            cache_push_front(Cache *cache, CacheEntry *entry, int queue);
+void            cache_push_back(Cache *cache, CacheEntry *entry, int queue);
+
+CacheEntry *    cache_evict(Cache *cache);
+void            cache_remember(Cache *cache, size_t block);
+bool            cache_forget(Cache *cache, size_t block);
+void            cache_store(Cache *cache, size_t block, int class, const char *data, bool cold);
+void            cache_stamp(Cache *cache, size_t block);
+
+/* External Functions */
+
+/**
+ * Create block cache by doing the following:
+ *
+ *  1. Allocate Cache structure, entry storage, and block storage.
+ *
+ *  2. Allocate ghost entries for the A1out queue.
+ *
+ *  3. Allocate hash tables with a power of two number of buckets.
+ *
+ * The cache implements the 2Q replacement policy for file data: blocks seen
+ * once enter the A1in FIFO and are only promoted to the Am LRU if they are
+ * referenced again after falling out of A1in (while their id is remembered in
+ * A1out). A single large scan therefore only cycles through A1in. Metadata
+ * (superblock, inode table, and indirect blocks) is kept on its own LRU and is
+ * never evicted in favor of data unless it exceeds 1/CACHE_META_SHARE of the
+ * cache.
+ *
+ * @param       capacity    Maximum number of blocks to cache.
+ *
+ * @return      Pointer to newly allocated Cache structure (NULL on failure).
+ **/
+Cache * cache_create(size_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+
+    Cache *cache = calloc(1, sizeof(Cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->capacity = capacity;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    // size hash tables to at least the number of entries
+    cache->nbuckets = 1;
+    while (cache->nbuckets < capacity) {
+        cache->nbuckets <<= 1;
+    }
+
+    size_t nghosts = capacity / CACHE_A1OUT_SHARE + 1;
+
+    cache->blocks        = malloc(capacity * BLOCK_SIZE);
+    cache->entries       = calloc(capacity, sizeof(CacheEntry));
+    cache->ghosts        = calloc(nghosts, sizeof(CacheEntry));
+    cache->buckets       = calloc(cache->nbuckets, sizeof(CacheEntry *));
+    cache->ghost_buckets = calloc(cache->nbuckets, sizeof(CacheEntry *));
+    cache->stamps        = calloc(cache->nbuckets, sizeof(uint64_t));
+    if (!cache->blocks || !cache->entries || !cache->ghosts || !cache->buckets || !cache->ghost_buckets || !cache->stamps) {
+        cache_delete(cache);
+        return NULL;
+    }
+
+    // thread entries and ghosts onto free lists
+    for (size_t i = 0; i < capacity; i++) {
+        cache->entries[i].data = cache->blocks + i * BLOCK_SIZE;
+        cache->entries[i].next = cache->free_entries;
+        cache->free_entries    = &cache->entries[i];
+    }
+
+    for (size_t i = 0; i < nghosts; i++) {
+        cache->ghosts[i].next = cache->free_ghosts;
+        cache->free_ghosts    = &cache->ghosts[i];
+    }
+
+    return cache;
+}
+
+/**
+ * Release block cache and all of its entries.
+ *
+ * @param       cache       Pointer to Cache structure.
+ **/
+void    cache_delete(Cache *cache) {
+    if (!cache) {
+        return;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->blocks);
+    free(cache->entries);
+    free(cache->ghosts);
+    free(cache->buckets);
+    free(cache->ghost_buckets);
+    free(cache->stamps);
+    free(cache);
+}
+
+/**
+ * Lookup block in cache by doing the following:
+ *
+ *  1. Search hash table for block and record hit or miss for its class.
+ *
+ *  2. On hit, copy contents to data buffer and update recency (Am and
+ *  metadata entries move to the front of their LRU; A1in entries stay put).
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to lookup.
+ * @param       class       Block class (CACHE_*).
+ * @param       data        Data buffer (must be BLOCK_SIZE).
+ *
+ * @return      Whether or not the block was found in the cache.
+ **/
+bool    cache_lookup(Cache *cache, size_t block, int class, char *data) {
+    if (!cache || class < 0 || class >= CACHE_CLASSES) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = cache_find(cache, cache->buckets, block);
+    if (!entry) {
+        cache->stats[class].misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return false;
+    }
+
+    cache->stats[class].hits++;
+    memcpy(data, entry->data, BLOCK_SIZE);
+
+    if (entry->queue != QUEUE_A1IN) {
+        int queue = entry->queue;
+        cache_unlink(cache, entry);
+        cache_push_front(cache, entry, queue);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return true;
+}
+
+/**
+ * Check if block is in cache without updating recency or statistics.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to check.
+ *
+ * @return      Whether or not the block is cached.
+ **/
+bool    cache_contains(Cache *cache, size_t block) {
+    if (!cache) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    bool found = cache_find(cache, cache->buckets, block) != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+/**
+ * Insert block into cache by doing the following:
+ *
+ *  1. Update existing entry if block is already cached.
+ *
+ *  2. Otherwise, take an unused entry or evict one.
+ *
+ *  3. Place metadata on the metadata LRU, data whose id is remembered in
+ *  A1out on the Am LRU, and other data at the front of the A1in FIFO.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to insert.
+ * @param       class       Block class (CACHE_*).
+ * @param       data        Data buffer (must be BLOCK_SIZE).
+ **/
+void    cache_insert(Cache *cache, size_t block, int class, const char *data) {
+    if (!cache) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache_stamp(cache, block);
+    cache_store(cache, block, class, data, false);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Insert block into cache without expectation of reuse: data is placed at the
+ * eviction end of A1in and its id is not remembered when it is evicted, so
+ * it can never displace blocks on the Am or metadata LRUs.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to insert.
+ * @param       class       Block class (CACHE_*).
+ * @param       data        Data buffer (must be BLOCK_SIZE).
+ **/
+void    cache_insert_cold(Cache *cache, size_t block, int class, const char *data) {
+    if (!cache) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache_stamp(cache, block);
+    cache_store(cache, block, class, data, true);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Return current write sequence of cache, which a background fill records
+ * before it reads blocks from disk (see cache_fill).
+ *
+ * @param       cache       Pointer to Cache structure.
+ *
+ * @return      Number of inserts and invalidations so far.
+ **/
+uint64_t cache_sequence(Cache *cache) {
+    if (!cache) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    uint64_t sequence = cache->sequence;
+    pthread_mutex_unlock(&cache->lock);
+    return sequence;
+}
+
+/**
+ * Insert block into cache only if it is not already cached and was not
+ * inserted or invalidated since the specified sequence. This is used by
+ * background fills, whose data must never replace newer contents written by
+ * the file system while the fill was reading from disk (even if those
+ * contents have been evicted since).
+ *
+ * Write stamps are kept per hash bucket, so a write to another block in the
+ * same bucket may also refuse a fill.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to insert.
+ * @param       class       Block class (CACHE_*).
+ * @param       data        Data buffer (must be BLOCK_SIZE).
+ * @param       since       Cache sequence from before data was read.
+ *
+ * @return      Whether or not the block was inserted.
+ **/
+bool    cache_fill(Cache *cache, size_t block, int class, const char *data, uint64_t since) {
+    if (!cache) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    size_t bucket   = cache_bucket(cache, cache->buckets, block) - cache->buckets;
+    bool   inserted = cache->stamps[bucket] <= since && cache_find(cache, cache->buckets, block) == NULL;
+    if (inserted) {
+        cache_store(cache, block, class, data, false);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return inserted;
+}
+
+/**
+ * Remove block (and any remembered id of it) from cache.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       block       Block number to remove.
+ **/
+void    cache_invalidate(Cache *cache, size_t block) {
+    if (!cache) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache_stamp(cache, block);
+    cache_forget(cache, block);
+
+    CacheEntry *entry = cache_find(cache, cache->buckets, block);
+    if (entry) {
+        cache->stats[entry->class].resident--;
+        cache_unlink(cache, entry);
+        cache_unhash(cache, cache->buckets, entry);
+
+        entry->next         = cache->free_entries;
+        cache->free_entries = entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Return hit rate of lookups for the specified block class.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       class       Block class (CACHE_*).
+ *
+ * @return      Fraction of lookups that hit (0 if there were none).
+ **/
+double  cache_hit_rate(Cache *cache, int class) {
+    if (!cache || class < 0 || class >= CACHE_CLASSES) {
+        return 0.0;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    size_t hits  = cache->stats[class].hits;
+    size_t total = hits + cache->stats[class].misses;
+    pthread_mutex_unlock(&cache->lock);
+    return total ? (double)hits / total : 0.0;
+}
+
+/**
+ * Collect the hot block set: metadata blocks followed by data blocks on the
+ * Am LRU (data that has been referenced more than once), most recent first.
+ *
+ * @param       cache       Pointer to Cache structure.
+ * @param       blocks      Output array of block numbers.
+ * @param       classes     Output array of block classes (CACHE_*).
+ * @param       max         Maximum number of blocks to collect.
+ *
+ * @return      Number of blocks collected.
+ **/
+size_t  cache_hot(Cache *cache, uint32_t *blocks, uint8_t *classes, size_t max) {
+    if (!cache) {
+        return 0;
+    }
+
+    size_t count = 0;
+    pthread_mutex_lock(&cache->lock);
+    CacheQueue *queues[] = {&cache->meta, &cache->am};
+    for (size_t q = 0; q < sizeof(queues) / sizeof(queues[0]); q++) {
+        for (CacheEntry *entry = queues[q]->head; entry && count < max; entry = entry->next) {
+            blocks[count]  = entry->block;
+            classes[count] = entry->class;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return count;
+}
+
+/* Internal Functions */
+
+// helper function to locate hash bucket for block
+CacheEntry **   cache_bucket(Cache *cache, CacheEntry **buckets, size_t block) {
+    size_t hash = block * 0x9E3779B97F4A7C15ULL;
+    return &buckets[(hash >> 16) & (cache->nbuckets - 1)];
+}
+
+// helper function to find entry for block
+CacheEntry *    cache_find(Cache *cache, CacheEntry **buckets, size_t block) {
+    for (CacheEntry *entry = *cache_bucket(cache, buckets, block); entry; entry = entry->chain) {
+        if (entry->block == block) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// helper function to add entry to hash table
+void    cache_hash(Cache *cache, CacheEntry **buckets, CacheEntry *entry) {
+    CacheEntry **bucket = cache_bucket(cache, buckets, entry->block);
+    entry->chain = *bucket;
+    *bucket      = entry;
+}
+
+// helper function to remove entry from hash table
+void    cache_unhash(Cache *cache, CacheEntry **buckets, CacheEntry *entry) {
+    CacheEntry **link = cache_bucket(cache, buckets, entry->block);
+    while (*link && *link != entry) {
+        link = &(*link)->chain;
+    }
+
+    if (*link) {
+        *link = entry->chain;
+    }
+    entry->chain = NULL;
+}
+
+// helper function to map queue id to queue
+CacheQueue *    cache_queue(Cache *cache, int queue) {
+    switch (queue) {
+        case QUEUE_A1IN:  return &cache->a1in;
+        case QUEUE_AM:    return &cache->am;
+        case QUEUE_META:  return &cache->meta;
+        default:          return &cache->a1out;
+    }
+}
+
+// helper function to remove entry from its queue
+void    cache_unlink(Cache *cache, CacheEntry *entry) {
+    CacheQueue *queue = cache_queue(cache, entry->queue);
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        queue->head = entry->next;
+    }
+
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        queue->tail = entry->prev;
+    }
+
+    entry->prev = entry->next = NULL;
+    queue->count--;
+}
+
+// helper function to add entry to front of queue
+void    cache_push_front(Cache *cache, CacheEntry *entry, int queue_id) {
+    CacheQueue *queue = cache_queue(cache, queue_id);
+
+    entry->queue = queue_id;
+    entry->prev  = NULL;
+    entry->next  = queue->head;
+    if (queue->head) {
+        queue->head->prev = entry;
+    }
+    queue->head = entry;
+
+    if (!queue->tail) {
+        queue->tail = entry;
+    }
+    queue->count++;
+}
+
+// helper function to add entry to back of queue
+void    cache_push_back(Cache *cache, CacheEntry *entry, int queue_id) {
+    CacheQueue *queue = cache_queue(cache, queue_id);
+
+    entry->queue = queue_id;
+    entry->next  = NULL;
+    entry->prev  = queue->tail;
+    if (queue->tail) {
+        queue->tail->next = entry;
+    }
+    queue->tail = entry;
+
+    if (!queue->head) {
+        queue->head = entry;
+    }
+    queue->count++;
+}
+
+// helper function to pick and detach an entry to reuse
+CacheEntry *    cache_evict(Cache *cache) {
+    size_t data_count = cache->a1in.count + cache->am.count;
+    size_t kin        = max(data_count / CACHE_A1IN_SHARE, 1);
+    CacheEntry *victim;
+
+    // data gives way to metadata until metadata exceeds its share
+    if (data_count == 0 || cache->meta.count > cache->capacity / CACHE_META_SHARE) {
+        victim = cache->meta.tail;
+    } else if (cache->a1in.count > kin || cache->am.count == 0) {
+        victim = cache->a1in.tail;
+        if (!victim->cold) {
+            cache_remember(cache, victim->block);
+        }
+    } else {
+        victim = cache->am.tail;
+    }
+
+    cache->stats[victim->class].resident--;
+    cache_unlink(cache, victim);
+    cache_unhash(cache, cache->buckets, victim);
+    return victim;
+}
+
+// helper function to remember id of block evicted from A1in
+void    cache_remember(Cache *cache, size_t block) {
+    CacheEntry *ghost = cache->free_ghosts;
+    if (ghost) {
+        cache->free_ghosts = ghost->next;
+    } else {
+        ghost = cache->a1out.tail;
+        cache_unlink(cache, ghost);
+        cache_unhash(cache, cache->ghost_buckets, ghost);
+    }
+
+    ghost->block = block;
+    cache_hash(cache, cache->ghost_buckets, ghost);
+    cache_push_front(cache, ghost, QUEUE_A1OUT);
+}
+
+// helper function to forget remembered id of block (returns whether it was remembered)
+bool    cache_forget(Cache *cache, size_t block) {
+    CacheEntry *ghost = cache_find(cache, cache->ghost_buckets, block);
+    if (!ghost) {
+        return false;
+    }
+
+    cache_unlink(cache, ghost);
+    cache_unhash(cache, cache->ghost_buckets, ghost);
+    ghost->next        = cache->free_ghosts;
+    cache->free_ghosts = ghost;
+    return true;
+}
+
+// helper function to record a write or invalidation of block (with lock held)
+void    cache_stamp(Cache *cache, size_t block) {
+    size_t bucket = cache_bucket(cache, cache->buckets, block) - cache->buckets;
+    cache->stamps[bucket] = ++cache->sequence;
+}
+
+// helper function to insert or update entry for block
+void    cache_store(Cache *cache, size_t block, int class, const char *data, bool cold) {
+    if (!cache || class < 0 || class >= CACHE_CLASSES) {
+        return;
+    }
+
+    CacheEntry *entry = cache_find(cache, cache->buckets, block);
+    if (entry) {
+        // updating contents does not count as a reference
+        memcpy(entry->data, data, BLOCK_SIZE);
+        if (entry->class == class) {
+            return;
+        }
+
+        cache->stats[entry->class].resident--;
+        cache_unlink(cache, entry);
+    } else {
+        entry = cache->free_entries;
+        if (entry) {
+            cache->free_entries = entry->next;
+        } else {
+            entry = cache_evict(cache);
+        }
+
+        entry->block = block;
+        memcpy(entry->data, data, BLOCK_SIZE);
+        cache_hash(cache, cache->buckets, entry);
+    }
+
+    entry->class = class;
+    entry->cold  = cold;
+    cache->stats[class].resident++;
+
+    bool seen = cache_forget(cache, block);
+    if (class != CACHE_DATA) {
+        cache_push_front(cache, entry, QUEUE_META);
+    } else if (cold) {
+        cache_push_back(cache, entry, QUEUE_A1IN);
+    } else if (seen) {
+        cache_push_front(cache, entry, QUEUE_AM);
+    } else {
+        cache_push_front(cache, entry, QUEUE_A1IN);
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,229 @@
+/* crc32c.c: SimpleFS CRC32C (Castagnoli) checksums */
+
+#include "sfs/crc32c.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/* Internal Constants */
+
+#define CRC32C_LONG             (1024)          /* Bytes per stream of long interleaved steps */
+#define CRC32C_SHORT            (128)           /* Bytes per stream of short interleaved steps */
+
+/* Internal Globals */
+
+static uint32_t         Table[8][256];          /* Slicing-by-8 lookup tables */
+static uint32_t         Long[4][256];           /* Advance CRC over CRC32C_LONG zero bytes */
+static uint32_t         Short[4][256];          /* Advance CRC over CRC32C_SHORT zero bytes */
+static bool             Accelerated = false;    /* Whether SSE4.2 crc32 is available */
+static pthread_once_t   Once = PTHREAD_ONCE_INIT;
+
+/* Internal Prototypes */
+
+void    crc32c_init(void);
+void    crc32c_init_shift(uint32_t shift[4][256], size_t length);
+uint32_t crc32c_shift(uint32_t shift[4][256], uint32_t crc);
+
+/* External Functions */
+
+/**
+ * Extend CRC32C of previous data with length bytes of data, using the SSE4.2
+ * crc32 instruction when the processor has it and slicing-by-8 tables
+ * otherwise (chosen once at runtime).
+ *
+ * @param       crc         CRC32C of previous data (0 to start).
+ * @param       data        Data buffer.
+ * @param       length      Number of bytes in data buffer.
+ * @return      CRC32C of previous data followed by data.
+ **/
+uint32_t    crc32c(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&Once, crc32c_init);
+    return Accelerated ? crc32c_hardware(crc, data, length) : crc32c_software(crc, data, length);
+}
+
+/**
+ * Extend CRC32C with slicing-by-8: eight bytes per step through eight
+ * 256-entry tables.
+ *
+ * @param       crc         CRC32C of previous data (0 to start).
+ * @param       data        Data buffer.
+ * @param       length      Number of bytes in data buffer.
+ * @return      CRC32C of previous data followed by data.
+ **/
+uint32_t    crc32c_software(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&Once, crc32c_init);
+
+    const uint8_t *bytes = data;
+    crc = ~crc;
+
+    // align to eight bytes, then consume a word at a time
+    while (length && ((uintptr_t)bytes & 7)) {
+        crc = Table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+        length--;
+    }
+
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        word ^= crc;
+        crc = Table[7][word & 0xFF]         ^ Table[6][(word >> 8) & 0xFF]  ^
+              Table[5][(word >> 16) & 0xFF] ^ Table[4][(word >> 24) & 0xFF] ^
+              Table[3][(word >> 32) & 0xFF] ^ Table[2][(word >> 40) & 0xFF] ^
+              Table[1][(word >> 48) & 0xFF] ^ Table[0][word >> 56];
+        bytes  += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = Table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Extend CRC32C with the SSE4.2 crc32 instruction (the caller must check
+ * crc32c_accelerated first).  Each crc32 has a latency of three cycles but
+ * one can start every cycle, so large buffers are split into three streams
+ * whose CRCs are computed together and then combined.
+ *
+ * @param       crc         CRC32C of previous data (0 to start).
+ * @param       data        Data buffer.
+ * @param       length      Number of bytes in data buffer.
+ * @return      CRC32C of previous data followed by data.
+ **/
+__attribute__((target("sse4.2")))
+uint32_t    crc32c_hardware(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&Once, crc32c_init);
+
+    const uint8_t *bytes = data;
+    uint64_t       value = ~crc;
+
+    while (length >= 3 * CRC32C_LONG) {
+        uint64_t second = 0, third = 0;
+        for (size_t offset = 0; offset < CRC32C_LONG; offset += 8) {
+            uint64_t words[3];
+            memcpy(&words[0], bytes + offset, 8);
+            memcpy(&words[1], bytes + CRC32C_LONG + offset, 8);
+            memcpy(&words[2], bytes + 2 * CRC32C_LONG + offset, 8);
+            value  = _mm_crc32_u64(value, words[0]);
+            second = _mm_crc32_u64(second, words[1]);
+            third  = _mm_crc32_u64(third, words[2]);
+        }
+        value   = crc32c_shift(Long, crc32c_shift(Long, value) ^ second) ^ third;
+        bytes  += 3 * CRC32C_LONG;
+        length -= 3 * CRC32C_LONG;
+    }
+
+    while (length >= 3 * CRC32C_SHORT) {
+        uint64_t second = 0, third = 0;
+        for (size_t offset = 0; offset < CRC32C_SHORT; offset += 8) {
+            uint64_t words[3];
+            memcpy(&words[0], bytes + offset, 8);
+            memcpy(&words[1], bytes + CRC32C_SHORT + offset, 8);
+            memcpy(&words[2], bytes + 2 * CRC32C_SHORT + offset, 8);
+            value  = _mm_crc32_u64(value, words[0]);
+            second = _mm_crc32_u64(second, words[1]);
+            third  = _mm_crc32_u64(third, words[2]);
+        }
+        value   = crc32c_shift(Short, crc32c_shift(Short, value) ^ second) ^ third;
+        bytes  += 3 * CRC32C_SHORT;
+        length -= 3 * CRC32C_SHORT;
+    }
+
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        value   = _mm_crc32_u64(value, word);
+        bytes  += 8;
+        length -= 8;
+    }
+
+    uint32_t tail = value;
+    while (length--) {
+        tail = _mm_crc32_u8(tail, *bytes++);
+    }
+
+    return ~tail;
+}
+#else
+uint32_t    crc32c_hardware(uint32_t crc, const void *data, size_t length) {
+    return crc32c_software(crc, data, length);
+}
+#endif
+
+/**
+ * Return whether crc32c uses the processor's crc32 instruction.
+ *
+ * @return      Whether CRC32C is hardware accelerated.
+ **/
+bool        crc32c_accelerated(void) {
+    pthread_once(&Once, crc32c_init);
+    return Accelerated;
+}
+
+/* Internal Functions */
+
+// helper function to build lookup tables and detect SSE4.2
+void    crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        Table[0][i] = crc;
+    }
+
+    // table k advances a byte through k more zero bytes
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            Table[k][i] = (Table[k - 1][i] >> 8) ^ Table[0][Table[k - 1][i] & 0xFF];
+        }
+    }
+
+    crc32c_init_shift(Long, CRC32C_LONG);
+    crc32c_init_shift(Short, CRC32C_SHORT);
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    Accelerated = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// helper function to build tables that advance a CRC over length zero bytes
+// (the CRC is linear, so each bit's image is found once and combined)
+void    crc32c_init_shift(uint32_t shift[4][256], size_t length) {
+    uint32_t bits[32];
+    for (int bit = 0; bit < 32; bit++) {
+        uint32_t crc = 1U << bit;
+        for (size_t i = 0; i < length; i++) {
+            crc = Table[0][crc & 0xFF] ^ (crc >> 8);
+        }
+        bits[bit] = crc;
+    }
+
+    for (int k = 0; k < 4; k++) {
+        for (uint32_t byte = 0; byte < 256; byte++) {
+            uint32_t crc = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                if (byte & (1U << bit)) {
+                    crc ^= bits[8 * k + bit];
+                }
+            }
+            shift[k][byte] = crc;
+        }
+    }
+}
+
+// helper function to advance CRC over the zero bytes of a shift table
+uint32_t crc32c_shift(uint32_t shift[4][256], uint32_t crc) {
+    return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^
+           shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
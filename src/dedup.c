@@ -0,0 +1,410 @@
+/* dedup.c: SimpleFS inline block deduplication */
+
+#include "sfs/crc32c.h"
+#include "sfs/fs.h"
+#include "sfs/simd.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Internal Prototypes */
+
+size_t  dedup_slot(Dedup *dedup, uint64_t hash);
+bool    dedup_bloom_test(Dedup *dedup, uint64_t hash);
+void    dedup_bloom_add(Dedup *dedup, uint64_t hash);
+void    dedup_add(Dedup *dedup, size_t block, uint64_t hash);
+void    dedup_load(FileSystem *fs, Dedup *dedup);
+void    dedup_mark(FileSystem *fs, bool *data);
+void    dedup_mark_inodes(FileSystem *fs, size_t block, bool *data);
+bool    dedup_save(Dedup *dedup);
+size_t  dedup_power(size_t n);
+
+/* External Functions */
+
+/**
+ * Enable inline deduplication of written blocks by doing the following:
+ *
+ *  1. Size the hash index and its Bloom filter for every block of the
+ *  FileSystem.
+ *
+ *  2. Reload the index saved in the index file (if any) by an earlier run,
+ *  keeping only entries for blocks that are still file data.
+ *
+ * While enabled, fs_write hashes every block it stores; a block whose hash
+ * is in the index (and whose contents match) is shared by taking another
+ * reference instead of being allocated and written.  The Bloom filter
+ * answers most lookups for new contents without probing the index.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       path        Path to index file (NULL for none).
+ * @return      Whether or not deduplication was enabled.
+ **/
+bool    fs_dedup_start(FileSystem *fs, const char *path) {
+    if (!fs || !fs->disk || !fs->free_blocks) {
+        return false;
+    }
+
+    fs_dedup_stop(fs);
+
+    Dedup *dedup = calloc(1, sizeof(Dedup));
+    if (!dedup) {
+        return false;
+    }
+
+    dedup->blocks     = fs->meta_data.blocks;
+    dedup->capacity   = dedup_power(2 * fs->meta_data.blocks);
+    dedup->bloom_bits = dedup_power(DEDUP_BLOOM_BITS * fs->meta_data.blocks);
+    dedup->table      = calloc(dedup->capacity, sizeof(DedupEntry));
+    dedup->bloom      = calloc(dedup->bloom_bits / 64, sizeof(uint64_t));
+    dedup->hashes     = calloc(fs->meta_data.blocks, sizeof(uint64_t));
+    dedup->path       = path ? strdup(path) : NULL;
+    if (!dedup->table || !dedup->bloom || !dedup->hashes) {
+        free(dedup->table);
+        free(dedup->bloom);
+        free(dedup->hashes);
+        free(dedup->path);
+        free(dedup);
+        return false;
+    }
+
+    dedup_load(fs, dedup);
+    fs->dedup = dedup;
+    return true;
+}
+
+/**
+ * Disable deduplication (if enabled), save the index to the index file and
+ * release its state.  Blocks already shared stay shared.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ **/
+void    fs_dedup_stop(FileSystem *fs) {
+    Dedup *dedup = fs ? fs->dedup : NULL;
+    if (!dedup) {
+        return;
+    }
+
+    dedup_save(dedup);
+    free(dedup->table);
+    free(dedup->bloom);
+    free(dedup->hashes);
+    free(dedup->path);
+    free(dedup);
+    fs->dedup = NULL;
+}
+
+/**
+ * Copy statistics of inline deduplication.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       stats   DedupStats structure to fill.
+ * @return      Whether or not deduplication is enabled.
+ **/
+bool    fs_dedup_stats(FileSystem *fs, DedupStats *stats) {
+    Dedup *dedup = fs ? fs->dedup : NULL;
+    if (!dedup) {
+        return false;
+    }
+
+    *stats = dedup->stats;
+    return true;
+}
+
+/**
+ * Hash the contents of a block: CRC32C of each half, so 64 bits come from
+ * one (hardware accelerated) pass over the data.  Never returns 0.
+ *
+ * @param       data        Block data (BLOCK_SIZE bytes).
+ * @return      Content hash.
+ **/
+uint64_t dedup_hash(const char *data) {
+    uint64_t hash = ((uint64_t)crc32c(0, data, BLOCK_SIZE / 2) << 32) |
+                    crc32c(0, data + BLOCK_SIZE / 2, BLOCK_SIZE / 2);
+    return hash ? hash : 1;
+}
+
+/**
+ * Find a stored block with the same contents as data.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       data        Block data (BLOCK_SIZE bytes).
+ * @return      Block number of identical block (-1 if none or disabled).
+ **/
+ssize_t dedup_lookup(FileSystem *fs, const char *data) {
+    Dedup *dedup = fs->dedup;
+    if (!dedup) {
+        return -1;
+    }
+
+    uint64_t hash = dedup_hash(data);
+    dedup->stats.lookups++;
+    if (!dedup_bloom_test(dedup, hash)) {
+        dedup->stats.filtered++;
+        return -1;
+    }
+
+    size_t slot = dedup_slot(dedup, hash);
+    for (; dedup->table[slot].block; slot = (slot + 1) & (dedup->capacity - 1)) {
+        DedupEntry *entry = &dedup->table[slot];
+        if (entry->hash != hash) {
+            continue;
+        }
+
+        // verify contents, so a hash collision never shares a block
+        Block block;
+        if (!cache_lookup(fs->cache, entry->block, CACHE_DATA, block.data)) {
+            if (disk_read(fs->disk, entry->block, block.data) == DISK_FAILURE) {
+                return -1;
+            }
+            cache_insert(fs->cache, entry->block, CACHE_DATA, block.data);
+        }
+        if (!simd_equal(block.data, data, BLOCK_SIZE)) {
+            dedup->stats.mismatches++;
+            continue;
+        }
+
+        dedup->stats.hits++;
+        return entry->block;
+    }
+
+    return -1;
+}
+
+/**
+ * Add a newly stored block to the index (blocks whose hashes collide each
+ * get their own entry, so lookups probe past a mismatch).
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       block       Block number.
+ * @param       data        Block data (BLOCK_SIZE bytes).
+ **/
+void    dedup_insert(FileSystem *fs, size_t block, const char *data) {
+    if (fs->dedup && block < fs->meta_data.blocks) {
+        dedup_add(fs->dedup, block, dedup_hash(data));
+    }
+}
+
+/**
+ * Remove a freed block from the index, shifting later entries of its probe
+ * sequence back so lookups never need tombstones.  (The Bloom filter keeps
+ * its bits; they only cost an extra probe.)
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       block       Block number.
+ **/
+void    dedup_forget(FileSystem *fs, size_t block) {
+    Dedup *dedup = fs->dedup;
+    if (!dedup || block >= fs->meta_data.blocks || !dedup->hashes[block]) {
+        return;
+    }
+
+    size_t mask = dedup->capacity - 1;
+    size_t slot = dedup_slot(dedup, dedup->hashes[block]);
+    while (dedup->table[slot].block && dedup->table[slot].block != block) {
+        slot = (slot + 1) & mask;
+    }
+    dedup->hashes[block] = 0;
+    if (!dedup->table[slot].block) {
+        return;
+    }
+
+    for (size_t next = (slot + 1) & mask; dedup->table[next].block; next = (next + 1) & mask) {
+        size_t home = dedup_slot(dedup, dedup->table[next].hash);
+
+        // move entry back unless its home lies cyclically in (slot, next]
+        bool stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            dedup->table[slot] = dedup->table[next];
+            slot = next;
+        }
+    }
+    memset(&dedup->table[slot], 0, sizeof(DedupEntry));
+    dedup->stats.entries--;
+}
+
+/* Internal Functions */
+
+// helper function to compute home slot of hash
+size_t  dedup_slot(Dedup *dedup, uint64_t hash) {
+    return (hash ^ (hash >> 29)) & (dedup->capacity - 1);
+}
+
+// helper function to test Bloom filter (double hashing over the two hash halves)
+bool    dedup_bloom_test(Dedup *dedup, uint64_t hash) {
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    for (size_t i = 0; i < DEDUP_BLOOM_HASHES; i++) {
+        size_t bit = (h1 + i * h2) & (dedup->bloom_bits - 1);
+        if (!(dedup->bloom[bit / 64] & (1ULL << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// helper function to add hash to Bloom filter
+void    dedup_bloom_add(Dedup *dedup, uint64_t hash) {
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    for (size_t i = 0; i < DEDUP_BLOOM_HASHES; i++) {
+        size_t bit = (h1 + i * h2) & (dedup->bloom_bits - 1);
+        dedup->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+// helper function to index block under hash (unless the block is already indexed)
+void    dedup_add(Dedup *dedup, size_t block, uint64_t hash) {
+    size_t slot = dedup_slot(dedup, hash);
+    for (; dedup->table[slot].block; slot = (slot + 1) & (dedup->capacity - 1)) {
+        if (dedup->table[slot].block == block) {
+            return;
+        }
+    }
+
+    dedup->table[slot].hash  = hash;
+    dedup->table[slot].block = block;
+    dedup->hashes[block]     = hash;
+    dedup_bloom_add(dedup, hash);
+    dedup->stats.entries++;
+}
+
+// helper function to reload index file if it matches the file system
+void    dedup_load(FileSystem *fs, Dedup *dedup) {
+    FILE *stream = dedup->path ? fopen(dedup->path, "r") : NULL;
+    if (!stream) {
+        return;
+    }
+
+    DedupHeader header;
+    if (fread(&header, sizeof(header), 1, stream) != 1 ||
+        header.magic  != DEDUP_MAGIC ||
+        header.blocks != fs->meta_data.blocks) {
+        fprintf(stderr, "fs_dedup_start: %s is not a dedup index for this file system\n", dedup->path);
+        fclose(stream);
+        return;
+    }
+
+    // blocks freed since the index was saved may now hold metadata (pointer
+    // blocks, cluster tables, snapshot maps, or inode copies), which must
+    // never be shared with file data, so keep only entries for data blocks
+    bool *data = calloc(fs->meta_data.blocks, sizeof(bool));
+    if (!data) {
+        fclose(stream);
+        return;
+    }
+    dedup_mark(fs, data);
+
+    DedupEntry entry;
+    for (uint64_t e = 0; e < header.entries && fread(&entry, sizeof(entry), 1, stream) == 1; e++) {
+        if (entry.block && entry.block < fs->meta_data.blocks && fs->refs[entry.block] && data[entry.block]) {
+            dedup_add(dedup, entry.block, entry.hash);
+        }
+    }
+    free(data);
+    fclose(stream);
+}
+
+// helper function to mark blocks pointed to as file data by the inode table or any snapshot
+void    dedup_mark(FileSystem *fs, bool *data) {
+    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+        dedup_mark_inodes(fs, i + 1, data);
+    }
+
+    for (uint32_t s = 0; s < SNAPSHOTS_MAX; ++s) {
+        uint32_t m = fs->meta_data.snapshots[s];
+        Block    map;
+        if (!m || m <= fs->meta_data.inode_blocks || m >= fs->meta_data.blocks ||
+            disk_read(fs->disk, m, map.data) == DISK_FAILURE) {
+            continue;
+        }
+
+        // inode blocks still shared with the live table were marked above
+        for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+            if (map.pointers[i] && map.pointers[i] < fs->meta_data.blocks) {
+                dedup_mark_inodes(fs, map.pointers[i], data);
+            }
+        }
+    }
+}
+
+// helper function to mark data blocks of the uncompressed inodes in an inode block
+void    dedup_mark_inodes(FileSystem *fs, size_t block, bool *data) {
+    Block inodeBlock;
+    if (disk_read(fs->disk, block, inodeBlock.data) == DISK_FAILURE) {
+        return;
+    }
+
+    uint32_t valid[INODES_PER_BLOCK];
+    size_t   nvalid = simd_nonzero(&inodeBlock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+    for (size_t v = 0; v < nvalid; ++v) {
+        Inode *inode = &inodeBlock.inodes[valid[v]];
+        if (inode->valid & INODE_COMPRESSED) {
+            continue;
+        }
+
+        for (uint32_t d = 0; d < POINTERS_PER_INODE; ++d) {
+            if (inode->direct[d] < fs->meta_data.blocks) {
+                data[inode->direct[d]] = true;
+            }
+        }
+
+        Block pointerBlock;
+        if (!inode->indirect || inode->indirect >= fs->meta_data.blocks ||
+            disk_read(fs->disk, inode->indirect, pointerBlock.data) == DISK_FAILURE) {
+            continue;
+        }
+        for (uint32_t p = 0; p < POINTERS_PER_BLOCK; ++p) {
+            if (pointerBlock.pointers[p] < fs->meta_data.blocks) {
+                data[pointerBlock.pointers[p]] = true;
+            }
+        }
+    }
+}
+
+// helper function to atomically write index file
+bool    dedup_save(Dedup *dedup) {
+    if (!dedup->path) {
+        return true;
+    }
+
+    char temp[BUFSIZ];
+    snprintf(temp, sizeof(temp), "%s.tmp", dedup->path);
+
+    FILE *stream = fopen(temp, "w");
+    if (!stream) {
+        fprintf(stderr, "fs_dedup: fopen: %s\n", strerror(errno));
+        return false;
+    }
+
+    DedupHeader header = {DEDUP_MAGIC, dedup->blocks, dedup->stats.entries};
+    bool written = fwrite(&header, sizeof(header), 1, stream) == 1;
+    for (size_t slot = 0; written && slot < dedup->capacity; slot++) {
+        if (dedup->table[slot].block) {
+            written = fwrite(&dedup->table[slot], sizeof(DedupEntry), 1, stream) == 1;
+        }
+    }
+
+    if (fclose(stream) != 0 || !written) {
+        fprintf(stderr, "fs_dedup: unable to write %s\n", temp);
+        unlink(temp);
+        return false;
+    }
+
+    if (rename(temp, dedup->path) < 0) {
+        fprintf(stderr, "fs_dedup: rename: %s\n", strerror(errno));
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+// helper function to round up to a power of two (at least 64)
+size_t  dedup_power(size_t n) {
+    size_t power = 64;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -1,14 +1,43 @@
 /* disk.c: SimpleFS disk emulator */
 
+#define _GNU_SOURCE                             /* copy_file_range */
+
 #include "sfs/disk.h"
+#include "sfs/crc32c.h"
 #include "sfs/logging.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
 
 #include <fcntl.h>
+#include <stddef.h>
 #include <unistd.h>
 
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/* linux/fs.h would clobber BLOCK_SIZE, so define the reflink ioctl here */
+
+#ifndef FICLONE
+#define FICLONE         _IOW(0x94, 9, int)
+#endif
+
 /* Internal Prototyes */
 
+Disk *  disk_allocate(size_t blocks);
 bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
+bool    disk_io(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, bool write);
+bool    disk_io_fd(int fd, off_t offset, struct iovec *vector, int iovcnt, bool write);
+bool    disk_overlay_load(Disk *disk);
+uint32_t disk_overlay_slot(Disk *disk, size_t block, bool *fresh);
+off_t   disk_overlay_offset(Disk *disk, uint32_t slot);
+bool    disk_clone_range(int src_fd, int dst_fd, off_t offset, off_t length);
+ssize_t disk_submit(Disk *disk, size_t block, size_t count, char *data, bool write);
+bool    disk_checksum_load(Disk *disk);
+bool    disk_checksum_build(Disk *disk);
+bool    disk_checksum_update(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, size_t count);
+bool    disk_checksum_verify(Disk *disk, size_t block, const struct iovec *iov, int iovcnt);
+bool    disk_track_load(Disk *disk);
+bool    disk_track_update(Disk *disk, size_t block, size_t count, uint64_t generation);
 
 /* External Functions */
 
@@ -33,12 +62,7 @@ bool    disk_sanity_check(Disk *disk, size_t blocknum, const char *data);
 Disk *	disk_open(const char *path, size_t blocks) {
 
     // allocate disk structure
-    Disk *disk = malloc(sizeof(Disk));
-    
-    //setting data
-    disk->blocks = blocks;
-    disk->reads = 0;
-    disk->writes = 0;
+    Disk *disk = disk_allocate(blocks);
 
     // opening file descriptor
     int fd = open(path, O_RDWR | O_CREAT, 0600);
@@ -61,6 +85,144 @@ Disk *	disk_open(const char *path, size_t blocks) {
     return disk;
 }
 
+/**
+ * Open a copy-on-write overlay disk over a read-only base image by doing the
+ * following:
+ *
+ *  1. Open the base image read-only (it must hold at least blocks blocks).
+ *
+ *  2. Open the delta file, creating it with an empty block index map if
+ *  needed, and load its map.
+ *
+ * Reads of blocks that were never written through the overlay fall through
+ * to the base image; writes go to the next free slot of the delta file and
+ * the slot is recorded in the map.  A new overlay costs one header write (the
+ * map starts out as a hole in the delta file), and every overlay of a base
+ * image shares its pages in the host page cache.
+ *
+ * @param       base        Path to base disk image (never written).
+ * @param       delta       Path to delta file of this overlay.
+ * @param       blocks      Number of blocks in disk.
+ *
+ * @return      Pointer to newly allocated and configured Disk structure (NULL
+ *              on failure).
+ **/
+Disk *	disk_overlay(const char *base, const char *delta, size_t blocks) {
+    int base_fd = open(base, O_RDONLY);
+    if (base_fd < 0) {
+        fprintf(stderr, "disk_overlay: open: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(base_fd, &st) < 0 || (size_t)st.st_size < blocks * BLOCK_SIZE) {
+        fprintf(stderr, "disk_overlay: %s is smaller than %lu blocks\n", base, blocks);
+        close(base_fd);
+        return NULL;
+    }
+
+    int fd = open(delta, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "disk_overlay: open: %s\n", strerror(errno));
+        close(base_fd);
+        return NULL;
+    }
+
+    Disk *disk    = disk_allocate(blocks);
+    disk->fd      = fd;
+    disk->base_fd = base_fd;
+    disk->overlay = calloc(max(blocks, 1), sizeof(uint32_t));
+    if (!disk->overlay || !disk_overlay_load(disk)) {
+        fprintf(stderr, "disk_overlay: %s is not an overlay of %lu blocks\n", delta, blocks);
+        disk_close(disk);
+        return NULL;
+    }
+
+    return disk;
+}
+
+/**
+ * Copy a disk image file (for a test or rollback) by doing the following:
+ *
+ *  1. Share all of its extents with a reflink (FICLONE) when the host file
+ *  system supports it.
+ *
+ *  2. Otherwise copy only its data extents (found with SEEK_DATA and
+ *  SEEK_HOLE), each with copy_file_range (which the host may turn into a
+ *  reflink or a server-side copy), or with read and write if that fails.
+ *
+ * Holes stay holes in the copy, so cloning a large, mostly empty image is
+ * fast even without reflinks.  The copy is only truncated once it is known
+ * not to be the image itself (the same path or a hard link to it).
+ *
+ * @param       src_path    Path to disk image to copy.
+ * @param       dst_path    Path to copy (replaced if it exists).
+ *
+ * @return      Whether or not the image was copied.
+ **/
+bool    disk_clone(const char *src_path, const char *dst_path) {
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd < 0) {
+        fprintf(stderr, "disk_clone: open: %s\n", strerror(errno));
+        return false;
+    }
+
+    int dst_fd = open(dst_path, O_WRONLY | O_CREAT, 0600);
+    if (dst_fd < 0) {
+        fprintf(stderr, "disk_clone: open: %s\n", strerror(errno));
+        close(src_fd);
+        return false;
+    }
+
+    struct stat st, dst_st;
+    if (fstat(src_fd, &st) < 0 || fstat(dst_fd, &dst_st) < 0) {
+        fprintf(stderr, "disk_clone: fstat: %s\n", strerror(errno));
+        close(dst_fd);
+        close(src_fd);
+        return false;
+    }
+    if (st.st_dev == dst_st.st_dev && st.st_ino == dst_st.st_ino) {
+        fprintf(stderr, "disk_clone: %s and %s are the same file\n", src_path, dst_path);
+        close(dst_fd);
+        close(src_fd);
+        return false;
+    }
+
+    bool success = ftruncate(dst_fd, 0) == 0;
+    if (success && ioctl(dst_fd, FICLONE, src_fd) != 0) {
+        // size first, so holes (including a trailing one) are never written
+        success = ftruncate(dst_fd, st.st_size) == 0;
+
+        off_t data = 0;
+        while (success && data < st.st_size) {
+            data = lseek(src_fd, data, SEEK_DATA);
+            if (data < 0) {
+                // no data left (ENXIO), or no hole support: copy the rest as data
+                if (errno != ENXIO) {
+                    success = disk_clone_range(src_fd, dst_fd, 0, st.st_size);
+                }
+                break;
+            }
+
+            off_t hole = lseek(src_fd, data, SEEK_HOLE);
+            if (hole < 0) {
+                hole = st.st_size;
+            }
+            success = disk_clone_range(src_fd, dst_fd, data, hole - data);
+            data    = hole;
+        }
+    }
+
+    if (!success) {
+        fprintf(stderr, "disk_clone: unable to copy %s: %s\n", src_path, strerror(errno));
+    }
+    if (close(dst_fd) < 0) {
+        success = false;
+    }
+    close(src_fd);
+    return success;
+}
+
 /**
  * Close disk structure by doing the following:
  *
@@ -68,7 +230,8 @@ Disk *	disk_open(const char *path, size_t blocks) {
  *
  *  2. Report number of disk reads and writes.
  *
- *  3. Release disk structure memory.
+ *  3. Release request queue, timing model, checksums and changed-block
+ *  tracking (if any) and disk structure memory.
  *
  * @param       disk        Pointer to Disk structure.
  */
@@ -88,7 +251,17 @@ void	disk_close(Disk *disk) {
     printf("\nwrites: %zu", disk->writes);
     */
 
-    // free disk
+    // close base image of overlay
+    if (disk->base_fd >= 0) {
+        close(disk->base_fd);
+    }
+
+    // free disk, its request queue, its timing model, its checksums, its tracking and its overlay map
+    free(disk->overlay);
+    queue_delete(disk->queue);
+    model_delete(disk->model);
+    disk_checksum(disk, NULL, false);
+    disk_track(disk, NULL);
     free(disk);
 }
 
@@ -98,9 +271,9 @@ void	disk_close(Disk *disk) {
  *
  *  1. Perform sanity check.
  *
- *  2. Seek to specified block.
+ *  2. Read from block offset to data buffer (must be BLOCK_SIZE).
  *
- *  3. Read from block to data buffer (must be BLOCK_SIZE).
+ *  3. Record operation statistics.
  *
  * @param       disk        Pointer to Disk structure.
  * @param       block       Block number to perform operation on.
@@ -110,81 +283,397 @@ void	disk_close(Disk *disk) {
  *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
  **/
 ssize_t disk_read(Disk *disk, size_t block, char *data) {
-    
-    // make sure disk exists
-    if (disk == NULL) {
-        return DISK_FAILURE;
+    StatsTimer timer  = stats_start();
+    ssize_t    result = disk_submit(disk, block, 1, data, false);
+    stats_stop(STATS_DISK_READ, &timer, result);
+    return result;
+}
+
+/**
+ * Write data to disk at specified block from data buffer by doing the
+ * following:
+ *
+ *  1. Perform sanity check.
+ *
+ *  2. Write data buffer (must be BLOCK_SIZE) to disk block offset.
+ *
+ *  3. Record operation statistics.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       Block number to perform operation on.
+ * @param       data        Data buffer.
+ *
+ * @return      Number of bytes written.
+ *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_write(Disk *disk, size_t block, char *data) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = disk_submit(disk, block, 1, data, true);
+    stats_stop(STATS_DISK_WRITE, &timer, result);
+    return result;
+}
+
+/**
+ * Read count contiguous blocks from disk starting at specified block into
+ * data buffer with a single request by doing the following:
+ *
+ *  1. Perform sanity check on first and last block.
+ *
+ *  2. Read from block offset to data buffer (must be count * BLOCK_SIZE).
+ *
+ *  3. Record operation statistics (as a single disk read).
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number to read.
+ * @param       count       Number of blocks to read.
+ * @param       data        Data buffer.
+ *
+ * @return      Number of bytes read.
+ *              (count * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_readv(Disk *disk, size_t block, size_t count, char *data) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = disk_submit(disk, block, count, data, false);
+    stats_stop(STATS_DISK_READ, &timer, result);
+    return result;
+}
+
+/**
+ * Pass access advice for count contiguous blocks starting at specified block
+ * down to the host file system holding the disk image.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number of range.
+ * @param       count       Number of blocks in range.
+ * @param       advice      Host advice (POSIX_FADV_*).
+ *
+ * @return      Whether or not the advice was accepted by the host.
+ **/
+bool    disk_advise(Disk *disk, size_t block, size_t count, int advice) {
+    if (disk == NULL || block + count > disk->blocks) {
+        return false;
     }
 
-    // do sanity check
-    if (!disk_sanity_check(disk, block, data)) {
-        return DISK_FAILURE;
+    // advice for an overlay goes to its base image, which holds most blocks
+    int fd     = disk->base_fd >= 0 ? disk->base_fd : disk->fd;
+    int status = posix_fadvise(fd, block * BLOCK_SIZE, count * BLOCK_SIZE, advice);
+    if (status != 0) {
+        fprintf(stderr, "disk_advise: posix_fadvise: %s\n", strerror(status));
+        return false;
     }
 
-    // look for the block
-    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-        fprintf(stderr, "disk_read: lseek: %s\n", strerror(errno));
-        return DISK_FAILURE;
+    return true;
+}
+
+/**
+ * Attach device timing model to disk (replacing and releasing any previous
+ * one), so every transfer also accrues simulated service time.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       model       Pointer to DiskModel structure (NULL to detach).
+ **/
+void    disk_model(Disk *disk, DiskModel *model) {
+    if (disk == NULL || disk->model == model) {
+        return;
     }
 
-    // read the block
-    if (read(disk->fd, data, BLOCK_SIZE) != BLOCK_SIZE) {
-        fprintf(stderr, "disk_read: unable to read: %s\n", strerror(errno));
-        return DISK_FAILURE;
+    model_delete(disk->model);
+    if (model) {
+        model->blocks = disk->blocks;
+        model_reset(model);
     }
+    disk->model = model;
+}
 
-    ++disk->reads;
+/**
+ * Attach request queue to disk (replacing and releasing any previous one),
+ * so reads and writes are dispatched by the queue's policy.  The disk must
+ * be idle while the queue is changed.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       queue       Pointer to DiskQueue structure (NULL to detach).
+ **/
+void    disk_queue(Disk *disk, DiskQueue *queue) {
+    if (disk == NULL || disk->queue == queue) {
+        return;
+    }
 
-    return BLOCK_SIZE;
+    queue_delete(disk->queue);
+    if (queue) {
+        queue->disk = disk;
+    }
+    disk->queue = queue;
 }
 
 /**
- * Write data to disk at specified block from data buffer by doing the
- * following:
+ * Attach CRC32C checksums kept in a sidecar file to disk (replacing any
+ * previous ones) by doing the following:
  *
- *  1. Perform sanity check.
+ *  1. Open the sidecar file, creating it if needed.
  *
- *  2. Seek to specified block.
+ *  2. Load its checksums if its header matches the disk, or (when rebuild is
+ *  set or the header does not match) checksum every block of the image and
+ *  write them out.
  *
- *  3. Write data buffer (must be BLOCK_SIZE) to disk block.
+ * Afterwards every write updates the checksums of its blocks and every read
+ * is verified against them: a block that fails fails the read.  The image
+ * must only be written through this disk while checksums are attached.  The
+ * disk must be idle while checksums are changed.
  *
  * @param       disk        Pointer to Disk structure.
- * @param       block       Block number to perform operation on.
- * @param       data        Data buffer.
+ * @param       path        Path to checksum sidecar file (NULL to detach).
+ * @param       rebuild     Whether to recompute checksums from the image.
  *
- * @return      Number of bytes written.
- *              (BLOCK_SIZE on success, DISK_FAILURE on failure).
+ * @return      Whether or not checksums were attached (or detached).
  **/
-ssize_t disk_write(Disk *disk, size_t block, char *data) {
+bool    disk_checksum(Disk *disk, const char *path, bool rebuild) {
+    if (disk == NULL) {
+        return false;
+    }
+
+    if (disk->checksum_fd >= 0) {
+        close(disk->checksum_fd);
+        disk->checksum_fd = -1;
+    }
+    free(disk->checksums);
+    disk->checksums = NULL;
+
+    if (path == NULL) {
+        return true;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "disk_checksum: open: %s\n", strerror(errno));
+        return false;
+    }
 
-    // make sure disk exists
+    disk->checksum_fd = fd;
+    disk->checksums   = calloc(max(disk->blocks, 1), sizeof(uint32_t));
+    if (!disk->checksums || !((!rebuild && disk_checksum_load(disk)) || disk_checksum_build(disk))) {
+        disk_checksum(disk, NULL, false);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Attach changed-block tracking kept in a sidecar file to disk (replacing
+ * any previous one) by doing the following:
+ *
+ *  1. Open the sidecar file, creating it if needed.
+ *
+ *  2. Load the generation of every block if its header matches the disk, or
+ *  start over at generation 1 (with no block changed).
+ *
+ * Afterwards every write records the current generation for its blocks,
+ * touching the sidecar file only the first time a block is written in a
+ * generation.  disk_checkpoint ends a generation, and disk_changed lists
+ * the blocks written since any earlier checkpoint, so an incremental backup
+ * reads only those.  The image must only be written through this disk while
+ * tracking is attached.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       path        Path to tracking sidecar file (NULL to detach).
+ *
+ * @return      Whether or not tracking was attached (or detached).
+ **/
+bool    disk_track(Disk *disk, const char *path) {
     if (disk == NULL) {
+        return false;
+    }
+
+    if (disk->track_fd >= 0) {
+        close(disk->track_fd);
+        disk->track_fd = -1;
+    }
+    free(disk->generations);
+    disk->generations = NULL;
+    disk->generation  = 0;
+
+    if (path == NULL) {
+        return true;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "disk_track: open: %s\n", strerror(errno));
+        return false;
+    }
+
+    disk->track_fd    = fd;
+    disk->generations = calloc(max(disk->blocks, 1), sizeof(uint64_t));
+    if (!disk->generations || !disk_track_load(disk)) {
+        disk_track(disk, NULL);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * End the current generation of changed-block tracking.
+ *
+ * Blocks written after this call are reported by disk_changed for the
+ * returned checkpoint.
+ *
+ * @param       disk        Pointer to Disk structure.
+ *
+ * @return      Checkpoint identifier (0 if tracking is not attached).
+ **/
+uint64_t disk_checkpoint(Disk *disk) {
+    if (disk == NULL || disk->generations == NULL) {
+        return 0;
+    }
+
+    uint64_t checkpoint = disk->generation;
+    uint64_t generation = checkpoint + 1;
+    if (pwrite(disk->track_fd, &generation, sizeof(generation), offsetof(DiskTrackHeader, generation)) != sizeof(generation)) {
+        fprintf(stderr, "disk_checkpoint: unable to write generation: %s\n", strerror(errno));
+        return 0;
+    }
+
+    __sync_synchronize();
+    disk->generation = generation;
+    return checkpoint;
+}
+
+/**
+ * List the blocks written since the specified checkpoint.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       checkpoint  Checkpoint identifier (0 for every block written
+ *                          since tracking started).
+ * @param       blocks      Array to fill with block numbers (disk->blocks
+ *                          entries, in increasing order).
+ *
+ * @return      Number of changed blocks (DISK_FAILURE if tracking is not
+ *              attached or the checkpoint was not taken on this image).
+ **/
+ssize_t disk_changed(Disk *disk, uint64_t checkpoint, uint32_t *blocks) {
+    if (disk == NULL || disk->generations == NULL || checkpoint >= disk->generation) {
         return DISK_FAILURE;
     }
 
-    // sanity check
-    if (!disk_sanity_check(disk, block, data)) {
+    size_t count = 0;
+    for (size_t block = 0; block < disk->blocks; block++) {
+        if (disk->generations[block] > checkpoint) {
+            blocks[count++] = block;
+        }
+    }
+    return count;
+}
+
+/**
+ * Transfer contiguous blocks between disk and a vector of data buffers with
+ * a single request by doing the following:
+ *
+ *  1. Perform sanity check on first and last block (every buffer must hold
+ *  whole blocks).
+ *
+ *  2. Read or write the whole range at its offset, retrying on short
+ *  transfers (an overlay maps each block to its delta slot or base image
+ *  block and transfers each contiguous run at once).
+ *
+ *  3. Update disk read or write counter (one per block).
+ *
+ *  4. Verify blocks read or update checksums of blocks written (if
+ *  checksums are attached).
+ *
+ *  5. Record the generation of blocks written (if changed-block tracking is
+ *  attached), both before the write (so a crash never hides a change) and
+ *  again if a checkpoint was taken while it ran.
+ *
+ *  6. Accrue simulated service time (if a timing model is attached).
+ *
+ * This bypasses the request queue (which uses it to issue merged requests)
+ * and operation statistics.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number to transfer.
+ * @param       iov         Data buffers (in block order).
+ * @param       iovcnt      Number of data buffers.
+ * @param       write       Whether to write (true) or read (false).
+ *
+ * @return      Number of bytes transferred.
+ *              (total buffer size on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_transferv(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, bool write) {
+
+    // make sure disk exists and buffers are valid
+    if (disk == NULL || iovcnt <= 0 || iovcnt > DISK_VECTOR_MAX) {
+        return DISK_FAILURE;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_base == NULL || iov[i].iov_len == 0 || iov[i].iov_len % BLOCK_SIZE) {
+            return DISK_FAILURE;
+        }
+        total += iov[i].iov_len;
+    }
+
+    size_t count = total / BLOCK_SIZE;
+    if (!disk_sanity_check(disk, block, iov[0].iov_base) ||
+        !disk_sanity_check(disk, block + count - 1, iov[0].iov_base)) {
         return DISK_FAILURE;
     }
 
-    // look for the block
-    if (lseek(disk->fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-        fprintf(stderr, "disk_write: lseek: %s\n", strerror(errno));
+    uint64_t generation = disk->generation;
+    if (write && disk->generations && !disk_track_update(disk, block, count, generation)) {
         return DISK_FAILURE;
     }
 
-    // write the block
-    if (write(disk->fd, data, BLOCK_SIZE) != BLOCK_SIZE) {
-        fprintf(stderr, "disk_write: unable to write: %s\n", strerror(errno));
+    if (!disk_io(disk, block, iov, iovcnt, write)) {
         return DISK_FAILURE;
     }
 
-    ++disk->writes;
-    return BLOCK_SIZE;
+    __sync_fetch_and_add(write ? &disk->writes : &disk->reads, count);
+    model_access(disk->model, block, count, write);
+
+    if (disk->checksums) {
+        if (write && !disk_checksum_update(disk, block, iov, iovcnt, count)) {
+            return DISK_FAILURE;
+        }
+        if (!write && !disk_checksum_verify(disk, block, iov, iovcnt)) {
+            return DISK_FAILURE;
+        }
+    }
+
+    __sync_synchronize();
+    if (write && disk->generations && disk->generation != generation &&
+        !disk_track_update(disk, block, count, disk->generation)) {
+        return DISK_FAILURE;
+    }
+    return total;
 }
 
 /* Internal Functions */
 
+// helper function to allocate and initialize disk structure (without a file)
+Disk *  disk_allocate(size_t blocks) {
+    Disk *disk = malloc(sizeof(Disk));
+
+    //setting data
+    disk->fd = -1;
+    disk->blocks = blocks;
+    disk->reads = 0;
+    disk->writes = 0;
+    disk->model = NULL;
+    disk->queue = NULL;
+    disk->checksum_fd = -1;
+    disk->checksums = NULL;
+    disk->corrupted = 0;
+    disk->track_fd = -1;
+    disk->generations = NULL;
+    disk->generation = 0;
+    disk->base_fd = -1;
+    disk->overlay = NULL;
+    disk->overlay_slots = 0;
+    return disk;
+}
+
 /**
  * Perform sanity check before read or write operation by doing the following:
  *
@@ -227,4 +716,323 @@ bool    disk_sanity_check(Disk *disk, size_t block, const char *data) {
     return true;
 }
 
+/**
+ * Submit transfer of count contiguous blocks between disk and data buffer by
+ * doing the following:
+ *
+ *  1. Perform sanity check on first and last block.
+ *
+ *  2. Pass the request to the request queue (if any) and wait for it, or
+ *  issue it directly.
+ *
+ * @param       disk        Pointer to Disk structure.
+ * @param       block       First block number to transfer.
+ * @param       count       Number of blocks to transfer.
+ * @param       data        Data buffer (must be count * BLOCK_SIZE).
+ * @param       write       Whether to write (true) or read (false).
+ *
+ * @return      Number of bytes transferred.
+ *              (count * BLOCK_SIZE on success, DISK_FAILURE on failure).
+ **/
+ssize_t disk_submit(Disk *disk, size_t block, size_t count, char *data, bool write) {
+
+    // make sure disk exists and range is valid
+    if (disk == NULL || count == 0) {
+        return DISK_FAILURE;
+    }
+
+    if (!disk_sanity_check(disk, block, data) ||
+        !disk_sanity_check(disk, block + count - 1, data)) {
+        return DISK_FAILURE;
+    }
+
+    if (disk->queue) {
+        return queue_transfer(disk->queue, block, count, data, write);
+    }
+
+    struct iovec iov = {data, count * BLOCK_SIZE};
+    return disk_transferv(disk, block, &iov, 1, write);
+}
+
+// helper function to load checksums from sidecar file if it matches disk
+bool    disk_checksum_load(Disk *disk) {
+    DiskChecksumHeader header;
+    size_t             size = disk->blocks * sizeof(uint32_t);
+
+    return pread(disk->checksum_fd, &header, sizeof(header), 0) == sizeof(header) &&
+           header.magic == DISK_CHECKSUM_MAGIC && header.version == DISK_CHECKSUM_VERSION &&
+           header.blocks == disk->blocks &&
+           pread(disk->checksum_fd, disk->checksums, size, sizeof(header)) == (ssize_t)size;
+}
+
+// helper function to checksum every block of image and rewrite sidecar file
+bool    disk_checksum_build(Disk *disk) {
+    size_t  chunk  = 256;
+    char   *buffer = malloc(chunk * BLOCK_SIZE);
+    bool    success = buffer != NULL;
+
+    for (size_t block = 0; success && block < disk->blocks; block += chunk) {
+        size_t  count  = min(chunk, disk->blocks - block);
+        success = disk_io(disk, block, &(struct iovec){buffer, count * BLOCK_SIZE}, 1, false);
+        for (size_t b = 0; success && b < count; b++) {
+            disk->checksums[block + b] = crc32c(0, buffer + b * BLOCK_SIZE, BLOCK_SIZE);
+        }
+    }
+    free(buffer);
+
+    DiskChecksumHeader header = {DISK_CHECKSUM_MAGIC, DISK_CHECKSUM_VERSION, disk->blocks};
+    size_t             size   = disk->blocks * sizeof(uint32_t);
+    success = success &&
+              ftruncate(disk->checksum_fd, 0) == 0 &&
+              pwrite(disk->checksum_fd, &header, sizeof(header), 0) == sizeof(header) &&
+              pwrite(disk->checksum_fd, disk->checksums, size, sizeof(header)) == (ssize_t)size;
+    if (!success) {
+        fprintf(stderr, "disk_checksum: unable to build checksums: %s\n", strerror(errno));
+    }
+    return success;
+}
+
+// helper function to record checksums of blocks just written
+bool    disk_checksum_update(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, size_t count) {
+    size_t b = block;
+    for (int i = 0; i < iovcnt; i++) {
+        for (size_t offset = 0; offset < iov[i].iov_len; offset += BLOCK_SIZE, b++) {
+            disk->checksums[b] = crc32c(0, (char *)iov[i].iov_base + offset, BLOCK_SIZE);
+        }
+    }
+
+    size_t size = count * sizeof(uint32_t);
+    if (pwrite(disk->checksum_fd, disk->checksums + block, size,
+               sizeof(DiskChecksumHeader) + block * sizeof(uint32_t)) != (ssize_t)size) {
+        fprintf(stderr, "disk_write: unable to write checksums: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// helper function to check blocks just read against their checksums
+bool    disk_checksum_verify(Disk *disk, size_t block, const struct iovec *iov, int iovcnt) {
+    size_t b = block;
+    bool   valid = true;
+    for (int i = 0; i < iovcnt; i++) {
+        for (size_t offset = 0; offset < iov[i].iov_len; offset += BLOCK_SIZE, b++) {
+            if (crc32c(0, (char *)iov[i].iov_base + offset, BLOCK_SIZE) != disk->checksums[b]) {
+                fprintf(stderr, "disk_read: block %lu failed checksum verification\n", b);
+                __sync_fetch_and_add(&disk->corrupted, 1);
+                valid = false;
+            }
+        }
+    }
+    return valid;
+}
+
+// helper function to transfer contiguous blocks of the image (through the overlay map, if any)
+bool    disk_io(Disk *disk, size_t block, const struct iovec *iov, int iovcnt, bool write) {
+    if (!disk->overlay) {
+        struct iovec vector[iovcnt];
+        memcpy(vector, iov, iovcnt * sizeof(struct iovec));
+        return disk_io_fd(disk->fd, block * BLOCK_SIZE, vector, iovcnt, write);
+    }
+
+    // gather each run of blocks that are contiguous in the same file
+    struct iovec run[DISK_VECTOR_MAX];
+    int          runcnt = 0;
+    int          run_fd = -1;
+    off_t        run_offset = 0, next_offset = 0;
+    bool         fresh = false;
+    size_t       b = block;
+
+    for (int i = 0; i < iovcnt; i++) {
+        for (size_t offset = 0; offset < iov[i].iov_len; offset += BLOCK_SIZE, b++) {
+            int   fd;
+            off_t position;
+            if (write || disk->overlay[b]) {
+                fd       = disk->fd;
+                position = disk_overlay_offset(disk, write ? disk_overlay_slot(disk, b, &fresh) : disk->overlay[b] - 1);
+            } else {
+                fd       = disk->base_fd;
+                position = b * BLOCK_SIZE;
+            }
+
+            if (runcnt && (fd != run_fd || position != next_offset || runcnt == DISK_VECTOR_MAX)) {
+                if (!disk_io_fd(run_fd, run_offset, run, runcnt, write)) {
+                    return false;
+                }
+                runcnt = 0;
+            }
+            if (!runcnt) {
+                run_fd     = fd;
+                run_offset = position;
+            }
+            run[runcnt++] = (struct iovec){(char *)iov[i].iov_base + offset, BLOCK_SIZE};
+            next_offset   = position + BLOCK_SIZE;
+        }
+    }
+    if (runcnt && !disk_io_fd(run_fd, run_offset, run, runcnt, write)) {
+        return false;
+    }
+
+    // record new slots only after their data is written
+    size_t size = (b - block) * sizeof(uint32_t);
+    if (fresh && pwrite(disk->fd, disk->overlay + block, size,
+                        sizeof(DiskOverlayHeader) + block * sizeof(uint32_t)) != (ssize_t)size) {
+        fprintf(stderr, "disk_write: unable to write overlay map: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// helper function to transfer a vector at offset of fd, retrying on short transfers
+bool    disk_io_fd(int fd, off_t offset, struct iovec *vector, int iovcnt, bool write) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += vector[i].iov_len;
+    }
+
+    size_t done  = 0;
+    int    first = 0;
+    while (done < total) {
+        ssize_t result;
+        if (write) {
+            result = pwritev(fd, vector + first, iovcnt - first, offset + done);
+        } else {
+            result = preadv(fd, vector + first, iovcnt - first, offset + done);
+        }
+
+        if (result <= 0) {
+            fprintf(stderr, "disk_%s: unable to %s: %s\n",
+                write ? "write" : "read", write ? "write" : "read", strerror(errno));
+            return false;
+        }
+        done += result;
+
+        // skip buffers that were completed and trim a partially completed one
+        while (result > 0 && (size_t)result >= vector[first].iov_len) {
+            result -= vector[first++].iov_len;
+        }
+        if (result > 0) {
+            vector[first].iov_base = (char *)vector[first].iov_base + result;
+            vector[first].iov_len -= result;
+        }
+    }
+    return true;
+}
+
+// helper function to copy a byte range between files (in the kernel when possible)
+bool    disk_clone_range(int src_fd, int dst_fd, off_t offset, off_t length) {
+    off_t end = offset + length;
+
+    while (offset < end) {
+        loff_t  src_offset = offset, dst_offset = offset;
+        ssize_t result     = copy_file_range(src_fd, &src_offset, dst_fd, &dst_offset, end - offset, 0);
+        if (result <= 0) {
+            break;
+        }
+        offset += result;
+    }
+
+    char buffer[16 * BLOCK_SIZE];
+    while (offset < end) {
+        ssize_t result = pread(src_fd, buffer, min(sizeof(buffer), (size_t)(end - offset)), offset);
+        if (result <= 0 || pwrite(dst_fd, buffer, result, offset) != result) {
+            return false;
+        }
+        offset += result;
+    }
+    return true;
+}
+
+// helper function to load overlay map from delta file (writing the header of a new one)
+bool    disk_overlay_load(Disk *disk) {
+    DiskOverlayHeader header;
+    size_t            size = disk->blocks * sizeof(uint32_t);
+    ssize_t           result = pread(disk->fd, &header, sizeof(header), 0);
+
+    if (result == 0) {
+        header = (DiskOverlayHeader){DISK_OVERLAY_MAGIC, DISK_OVERLAY_VERSION, disk->blocks};
+        return pwrite(disk->fd, &header, sizeof(header), 0) == sizeof(header) &&
+               ftruncate(disk->fd, disk_overlay_offset(disk, 0)) == 0;
+    }
+
+    if (result != sizeof(header) ||
+        header.magic != DISK_OVERLAY_MAGIC || header.version != DISK_OVERLAY_VERSION ||
+        header.blocks != disk->blocks ||
+        pread(disk->fd, disk->overlay, size, sizeof(header)) != (ssize_t)size) {
+        return false;
+    }
+
+    for (size_t b = 0; b < disk->blocks; b++) {
+        disk->overlay_slots = max(disk->overlay_slots, disk->overlay[b]);
+    }
+    return true;
+}
+
+// helper function to find (or allocate) the delta slot of a block
+uint32_t disk_overlay_slot(Disk *disk, size_t block, bool *fresh) {
+    if (disk->overlay[block]) {
+        return disk->overlay[block] - 1;
+    }
+
+    // a concurrent writer of the same block may win (and its slot is used)
+    uint32_t slot = __sync_fetch_and_add(&disk->overlay_slots, 1);
+    if (__sync_bool_compare_and_swap(&disk->overlay[block], 0, slot + 1)) {
+        *fresh = true;
+    }
+    return disk->overlay[block] - 1;
+}
+
+// helper function to compute offset of a slot in delta file (after header and map)
+off_t   disk_overlay_offset(Disk *disk, uint32_t slot) {
+    size_t map = sizeof(DiskOverlayHeader) + disk->blocks * sizeof(uint32_t);
+    return (map + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE + (off_t)slot * BLOCK_SIZE;
+}
+
+// helper function to load block generations from sidecar file (or start over if it does not match disk)
+bool    disk_track_load(Disk *disk) {
+    DiskTrackHeader header;
+    size_t          size = disk->blocks * sizeof(uint64_t);
+
+    if (pread(disk->track_fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == DISK_TRACK_MAGIC && header.version == DISK_TRACK_VERSION &&
+        header.blocks == disk->blocks && header.generation > 0 &&
+        pread(disk->track_fd, disk->generations, size, sizeof(header)) == (ssize_t)size) {
+        disk->generation = header.generation;
+        return true;
+    }
+
+    header = (DiskTrackHeader){DISK_TRACK_MAGIC, DISK_TRACK_VERSION, disk->blocks, 1};
+    memset(disk->generations, 0, size);
+    if (ftruncate(disk->track_fd, 0) != 0 ||
+        pwrite(disk->track_fd, &header, sizeof(header), 0) != sizeof(header) ||
+        pwrite(disk->track_fd, disk->generations, size, sizeof(header)) != (ssize_t)size) {
+        fprintf(stderr, "disk_track: unable to write generations: %s\n", strerror(errno));
+        return false;
+    }
+    disk->generation = header.generation;
+    return true;
+}
+
+// helper function to record generation of blocks about to be written (sidecar only touched on change)
+bool    disk_track_update(Disk *disk, size_t block, size_t count, uint64_t generation) {
+    size_t first = block + count, last = block;
+    for (size_t b = block; b < block + count; b++) {
+        if (disk->generations[b] != generation) {
+            disk->generations[b] = generation;
+            first = min(first, b);
+            last  = b;
+        }
+    }
+    if (first > last) {
+        return true;
+    }
+
+    size_t size = (last + 1 - first) * sizeof(uint64_t);
+    if (pwrite(disk->track_fd, disk->generations + first, size,
+               sizeof(DiskTrackHeader) + first * sizeof(uint64_t)) != (ssize_t)size) {
+        fprintf(stderr, "disk_write: unable to write generations: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
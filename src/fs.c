@@ -2,21 +2,64 @@
 
 #include "sfs/fs.h"
 #include "sfs/logging.h"
+#include "sfs/record.h"
+#include "sfs/simd.h"
+#include "sfs/stats.h"
 #include "sfs/utils.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 
 /* Internal Prototypes */
 
+bool    fs_do_format(FileSystem *fs, Disk *disk);
+bool    fs_do_mount(FileSystem *fs, Disk *disk);
+ssize_t fs_do_create(FileSystem *fs);
+bool    fs_do_remove(FileSystem *fs, size_t inode_number);
+ssize_t fs_do_stat(FileSystem *fs, size_t inode_number);
+ssize_t fs_do_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
+ssize_t fs_do_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset);
+bool    fs_do_advise(FileSystem *fs, size_t inode_number, size_t offset, size_t length, int advice);
+bool    fs_do_compress(FileSystem *fs, size_t inode_number);
+ssize_t fs_do_clone(FileSystem *fs, size_t inode_number);
+ssize_t fs_do_snapshot(FileSystem *fs);
+bool    fs_do_snapshot_delete(FileSystem *fs, size_t snapshot);
+bool    fs_do_snapshot_mount(FileSystem *fs, Disk *disk, size_t snapshot);
+void    fs_do_unmount(FileSystem *fs);
+
 void    fs_initialize_free_block_bitmap(FileSystem *fs);
 ssize_t fs_allocate_free_block(FileSystem *fs);
+ssize_t fs_allocate_free_run(FileSystem *fs, size_t count);
+void    fs_mark_block(FileSystem *fs, size_t block, bool free);
+void    fs_reference(FileSystem *fs, uint32_t *pointers, size_t count);
+void    fs_release(FileSystem *fs, uint32_t *pointers, size_t count);
+bool    fs_release_block(FileSystem *fs, size_t block);
+void    fs_release_map(FileSystem *fs, Inode *inode);
+void    fs_reference_inode(FileSystem *fs, Inode *inode);
+ssize_t fs_allocate_inode(FileSystem *fs, Inode *node);
+ssize_t fs_read_inode_block(FileSystem *fs, size_t index, char *data);
+bool    fs_save_super(FileSystem *fs);
+void    fs_snapshot_scan(FileSystem *fs, bool reference);
+bool    fs_snapshot_preserve(FileSystem *fs, size_t index);
 void    disk_clear_data(Disk *disk);
 void    block_clear_data(Block *block);
 
 bool    fs_load_inode(FileSystem *fs, size_t inode_number, Inode *node);
 bool    fs_save_inode(FileSystem *fs, size_t inode_number, Inode *node);
 
+ssize_t fs_read_block(FileSystem *fs, size_t block, int class, char *data);
+ssize_t fs_read_data_block(FileSystem *fs, size_t inode_number, size_t block, char *data);
+ssize_t fs_write_block(FileSystem *fs, size_t block, int class, char *data);
+
+ssize_t fs_cluster_read(FileSystem *fs, size_t inode_number, Inode *inode, char *data, size_t length, size_t offset);
+ssize_t fs_cluster_write(FileSystem *fs, size_t inode_number, Inode *inode, char *data, size_t length, size_t offset);
+bool    fs_cluster_fetch(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data);
+bool    fs_cluster_load(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data);
+bool    fs_cluster_store(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data, size_t length);
+bool    fs_cluster_check(FileSystem *fs, Cluster *cluster);
+void    fs_cluster_forget(FileSystem *fs, size_t inode_number);
+
 /* External Functions */
 
 /**
@@ -42,6 +85,11 @@ void    fs_debug(Disk *disk) {
     printf("    %u blocks\n"         , block.super.blocks);
     printf("    %u inode blocks\n"   , block.super.inode_blocks);
     printf("    %u inodes"         , block.super.inodes);
+    for (uint32_t s = 0; s < SNAPSHOTS_MAX; ++s) {
+        if (block.super.snapshots[s]) {
+            printf("\n    snapshot %u: inode table map %u", s, block.super.snapshots[s]);
+        }
+    }
 
     /* Read Inodes */
     Block iblock;
@@ -51,38 +99,63 @@ void    fs_debug(Disk *disk) {
         // read inode block
         disk_read(disk, i+1, iblock.data);
 
-        // loop through inodes in inode block
-        for (uint32_t j = 0; j < INODES_PER_BLOCK; ++j) {
+        // loop through the valid inodes in inode block
+        uint32_t valid[INODES_PER_BLOCK];
+        size_t   nvalid = simd_nonzero(&iblock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        for (size_t v = 0; v < nvalid; ++v) {
+            uint32_t j = valid[v];
             Inode inode = iblock.inodes[j];
-            if (inode.valid) {
-                printf("\n");
-                printf("Inode %u:\n", (i * INODES_PER_BLOCK) + j);
-                printf("    size: %u bytes\n", inode.size);
-                printf("    direct blocks:");
-            
-
-                // loop through direct pointers
-                for (uint32_t k = 0; k < POINTERS_PER_INODE; ++k) {
-                    //printf("\nk = %u\n", k);
-                    if (inode.direct[k]) {
-                        printf(" %lu", (unsigned long)(inode.direct[k]));
-                    }
-                }
-                if (inode.indirect) { 
-                    printf("\n");
-                    printf("    indirect block: %lu\n", (unsigned long)(inode.indirect));
-                    printf("    indirect data blocks:");
-
-                    Block inblock;
-                    disk_read(disk, inode.indirect, inblock.data);
-                    // loop through indirect pointers
-                    for (uint32_t a = 0; a < POINTERS_PER_BLOCK; ++a) {
-                        if (inblock.pointers[a]){
-                            printf(" %d",(inblock.pointers[a]));
+            printf("\n");
+            printf("Inode %u:\n", (i * INODES_PER_BLOCK) + j);
+            printf("    size: %u bytes\n", inode.size);
+
+            if (inode.valid & INODE_COMPRESSED) {
+                printf("    cluster table: %lu\n", (unsigned long)(inode.indirect));
+                printf("    compressed clusters:");
+
+                Block table;
+                if (inode.indirect && disk_read(disk, inode.indirect, table.data) != DISK_FAILURE) {
+                    for (uint32_t c = 0; c < CLUSTERS_PER_BLOCK; ++c) {
+                        Cluster *cluster = &table.clusters[c];
+                        if (cluster->start) {
+                            printf(" %u-%u%s", cluster->start, cluster->start + cluster->blocks - 1,
+                                (cluster->flags & CLUSTER_RAW) ? "(raw)" : "");
                         }
                     }
+                }
+                continue;
+            }
+
+            printf("    direct blocks:");
+        
 
+            // loop through direct pointers
+            for (uint32_t k = 0; k < POINTERS_PER_INODE; ++k) {
+                //printf("\nk = %u\n", k);
+                if (inode.direct[k] == HOLE_BLOCK) {
+                    printf(" hole");
+                } else if (inode.direct[k]) {
+                    printf(" %lu", (unsigned long)(inode.direct[k]));
+                }
+            }
+            if (inode.indirect) { 
+                printf("\n");
+                printf("    indirect block: %lu\n", (unsigned long)(inode.indirect));
+                printf("    indirect data blocks:");
+
+                Block inblock;
+                disk_read(disk, inode.indirect, inblock.data);
+                // loop through nonzero indirect pointers
+                uint32_t used[POINTERS_PER_BLOCK];
+                size_t   nused = simd_nonzero(inblock.pointers, POINTERS_PER_BLOCK, 1, used);
+                for (size_t a = 0; a < nused; ++a) {
+                    if (inblock.pointers[used[a]] == HOLE_BLOCK) {
+                        printf(" hole");
+                    } else {
+                        printf(" %d",(inblock.pointers[used[a]]));
+                    }
                 }
+
             }
         }
     }
@@ -104,6 +177,14 @@ void    fs_debug(Disk *disk) {
  * @return      Whether or not all disk operations were successful.
  **/
 bool    fs_format(FileSystem *fs, Disk *disk) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_format(fs, disk);
+    record_op(RECORD_FORMAT, &timer, 0, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
+
+// helper function to format disk
+bool    fs_do_format(FileSystem *fs, Disk *disk) {
     // make sure not already mounted
     if (fs->disk == disk) {
         return false;
@@ -146,7 +227,13 @@ bool    fs_format(FileSystem *fs, Disk *disk) {
  *
  *  3. Copy SuperBlock to FileSystem meta data attribute
  *
- *  4. Initialize FileSystem free blocks bitmap.
+ *  4. Initialize FileSystem free blocks bitmap and count the references to
+ *  each data block (including those of snapshots).
+ *
+ *  5. Allocate block cache and readahead state.
+ *
+ *  6. Start prefetching the recorded hot block set in the background (if a
+ *  warm-up sidecar file is configured).
  *
  * Note: Do not mount a Disk that has already been mounted!
  *
@@ -155,6 +242,15 @@ bool    fs_format(FileSystem *fs, Disk *disk) {
  * @return      Whether or not the mount operation was successful.
  **/
 bool    fs_mount(FileSystem *fs, Disk *disk) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_mount(fs, disk);
+    stats_stop(STATS_MOUNT, &timer, result ? 0 : -1);
+    record_op(RECORD_MOUNT, &timer, 0, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
+
+// helper function to mount file system
+bool    fs_do_mount(FileSystem *fs, Disk *disk) {
    // make sure not already mounted
     if (fs->disk == disk) {
         return false;
@@ -199,47 +295,45 @@ bool    fs_mount(FileSystem *fs, Disk *disk) {
     fs->meta_data.blocks = superBlock.super.blocks;
     fs->meta_data.inode_blocks = superBlock.super.inode_blocks;
     fs->meta_data.inodes = superBlock.super.inodes;
+    memcpy(fs->meta_data.snapshots, superBlock.super.snapshots, sizeof(fs->meta_data.snapshots));
+    fs->snapshot = 0;
 
     // initalize free blocks bitmap
     fs->free_blocks = malloc(fs->meta_data.blocks * sizeof(bool));
     fs_initialize_free_block_bitmap(fs); 
+
+    // reference counts of data blocks are rebuilt from the block maps
+    fs->refs = calloc(fs->meta_data.blocks, sizeof(uint32_t));
+    fs->frozen = calloc(fs->meta_data.inode_blocks, sizeof(bool));
+
+    // allocate block cache and readahead state
+    fs->cache     = cache_create(min(CACHE_BLOCKS, fs->meta_data.blocks));
+    fs->readahead = readahead_create(fs->meta_data.inode_blocks * INODES_PER_BLOCK);
+    fs->clusters  = calloc(1, sizeof(ClusterCache));
+    cache_insert(fs->cache, 0, CACHE_SUPER, superBlock.data);
     
-    // mark inodes, the direct blocks, the indirect blocks, and the pointers in the indirect blocks
+    // mark and count the direct blocks, the indirect blocks, and the pointers in the indirect blocks
     Block inodeBlock;
+    fs->free_inodes = fs->meta_data.inode_blocks * INODES_PER_BLOCK;
     for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
         
-        disk_read(disk, i+1, inodeBlock.data);
-
-        // loop through inodes in the inode block
-        for (uint32_t j = 0; j < INODES_PER_BLOCK; ++j) {
-            Inode inode = inodeBlock.inodes[j];
-            
-            // check if valid
-            if (inode.valid) {
-                    
-                // loop through direct pointers
-                for (uint32_t k = 0; k < POINTERS_PER_INODE; ++k) {
-                    if (inode.direct[k]) {
-                        fs->free_blocks[inode.direct[k]] = false;
-                    }
-                }
-
-                // check indirect pointer
-                if (inode.indirect) {
-                    fs->free_blocks[inode.indirect] = false;
+        fs_read_block(fs, i+1, CACHE_INODE, inodeBlock.data);
+
+        // loop through the valid inodes in the inode block
+        uint32_t valid[INODES_PER_BLOCK];
+        size_t   nvalid = simd_nonzero(&inodeBlock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        fs->free_inodes -= nvalid;
+        for (size_t v = 0; v < nvalid; ++v) {
+            fs_reference_inode(fs, &inodeBlock.inodes[valid[v]]);
+        }
+    }
 
-                    Block pointerBlock;
-                    disk_read(disk, inode.indirect, pointerBlock.data);
+    // count the references of every snapshot (and find inode blocks they still share)
+    fs_snapshot_scan(fs, true);
 
-                    // loop through indirect block
-                    for (uint32_t a = 0; a < POINTERS_PER_BLOCK; ++a) {
-                        if (pointerBlock.pointers[a]) {
-                            fs->free_blocks[pointerBlock.pointers[a]] = false;
-                        }
-                    }
-                }
-            }
-        }
+    // warm the cache with blocks that were hot before the last unmount
+    if (fs->warmup_path) {
+        fs_warmup_load(fs, fs->warmup_path, true);
     }
 
     return true;
@@ -249,18 +343,51 @@ bool    fs_mount(FileSystem *fs, Disk *disk) {
 /**
  * Unmount FileSystem from internal Disk by doing the following:
  *
- *  1. Set FileSystem disk attribute.
+ *  1. Stop periodic metrics export, scrubbing, deduplication and background
+ *  warm-up.
+ *
+ *  2. Set FileSystem disk attribute.
+ *
+ *  3. Release free blocks bitmap and block reference counts.
+ *
+ *  4. Record hot block set (if a warm-up sidecar file is configured).
  *
- *  2. Release free blocks bitmap.
+ *  5. Release block cache, readahead state and decompressed cluster.
  *
  * @param       fs      Pointer to FileSystem structure.
  **/
 void    fs_unmount(FileSystem *fs) {
+    StatsTimer timer = stats_start();
+    fs_do_unmount(fs);
+    record_op(RECORD_UNMOUNT, &timer, 0, 0, 0, 0, 0);
+}
+
+// helper function to unmount file system
+void    fs_do_unmount(FileSystem *fs) {
+    fs_metrics_stop(fs);
+    fs_scrub_stop(fs);
+    fs_dedup_stop(fs);
+    fs_warmup_wait(fs);
+    if (fs->warmup_path && fs->cache) {
+        fs_warmup_save(fs, fs->warmup_path);
+    }
+
     fs->disk = NULL;
     //fprintf(stderr, "\ndisk = NULL\n");
     free(fs->free_blocks);
     fs->free_blocks = NULL;
     //fprintf(stderr, "\nfree_blocks freed\n");
+    free(fs->refs);
+    fs->refs = NULL;
+    free(fs->frozen);
+    fs->frozen = NULL;
+    fs->snapshot = 0;
+    cache_delete(fs->cache);
+    fs->cache = NULL;
+    readahead_delete(fs->readahead);
+    fs->readahead = NULL;
+    free(fs->clusters);
+    fs->clusters = NULL;
 }
 
 /**
@@ -276,6 +403,27 @@ void    fs_unmount(FileSystem *fs) {
  * @return      Inode number of allocated Inode.
  **/
 ssize_t fs_create(FileSystem *fs) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_create(fs);
+    stats_stop(STATS_CREATE, &timer, result);
+    record_op(RECORD_CREATE, &timer, 0, 0, 0, 0, result);
+    return result;
+}
+
+// helper function to allocate inode
+ssize_t fs_do_create(FileSystem *fs) {
+    Inode node = {.valid = INODE_VALID};
+
+    // snapshots are read-only
+    if (fs->snapshot) {
+        return -1;
+    }
+
+    return fs_allocate_inode(fs, &node);
+}
+
+// helper function to store node in the first free inode (a single inode block write)
+ssize_t fs_allocate_inode(FileSystem *fs, Inode *node) {
 
     Block block;
 
@@ -283,33 +431,41 @@ ssize_t fs_create(FileSystem *fs) {
     for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
 
         // read current inode block into block
-        disk_read(fs->disk, i+1, block.data);
-
-        // loop through inodes in the current inode block
-        for (uint32_t j = 0; j < INODES_PER_BLOCK; ++j) {
+        fs_read_block(fs, i+1, CACHE_INODE, block.data);
+
+        // the first free inode is the first gap in the (sorted) valid inodes
+        uint32_t valid[INODES_PER_BLOCK];
+        size_t   nvalid = simd_nonzero(&block.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        uint32_t j = 0;
+        while (j < nvalid && valid[j] == j) {
+            ++j;
+        }
 
-            int base = i * INODES_PER_BLOCK;
-            int offset = j;
+        int base = i * INODES_PER_BLOCK;
+        int offset = j;
 
-            // find free inode in current inode block and create inode
-            if (!block.inodes[j].valid) {
+        // create inode if current inode block has a free one
+        if (j < INODES_PER_BLOCK) {
+            if (!fs_snapshot_preserve(fs, i)) {
+                return -1;
+            }
 
-                /*    
-                // lets see if this helps
-                block.inodes[j].size = 0;
-                for (uint32_t k; k < POINTERS_PER_INODE; ++k) {
-                    block.inodes[j].direct[k] = 0;
-                }
-                block.inodes[j].indirect = 0;
-                */
+            /*    
+            // lets see if this helps
+            block.inodes[j].size = 0;
+            for (uint32_t k; k < POINTERS_PER_INODE; ++k) {
+                block.inodes[j].direct[k] = 0;
+            }
+            block.inodes[j].indirect = 0;
+            */
 
-                block.inodes[j].valid = 1;
+            block.inodes[j] = *node;
 
-                disk_write(fs->disk, i+1, block.data);
+            fs_write_block(fs, i+1, CACHE_INODE, block.data);
+            __sync_fetch_and_sub(&fs->free_inodes, 1);
 
-                // return the created inode block number
-                return (base + offset);
-            }
+            // return the created inode block number
+            return (base + offset);
         }
     }
 
@@ -332,48 +488,41 @@ ssize_t fs_create(FileSystem *fs) {
  * @return      Whether or not removing the specified Inode was successful.
  **/
 bool    fs_remove(FileSystem *fs, size_t inode_number) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_remove(fs, inode_number);
+    stats_stop(STATS_REMOVE, &timer, result ? 0 : -1);
+    record_op(RECORD_REMOVE, &timer, inode_number, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
+
+// helper function to remove inode
+bool    fs_do_remove(FileSystem *fs, size_t inode_number) {
 
-    // sanity check
-    if (!fs) {
-        fprintf(stderr, "No fs");
+    // sanity check (snapshots are read-only)
+    if (!fs || fs->snapshot) {
         return false;
     }
 
     // load inode information
     Inode remove_inode;
     if (!fs_load_inode(fs, inode_number, &remove_inode)) {
-        fprintf(stderr, "load inode error\n");
         return false;
     }
+    trace_info(TRACE_INODE_REMOVE, inode_number, 0);
 
-    remove_inode.valid = false;
-    remove_inode.size = 0;
-
-    // free direct blocks
-    for (uint32_t i = 0; i < POINTERS_PER_INODE; i++) {
-        if (remove_inode.direct[i] != 0) {
-            fs->free_blocks[remove_inode.direct[i]] = true;
-        }
-        remove_inode.direct[i] = 0;
-    }
+    // release direct, indirect and cluster blocks (shared blocks are freed with their last reference)
+    fs_release_map(fs, &remove_inode);
+    fs_cluster_forget(fs, inode_number);
 
-    // free indirect blocks
-    if (remove_inode.indirect) {
-        Block pointerBlock;
-        disk_read(fs->disk, remove_inode.indirect, pointerBlock.data);
+    remove_inode.valid = false;
 
-        for (uint32_t i = 0; i < POINTERS_PER_BLOCK; i++) {
-            if (pointerBlock.pointers[i] != 0) {
-                fs->free_blocks[pointerBlock.pointers[i]] = true;
-            }
-        }
+    readahead_forget(fs, inode_number);
 
-        fs->free_blocks[remove_inode.indirect] = true;
+    if (!fs_save_inode(fs, inode_number, &remove_inode)) {
+        return false;
     }
-
-    remove_inode.indirect = 0;
-
-    return (fs_save_inode(fs, inode_number, &remove_inode));
+    __sync_fetch_and_add(&fs->free_inodes, 1);
+    return true;
 }
 
 /**
@@ -384,11 +533,19 @@ bool    fs_remove(FileSystem *fs, size_t inode_number) {
  * @return      Size of specified Inode (-1 if does not exist).
  **/
 ssize_t fs_stat(FileSystem *fs, size_t inode_number) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_stat(fs, inode_number);
+    stats_stop(STATS_STAT, &timer, result);
+    record_op(RECORD_STAT, &timer, inode_number, 0, 0, 0, result);
+    return result;
+}
+
+// helper function to return inode size
+ssize_t fs_do_stat(FileSystem *fs, size_t inode_number) {
     Inode inode;
     bool valid_inode = fs_load_inode(fs, inode_number, &inode);
 
     if (!valid_inode) {
-        fprintf(stderr, "fs_stat: load inode failed\n");
         return -1;
     }
 
@@ -413,28 +570,37 @@ ssize_t fs_stat(FileSystem *fs, size_t inode_number) {
  * @return      Number of bytes read (-1 on error).
  **/
 ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_read(fs, inode_number, data, length, offset);
+    stats_stop(STATS_READ, &timer, result);
+    record_op(RECORD_READ, &timer, inode_number, length, offset, 0, result);
+    return result;
+}
+
+// helper function to read inode data
+ssize_t fs_do_read(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
     // load inode and error check
     Inode inode;
 
 
     bool valid_inode = fs_load_inode(fs, inode_number, &inode);
     if (!valid_inode) {
-        fprintf(stderr, "fs_read: invalid inode\n");
         return -1;
     }
     
     if (length < 0) {
-        fprintf(stderr, "fs_read: length < 0\n");
         return -1;
     }
 
     if (offset < 0) {
-        fprintf(stderr, "fs_read: offset < 0\n");
         return -1;
     }
 
+    if (inode.valid & INODE_COMPRESSED) {
+        return fs_cluster_read(fs, inode_number, &inode, data, length, offset);
+    }
+
     if (offset == inode.size) {
-        fprintf(stderr, "return HERE?!?");
         return 0;
     }
 
@@ -453,20 +619,22 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
 
     uint32_t direct_num = 0;
     uint32_t indirect_num = 0;   
+    bool     found = false;
     
     for (direct_num = 0; direct_num < POINTERS_PER_INODE; ++direct_num) {
         // *** could use free list
         if (inode.direct[direct_num] == 0) {
-            fprintf(stderr, "fs_read: direct block not found, offset too large\noffset is %lu, direct block searched for was %u\n", offset, direct_num);
+            trace_error(TRACE_READ_RANGE, inode_number, direct_num);
             return -1; 
         }
-        
-        disk_read(fs->disk, inode.direct[direct_num], dataBlock.data);
 
-        // get to correct starting block
+        // get to correct starting block (only the starting block is read)
         if (before_offset < BLOCK_SIZE) {
-            fprintf(stderr, "found direct block pointer # %u to start\n", direct_num);
+            readahead_access(fs, inode_number, &inode, direct_num);
+            fs_read_data_block(fs, inode_number, inode.direct[direct_num], dataBlock.data);
+            trace_debug(TRACE_READ_BLOCK, inode_number, inode.direct[direct_num]);
             ++direct_num;
+            found = true;
             break;
         }
         else {
@@ -474,33 +642,35 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
         }
     }
     
-    if (before_offset >= BLOCK_SIZE) {
+    // offset may start exactly at the first indirect block
+    if (!found) {
         
     
         // make sure indirect block exists
         // *** could use free list
         if (inode.indirect == 0) {
-            fprintf(stderr, "fs_read: indirect block not found, offset too large\n");
+            trace_error(TRACE_READ_RANGE, inode_number, POINTERS_PER_INODE);
             return -1;
         }
 
         // read in indirect pointer block 
-        disk_read(fs->disk, inode.indirect, pointerBlock.data);
+        fs_read_block(fs, inode.indirect, CACHE_INDIRECT, pointerBlock.data);
 
         for (indirect_num = 0; indirect_num < POINTERS_PER_BLOCK; ++indirect_num) {
             // check for valid data block
             // *** could use free list
             if (pointerBlock.pointers[indirect_num] == 0) {
-                fprintf(stderr, "fs_read: indirect block at index not found, offset too large\n");
+                trace_error(TRACE_READ_RANGE, inode_number, POINTERS_PER_INODE + indirect_num);
                 return -1; 
             }
-            
-            disk_read(fs->disk, pointerBlock.pointers[indirect_num], dataBlock.data);
 
-            // get to correct starting block
+            // get to correct starting block (only the starting block is read)
             if (before_offset < BLOCK_SIZE) {
-                fprintf(stderr, "found indirect block pointer # %u to start\n", indirect_num);
+                readahead_access(fs, inode_number, &inode, POINTERS_PER_INODE + indirect_num);
+                fs_read_data_block(fs, inode_number, pointerBlock.pointers[indirect_num], dataBlock.data);
+                trace_debug(TRACE_READ_BLOCK, inode_number, pointerBlock.pointers[indirect_num]);
                 ++indirect_num;
+                found = true;
                 break;
             }
             else {
@@ -509,8 +679,8 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
         }
     }
         
-    if (before_offset >= BLOCK_SIZE) {
-        fprintf(stderr, "fs_read: all indirect blocks checked, offset too large\n");
+    if (!found) {
+        trace_error(TRACE_READ_RANGE, inode_number, POINTERS_PER_INODE + POINTERS_PER_BLOCK);
         return -1;
     }
 
@@ -541,7 +711,6 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
         }
         else {
             upto -= snprintf(tempData, size_check + 1, "%.*s", BLOCK_SIZE, dataBlock.data);  
-            fprintf(stderr, "should exit here 1\n"); 
                 
             strcpy(data, tempData);
         
@@ -559,8 +728,6 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
 
     // always check if upto > 0
     for (; direct_num < POINTERS_PER_INODE; ++direct_num) {
-        fprintf(stderr, "looking at direct block pointer # %u to read in\n", direct_num);
-
         // *** could use free list
         if (inode.direct[direct_num] == 0 || upto <= 0) {
             //fprintf(stderr, "fs_read: direct block not found, offset too large\n");
@@ -580,7 +747,9 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
         }
 
         // read next data block
-        disk_read(fs->disk, inode.direct[direct_num], dataBlock.data);
+        readahead_access(fs, inode_number, &inode, direct_num);
+        fs_read_data_block(fs, inode_number, inode.direct[direct_num], dataBlock.data);
+        trace_debug(TRACE_READ_BLOCK, inode_number, inode.direct[direct_num]);
 
         if (size_check > BLOCK_SIZE) {
 
@@ -591,7 +760,6 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
         }
         else {
             upto -= snprintf(tempData + strlen(tempData), size_check + 1, "%.*s", BLOCK_SIZE, dataBlock.data);  
-            fprintf(stderr, "should exit here 2\n"); 
             strcpy(data, tempData);
         
             free(tempData);
@@ -617,13 +785,11 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
     }
 
     // read in indirect pointer block 
-    disk_read(fs->disk, inode.indirect, pointerBlock.data);
+    fs_read_block(fs, inode.indirect, CACHE_INDIRECT, pointerBlock.data);
 
     
 
     for (; indirect_num < POINTERS_PER_BLOCK; ++indirect_num) {
-            fprintf(stderr, "looking at indirect block pointer # %u to read from\n", indirect_num);
-
             // check for valid data block
             // *** could use free list
             if (pointerBlock.pointers[indirect_num] == 0 || upto <= 0) {
@@ -640,7 +806,9 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
             }
             
             // read next data block
-            disk_read(fs->disk, pointerBlock.pointers[indirect_num], dataBlock.data);
+            readahead_access(fs, inode_number, &inode, POINTERS_PER_INODE + indirect_num);
+            fs_read_data_block(fs, inode_number, pointerBlock.pointers[indirect_num], dataBlock.data);
+            trace_debug(TRACE_READ_BLOCK, inode_number, pointerBlock.pointers[indirect_num]);
             
             if (size_check > BLOCK_SIZE) {
 
@@ -651,7 +819,6 @@ ssize_t fs_read(FileSystem *fs, size_t inode_number, char *data, size_t length,
             }
             else {
                 upto -= snprintf(tempData + strlen(tempData), size_check + 1, "%.*s", BLOCK_SIZE, dataBlock.data); 
-                fprintf(stderr, "should exit here 3\n"); 
                 strcpy(data, tempData);
         
                 free(tempData);
@@ -894,13 +1061,21 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
 }
 */
 
-// tim's fs_write
 ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_write(fs, inode_number, data, length, offset);
+    stats_stop(STATS_WRITE, &timer, result);
+    record_op(RECORD_WRITE, &timer, inode_number, length, offset, 0, result);
+    return result;
+}
+
+// tim's fs_write
+ssize_t fs_do_write(FileSystem *fs, size_t inode_number, char *data, size_t length, size_t offset) {
 
     //fprintf(stderr, "Starting fs_write\n");
     //fprintf(stderr, "length = %u\n", length);
 
-    if (!fs || length < 0 || offset < 0) {
+    if (!fs || fs->snapshot || length < 0 || offset < 0) {
         return -1;
     }
 
@@ -909,6 +1084,15 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
         return -1;
     }
 
+    readahead_reset(fs, inode_number);
+
+    if (write_inode.valid & INODE_COMPRESSED) {
+        return fs_cluster_write(fs, inode_number, &write_inode, data, length, offset);
+    }
+
+    // drop the old block map (blocks shared with clones stay with them)
+    fs_release_map(fs, &write_inode);
+
     // lets see if this helps
     write_inode.size = 0;
     for (uint32_t k = 0; k < POINTERS_PER_INODE; ++k) {
@@ -953,12 +1137,28 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
             if (write_inode.direct[i]) {
                 continue;
             }
+            else if (simd_zero(buffer.data, bytes_written)) {
+                // record all-zero block as a hole instead of storing it
+                write_inode.direct[i] = HOLE_BLOCK;
+                write_inode.size += bytes_written;
+                use_indirect = false;
+                break;
+            }
             else {
+                // share an identical stored block (when deduplicating)
+                ssize_t block_num = dedup_lookup(fs, buffer.data);
+                if (block_num >= 0) {
+                    fs->refs[block_num]++;
+                    write_inode.direct[i] = block_num;
+                    write_inode.size += bytes_written;
+                    use_indirect = false;
+                    break;
+                }
+
                 // find available block
-                ssize_t block_num = fs_allocate_free_block(fs);
+                block_num = fs_allocate_free_block(fs);
 
                 if (block_num > fs->meta_data.blocks) {
-                    fprintf(stderr, "no more blocks available, couldnt make direct block %u: exiting write\n", i);
                     // write_inode.size += bytes_written;
                     if (!fs_save_inode(fs, inode_number, &write_inode)) {
                         return -1;
@@ -971,11 +1171,11 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
 
                 // clear block
                 Block tempBlock;
-                disk_read(fs->disk, block_num, tempBlock.data);
+                fs_read_block(fs, block_num, CACHE_DATA, tempBlock.data);
             
                 block_clear_data(&tempBlock);
     
-                disk_write(fs->disk, block_num, tempBlock.data);
+                fs_write_block(fs, block_num, CACHE_DATA, tempBlock.data);
     
 
                 // add block_num to direct pointers list
@@ -983,7 +1183,9 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
                 // fprintf(stderr, "\n\nDirect link [%u]: %u\n\n", i, write_inode.direct[i]);
 
                 // write buffer to block @ block_num
-                disk_write(fs->disk, block_num, buffer.data);
+                fs_write_block(fs, block_num, CACHE_DATA, buffer.data);
+                dedup_insert(fs, block_num, buffer.data);
+                trace_debug(TRACE_WRITE_BLOCK, inode_number, block_num);
                 write_inode.size += bytes_written;
 
                 // set use_indirect flag to false
@@ -1001,10 +1203,7 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
                 // allocate block to hold indirect pointers
                 write_inode.indirect = fs_allocate_free_block(fs);
                 
-                fprintf(stderr, "indirect block at %u\n", write_inode.indirect);
-                
                 if (write_inode.indirect > fs->meta_data.blocks) {
-                    fprintf(stderr, "no more blocks available, couldnt make indirect block: exiting write\n");
                     // write_inode.size += bytes_written;
                     if (!fs_save_inode(fs, inode_number, &write_inode)) {
                         return -1;
@@ -1014,34 +1213,45 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
 
                 }
 
-                fprintf(stderr, "about to clear the indirect block\n");
+                trace_info(TRACE_WRITE_INDIRECT, inode_number, write_inode.indirect);
         
                 // clear block
                 Block tempBlock;
-                disk_read(fs->disk, write_inode.indirect, tempBlock.data);
+                fs_read_block(fs, write_inode.indirect, CACHE_INDIRECT, tempBlock.data);
             
                 block_clear_data(&tempBlock);
     
-                disk_write(fs->disk, write_inode.indirect, tempBlock.data);
-
-                fprintf(stderr, "block has (hopefully) been cleared\n");
+                fs_write_block(fs, write_inode.indirect, CACHE_INDIRECT, tempBlock.data);
             }
 
             Block pointerBlock;
-            disk_read(fs->disk, write_inode.indirect, pointerBlock.data);
+            fs_read_block(fs, write_inode.indirect, CACHE_INDIRECT, pointerBlock.data);
 
             // loop through indirect block to find free pointer
             for (uint32_t i = 0; i < POINTERS_PER_BLOCK; i++) {
-                fprintf(stderr, "was block cleared? who knows, pointerBlock.pointers[%u] = %u\n", i, pointerBlock.pointers[i]);
+                if (!pointerBlock.pointers[i] && simd_zero(buffer.data, bytes_written)) {
+                    // record all-zero block as a hole instead of storing it
+                    pointerBlock.pointers[i] = HOLE_BLOCK;
+                    write_inode.size += bytes_written;
+                    fs_write_block(fs, write_inode.indirect, CACHE_INDIRECT, pointerBlock.data);
+                    break;
+                }
                 if (!pointerBlock.pointers[i]) {
 
-                    fprintf(stderr, "block pointer %u\n", i);    
+                    // share an identical stored block (when deduplicating)
+                    ssize_t block_num = dedup_lookup(fs, buffer.data);
+                    if (block_num >= 0) {
+                        fs->refs[block_num]++;
+                        pointerBlock.pointers[i] = block_num;
+                        write_inode.size += bytes_written;
+                        fs_write_block(fs, write_inode.indirect, CACHE_INDIRECT, pointerBlock.data);
+                        break;
+                    }
 
                     // find available block
-                    ssize_t block_num = fs_allocate_free_block(fs);
+                    block_num = fs_allocate_free_block(fs);
 
                     if (block_num > fs->meta_data.blocks) {
-                        fprintf(stderr, "no more blocks available, couldnt make indirect pointer: exiting write\n");
                         // write_inode.size += bytes_written;
                         if (!fs_save_inode(fs, inode_number, &write_inode)) {
                             return -1;
@@ -1051,28 +1261,27 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
 
                     }
 
-
-                    fprintf(stderr, "found indirect block pointer %lu\n", block_num);
-
                     pointerBlock.pointers[i] = block_num;
 
                 
                     // clear block
                     Block tempBlock;
-                    disk_read(fs->disk, block_num, tempBlock.data);
+                    fs_read_block(fs, block_num, CACHE_DATA, tempBlock.data);
             
                     block_clear_data(&tempBlock);
     
-                    disk_write(fs->disk, block_num, tempBlock.data);
+                    fs_write_block(fs, block_num, CACHE_DATA, tempBlock.data);
 
 
                     
                     // write buffer to block @ block_num
-                    disk_write(fs->disk, block_num, buffer.data);
+                    fs_write_block(fs, block_num, CACHE_DATA, buffer.data);
+                    dedup_insert(fs, block_num, buffer.data);
+                    trace_debug(TRACE_WRITE_BLOCK, inode_number, block_num);
                     write_inode.size += bytes_written;
 
                     // update indirect pointer block and exit loop
-                    disk_write(fs->disk, write_inode.indirect, pointerBlock.data);
+                    fs_write_block(fs, write_inode.indirect, CACHE_INDIRECT, pointerBlock.data);
                     break;
                 }
             }
@@ -1087,118 +1296,1136 @@ ssize_t fs_write(FileSystem *fs, size_t inode_number, char *data, size_t length,
     return write_inode.size;
 }
 
-// helper function to initialize bitmap
-void    fs_initialize_free_block_bitmap(FileSystem *fs) {
+/**
+ * Advise the FileSystem how a byte range of the specified Inode will be
+ * accessed (modeled on posix_fadvise) by doing the following:
+ *
+ *  1. Load Inode information and compute the logical block range (a length
+ *  of 0 means until the end of the file).
+ *
+ *  2. Apply the advice to readahead and the block cache:
+ *
+ *      - SEQUENTIAL, RANDOM, NOREUSE, NORMAL: set readahead sizing and cache
+ *        insertion priority for future reads of the Inode.
+ *
+ *      - WILLNEED: prefetch the range into the cache now.
+ *
+ *      - DONTNEED: drop the range from the cache now.
+ *
+ *  3. Pass the advice for the underlying physical blocks down to the host
+ *  image file.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to advise.
+ * @param       offset          Byte offset of range.
+ * @param       length          Number of bytes in range (0 for rest of file).
+ * @param       advice          Access advice (FS_ADVICE_*).
+ * @return      Whether or not the advice was applied.
+ **/
+bool    fs_advise(FileSystem *fs, size_t inode_number, size_t offset, size_t length, int advice) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_advise(fs, inode_number, offset, length, advice);
+    record_op(RECORD_ADVISE, &timer, inode_number, length, offset, advice, result ? 0 : -1);
+    return result;
+}
 
-    // initialize all blocks to true (Free)
-    for (uint32_t i = 0; i < fs->meta_data.blocks; i++) {       
-        fs->free_blocks[i] = true;
+// helper function to apply access advice
+bool    fs_do_advise(FileSystem *fs, size_t inode_number, size_t offset, size_t length, int advice) {
+    static const int host_advice[] = {
+        [FS_ADVICE_NORMAL]     = POSIX_FADV_NORMAL,
+        [FS_ADVICE_SEQUENTIAL] = POSIX_FADV_SEQUENTIAL,
+        [FS_ADVICE_RANDOM]     = POSIX_FADV_RANDOM,
+        [FS_ADVICE_WILLNEED]   = POSIX_FADV_WILLNEED,
+        [FS_ADVICE_DONTNEED]   = POSIX_FADV_DONTNEED,
+        [FS_ADVICE_NOREUSE]    = POSIX_FADV_NOREUSE,
+    };
+
+    if (!fs || !fs->disk || advice < FS_ADVICE_NORMAL || advice > FS_ADVICE_NOREUSE) {
+        return false;
     }
 
-    // set super block to false (Occupied)
-    fs->free_blocks[0] = false;
-
-    // set inode blocks to false (Occupied)
-    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; i++) {
-        fs->free_blocks[i+1] = false;
+    Inode inode;
+    if (!fs_load_inode(fs, inode_number, &inode)) {
+        return false;
     }
-}
-
-// helper function to allocate a free block
-ssize_t fs_allocate_free_block(FileSystem *fs) {
 
-    fprintf(stderr, "fs_allocate: fs->meta_data.blocks = %u\n", fs->meta_data.blocks); 
+    // compute logical block range
+    size_t file_blocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t start       = offset / BLOCK_SIZE;
+    size_t end         = file_blocks;
+    if (length) {
+        end = min(end, (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
 
-    // loop through free blocks bitmap
-    for (uint32_t i = 0; i < fs->meta_data.blocks; i++) {
-        fprintf(stderr, "fs_allocate: looking at block %u\n", i);
-    
-        if (fs->free_blocks[i] == true) {
-            fprintf(stderr, "found %u\n", i);
-            // If a free block is found, occupy it and return the block number
-            fs->free_blocks[i] = false;
-            return i;
+    if (inode.valid & INODE_COMPRESSED) {
+        Block table;
+        if (advice != FS_ADVICE_WILLNEED && advice != FS_ADVICE_DONTNEED) {
+            readahead_advise(fs, inode_number, advice);
+        }
+        if (!inode.indirect || fs_read_block(fs, inode.indirect, CACHE_INDIRECT, table.data) == DISK_FAILURE) {
+            return true;
+        }
+        if (advice == FS_ADVICE_DONTNEED) {
+            fs_cluster_forget(fs, inode_number);
         }
-    }
-    return fs->meta_data.blocks + 1;
-}
 
-// helper function to clear data other than super block
-void    disk_clear_data(Disk *disk) {
+        // clusters are contiguous runs, so advise (and prefetch) them whole
+        for (size_t c = start / CLUSTER_BLOCKS; c < min((end + CLUSTER_BLOCKS - 1) / CLUSTER_BLOCKS, CLUSTERS_PER_BLOCK); c++) {
+            Cluster *cluster = &table.clusters[c];
+            if (!fs_cluster_check(fs, cluster) || !cluster->start) {
+                continue;
+            }
 
-    // initialize new block to all 0 (empty)
-    Block block;
-    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
-        block.data[i] = 0;
+            if (advice == FS_ADVICE_WILLNEED) {
+                fs_cluster_fetch(fs, inode_number, cluster, fs->clusters->packed);
+            } else if (advice == FS_ADVICE_DONTNEED) {
+                for (size_t b = 0; b < cluster->blocks; b++) {
+                    cache_invalidate(fs->cache, cluster->start + b);
+                }
+            }
+            disk_advise(fs->disk, cluster->start, cluster->blocks, host_advice[advice]);
+        }
+        return true;
     }
 
-    // write the empty block to all blocks on disk except superblock
-    for (size_t j = 1; j < disk->blocks; ++j) {
-        disk_write(disk, j, block.data);
+    switch (advice) {
+        case FS_ADVICE_WILLNEED:
+            readahead_prefetch(fs, inode_number, &inode, start, end);
+            break;
+        case FS_ADVICE_DONTNEED:
+            break;
+        default:
+            readahead_advise(fs, inode_number, advice);
+            break;
     }
-}
 
+    // walk physical runs of the range to drop cached blocks and advise host
+    for (size_t window = start; window < end; window += READAHEAD_MAX) {
+        uint32_t blocks[READAHEAD_MAX];
+        size_t   nblocks = readahead_map(fs, &inode, window, min(window + READAHEAD_MAX, end), blocks);
 
-// helper function to clear a single block data
-void    block_clear_data(Block *block) {
-    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
-        block->data[i] = 0;
-    }
-}
+        for (size_t i = 0; i < nblocks; ) {
+            if (!blocks[i]) {
+                i++;
+                continue;
+            }
 
+            size_t run = 1;
+            while (i + run < nblocks && blocks[i + run] == blocks[i] + run) {
+                run++;
+            }
 
-// helper function to load inode @ inode_number into node
-bool    fs_load_inode(FileSystem *fs, size_t inode_number, Inode *node) {  
-    Block inodeBlock;
+            if (advice == FS_ADVICE_DONTNEED) {
+                for (size_t j = 0; j < run; j++) {
+                    cache_invalidate(fs->cache, blocks[i] + j);
+                }
+            }
 
-    // calculate block to read from
-    size_t inode_block_num = (inode_number / INODES_PER_BLOCK) + 1;
+            disk_advise(fs->disk, blocks[i], run, host_advice[advice]);
+            i += run;
+        }
 
-    if (inode_block_num > fs->meta_data.inode_blocks) {
-        fprintf(stderr, "fs_load: block num > blocks\nblock_num = %lu, iblocks = %d", inode_block_num, fs->meta_data.inode_blocks);
-        return false;
+        if (nblocks < min(window + READAHEAD_MAX, end) - window) {
+            break;
+        }
     }
-    
-    // read from disk
-    disk_read(fs->disk, inode_block_num, inodeBlock.data);
-
-    // calculate inode in block to get
-    uint32_t inode_offset = (inode_number % INODES_PER_BLOCK);
-
-    // set output
-    *node = inodeBlock.inodes[inode_offset];
-    
-    // check node is valid before returning
-    if (!node->valid) {
-        fprintf(stderr, "fs_load: inode not valid\n");
-        return false;
-    }    
 
     return true;
 }
 
-// helper function to save data in node to inode @ inode_number
-bool    fs_save_inode(FileSystem *fs, size_t inode_number, Inode *node) {
-    Block inodeBlock;
+/**
+ * Enable transparent compression for the specified Inode by doing the
+ * following:
+ *
+ *  1. Load Inode and check that it holds no data yet.
+ *
+ *  2. Set the INODE_COMPRESSED flag and save the Inode.
+ *
+ * Data of a compressed Inode is split into CLUSTER_SIZE clusters that are
+ * each compressed with the LZ codec and stored as a contiguous run of
+ * physical blocks; the indirect pointer then refers to a cluster table block
+ * instead of a pointer block.  Clusters that do not save at least one block
+ * are stored raw.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to compress.
+ * @return      Whether or not compression was enabled.
+ **/
+bool    fs_compress(FileSystem *fs, size_t inode_number) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_compress(fs, inode_number);
+    stats_stop(STATS_COMPRESS, &timer, result ? 0 : -1);
+    record_op(RECORD_COMPRESS, &timer, inode_number, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
 
-    // calculate block to read from
-    size_t inode_block_num = (inode_number / INODES_PER_BLOCK) + 1;
+// helper function to enable compression
+bool    fs_do_compress(FileSystem *fs, size_t inode_number) {
+    if (!fs || !fs->disk || fs->snapshot) {
+        return false;
+    }
 
-    if (inode_block_num > fs->meta_data.inode_blocks) {
+    Inode inode;
+    if (!fs_load_inode(fs, inode_number, &inode)) {
         return false;
     }
 
-    // read from disk
-    disk_read(fs->disk, inode_block_num, inodeBlock.data);
+    if (inode.valid & INODE_COMPRESSED) {
+        return true;
+    }
 
-    // calculate inode in block to get
-    uint32_t inode_offset = (inode_number % INODES_PER_BLOCK);
+    // existing block maps are not converted
+    if (inode.size || inode.indirect) {
+        return false;
+    }
+    for (uint32_t k = 0; k < POINTERS_PER_INODE; ++k) {
+        if (inode.direct[k]) {
+            return false;
+        }
+    }
 
-    // set inodeblock to write back to disk
-    inodeBlock.inodes[inode_offset] = *node;
+    inode.valid |= INODE_COMPRESSED;
+    readahead_reset(fs, inode_number);
+    fs_cluster_forget(fs, inode_number);
+    return fs_save_inode(fs, inode_number, &inode);
+}
 
-    disk_write(fs->disk, inode_block_num, inodeBlock.data);
-    return true;
+/**
+ * Clone a file by doing the following:
+ *
+ *  1. Load and check the source Inode.
+ *
+ *  2. Store a copy of it in the first free Inode.
+ *
+ *  3. Take another reference to each of its direct blocks and to its
+ *  indirect (pointer or cluster table) block.
+ *
+ * The clone shares every data and pointer block with the source, so cloning
+ * costs one inode block write however large the file is.  Shared blocks are
+ * copied on write: rewriting a file gives it a new block map, and writing a
+ * cloned compressed file first gives it its own cluster table, storing each
+ * changed cluster in a new run.  A shared block is freed with its last
+ * reference.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to clone.
+ * @return      Inode number of clone (-1 on failure).
+ **/
+ssize_t fs_clone(FileSystem *fs, size_t inode_number) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_clone(fs, inode_number);
+    stats_stop(STATS_CLONE, &timer, result);
+    record_op(RECORD_CLONE, &timer, inode_number, 0, 0, 0, result);
+    return result;
+}
+
+// helper function to clone file
+ssize_t fs_do_clone(FileSystem *fs, size_t inode_number) {
+    if (!fs || !fs->disk || fs->snapshot) {
+        return -1;
+    }
+
+    Inode inode;
+    if (!fs_load_inode(fs, inode_number, &inode)) {
+        return -1;
+    }
+
+    ssize_t clone = fs_allocate_inode(fs, &inode);
+    if (clone < 0) {
+        return -1;
+    }
+
+    fs_reference_inode(fs, &inode);
+    return clone;
+}
+
+/**
+ * Take a read-only snapshot of the FileSystem by doing the following:
+ *
+ *  1. Find a free slot in the snapshot table of the SuperBlock.
+ *
+ *  2. Allocate and clear the snapshot's inode table map.
+ *
+ *  3. Record the map in the SuperBlock.
+ *
+ *  4. Take a snapshot reference to the blocks of every file.
+ *
+ * A snapshot writes only two blocks: the map starts out empty, meaning every
+ * inode block is shared with the live inode table, and an inode block is
+ * copied (and the copy recorded in the map) only before the live table first
+ * changes it.  Taking the references is not free, though: step 4 reads every
+ * inode block and the pointer or cluster table block of every file, and
+ * updates the in-memory count of each referenced block, so a snapshot costs
+ * O(inodes + blocks in use) time.  Data, pointer and cluster table blocks are
+ * kept by their reference counts, so later writes are copied on write and the
+ * free block bitmap never hands out a block a snapshot still uses.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @return      Snapshot number (-1 on failure).
+ **/
+ssize_t fs_snapshot(FileSystem *fs) {
+    StatsTimer timer  = stats_start();
+    ssize_t    result = fs_do_snapshot(fs);
+    stats_stop(STATS_SNAPSHOT, &timer, result);
+    record_op(RECORD_SNAPSHOT, &timer, 0, 0, 0, 0, result);
+    return result;
+}
+
+// helper function to take snapshot
+ssize_t fs_do_snapshot(FileSystem *fs) {
+    if (!fs || !fs->disk || fs->snapshot || fs->meta_data.inode_blocks > POINTERS_PER_BLOCK) {
+        return -1;
+    }
+
+    ssize_t snapshot = 0;
+    while (snapshot < SNAPSHOTS_MAX && fs->meta_data.snapshots[snapshot]) {
+        snapshot++;
+    }
+    if (snapshot == SNAPSHOTS_MAX) {
+        return -1;
+    }
+
+    Block block;
+    block_clear_data(&block);
+
+    ssize_t map = fs_allocate_free_block(fs);
+    if (map >= fs->meta_data.blocks) {
+        return -1;
+    }
+    if (fs_write_block(fs, map, CACHE_INDIRECT, block.data) == DISK_FAILURE) {
+        fs_release_block(fs, map);
+        return -1;
+    }
+
+    fs->meta_data.snapshots[snapshot] = map;
+    if (!fs_save_super(fs)) {
+        fs->meta_data.snapshots[snapshot] = 0;
+        fs_release_block(fs, map);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+        fs_read_block(fs, i+1, CACHE_INODE, block.data);
+
+        uint32_t valid[INODES_PER_BLOCK];
+        size_t   nvalid = simd_nonzero(&block.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        for (size_t v = 0; v < nvalid; ++v) {
+            fs_reference_inode(fs, &block.inodes[valid[v]]);
+        }
+        fs->frozen[i] = true;
+    }
+
+    return snapshot;
+}
+
+/**
+ * Delete a snapshot by doing the following:
+ *
+ *  1. Remove the snapshot from the snapshot table of the SuperBlock.
+ *
+ *  2. Drop its references to the blocks of every file in its inode table,
+ *  freeing the blocks nothing else uses.
+ *
+ *  3. Release its inode table copies and map.
+ *
+ * Note: Do not delete a snapshot that is mounted!
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       snapshot    Snapshot to delete.
+ * @return      Whether or not the snapshot was deleted.
+ **/
+bool    fs_snapshot_delete(FileSystem *fs, size_t snapshot) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_snapshot_delete(fs, snapshot);
+    stats_stop(STATS_SNAPSHOT_DELETE, &timer, result ? 0 : -1);
+    record_op(RECORD_SNAPSHOT_DELETE, &timer, snapshot, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
+
+// helper function to delete snapshot
+bool    fs_do_snapshot_delete(FileSystem *fs, size_t snapshot) {
+    if (!fs || !fs->disk || fs->snapshot || snapshot >= SNAPSHOTS_MAX || !fs->meta_data.snapshots[snapshot]) {
+        return false;
+    }
+
+    uint32_t m = fs->meta_data.snapshots[snapshot];
+    Block    map;
+    if (fs_read_block(fs, m, CACHE_INDIRECT, map.data) == DISK_FAILURE) {
+        return false;
+    }
+
+    fs->meta_data.snapshots[snapshot] = 0;
+    if (!fs_save_super(fs)) {
+        fs->meta_data.snapshots[snapshot] = m;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+        uint32_t copy = map.pointers[i];
+        if (copy >= fs->meta_data.blocks) {
+            continue;
+        }
+
+        Block inodeBlock;
+        fs_read_block(fs, copy ? copy : i + 1, CACHE_INODE, inodeBlock.data);
+
+        uint32_t valid[INODES_PER_BLOCK];
+        size_t   nvalid = simd_nonzero(&inodeBlock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        for (size_t v = 0; v < nvalid; ++v) {
+            fs_release_map(fs, &inodeBlock.inodes[valid[v]]);
+        }
+        if (copy) {
+            fs_release_block(fs, copy);
+        }
+    }
+    fs_release_block(fs, m);
+
+    fs_snapshot_scan(fs, false);
+    return true;
+}
+
+/**
+ * Mount a snapshot of the FileSystem on Disk read-only by doing the
+ * following:
+ *
+ *  1. Mount the FileSystem.
+ *
+ *  2. Check the snapshot and read inodes from its inode table from then on.
+ *
+ * Files read through the mount are exactly as they were when the snapshot
+ * was taken, even while another mount keeps writing the live FileSystem, so
+ * it can be backed up under load.  Operations that modify the FileSystem
+ * fail.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       disk        Pointer to Disk structure.
+ * @param       snapshot    Snapshot to mount.
+ * @return      Whether or not the snapshot was mounted.
+ **/
+bool    fs_snapshot_mount(FileSystem *fs, Disk *disk, size_t snapshot) {
+    StatsTimer timer  = stats_start();
+    bool       result = fs_do_snapshot_mount(fs, disk, snapshot);
+    stats_stop(STATS_MOUNT, &timer, result ? 0 : -1);
+    record_op(RECORD_SNAPSHOT_MOUNT, &timer, snapshot, 0, 0, 0, result ? 0 : -1);
+    return result;
+}
+
+// helper function to mount snapshot (recorded as a single call)
+bool    fs_do_snapshot_mount(FileSystem *fs, Disk *disk, size_t snapshot) {
+    if (!fs_do_mount(fs, disk)) {
+        return false;
+    }
+
+    if (snapshot >= SNAPSHOTS_MAX || !fs->meta_data.snapshots[snapshot]) {
+        fs_do_unmount(fs);
+        return false;
+    }
+
+    fs->snapshot = fs->meta_data.snapshots[snapshot];
+
+    // count the free inodes of the snapshot's inode table instead
+    fs->free_inodes = fs->meta_data.inode_blocks * INODES_PER_BLOCK;
+    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+        Block    inodeBlock;
+        uint32_t valid[INODES_PER_BLOCK];
+        if (fs_read_inode_block(fs, i, inodeBlock.data) != DISK_FAILURE) {
+            fs->free_inodes -= simd_nonzero(&inodeBlock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+        }
+    }
+    return true;
+}
+
+/**
+ * Report operation statistics by doing the following:
+ *
+ *  1. Merge the per-thread counters of every thread into a single snapshot.
+ *
+ *  2. Copy the snapshot into the caller's Stats structure.
+ *
+ * Counters are process-wide (and thus cover every mounted FileSystem).
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       stats   Stats structure to fill.
+ **/
+void    fs_stats(FileSystem *fs, Stats *stats) {
+    if (!stats) {
+        return;
+    }
+
+    stats_collect(stats);
+}
+
+// helper function to initialize bitmap
+void    fs_initialize_free_block_bitmap(FileSystem *fs) {
+
+    // initialize all blocks to true (Free)
+    for (uint32_t i = 0; i < fs->meta_data.blocks; i++) {       
+        fs->free_blocks[i] = true;
+    }
+
+    // set super block to false (Occupied)
+    fs->free_blocks[0] = false;
+
+    // set inode blocks to false (Occupied)
+    for (uint32_t i = 0; i < fs->meta_data.inode_blocks; i++) {
+        fs->free_blocks[i+1] = false;
+    }
+}
+
+// helper function to allocate a free block
+ssize_t fs_allocate_free_block(FileSystem *fs) {
+
+    // loop through free blocks bitmap
+    for (uint32_t i = 0; i < fs->meta_data.blocks; i++) {
+        trace_debug(TRACE_ALLOC_SCAN, 0, i);
+    
+        if (fs->free_blocks[i] == true) {
+            trace_info(TRACE_ALLOC_BLOCK, 0, i);
+            // If a free block is found, occupy it and return the block number
+            fs_mark_block(fs, i, false);
+            fs->refs[i] = 1;
+            return i;
+        }
+    }
+    trace_error(TRACE_ALLOC_FAIL, 0, fs->meta_data.blocks);
+    return fs->meta_data.blocks + 1;
+}
+
+// helper function to allocate count contiguous free blocks (first fit)
+ssize_t fs_allocate_free_run(FileSystem *fs, size_t count) {
+    size_t run = 0;
+
+    for (uint32_t i = 0; i < fs->meta_data.blocks; i++) {
+        run = fs->free_blocks[i] ? run + 1 : 0;
+        if (run == count) {
+            size_t start = i + 1 - count;
+            for (size_t b = start; b <= i; b++) {
+                fs_mark_block(fs, b, false);
+                fs->refs[b] = 1;
+            }
+            trace_info(TRACE_ALLOC_BLOCK, count, start);
+            return start;
+        }
+    }
+    trace_error(TRACE_ALLOC_FAIL, count, fs->meta_data.blocks);
+    return fs->meta_data.blocks + 1;
+}
+
+// helper function to set whether a block is free (atomically, as the
+// background scrubber reads the bitmap while blocks are allocated and freed)
+void    fs_mark_block(FileSystem *fs, size_t block, bool free) {
+    __atomic_store_n(&fs->free_blocks[block], free, __ATOMIC_RELEASE);
+}
+
+// helper function to mark and count references to the blocks of a pointer array
+void    fs_reference(FileSystem *fs, uint32_t *pointers, size_t count) {
+    uint32_t used[POINTERS_PER_BLOCK];
+    size_t   nused = simd_nonzero(pointers, count, 1, used);
+
+    for (size_t u = 0; u < nused; u++) {
+        uint32_t block = pointers[used[u]];
+        if (block < fs->meta_data.blocks) {
+            fs_mark_block(fs, block, false);
+            fs->refs[block]++;
+        }
+    }
+}
+
+// helper function to drop references to the blocks of a pointer array, freeing unshared blocks
+void    fs_release(FileSystem *fs, uint32_t *pointers, size_t count) {
+    uint32_t used[POINTERS_PER_BLOCK];
+    size_t   nused = simd_nonzero(pointers, count, 1, used);
+
+    for (size_t u = 0; u < nused; u++) {
+        fs_release_block(fs, pointers[used[u]]);
+    }
+}
+
+// helper function to mark and count the references of an inode to its blocks
+// (the blocks under a pointer block or cluster table are counted once for it)
+void    fs_reference_inode(FileSystem *fs, Inode *inode) {
+    if (!(inode->valid & INODE_COMPRESSED)) {
+        fs_reference(fs, inode->direct, POINTERS_PER_INODE);
+    }
+
+    if (!inode->indirect || inode->indirect >= fs->meta_data.blocks || fs->refs[inode->indirect]++) {
+        return;
+    }
+    fs_mark_block(fs, inode->indirect, false);
+
+    Block block;
+    fs_read_block(fs, inode->indirect, CACHE_INDIRECT, block.data);
+
+    if (inode->valid & INODE_COMPRESSED) {
+        // mark and count the contiguous run of every cluster
+        for (uint32_t c = 0; c < CLUSTERS_PER_BLOCK; ++c) {
+            if (fs_cluster_check(fs, &block.clusters[c])) {
+                for (uint32_t b = 0; b < block.clusters[c].blocks; ++b) {
+                    fs_mark_block(fs, block.clusters[c].start + b, false);
+                    fs->refs[block.clusters[c].start + b]++;
+                }
+            }
+        }
+    } else {
+        fs_reference(fs, block.pointers, POINTERS_PER_BLOCK);
+    }
+}
+
+// helper function to drop a reference to a block (returns whether it was freed)
+bool    fs_release_block(FileSystem *fs, size_t block) {
+    if (block >= fs->meta_data.blocks) {
+        return false;
+    }
+
+    if (fs->refs[block] > 1) {
+        fs->refs[block]--;
+        return false;
+    }
+
+    fs->refs[block] = 0;
+    fs_mark_block(fs, block, true);
+    dedup_forget(fs, block);
+    return true;
+}
+
+// helper function to drop the references of an inode to its blocks and clear its block map
+void    fs_release_map(FileSystem *fs, Inode *inode) {
+    if (inode->valid & INODE_COMPRESSED) {
+        // the runs of a shared cluster table belong to the table
+        if (inode->indirect && fs_release_block(fs, inode->indirect)) {
+            Block table;
+            fs_read_block(fs, inode->indirect, CACHE_INDIRECT, table.data);
+
+            for (uint32_t c = 0; c < CLUSTERS_PER_BLOCK; c++) {
+                if (table.clusters[c].start && fs_cluster_check(fs, &table.clusters[c])) {
+                    for (uint32_t b = 0; b < table.clusters[c].blocks; b++) {
+                        fs_release_block(fs, table.clusters[c].start + b);
+                    }
+                }
+            }
+        }
+    } else {
+        fs_release(fs, inode->direct, POINTERS_PER_INODE);
+
+        // the pointers of a shared pointer block belong to the pointer block
+        if (inode->indirect && fs_release_block(fs, inode->indirect)) {
+            Block pointerBlock;
+            fs_read_block(fs, inode->indirect, CACHE_INDIRECT, pointerBlock.data);
+
+            fs_release(fs, pointerBlock.pointers, POINTERS_PER_BLOCK);
+        }
+    }
+
+    for (uint32_t i = 0; i < POINTERS_PER_INODE; i++) {
+        inode->direct[i] = 0;
+    }
+    inode->indirect = 0;
+    inode->size = 0;
+}
+
+// helper function to clear data other than super block
+void    disk_clear_data(Disk *disk) {
+
+    // initialize new block to all 0 (empty)
+    Block block;
+    simd_clear(block.data, BLOCK_SIZE);
+
+    // write the empty block to all blocks on disk except superblock
+    for (size_t j = 1; j < disk->blocks; ++j) {
+        disk_write(disk, j, block.data);
+    }
+}
+
+
+// helper function to clear a single block data
+void    block_clear_data(Block *block) {
+    simd_clear(block->data, BLOCK_SIZE);
+}
+
+
+// helper function to load inode @ inode_number into node
+bool    fs_load_inode(FileSystem *fs, size_t inode_number, Inode *node) {  
+    Block inodeBlock;
+
+    // calculate block to read from
+    size_t inode_block_num = (inode_number / INODES_PER_BLOCK) + 1;
+
+    if (inode_block_num > fs->meta_data.inode_blocks) {
+        trace_error(TRACE_INODE_INVALID, inode_number, inode_block_num);
+        return false;
+    }
+    
+    // read from disk (or the frozen inode table of a mounted snapshot)
+    fs_read_inode_block(fs, inode_block_num - 1, inodeBlock.data);
+
+    // calculate inode in block to get
+    uint32_t inode_offset = (inode_number % INODES_PER_BLOCK);
+
+    // set output
+    *node = inodeBlock.inodes[inode_offset];
+    
+    // check node is valid before returning
+    if (!node->valid) {
+        trace_error(TRACE_INODE_INVALID, inode_number, inode_block_num);
+        return false;
+    }    
+
+    return true;
+}
+
+// helper function to save data in node to inode @ inode_number
+bool    fs_save_inode(FileSystem *fs, size_t inode_number, Inode *node) {
+    Block inodeBlock;
+
+    // calculate block to read from
+    size_t inode_block_num = (inode_number / INODES_PER_BLOCK) + 1;
+
+    if (inode_block_num > fs->meta_data.inode_blocks || fs->snapshot) {
+        return false;
+    }
+
+    // keep the old inode block for snapshots that still share it
+    if (!fs_snapshot_preserve(fs, inode_block_num - 1)) {
+        return false;
+    }
+
+    // read from disk
+    fs_read_block(fs, inode_block_num, CACHE_INODE, inodeBlock.data);
+
+    // calculate inode in block to get
+    uint32_t inode_offset = (inode_number % INODES_PER_BLOCK);
+
+    // set inodeblock to write back to disk
+    inodeBlock.inodes[inode_offset] = *node;
+
+    fs_write_block(fs, inode_block_num, CACHE_INODE, inodeBlock.data);
+    return true;
+}
+
+// helper function to read inode block index (of the mounted snapshot, if any)
+ssize_t fs_read_inode_block(FileSystem *fs, size_t index, char *data) {
+    if (!fs->snapshot) {
+        return fs_read_block(fs, index + 1, CACHE_INODE, data);
+    }
+
+    // the snapshot map changes under a live mount, so it is always read from disk
+    Block map;
+    if (disk_read(fs->disk, fs->snapshot, map.data) == DISK_FAILURE) {
+        return DISK_FAILURE;
+    }
+    if (map.pointers[index]) {
+        return fs_read_block(fs, map.pointers[index], CACHE_INODE, data);
+    }
+
+    // a block still shared with the live table was not overwritten if it
+    // was not copied for the snapshot before the read finished
+    ssize_t result = disk_read(fs->disk, index + 1, data);
+    if (disk_read(fs->disk, fs->snapshot, map.data) == DISK_FAILURE) {
+        return DISK_FAILURE;
+    }
+    if (map.pointers[index]) {
+        return fs_read_block(fs, map.pointers[index], CACHE_INODE, data);
+    }
+    return result;
+}
+
+// helper function to write meta data (with the snapshot table) to the super block
+bool    fs_save_super(FileSystem *fs) {
+    Block block;
+
+    block_clear_data(&block);
+    block.super = fs->meta_data;
+    return fs_write_block(fs, 0, CACHE_SUPER, block.data) != DISK_FAILURE;
+}
+
+// helper function to find inode blocks still shared with snapshots (and count snapshot references)
+void    fs_snapshot_scan(FileSystem *fs, bool reference) {
+    memset(fs->frozen, 0, fs->meta_data.inode_blocks * sizeof(bool));
+
+    for (uint32_t s = 0; s < SNAPSHOTS_MAX; ++s) {
+        uint32_t m = fs->meta_data.snapshots[s];
+        Block    map;
+        if (!m || m <= fs->meta_data.inode_blocks || m >= fs->meta_data.blocks ||
+            fs_read_block(fs, m, CACHE_INDIRECT, map.data) == DISK_FAILURE) {
+            continue;
+        }
+        if (reference) {
+            fs_mark_block(fs, m, false);
+            fs->refs[m] = 1;
+        }
+
+        for (uint32_t i = 0; i < fs->meta_data.inode_blocks; ++i) {
+            uint32_t copy = map.pointers[i];
+            if (copy >= fs->meta_data.blocks) {
+                continue;
+            }
+            fs->frozen[i] |= !copy;
+            if (!reference) {
+                continue;
+            }
+            if (copy) {
+                fs_mark_block(fs, copy, false);
+                fs->refs[copy]++;
+            }
+
+            Block inodeBlock;
+            fs_read_block(fs, copy ? copy : i + 1, CACHE_INODE, inodeBlock.data);
+
+            uint32_t valid[INODES_PER_BLOCK];
+            size_t   nvalid = simd_nonzero(&inodeBlock.inodes[0].valid, INODES_PER_BLOCK, INODE_WORDS, valid);
+            for (size_t v = 0; v < nvalid; ++v) {
+                fs_reference_inode(fs, &inodeBlock.inodes[valid[v]]);
+            }
+        }
+    }
+}
+
+// helper function to copy inode block index for the snapshots still sharing it (before it changes)
+bool    fs_snapshot_preserve(FileSystem *fs, size_t index) {
+    if (!fs->frozen || !fs->frozen[index]) {
+        return true;
+    }
+
+    Block block;
+    if (fs_read_block(fs, index + 1, CACHE_INODE, block.data) == DISK_FAILURE) {
+        return false;
+    }
+
+    ssize_t copy = fs_allocate_free_block(fs);
+    if (copy >= fs->meta_data.blocks) {
+        return false;
+    }
+    if (fs_write_block(fs, copy, CACHE_INODE, block.data) == DISK_FAILURE) {
+        fs_release_block(fs, copy);
+        return false;
+    }
+
+    // the copy is written before any map points at it, and the maps before the live block changes
+    fs->refs[copy] = 0;
+    for (uint32_t s = 0; s < SNAPSHOTS_MAX; ++s) {
+        uint32_t m = fs->meta_data.snapshots[s];
+        Block    map;
+        if (!m || fs_read_block(fs, m, CACHE_INDIRECT, map.data) == DISK_FAILURE || map.pointers[index]) {
+            continue;
+        }
+        map.pointers[index] = copy;
+        if (fs_write_block(fs, m, CACHE_INDIRECT, map.data) == DISK_FAILURE) {
+            return false;
+        }
+        fs->refs[copy]++;
+    }
+
+    fs->frozen[index] = false;
+    return true;
+}
+
+// helper function to read block through the block cache
+ssize_t fs_read_block(FileSystem *fs, size_t block, int class, char *data) {
+    if (cache_lookup(fs->cache, block, class, data)) {
+        return BLOCK_SIZE;
+    }
+
+    ssize_t result = disk_read(fs->disk, block, data);
+    if (result != DISK_FAILURE) {
+        cache_insert(fs->cache, block, class, data);
+    }
+    return result;
+}
+
+// helper function to read file data block, honoring the inode's reuse advice
+ssize_t fs_read_data_block(FileSystem *fs, size_t inode_number, size_t block, char *data) {
+    if (block == HOLE_BLOCK) {
+        memset(data, 0, BLOCK_SIZE);
+        return BLOCK_SIZE;
+    }
+
+    if (readahead_advice(fs, inode_number) != FS_ADVICE_NOREUSE) {
+        return fs_read_block(fs, block, CACHE_DATA, data);
+    }
+
+    if (cache_lookup(fs->cache, block, CACHE_DATA, data)) {
+        return BLOCK_SIZE;
+    }
+
+    ssize_t result = disk_read(fs->disk, block, data);
+    if (result != DISK_FAILURE) {
+        cache_insert_cold(fs->cache, block, CACHE_DATA, data);
+    }
+    return result;
+}
+
+// helper function to write block to disk and keep the block cache coherent
+ssize_t fs_write_block(FileSystem *fs, size_t block, int class, char *data) {
+    ssize_t result = disk_write(fs->disk, block, data);
+    if (result != DISK_FAILURE) {
+        cache_insert(fs->cache, block, class, data);
+    } else {
+        cache_invalidate(fs->cache, block);
+    }
+    return result;
+}
+
+// helper function to read compressed file data
+ssize_t fs_cluster_read(FileSystem *fs, size_t inode_number, Inode *inode, char *data, size_t length, size_t offset) {
+    ClusterCache *cache = fs->clusters;
+    Block         table;
+
+    if (offset >= inode->size) {
+        return 0;
+    }
+    length = min(length, inode->size - offset);
+
+    if (!inode->indirect) {
+        block_clear_data(&table);
+    } else if (fs_read_block(fs, inode->indirect, CACHE_INDIRECT, table.data) == DISK_FAILURE) {
+        return -1;
+    }
+
+    size_t copied = 0;
+    while (copied < length) {
+        size_t position = offset + copied;
+        size_t index    = position / CLUSTER_SIZE;
+        size_t start    = position % CLUSTER_SIZE;
+        size_t count    = min(CLUSTER_SIZE - start, length - copied);
+
+        // decompress cluster unless it is the one already cached
+        if (!cache->valid || cache->inode_number != inode_number || cache->index != index) {
+            cache->valid = false;
+            if (!fs_cluster_load(fs, inode_number, &table.clusters[index], cache->data)) {
+                return copied ? (ssize_t)copied : -1;
+            }
+            cache->valid        = true;
+            cache->inode_number = inode_number;
+            cache->index        = index;
+        }
+
+        memcpy(data + copied, cache->data + start, count);
+        copied += count;
+    }
+
+    return copied;
+}
+
+// helper function to write compressed file data at offset
+ssize_t fs_cluster_write(FileSystem *fs, size_t inode_number, Inode *inode, char *data, size_t length, size_t offset) {
+    ClusterCache *cache = fs->clusters;
+    size_t        limit = (size_t)CLUSTERS_PER_BLOCK * CLUSTER_SIZE;
+    Block         table;
+
+    if (offset >= limit) {
+        return length ? -1 : 0;
+    }
+    length = min(length, limit - offset);
+
+    // allocate cluster table on first write
+    if (!inode->indirect) {
+        ssize_t block = fs_allocate_free_block(fs);
+        if (block >= fs->meta_data.blocks) {
+            return -1;
+        }
+        block_clear_data(&table);
+        inode->indirect = block;
+        trace_info(TRACE_WRITE_INDIRECT, inode_number, block);
+    } else if (fs_read_block(fs, inode->indirect, CACHE_INDIRECT, table.data) == DISK_FAILURE) {
+        return -1;
+    } else if (fs->refs[inode->indirect] > 1) {
+        // copy on write: give a cloned file its own table that shares every run
+        ssize_t block = fs_allocate_free_block(fs);
+        if (block >= fs->meta_data.blocks) {
+            return -1;
+        }
+        for (uint32_t c = 0; c < CLUSTERS_PER_BLOCK; c++) {
+            if (table.clusters[c].start && fs_cluster_check(fs, &table.clusters[c])) {
+                for (uint32_t b = 0; b < table.clusters[c].blocks; b++) {
+                    fs->refs[table.clusters[c].start + b]++;
+                }
+            }
+        }
+        fs->refs[inode->indirect]--;
+        inode->indirect = block;
+        trace_info(TRACE_WRITE_INDIRECT, inode_number, block);
+    }
+
+    size_t size    = max(inode->size, offset + length);
+    size_t written = 0;
+    while (written < length) {
+        size_t   position = offset + written;
+        size_t   index    = position / CLUSTER_SIZE;
+        size_t   start    = position % CLUSTER_SIZE;
+        size_t   count    = min(CLUSTER_SIZE - start, length - written);
+        size_t   logical  = min(CLUSTER_SIZE, size - index * CLUSTER_SIZE);
+        Cluster *cluster  = &table.clusters[index];
+
+        // merge with existing contents unless the whole cluster is replaced
+        bool cached = cache->valid && cache->inode_number == inode_number && cache->index == index;
+        cache->valid = false;
+        if (start || count < logical) {
+            if (!cached && !fs_cluster_load(fs, inode_number, cluster, cache->data)) {
+                break;
+            }
+        }
+        memcpy(cache->data + start, data + written, count);
+        memset(cache->data + logical, 0, CLUSTER_SIZE - logical);
+
+        if (!fs_cluster_store(fs, inode_number, cluster, cache->data, logical)) {
+            break;
+        }
+        cache->valid        = true;
+        cache->inode_number = inode_number;
+        cache->index        = index;
+        written += count;
+    }
+
+    inode->size = max(inode->size, offset + written);
+    fs_write_block(fs, inode->indirect, CACHE_INDIRECT, table.data);
+    if (!fs_save_inode(fs, inode_number, inode)) {
+        return -1;
+    }
+
+    return (written || !length) ? (ssize_t)written : -1;
+}
+
+// helper function to read the physical run of a cluster (one request on a miss)
+bool    fs_cluster_fetch(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data) {
+    bool cold = readahead_advice(fs, inode_number) == FS_ADVICE_NOREUSE;
+    bool hit  = true;
+
+    for (size_t b = 0; b < cluster->blocks && hit; b++) {
+        hit = cache_lookup(fs->cache, cluster->start + b, CACHE_DATA, data + b * BLOCK_SIZE);
+    }
+    if (hit) {
+        return true;
+    }
+
+    if (disk_readv(fs->disk, cluster->start, cluster->blocks, data) == DISK_FAILURE) {
+        return false;
+    }
+
+    for (size_t b = 0; b < cluster->blocks; b++) {
+        trace_debug(TRACE_READ_BLOCK, inode_number, cluster->start + b);
+        if (cold) {
+            cache_insert_cold(fs->cache, cluster->start + b, CACHE_DATA, data + b * BLOCK_SIZE);
+        } else {
+            cache_insert(fs->cache, cluster->start + b, CACHE_DATA, data + b * BLOCK_SIZE);
+        }
+    }
+    return true;
+}
+
+// helper function to load and decompress a cluster (zero filled to CLUSTER_SIZE)
+bool    fs_cluster_load(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data) {
+    ssize_t length = 0;
+
+    if (!fs_cluster_check(fs, cluster)) {
+        return false;
+    }
+
+    if (cluster->start) {
+        if (cluster->flags & CLUSTER_RAW) {
+            if (!fs_cluster_fetch(fs, inode_number, cluster, data)) {
+                return false;
+            }
+            length = cluster->length;
+        } else {
+            if (!fs_cluster_fetch(fs, inode_number, cluster, fs->clusters->packed)) {
+                return false;
+            }
+            length = lz_decompress(fs->clusters->packed, cluster->length, data, CLUSTER_SIZE);
+            if (length < 0) {
+                fprintf(stderr, "fs_cluster_load: inode %lu: corrupt cluster at block %u\n", inode_number, cluster->start);
+                return false;
+            }
+        }
+    }
+
+    memset(data + length, 0, CLUSTER_SIZE - length);
+    return true;
+}
+
+// helper function to compress a cluster into a newly allocated contiguous run
+bool    fs_cluster_store(FileSystem *fs, size_t inode_number, Cluster *cluster, char *data, size_t length) {
+    size_t      raw_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t      packed     = 0;
+    const char *payload    = data;
+    uint16_t    flags      = CLUSTER_RAW;
+
+    // all-zero cluster becomes a hole: release its run and store nothing
+    if (simd_zero(data, length)) {
+        if (cluster->start && fs_cluster_check(fs, cluster)) {
+            for (size_t b = 0; b < cluster->blocks; b++) {
+                fs_release_block(fs, cluster->start + b);
+            }
+        }
+        memset(cluster, 0, sizeof(Cluster));
+        return true;
+    }
+
+    // keep compressed form only if it saves at least one block
+    if (raw_blocks > 1) {
+        packed = lz_compress(data, length, fs->clusters->packed, (raw_blocks - 1) * BLOCK_SIZE);
+    }
+    if (packed) {
+        payload = fs->clusters->packed;
+        length  = packed;
+        flags   = 0;
+    }
+    size_t blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // release the old run first so the new one may reuse it in place
+    // (a run shared with a clone is not freed here, so it is copied on write)
+    bool old = cluster->start && fs_cluster_check(fs, cluster);
+    if (old) {
+        for (size_t b = 0; b < cluster->blocks; b++) {
+            fs_release_block(fs, cluster->start + b);
+        }
+    }
+
+    ssize_t start = fs_allocate_free_run(fs, blocks);
+    if (start >= fs->meta_data.blocks) {
+        if (old) {
+            for (size_t b = 0; b < cluster->blocks; b++) {
+                fs_mark_block(fs, cluster->start + b, false);
+                fs->refs[cluster->start + b]++;
+            }
+        }
+        return false;
+    }
+
+    for (size_t b = 0; b < blocks; b++) {
+        Block  block;
+        size_t bytes = min(BLOCK_SIZE, length - b * BLOCK_SIZE);
+
+        memcpy(block.data, payload + b * BLOCK_SIZE, bytes);
+        memset(block.data + bytes, 0, BLOCK_SIZE - bytes);
+        trace_debug(TRACE_WRITE_BLOCK, inode_number, start + b);
+        if (fs_write_block(fs, start + b, CACHE_DATA, block.data) == DISK_FAILURE) {
+            return false;
+        }
+    }
+
+    cluster->start  = start;
+    cluster->blocks = blocks;
+    cluster->flags  = flags;
+    cluster->length = length;
+    return true;
+}
+
+// helper function to validate a cluster table entry
+bool    fs_cluster_check(FileSystem *fs, Cluster *cluster) {
+    if (!cluster->start) {
+        return true;
+    }
+
+    return cluster->blocks && cluster->blocks <= CLUSTER_BLOCKS &&
+           cluster->start + cluster->blocks <= fs->meta_data.blocks &&
+           cluster->length <= (size_t)cluster->blocks * BLOCK_SIZE;
+}
+
+// helper function to drop the decompressed cluster of an inode
+void    fs_cluster_forget(FileSystem *fs, size_t inode_number) {
+    if (fs->clusters && fs->clusters->inode_number == inode_number) {
+        fs->clusters->valid = false;
+    }
 }
 
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,239 @@
+/* lz.c: SimpleFS LZ compression codec */
+
+#include "sfs/lz.h"
+#include "sfs/utils.h"
+
+#include <string.h>
+
+/* Internal Constants */
+
+#define LZ_LAST_LITERALS    (5)                 /* Input always ends with this many literals */
+#define LZ_MATCH_LIMIT      (12)                /* No match starts this close to the end */
+#define LZ_SKIP_SHIFT       (6)                 /* Search step grows every 2^n missed bytes */
+
+/* Internal Prototypes */
+
+uint32_t lz_load32(const uint8_t *p);
+uint32_t lz_hash(uint32_t sequence);
+bool    lz_emit(uint8_t **op, uint8_t *oend, const uint8_t *literals, size_t nliterals, size_t offset, size_t match, bool last);
+uint8_t *lz_length(uint8_t *op, size_t length);
+
+/* External Functions */
+
+/**
+ * Compress a buffer into the LZ4 block format by doing the following:
+ *
+ *  1. Hash every 4-byte sequence into a table of recent positions and look
+ *  for an earlier occurrence within LZ_MAX_OFFSET bytes.
+ *
+ *  2. Extend each match backwards and forwards, then emit the pending
+ *  literals followed by the (offset, length) of the match.
+ *
+ *  3. Emit the remaining bytes as a final run of literals.
+ *
+ * Misses make the search step grow, so incompressible data is skipped over
+ * quickly instead of being hashed byte by byte.
+ *
+ * @param       src         Data to compress.
+ * @param       length      Number of bytes in src.
+ * @param       dst         Output buffer.
+ * @param       capacity    Size of output buffer.
+ * @return      Number of compressed bytes (0 if they do not fit in capacity).
+ **/
+size_t  lz_compress(const void *src, size_t length, void *dst, size_t capacity) {
+    const uint8_t *in       = src;
+    const uint8_t *end      = in + length;
+    const uint8_t *ip       = in;
+    const uint8_t *anchor   = in;
+    uint8_t       *op       = dst;
+    uint8_t       *oend     = op + capacity;
+    uint32_t       table[1 << LZ_HASH_BITS];
+
+    if (length > LZ_MATCH_LIMIT) {
+        const uint8_t *mflimit    = end - LZ_MATCH_LIMIT;
+        const uint8_t *matchlimit = end - LZ_LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+        ip++;
+        while (ip < mflimit) {
+            uint32_t       sequence = lz_load32(ip);
+            uint32_t       hash     = lz_hash(sequence);
+            const uint8_t *ref      = in + table[hash];
+            table[hash] = ip - in;
+
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_load32(ref) != sequence) {
+                ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+                continue;
+            }
+
+            // extend match backwards over pending literals, then forwards
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t *mp = ip  + LZ_MIN_MATCH;
+            const uint8_t *rp = ref + LZ_MIN_MATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            if (!lz_emit(&op, oend, anchor, ip - anchor, ip - ref, mp - ip - LZ_MIN_MATCH, false)) {
+                return 0;
+            }
+
+            // index a position inside the match so repeats are found sooner
+            if (mp - 2 > ip) {
+                table[lz_hash(lz_load32(mp - 2))] = mp - 2 - in;
+            }
+            ip = anchor = mp;
+        }
+    }
+
+    if (!lz_emit(&op, oend, anchor, end - anchor, 0, 0, true)) {
+        return 0;
+    }
+
+    return op - (uint8_t *)dst;
+}
+
+/**
+ * Decompress a buffer in the LZ4 block format, validating every length and
+ * offset against the input and output bounds.
+ *
+ * @param       src         Compressed data.
+ * @param       length      Number of bytes in src.
+ * @param       dst         Output buffer.
+ * @param       capacity    Size of output buffer.
+ * @return      Number of decompressed bytes (-1 if the input is corrupt or
+ *              does not fit in capacity).
+ **/
+ssize_t lz_decompress(const void *src, size_t length, void *dst, size_t capacity) {
+    const uint8_t *ip   = src;
+    const uint8_t *iend = ip + length;
+    uint8_t       *op   = dst;
+    uint8_t       *oend = op + capacity;
+
+    while (ip < iend) {
+        uint8_t token    = *ip++;
+        size_t  literals = token >> 4;
+        if (literals == 15) {
+            uint8_t byte;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                byte      = *ip++;
+                literals += byte;
+            } while (byte == 255);
+        }
+
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+
+        // last sequence has no match
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - (uint8_t *)dst)) {
+            return -1;
+        }
+
+        size_t match = token & 15;
+        if (match == 15) {
+            uint8_t byte;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                byte   = *ip++;
+                match += byte;
+            } while (byte == 255);
+        }
+        match += LZ_MIN_MATCH;
+
+        if (match > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        // overlapping matches repeat the last offset bytes: copy one period,
+        // then keep doubling the copied prefix (always a whole number of periods)
+        const uint8_t *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+        } else {
+            memcpy(op, ref, offset);
+            for (size_t done = offset; done < match; done *= 2) {
+                memcpy(op + done, op, min(done, match - done));
+            }
+        }
+        op += match;
+    }
+
+    return op - (uint8_t *)dst;
+}
+
+/* Internal Functions */
+
+// helper function to load four unaligned bytes
+uint32_t lz_load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// helper function to hash a 4-byte sequence (Knuth multiplicative hash)
+uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// helper function to emit a sequence of literals and (unless last) a match
+bool    lz_emit(uint8_t **op, uint8_t *oend, const uint8_t *literals, size_t nliterals, size_t offset, size_t match, bool last) {
+    uint8_t *p = *op;
+
+    if ((size_t)(oend - p) < 1 + nliterals / 255 + 1 + nliterals + 2 + match / 255 + 1) {
+        return false;
+    }
+
+    uint8_t *token = p++;
+    *token = (nliterals < 15 ? nliterals : 15) << 4;
+    if (nliterals >= 15) {
+        p = lz_length(p, nliterals - 15);
+    }
+    memcpy(p, literals, nliterals);
+    p += nliterals;
+
+    if (!last) {
+        *p++ = offset & 0xff;
+        *p++ = offset >> 8;
+        *token |= (match < 15 ? match : 15);
+        if (match >= 15) {
+            p = lz_length(p, match - 15);
+        }
+    }
+
+    *op = p;
+    return true;
+}
+
+// helper function to emit an extended length as a run of 255s plus remainder
+uint8_t *lz_length(uint8_t *op, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,280 @@
+/* metrics.c: SimpleFS Prometheus textfile exporter */
+
+#include "sfs/fs.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/* Internal Prototypes */
+
+void *  metrics_thread(void *arg);
+void    metrics_header(FILE *stream, const char *name, const char *type, const char *help);
+void    metrics_stats(FILE *stream);
+void    metrics_cache(FILE *stream, FileSystem *fs);
+void    metrics_fs(FILE *stream, FileSystem *fs);
+
+/* External Functions */
+
+/**
+ * Export FileSystem metrics in Prometheus text format by doing the following:
+ *
+ *  1. Write operation counters and latency histograms (process-wide).
+ *
+ *  2. Write cache, block, inode and disk I/O metrics (if mounted).
+ *
+ *  3. Atomically rename the temporary file over path, so a collector never
+ *  sees a partially written file.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       path    Path to .prom file.
+ * @return      Whether or not the metrics were written.
+ **/
+bool    fs_metrics_write(FileSystem *fs, const char *path) {
+    if (!fs || !path) {
+        return false;
+    }
+
+    char temp[BUFSIZ];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE *stream = fopen(temp, "w");
+    if (!stream) {
+        fprintf(stderr, "fs_metrics_write: fopen: %s\n", strerror(errno));
+        return false;
+    }
+
+    metrics_stats(stream);
+    if (fs->disk) {
+        metrics_cache(stream, fs);
+        metrics_fs(stream, fs);
+    }
+
+    bool success = !ferror(stream);
+    success = (fclose(stream) == 0) && success;
+    if (success && rename(temp, path) < 0) {
+        fprintf(stderr, "fs_metrics_write: rename: %s\n", strerror(errno));
+        success = false;
+    }
+
+    if (!success) {
+        unlink(temp);
+    }
+
+    return success;
+}
+
+/**
+ * Start exporting FileSystem metrics periodically by doing the following:
+ *
+ *  1. Stop any previous periodic export.
+ *
+ *  2. Start a background thread that writes the metrics file right away and
+ *  then every interval seconds until stopped.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       path        Path to .prom file.
+ * @param       interval    Seconds between exports (METRICS_INTERVAL if 0).
+ * @return      Whether or not the export thread was started.
+ **/
+bool    fs_metrics_start(FileSystem *fs, const char *path, unsigned int interval) {
+    if (!fs || !path) {
+        return false;
+    }
+
+    fs_metrics_stop(fs);
+
+    Metrics *metrics = calloc(1, sizeof(Metrics));
+    if (!metrics) {
+        return false;
+    }
+
+    metrics->path     = strdup(path);
+    metrics->interval = interval ? interval : METRICS_INTERVAL;
+    pthread_mutex_init(&metrics->lock, NULL);
+    pthread_cond_init(&metrics->wakeup, NULL);
+    fs->metrics = metrics;
+
+    if (!metrics->path || pthread_create(&metrics->thread, NULL, metrics_thread, fs) != 0) {
+        fprintf(stderr, "fs_metrics_start: unable to start export thread\n");
+        pthread_cond_destroy(&metrics->wakeup);
+        pthread_mutex_destroy(&metrics->lock);
+        free(metrics->path);
+        free(metrics);
+        fs->metrics = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Stop periodic metrics export (if any) and release its state.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ **/
+void    fs_metrics_stop(FileSystem *fs) {
+    Metrics *metrics = fs ? fs->metrics : NULL;
+    if (!metrics) {
+        return;
+    }
+
+    pthread_mutex_lock(&metrics->lock);
+    metrics->stop = true;
+    pthread_cond_signal(&metrics->wakeup);
+    pthread_mutex_unlock(&metrics->lock);
+    pthread_join(metrics->thread, NULL);
+
+    pthread_cond_destroy(&metrics->wakeup);
+    pthread_mutex_destroy(&metrics->lock);
+    free(metrics->path);
+    free(metrics);
+    fs->metrics = NULL;
+}
+
+/* Internal Functions */
+
+// helper function to export metrics every interval until stopped
+void *  metrics_thread(void *arg) {
+    FileSystem *fs      = arg;
+    Metrics    *metrics = fs->metrics;
+
+    pthread_mutex_lock(&metrics->lock);
+    while (!metrics->stop) {
+        pthread_mutex_unlock(&metrics->lock);
+        if (fs_metrics_write(fs, metrics->path)) {
+            metrics->exports++;
+        }
+        pthread_mutex_lock(&metrics->lock);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += metrics->interval;
+        while (!metrics->stop) {
+            if (pthread_cond_timedwait(&metrics->wakeup, &metrics->lock, &deadline) != 0) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&metrics->lock);
+    return NULL;
+}
+
+// helper function to write HELP and TYPE lines of a metric family
+void    metrics_header(FILE *stream, const char *name, const char *type, const char *help) {
+    fprintf(stream, "# HELP %s %s\n", name, help);
+    fprintf(stream, "# TYPE %s %s\n", name, type);
+}
+
+// helper function to write operation counters and latency histograms
+void    metrics_stats(FILE *stream) {
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t      offset;
+    } counters[] = {
+        {"sfs_operations_total",            "Number of operations.",                        offsetof(StatsOp, count)},
+        {"sfs_operation_errors_total",      "Number of failed operations.",                 offsetof(StatsOp, errors)},
+        {"sfs_operation_bytes_total",       "Number of bytes moved by operations.",         offsetof(StatsOp, bytes)},
+        {"sfs_operation_disk_reads_total",  "Number of disk reads issued by operations.",   offsetof(StatsOp, disk_reads)},
+        {"sfs_operation_disk_writes_total", "Number of disk writes issued by operations.",  offsetof(StatsOp, disk_writes)},
+    };
+
+    Stats stats;
+    stats_collect(&stats);
+
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+        metrics_header(stream, counters[c].name, "counter", counters[c].help);
+        for (int op = 0; op < STATS_OPS; op++) {
+            uint64_t value = *(uint64_t *)((char *)&stats.ops[op] + counters[c].offset);
+            fprintf(stream, "%s{op=\"%s\"} %lu\n", counters[c].name, stats_name(op), value);
+        }
+    }
+
+    // bucket b holds latencies in [2^b, 2^(b+1)) ns; the last bucket is open ended
+    metrics_header(stream, "sfs_operation_duration_seconds", "histogram", "Latency of operations.");
+    for (int op = 0; op < STATS_OPS; op++) {
+        StatsOp *stat       = &stats.ops[op];
+        uint64_t cumulative = 0;
+
+        for (int b = 0; b < STATS_BUCKETS - 1; b++) {
+            cumulative += stat->histogram[b];
+            fprintf(stream, "sfs_operation_duration_seconds_bucket{op=\"%s\",le=\"%.9g\"} %lu\n",
+                stats_name(op), (double)(2ULL << b) / 1e9, cumulative);
+        }
+        fprintf(stream, "sfs_operation_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n", stats_name(op), stat->count);
+        fprintf(stream, "sfs_operation_duration_seconds_sum{op=\"%s\"} %.9f\n", stats_name(op), stat->total_ns / 1e9);
+        fprintf(stream, "sfs_operation_duration_seconds_count{op=\"%s\"} %lu\n", stats_name(op), stat->count);
+    }
+}
+
+// helper function to write block cache metrics
+void    metrics_cache(FILE *stream, FileSystem *fs) {
+    static const char *classes[] = {"super", "inode", "indirect", "data"};
+
+    if (!fs->cache) {
+        return;
+    }
+
+    CacheStats stats[CACHE_CLASSES];
+    pthread_mutex_lock(&fs->cache->lock);
+    memcpy(stats, fs->cache->stats, sizeof(stats));
+    pthread_mutex_unlock(&fs->cache->lock);
+
+    metrics_header(stream, "sfs_cache_capacity_blocks", "gauge", "Maximum number of cached blocks.");
+    fprintf(stream, "sfs_cache_capacity_blocks %lu\n", fs->cache->capacity);
+
+    metrics_header(stream, "sfs_cache_resident_blocks", "gauge", "Number of cached blocks.");
+    for (int c = 0; c < CACHE_CLASSES; c++) {
+        fprintf(stream, "sfs_cache_resident_blocks{class=\"%s\"} %lu\n", classes[c], stats[c].resident);
+    }
+
+    metrics_header(stream, "sfs_cache_hits_total", "counter", "Number of cache lookup hits.");
+    for (int c = 0; c < CACHE_CLASSES; c++) {
+        fprintf(stream, "sfs_cache_hits_total{class=\"%s\"} %lu\n", classes[c], stats[c].hits);
+    }
+
+    metrics_header(stream, "sfs_cache_misses_total", "counter", "Number of cache lookup misses.");
+    for (int c = 0; c < CACHE_CLASSES; c++) {
+        fprintf(stream, "sfs_cache_misses_total{class=\"%s\"} %lu\n", classes[c], stats[c].misses);
+    }
+
+    if (fs->readahead) {
+        metrics_header(stream, "sfs_readahead_blocks_total", "counter", "Number of blocks prefetched by readahead.");
+        fprintf(stream, "sfs_readahead_blocks_total %lu\n", fs->readahead->issued);
+    }
+}
+
+// helper function to write block, inode and disk I/O metrics
+void    metrics_fs(FILE *stream, FileSystem *fs) {
+    // the foreground allocates and frees blocks concurrently
+    size_t free_blocks = 0;
+    for (uint32_t b = 0; fs->free_blocks && b < fs->meta_data.blocks; b++) {
+        free_blocks += __atomic_load_n(&fs->free_blocks[b], __ATOMIC_RELAXED);
+    }
+
+    // use the count kept by the file system, as reading the inode table here
+    // would add to the cache and disk statistics this exports
+    size_t free_inodes = __atomic_load_n(&fs->free_inodes, __ATOMIC_RELAXED);
+
+    metrics_header(stream, "sfs_blocks", "gauge", "Number of blocks in file system.");
+    fprintf(stream, "sfs_blocks %u\n", fs->meta_data.blocks);
+    metrics_header(stream, "sfs_free_blocks", "gauge", "Number of free blocks.");
+    fprintf(stream, "sfs_free_blocks %lu\n", free_blocks);
+    metrics_header(stream, "sfs_inodes", "gauge", "Number of inodes in file system.");
+    fprintf(stream, "sfs_inodes %u\n", fs->meta_data.inodes);
+    metrics_header(stream, "sfs_free_inodes", "gauge", "Number of free inodes.");
+    fprintf(stream, "sfs_free_inodes %lu\n", free_inodes);
+
+    metrics_header(stream, "sfs_disk_reads_total", "counter", "Number of blocks read from disk.");
+    fprintf(stream, "sfs_disk_reads_total %lu\n", fs->disk->reads);
+    metrics_header(stream, "sfs_disk_writes_total", "counter", "Number of blocks written to disk.");
+    fprintf(stream, "sfs_disk_writes_total %lu\n", fs->disk->writes);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
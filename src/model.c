@@ -0,0 +1,274 @@
+/* model.c: SimpleFS simulated device timing */
+
+#include "sfs/model.h"
+#include "sfs/disk.h"
+#include "sfs/utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Internal Prototypes */
+
+uint64_t    model_hdd(DiskModel *model, size_t block, size_t count);
+uint64_t    model_ssd(DiskModel *model, size_t block, size_t count, bool write);
+uint64_t    model_bandwidth(DiskModel *model, size_t count);
+
+/* External Functions */
+
+/**
+ * Create device timing model with default parameters.
+ *
+ * @param       type        Device type (MODEL_*).
+ * @return      Newly allocated DiskModel (NULL on failure).
+ **/
+DiskModel * model_create(int type) {
+    if (type != MODEL_HDD && type != MODEL_SSD) {
+        return NULL;
+    }
+
+    DiskModel *model = calloc(1, sizeof(DiskModel));
+    if (!model) {
+        return NULL;
+    }
+
+    model->type        = type;
+    model->rpm         = MODEL_HDD_RPM;
+    model->track       = MODEL_HDD_TRACK;
+    model->seek_min_ns = MODEL_HDD_SEEK_MIN * 1000ULL;
+    model->seek_max_ns = MODEL_HDD_SEEK_MAX * 1000ULL;
+    model->read_ns     = MODEL_SSD_READ * 1000ULL;
+    model->write_ns    = MODEL_SSD_WRITE * 1000ULL;
+    model->channels    = MODEL_SSD_CHANNELS;
+    pthread_mutex_init(&model->lock, NULL);
+    return model;
+}
+
+/**
+ * Create device timing model from a specification of the form
+ * TYPE[:KEY=VALUE,...] by doing the following:
+ *
+ *  1. Create model of TYPE (hdd or ssd) with default parameters.
+ *
+ *  2. Override parameters: rpm, track (blocks), seek_min and seek_max (us),
+ *  read and write (us per page), channels, and bandwidth (MB/s).
+ *
+ * @param       spec        Model specification (e.g. "hdd:rpm=5400").
+ * @return      Newly allocated DiskModel (NULL on invalid specification).
+ **/
+DiskModel * model_parse(const char *spec) {
+    size_t     length = strcspn(spec, ":");
+    DiskModel *model  = NULL;
+
+    if (length == 3 && strncmp(spec, "hdd", 3) == 0) {
+        model = model_create(MODEL_HDD);
+    } else if (length == 3 && strncmp(spec, "ssd", 3) == 0) {
+        model = model_create(MODEL_SSD);
+    }
+
+    if (!model) {
+        fprintf(stderr, "model_parse: unknown device type: %.*s\n", (int)length, spec);
+        return NULL;
+    }
+
+    char *list = strdup(spec[length] ? spec + length + 1 : "");
+    bool  valid = list != NULL;
+    for (char *pair = strtok(list, ","); valid && pair; pair = strtok(NULL, ",")) {
+        char *equals = strchr(pair, '=');
+        if (!equals) {
+            valid = false;
+            break;
+        }
+        *equals = 0;
+
+        uint64_t value = strtoull(equals + 1, NULL, 10);
+        if (strcmp(pair, "rpm") == 0) {
+            model->rpm = value;
+        } else if (strcmp(pair, "track") == 0) {
+            model->track = value;
+        } else if (strcmp(pair, "seek_min") == 0) {
+            model->seek_min_ns = value * 1000;
+        } else if (strcmp(pair, "seek_max") == 0) {
+            model->seek_max_ns = value * 1000;
+        } else if (strcmp(pair, "read") == 0) {
+            model->read_ns = value * 1000;
+        } else if (strcmp(pair, "write") == 0) {
+            model->write_ns = value * 1000;
+        } else if (strcmp(pair, "channels") == 0) {
+            model->channels = value;
+        } else if (strcmp(pair, "bandwidth") == 0) {
+            model->bandwidth = value << 20;
+        } else {
+            valid = false;
+        }
+    }
+    free(list);
+
+    valid = valid && model->rpm && model->track && model->seek_min_ns <= model->seek_max_ns &&
+            model->channels && model->channels <= MODEL_SSD_MAX_CHANNELS;
+    if (!valid) {
+        fprintf(stderr, "model_parse: invalid device parameters: %s\n", spec);
+        model_delete(model);
+        return NULL;
+    }
+
+    return model;
+}
+
+/**
+ * Release device timing model.
+ *
+ * @param       model       Pointer to DiskModel structure.
+ **/
+void        model_delete(DiskModel *model) {
+    if (!model) {
+        return;
+    }
+
+    pthread_mutex_destroy(&model->lock);
+    free(model);
+}
+
+/**
+ * Account for a request of count contiguous blocks by doing the following:
+ *
+ *  1. Compute its service time on the modeled device, starting at the
+ *  current simulated time (requests are serviced one at a time, like the
+ *  synchronous Disk calls they model).
+ *
+ *  2. Advance the simulated clock and update the counters.
+ *
+ * Nothing sleeps: the result only depends on the sequence of requests, so
+ * layout changes can be compared deterministically.
+ *
+ * @param       model       Pointer to DiskModel structure (NULL to ignore).
+ * @param       block       First block of request.
+ * @param       count       Number of blocks in request.
+ * @param       write       Whether request is a write.
+ * @return      Simulated service time of request (ns).
+ **/
+uint64_t    model_access(DiskModel *model, size_t block, size_t count, bool write) {
+    if (!model || !count) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&model->lock);
+    uint64_t service = (model->type == MODEL_HDD) ? model_hdd(model, block, count) :
+                                                    model_ssd(model, block, count, write);
+
+    model->clock_ns     += service;
+    model->busy_ns      += service;
+    model->max_ns        = max(model->max_ns, service);
+    model->requests     += 1;
+    model->blocks_moved += count;
+    pthread_mutex_unlock(&model->lock);
+
+    return service;
+}
+
+/**
+ * Reset simulated clock, device state and counters (parameters are kept).
+ *
+ * @param       model       Pointer to DiskModel structure.
+ **/
+void        model_reset(DiskModel *model) {
+    if (!model) {
+        return;
+    }
+
+    pthread_mutex_lock(&model->lock);
+    model->clock_ns     = 0;
+    model->head         = 0;
+    model->requests     = 0;
+    model->blocks_moved = 0;
+    model->seeks        = 0;
+    model->seek_ns      = 0;
+    model->rotation_ns  = 0;
+    model->transfer_ns  = 0;
+    model->busy_ns      = 0;
+    model->max_ns       = 0;
+    memset(model->channel_ns, 0, sizeof(model->channel_ns));
+    pthread_mutex_unlock(&model->lock);
+}
+
+/**
+ * Write one line summary of simulated device time to stream.
+ *
+ * @param       model       Pointer to DiskModel structure.
+ * @param       stream      Output stream.
+ **/
+void        model_report(DiskModel *model, FILE *stream) {
+    if (!model) {
+        return;
+    }
+
+    pthread_mutex_lock(&model->lock);
+    fprintf(stream, "device   %s: %lu requests, %lu blocks, %.3f ms simulated (avg %.1f us, max %.1f us)",
+        model->type == MODEL_HDD ? "hdd" : "ssd", model->requests, model->blocks_moved,
+        model->busy_ns / 1e6, model->requests ? model->busy_ns / 1e3 / model->requests : 0.0,
+        model->max_ns / 1e3);
+    if (model->type == MODEL_HDD) {
+        fprintf(stream, ", %lu seeks: seek %.3f ms, rotation %.3f ms, transfer %.3f ms",
+            model->seeks, model->seek_ns / 1e6, model->rotation_ns / 1e6, model->transfer_ns / 1e6);
+    }
+    fprintf(stream, "\n");
+    pthread_mutex_unlock(&model->lock);
+}
+
+/* Internal Functions */
+
+// helper function to time a request on a spinning disk (seek, rotation, transfer)
+uint64_t    model_hdd(DiskModel *model, size_t block, size_t count) {
+    uint64_t period = 60000000000ULL / model->rpm;
+    size_t   tracks = max(model->blocks / model->track, 1);
+    size_t   from   = model->head / model->track;
+    size_t   to     = block / model->track;
+
+    // seek time grows with the square root of the distance
+    uint64_t seek = 0;
+    if (from != to) {
+        double distance = (double)(from > to ? from - to : to - from) / tracks;
+        seek = model->seek_min_ns + (uint64_t)((model->seek_max_ns - model->seek_min_ns) * sqrt(distance));
+        model->seeks++;
+    }
+
+    // wait for the first block to rotate under the head
+    uint64_t angle    = (model->clock_ns + seek) % period;
+    uint64_t target   = (block % model->track) * period / model->track;
+    uint64_t rotation = (target + period - angle) % period;
+
+    uint64_t transfer = max(count * period / model->track, model_bandwidth(model, count));
+
+    model->head         = block + count;
+    model->seek_ns     += seek;
+    model->rotation_ns += rotation;
+    model->transfer_ns += transfer;
+    return seek + rotation + transfer;
+}
+
+// helper function to time a request on flash (pages striped over channels)
+uint64_t    model_ssd(DiskModel *model, size_t block, size_t count, bool write) {
+    uint64_t issue    = model->clock_ns;
+    uint64_t complete = issue;
+    uint64_t latency  = write ? model->write_ns : model->read_ns;
+
+    for (size_t b = block; b < block + count; b++) {
+        uint64_t *channel = &model->channel_ns[b % model->channels];
+        *channel = max(*channel, issue) + latency;
+        complete = max(complete, *channel);
+    }
+
+    complete = max(complete, issue + model_bandwidth(model, count));
+    model->transfer_ns += complete - issue;
+    return complete - issue;
+}
+
+// helper function to compute minimum transfer time under bandwidth cap
+uint64_t    model_bandwidth(DiskModel *model, size_t count) {
+    if (!model->bandwidth) {
+        return 0;
+    }
+    return (uint64_t)count * BLOCK_SIZE * 1000000000ULL / model->bandwidth;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,537 @@
+/* queue.c: SimpleFS disk request queue */
+
+#include "sfs/queue.h"
+#include "sfs/disk.h"
+#include "sfs/stats.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/uio.h>
+
+/* Internal Constants */
+
+static const int Classes[QUEUE_CLASSES] = {     /* Classes in dispatch order */
+    QUEUE_CLASS_RT, QUEUE_CLASS_BE, QUEUE_CLASS_IDLE,
+};
+
+/* Internal Globals */
+
+static __thread int Priority = QUEUE_CLASS_BE;  /* Priority class of calling thread */
+
+/* Internal Prototypes */
+
+void            queue_dispatch(DiskQueue *queue, DiskRequest *request);
+ssize_t         queue_pick(DiskQueue *queue, uint64_t *wake);
+ssize_t         queue_choose(DiskQueue *queue, int priority, uint64_t now);
+ssize_t         queue_next(DiskQueue *queue, size_t block, bool write, int priority, size_t room);
+bool            queue_blocked(DiskQueue *queue, DiskRequest *request);
+DiskRequest *   queue_take(DiskQueue *queue, size_t index);
+uint64_t        queue_refill(QueueBucket *bucket, uint64_t now);
+void            queue_charge(QueueBucket *bucket, size_t bytes);
+
+/* External Functions */
+
+/**
+ * Create disk request queue.
+ *
+ * @param       policy      Dispatch policy (QUEUE_FIFO or QUEUE_* flags).
+ * @return      Newly allocated DiskQueue (NULL on failure).
+ **/
+DiskQueue * queue_create(int policy) {
+    DiskQueue *queue = calloc(1, sizeof(DiskQueue));
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->policy            = policy;
+    queue->read_deadline_ns  = QUEUE_READ_DEADLINE * 1000000ULL;
+    queue->write_deadline_ns = QUEUE_WRITE_DEADLINE * 1000000ULL;
+    pthread_mutex_init(&queue->lock, NULL);
+
+    // throttled dispatchers sleep until a stats_now() time, so use its clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->completed, &attr);
+    pthread_condattr_destroy(&attr);
+    return queue;
+}
+
+/**
+ * Create disk request queue from policy name: fifo, merge (fifo with
+ * merging), cscan (merging and C-SCAN) or deadline (cscan with deadlines).
+ *
+ * @param       spec        Policy name.
+ * @return      Newly allocated DiskQueue (NULL on unknown policy).
+ **/
+DiskQueue * queue_parse(const char *spec) {
+    static const int policies[] = {
+        QUEUE_FIFO,
+        QUEUE_MERGE,
+        QUEUE_MERGE | QUEUE_CSCAN,
+        QUEUE_MERGE | QUEUE_CSCAN | QUEUE_DEADLINE,
+    };
+
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        if (strcmp(spec, queue_name(policies[p])) == 0) {
+            return queue_create(policies[p]);
+        }
+    }
+
+    fprintf(stderr, "queue_parse: unknown policy: %s\n", spec);
+    return NULL;
+}
+
+/**
+ * Release disk request queue (which must have no pending requests).
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ **/
+void        queue_delete(DiskQueue *queue) {
+    if (!queue) {
+        return;
+    }
+
+    pthread_cond_destroy(&queue->completed);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->pending);
+    free(queue);
+}
+
+/**
+ * Submit request without waiting for it, so a caller can queue a batch of
+ * requests before the first queue_wait dispatches them together.
+ *
+ * Requests that overlap an older pending request are never dispatched ahead
+ * of it if either one is a write.
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ * @param       request     Request with block, count, data, write and
+ *                          priority set (must stay valid until queue_wait
+ *                          returns).
+ **/
+void        queue_submit(DiskQueue *queue, DiskRequest *request) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        size_t        capacity = max(queue->capacity * 2, 16);
+        DiskRequest **pending  = realloc(queue->pending, capacity * sizeof(DiskRequest *));
+        if (!pending) {
+            // fail the request rather than lose it (queue_wait returns at once)
+            fprintf(stderr, "queue_submit: realloc: %s\n", strerror(errno));
+            request->result = DISK_FAILURE;
+            request->done   = true;
+            pthread_mutex_unlock(&queue->lock);
+            return;
+        }
+        queue->pending  = pending;
+        queue->capacity = capacity;
+    }
+
+    request->sequence  = queue->sequence++;
+    request->submitted = stats_now();
+    request->deadline  = request->submitted + (request->write ? queue->write_deadline_ns : queue->read_deadline_ns);
+    request->result    = DISK_FAILURE;
+    request->done      = false;
+    if (request->priority < 0 || request->priority >= QUEUE_CLASSES) {
+        request->priority = QUEUE_CLASS_BE;
+    }
+
+    queue->pending[queue->count++] = request;
+    queue->stats.submitted++;
+    queue->stats.classes[request->priority].submitted++;
+    queue->stats.max_depth = max(queue->stats.max_depth, queue->count);
+
+    // wake a throttled dispatcher so a higher class does not wait for tokens
+    pthread_cond_broadcast(&queue->completed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Wait for request to complete by doing the following:
+ *
+ *  1. If no other thread is dispatching, dispatch pending requests (highest
+ *  priority class with tokens first, then in policy order, merging adjacent
+ *  ones) until the request has completed.
+ *
+ *  2. Otherwise, sleep until the dispatching thread completes the request,
+ *  or hands dispatching over after completing its own.
+ *
+ * A dispatcher never keeps serving other threads' requests once its own is
+ * done, so a foreground request is not held up behind background I/O; the
+ * next waiter (or the next submitter to wait) dispatches the rest.
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ * @param       request     Submitted request.
+ * @return      Number of bytes transferred (DISK_FAILURE on failure).
+ **/
+ssize_t     queue_wait(DiskQueue *queue, DiskRequest *request) {
+    pthread_mutex_lock(&queue->lock);
+    while (!request->done) {
+        if (!queue->dispatching) {
+            queue->dispatching = true;
+            queue_dispatch(queue, request);
+            queue->dispatching = false;
+            pthread_cond_broadcast(&queue->completed);
+        } else {
+            pthread_cond_wait(&queue->completed, &queue->lock);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return request->result;
+}
+
+/**
+ * Submit a single request in the priority class of the calling thread and
+ * wait for it.
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ * @param       block       First block.
+ * @param       count       Number of blocks.
+ * @param       data        Data buffer (count * BLOCK_SIZE).
+ * @param       write       Whether to write (true) or read (false).
+ * @return      Number of bytes transferred (DISK_FAILURE on failure).
+ **/
+ssize_t     queue_transfer(DiskQueue *queue, size_t block, size_t count, char *data, bool write) {
+    DiskRequest request = {.block = block, .count = count, .data = data, .write = write, .priority = Priority};
+    queue_submit(queue, &request);
+    return queue_wait(queue, &request);
+}
+
+/**
+ * Limit rate of priority class with a token bucket that holds QUEUE_BURST ms
+ * worth of its rate.  Throttled requests stay pending (they never fail) and
+ * lower classes may be dispatched meanwhile.
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ * @param       priority    Priority class (QUEUE_CLASS_*).
+ * @param       iops        I/Os per second (0 for no limit).
+ * @param       bandwidth   Bytes per second (0 for no limit).
+ **/
+void        queue_limit(DiskQueue *queue, int priority, uint64_t iops, uint64_t bandwidth) {
+    if (priority < 0 || priority >= QUEUE_CLASSES) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    QueueBucket *bucket = &queue->buckets[priority];
+    bucket->iops        = iops;
+    bucket->bandwidth   = bandwidth;
+    bucket->io_tokens   = max(iops * QUEUE_BURST / 1000.0, 1.0);
+    bucket->byte_tokens = max(bandwidth * QUEUE_BURST / 1000.0, (double)BLOCK_SIZE);
+    bucket->refilled    = stats_now();
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Copy queue statistics.
+ *
+ * @param       queue       Pointer to DiskQueue structure.
+ * @param       stats       QueueStats structure to fill.
+ **/
+void        queue_stats(DiskQueue *queue, QueueStats *stats) {
+    pthread_mutex_lock(&queue->lock);
+    *stats = queue->stats;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Return name of policy.
+ *
+ * @param       policy      Dispatch policy (QUEUE_* flags).
+ * @return      Name of policy ("custom" for other flag combinations).
+ **/
+const char *queue_name(int policy) {
+    switch (policy) {
+        case QUEUE_FIFO:                                    return "fifo";
+        case QUEUE_MERGE:                                   return "merge";
+        case QUEUE_MERGE | QUEUE_CSCAN:                     return "cscan";
+        case QUEUE_MERGE | QUEUE_CSCAN | QUEUE_DEADLINE:    return "deadline";
+        default:                                            return "custom";
+    }
+}
+
+/**
+ * Set priority class of I/O issued by the calling thread.
+ *
+ * @param       priority    Priority class (QUEUE_CLASS_*).
+ * @return      Previous priority class (-1 on invalid class).
+ **/
+int         queue_set_priority(int priority) {
+    if (priority < 0 || priority >= QUEUE_CLASSES) {
+        return -1;
+    }
+
+    int previous = Priority;
+    Priority = priority;
+    return previous;
+}
+
+/**
+ * Return priority class of I/O issued by the calling thread.
+ *
+ * @return      Priority class (QUEUE_CLASS_*).
+ **/
+int         queue_priority(void) {
+    return Priority;
+}
+
+/**
+ * Return name of priority class.
+ *
+ * @param       priority    Priority class (QUEUE_CLASS_*).
+ * @return      Name of class ("unknown" for invalid classes).
+ **/
+const char *queue_class_name(int priority) {
+    switch (priority) {
+        case QUEUE_CLASS_RT:    return "rt";
+        case QUEUE_CLASS_BE:    return "be";
+        case QUEUE_CLASS_IDLE:  return "idle";
+        default:                return "unknown";
+    }
+}
+
+/* Internal Functions */
+
+// helper function to dispatch pending requests until request is done (caller holds lock)
+void        queue_dispatch(DiskQueue *queue, DiskRequest *request) {
+    DiskRequest *run[QUEUE_MERGE_MAX];
+    struct iovec iov[QUEUE_MERGE_MAX];
+
+    while (queue->count && !request->done) {
+        uint64_t wake = 0;
+        ssize_t  pick = queue_pick(queue, &wake);
+
+        // every eligible class is out of tokens: sleep until one refills or
+        // a request arrives
+        if (pick < 0) {
+            struct timespec until = {wake / 1000000000ULL, wake % 1000000000ULL};
+            uint64_t        start = stats_now();
+            pthread_cond_timedwait(&queue->completed, &queue->lock, &until);
+            queue->stats.throttled_ns += stats_now() - start;
+            continue;
+        }
+
+        size_t n        = 0;
+        run[n++]        = queue_take(queue, pick);
+        size_t end      = run[0]->block + run[0]->count;
+        bool   write    = run[0]->write;
+        int    priority = run[0]->priority;
+
+        // extend run with requests of the same class that start where it ends
+        // (a single request may already be larger than the merge limit)
+        while ((queue->policy & QUEUE_MERGE) && n < QUEUE_MERGE_MAX) {
+            size_t span = end - run[0]->block;
+            size_t room = span >= QUEUE_MERGE_MAX ? 0 : QUEUE_MERGE_MAX - span;
+            if (!room) {
+                break;
+            }
+
+            ssize_t next = queue_next(queue, end, write, priority, room);
+            if (next < 0) {
+                break;
+            }
+            run[n++] = queue_take(queue, next);
+            end     += run[n - 1]->count;
+            queue->stats.merges++;
+        }
+
+        QueueClassStats *stats = &queue->stats.classes[priority];
+        uint64_t         now   = stats_now();
+        for (size_t i = 0; i < n; i++) {
+            uint64_t wait = now - run[i]->submitted;
+            queue->stats.total_wait_ns += wait;
+            queue->stats.max_wait_ns    = max(queue->stats.max_wait_ns, wait);
+            stats->total_wait_ns       += wait;
+            stats->max_wait_ns          = max(stats->max_wait_ns, wait);
+            iov[i].iov_base = run[i]->data;
+            iov[i].iov_len  = run[i]->count * BLOCK_SIZE;
+        }
+        queue->stats.dispatched++;
+        stats->dispatched++;
+        queue->cursor = end;
+        queue_charge(&queue->buckets[priority], (end - run[0]->block) * BLOCK_SIZE);
+
+        pthread_mutex_unlock(&queue->lock);
+        ssize_t result = disk_transferv(queue->disk, run[0]->block, iov, n, write);
+        pthread_mutex_lock(&queue->lock);
+
+        for (size_t i = 0; i < n; i++) {
+            run[i]->result = (result == DISK_FAILURE) ? DISK_FAILURE : (ssize_t)(run[i]->count * BLOCK_SIZE);
+            run[i]->done   = true;
+        }
+        pthread_cond_broadcast(&queue->completed);
+    }
+}
+
+// helper function to choose index of next request to dispatch from the
+// highest class with tokens, or -1 and the time tokens arrive (caller holds lock)
+ssize_t     queue_pick(DiskQueue *queue, uint64_t *wake) {
+    uint64_t now = stats_now();
+    bool     pending[QUEUE_CLASSES] = {false};
+    for (size_t i = 0; i < queue->count; i++) {
+        pending[queue->pending[i]->priority] = true;
+    }
+
+    for (size_t c = 0; c < QUEUE_CLASSES; c++) {
+        int priority = Classes[c];
+        if (!pending[priority]) {
+            continue;
+        }
+
+        uint64_t ready = queue_refill(&queue->buckets[priority], now);
+        if (ready > now) {
+            queue->stats.classes[priority].throttled++;
+            *wake = *wake ? min(*wake, ready) : ready;
+            continue;
+        }
+
+        ssize_t pick = queue_choose(queue, priority, now);
+        if (pick >= 0) {
+            return pick;
+        }
+    }
+
+    return -1;
+}
+
+// helper function to choose index of next request of class by policy, or -1
+// if all of its requests are blocked (caller holds lock)
+ssize_t     queue_choose(DiskQueue *queue, int priority, uint64_t now) {
+    ssize_t oldest = -1;
+    for (size_t i = 0; i < queue->count; i++) {
+        DiskRequest *request = queue->pending[i];
+        if (request->priority == priority && !queue_blocked(queue, request) &&
+            (oldest < 0 || request->sequence < queue->pending[oldest]->sequence)) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return -1;
+    }
+
+    ssize_t pick = -1;
+
+    // expired requests go first, earliest deadline first
+    if (queue->policy & QUEUE_DEADLINE) {
+        for (size_t i = 0; i < queue->count; i++) {
+            DiskRequest *request = queue->pending[i];
+            if (request->priority == priority && request->deadline <= now && !queue_blocked(queue, request) &&
+                (pick < 0 || request->deadline < queue->pending[pick]->deadline)) {
+                pick = i;
+            }
+        }
+        if (pick >= 0) {
+            queue->stats.expired++;
+        }
+    }
+
+    // otherwise the lowest block at or after the cursor, wrapping to the lowest block
+    if (pick < 0 && (queue->policy & QUEUE_CSCAN)) {
+        ssize_t wrap = -1;
+        for (size_t i = 0; i < queue->count; i++) {
+            DiskRequest *request = queue->pending[i];
+            if (request->priority != priority || queue_blocked(queue, request)) {
+                continue;
+            }
+            if (request->block >= queue->cursor && (pick < 0 || request->block < queue->pending[pick]->block)) {
+                pick = i;
+            }
+            if (wrap < 0 || request->block < queue->pending[wrap]->block) {
+                wrap = i;
+            }
+        }
+        pick = (pick >= 0) ? pick : wrap;
+    }
+
+    if (pick < 0) {
+        pick = oldest;
+    }
+
+    // count requests passed over, whatever their class
+    for (size_t i = 0; i < queue->count; i++) {
+        if (queue->pending[i]->sequence < queue->pending[pick]->sequence) {
+            queue->stats.reorders++;
+            break;
+        }
+    }
+    return pick;
+}
+
+// helper function to find request starting at block that can join a run (caller holds lock)
+ssize_t     queue_next(DiskQueue *queue, size_t block, bool write, int priority, size_t room) {
+    for (size_t i = 0; i < queue->count; i++) {
+        DiskRequest *request = queue->pending[i];
+        if (request->block == block && request->write == write && request->priority == priority &&
+            request->count <= room &&
+            !queue_blocked(queue, request)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// helper function to check if an older conflicting request is still pending (caller holds lock)
+bool        queue_blocked(DiskQueue *queue, DiskRequest *request) {
+    for (size_t i = 0; i < queue->count; i++) {
+        DiskRequest *other = queue->pending[i];
+        if (other->sequence < request->sequence && (other->write || request->write) &&
+            other->block < request->block + request->count &&
+            request->block < other->block + other->count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// helper function to remove request from pending set (caller holds lock)
+DiskRequest *   queue_take(DiskQueue *queue, size_t index) {
+    DiskRequest *request  = queue->pending[index];
+    queue->pending[index] = queue->pending[--queue->count];
+    return request;
+}
+
+// helper function to add tokens earned since last refill and return when the
+// bucket allows another I/O
+uint64_t    queue_refill(QueueBucket *bucket, uint64_t now) {
+    if (!bucket->iops && !bucket->bandwidth) {
+        return now;
+    }
+
+    double elapsed   = (now - bucket->refilled) / 1e9;
+    bucket->refilled = now;
+
+    uint64_t ready = now;
+    if (bucket->iops) {
+        bucket->io_tokens = min(bucket->io_tokens + elapsed * bucket->iops,
+                                max(bucket->iops * QUEUE_BURST / 1000.0, 1.0));
+        if (bucket->io_tokens < 1.0) {
+            ready = max(ready, now + (uint64_t)((1.0 - bucket->io_tokens) * 1e9 / bucket->iops) + 1);
+        }
+    }
+
+    // bytes may be overdrawn by one I/O, which the bucket then pays back
+    if (bucket->bandwidth) {
+        bucket->byte_tokens = min(bucket->byte_tokens + elapsed * bucket->bandwidth,
+                                  max(bucket->bandwidth * QUEUE_BURST / 1000.0, (double)BLOCK_SIZE));
+        if (bucket->byte_tokens <= 0.0) {
+            ready = max(ready, now + (uint64_t)(-bucket->byte_tokens * 1e9 / bucket->bandwidth) + 1);
+        }
+    }
+    return ready;
+}
+
+// helper function to take tokens for one dispatched I/O of bytes
+void        queue_charge(QueueBucket *bucket, size_t bytes) {
+    if (bucket->iops) {
+        bucket->io_tokens -= 1.0;
+    }
+    if (bucket->bandwidth) {
+        bucket->byte_tokens -= bytes;
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
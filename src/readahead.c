@@ -0,0 +1,350 @@
+/* readahead.c: SimpleFS sequential readahead */
+
+#include "sfs/fs.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <string.h>
+
+/* Internal Prototypes */
+
+Stream *readahead_find(Readahead *ra, size_t inode_number);
+Stream *readahead_stream(Readahead *ra, size_t inode_number);
+
+/* External Functions */
+
+/**
+ * Create readahead state for a FileSystem with the specified number of
+ * inodes.  Access advice is kept per inode (not per stream), so it lasts
+ * however many other files are read after it is given.
+ *
+ * @param       inodes      Number of inodes in the FileSystem.
+ * @return      Pointer to Readahead structure (NULL on failure).
+ **/
+Readahead *readahead_create(size_t inodes) {
+    Readahead *ra = calloc(1, sizeof(Readahead));
+    if (!ra) {
+        return NULL;
+    }
+
+    ra->advice = calloc(inodes, sizeof(uint8_t));
+    if (inodes && !ra->advice) {
+        free(ra);
+        return NULL;
+    }
+    ra->inodes = inodes;
+    return ra;
+}
+
+/**
+ * Release readahead state.
+ *
+ * @param       ra          Pointer to Readahead structure.
+ **/
+void    readahead_delete(Readahead *ra) {
+    if (!ra) {
+        return;
+    }
+
+    free(ra->advice);
+    free(ra);
+}
+
+/**
+ * Record access to logical block of specified Inode and issue readahead by
+ * doing the following:
+ *
+ *  1. Find (or replace) the access stream for the Inode.
+ *
+ *  2. Classify the access as sequential or random (unless advised).
+ *
+ *  3. When fewer than half a window of blocks remain ahead of the reader,
+ *  prefetch the next window into the cache and grow the window.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode being read.
+ * @param       inode           Loaded Inode structure.
+ * @param       logical         Logical block about to be read.
+ **/
+void    readahead_access(FileSystem *fs, size_t inode_number, Inode *inode, size_t logical) {
+    Readahead *ra = fs->readahead;
+    if (!ra || !fs->cache) {
+        return;
+    }
+
+    int     advice = readahead_advice(fs, inode_number);
+    Stream *stream = readahead_stream(ra, inode_number);
+    stream->age = ++ra->tick;
+
+    // random access advice disables readahead entirely
+    if (advice == FS_ADVICE_RANDOM) {
+        stream->next = logical + 1;
+        return;
+    }
+
+    // re-reading the previous block does not break a sequential stream
+    if (logical == stream->next) {
+        stream->sequential++;
+    } else if (logical + 1 != stream->next) {
+        if (advice == FS_ADVICE_SEQUENTIAL) {
+            stream->sequential = 1;
+            stream->window     = READAHEAD_MAX;
+        } else {
+            stream->sequential = 0;
+            stream->window     = READAHEAD_MIN;
+        }
+        stream->ahead = logical + 1;
+    }
+    stream->next = logical + 1;
+
+    if (stream->sequential == 0) {
+        return;
+    }
+
+    // limit readahead to the end of the file
+    size_t file_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t start       = max(stream->ahead, logical + 1);
+    size_t end         = min(logical + 1 + stream->window, file_blocks);
+
+    if (stream->ahead >= logical + 1 + stream->window / 2 || start >= end) {
+        return;
+    }
+
+    readahead_prefetch(fs, inode_number, inode, start, end);
+    stream->ahead  = end;
+    stream->window = min(stream->window * 2, READAHEAD_MAX);
+}
+
+/**
+ * Read uncached logical blocks [start, end) of specified Inode into the cache
+ * by doing the following:
+ *
+ *  1. Map logical blocks to physical blocks in windows of READAHEAD_MAX.
+ *
+ *  2. Issue one vectored read per physically contiguous run.
+ *
+ *  3. Insert blocks into the cache (at the cold end if the Inode was advised
+ *  FS_ADVICE_NOREUSE).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode being read.
+ * @param       inode           Loaded Inode structure.
+ * @param       start           First logical block to prefetch.
+ * @param       end             Logical block to stop before.
+ **/
+void    readahead_prefetch(FileSystem *fs, size_t inode_number, Inode *inode, size_t start, size_t end) {
+    if (!fs->cache || start >= end) {
+        return;
+    }
+
+    bool  cold   = readahead_advice(fs, inode_number) == FS_ADVICE_NOREUSE;
+    char *buffer = malloc(READAHEAD_MAX * BLOCK_SIZE);
+    if (!buffer) {
+        return;
+    }
+
+    for (size_t window = start; window < end; window += READAHEAD_MAX) {
+        uint32_t mapped[READAHEAD_MAX];
+        size_t   nmapped = readahead_map(fs, inode, window, min(window + READAHEAD_MAX, end), mapped);
+
+        // keep only blocks that are not already cached
+        uint32_t blocks[READAHEAD_MAX];
+        size_t   nblocks = 0;
+        for (size_t i = 0; i < nmapped; i++) {
+            if (mapped[i] && !cache_contains(fs->cache, mapped[i])) {
+                blocks[nblocks++] = mapped[i];
+            }
+        }
+
+        for (size_t i = 0; i < nblocks; ) {
+            size_t run = 1;
+            while (i + run < nblocks && blocks[i + run] == blocks[i] + run) {
+                run++;
+            }
+
+            if (disk_readv(fs->disk, blocks[i], run, buffer) != DISK_FAILURE) {
+                for (size_t j = 0; j < run; j++) {
+                    if (cold) {
+                        cache_insert_cold(fs->cache, blocks[i] + j, CACHE_DATA, buffer + j * BLOCK_SIZE);
+                    } else {
+                        cache_insert(fs->cache, blocks[i] + j, CACHE_DATA, buffer + j * BLOCK_SIZE);
+                    }
+                }
+                fs->readahead->issued += run;
+            }
+
+            i += run;
+        }
+
+        if (nmapped < min(window + READAHEAD_MAX, end) - window) {
+            break;
+        }
+    }
+
+    free(buffer);
+}
+
+/**
+ * Map logical blocks [start, end) of specified Inode to physical blocks,
+ * reading the indirect pointer block (through the cache) as soon as the range
+ * reaches it.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode           Loaded Inode structure.
+ * @param       start           First logical block to map.
+ * @param       end             Logical block to stop before (at most
+ *                              READAHEAD_MAX blocks after start).
+ * @param       blocks          Output array of physical blocks (0 if none or
+ *                              a hole).
+ *
+ * @return      Number of logical blocks mapped.
+ **/
+size_t  readahead_map(FileSystem *fs, Inode *inode, size_t start, size_t end, uint32_t *blocks) {
+    Block  pointerBlock;
+    bool   have_pointers = false;
+    size_t nblocks = 0;
+
+    for (size_t logical = start; logical < end && nblocks < READAHEAD_MAX; logical++) {
+        uint32_t block = 0;
+
+        if (logical < POINTERS_PER_INODE) {
+            block = inode->direct[logical];
+        } else {
+            size_t index = logical - POINTERS_PER_INODE;
+            if (index >= POINTERS_PER_BLOCK || !inode->indirect) {
+                break;
+            }
+
+            if (!have_pointers) {
+                if (!cache_lookup(fs->cache, inode->indirect, CACHE_INDIRECT, pointerBlock.data)) {
+                    if (disk_read(fs->disk, inode->indirect, pointerBlock.data) == DISK_FAILURE) {
+                        break;
+                    }
+                    cache_insert(fs->cache, inode->indirect, CACHE_INDIRECT, pointerBlock.data);
+                }
+                have_pointers = true;
+            }
+            block = pointerBlock.pointers[index];
+        }
+
+        blocks[nblocks++] = (block < fs->meta_data.blocks) ? block : 0;
+    }
+
+    return nblocks;
+}
+
+/**
+ * Record access advice for specified Inode (kept until the Inode is removed
+ * or advised again).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to advise.
+ * @param       advice          Access advice (FS_ADVICE_*).
+ **/
+void    readahead_advise(FileSystem *fs, size_t inode_number, int advice) {
+    Readahead *ra = fs->readahead;
+    if (!ra || inode_number >= ra->inodes) {
+        return;
+    }
+
+    ra->advice[inode_number] = advice;
+
+    // an active stream switches to the new window at once
+    Stream *stream = readahead_find(ra, inode_number);
+    if (stream && advice == FS_ADVICE_SEQUENTIAL) {
+        stream->window = READAHEAD_MAX;
+    }
+}
+
+/**
+ * Return access advice for specified Inode.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to check.
+ *
+ * @return      Access advice (FS_ADVICE_NORMAL if none was given).
+ **/
+int     readahead_advice(FileSystem *fs, size_t inode_number) {
+    Readahead *ra = fs->readahead;
+    return (ra && inode_number < ra->inodes) ? ra->advice[inode_number] : FS_ADVICE_NORMAL;
+}
+
+/**
+ * Reset access pattern of specified Inode (after its contents change) while
+ * keeping any advice given for it.
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to reset.
+ **/
+void    readahead_reset(FileSystem *fs, size_t inode_number) {
+    Stream *stream = fs->readahead ? readahead_find(fs->readahead, inode_number) : NULL;
+    if (!stream) {
+        return;
+    }
+
+    stream->next       = 0;
+    stream->ahead      = 0;
+    stream->sequential = 0;
+    stream->window     = (readahead_advice(fs, inode_number) == FS_ADVICE_SEQUENTIAL) ? READAHEAD_MAX : READAHEAD_MIN;
+}
+
+/**
+ * Drop access stream and advice for specified Inode (if any).
+ *
+ * @param       fs              Pointer to FileSystem structure.
+ * @param       inode_number    Inode to forget.
+ **/
+void    readahead_forget(FileSystem *fs, size_t inode_number) {
+    Readahead *ra = fs->readahead;
+    if (!ra) {
+        return;
+    }
+
+    Stream *stream = readahead_find(ra, inode_number);
+    if (stream) {
+        stream->valid = false;
+    }
+    if (inode_number < ra->inodes) {
+        ra->advice[inode_number] = FS_ADVICE_NORMAL;
+    }
+}
+
+/* Internal Functions */
+
+// helper function to find existing stream for inode
+Stream *readahead_find(Readahead *ra, size_t inode_number) {
+    for (size_t i = 0; i < READAHEAD_STREAMS; i++) {
+        if (ra->streams[i].valid && ra->streams[i].inode_number == inode_number) {
+            return &ra->streams[i];
+        }
+    }
+    return NULL;
+}
+
+// helper function to find stream for inode, replacing the oldest if needed
+// (a new stream starts at the full window if the inode was advised sequential)
+Stream *readahead_stream(Readahead *ra, size_t inode_number) {
+    Stream *stream = readahead_find(ra, inode_number);
+    if (stream) {
+        return stream;
+    }
+
+    Stream *victim = &ra->streams[0];
+    for (size_t i = 0; i < READAHEAD_STREAMS; i++) {
+        stream = &ra->streams[i];
+        if (!stream->valid || (victim->valid && stream->age < victim->age)) {
+            victim = stream;
+        }
+    }
+
+    memset(victim, 0, sizeof(Stream));
+    victim->valid        = true;
+    victim->inode_number = inode_number;
+    victim->window       = READAHEAD_MIN;
+    if (inode_number < ra->inodes && ra->advice[inode_number] == FS_ADVICE_SEQUENTIAL) {
+        victim->window = READAHEAD_MAX;
+    }
+    return victim;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
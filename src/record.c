@@ -0,0 +1,151 @@
+/* record.c: SimpleFS workload recording */
+
+#include "sfs/record.h"
+#include "sfs/utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Constants */
+
+#define RECORD_BUFFER       (1 << 20)           /* Bytes buffered before writing */
+
+/* Internal Variables */
+
+static pthread_mutex_t  RecordLock    = PTHREAD_MUTEX_INITIALIZER;
+static FILE            *RecordStream  = NULL;   /* Record file (NULL if not recording) */
+static uint16_t         RecordThreads = 0;      /* Number of threads seen */
+static __thread uint16_t RecordLocal  = 0;      /* Thread number plus one of calling thread */
+
+/* External Functions */
+
+/**
+ * Start recording public file system calls by doing the following:
+ *
+ *  1. Stop any previous recording.
+ *
+ *  2. Open the record file and write its header.
+ *
+ * @param       path        Path to record file.
+ * @return      Whether or not recording was started.
+ **/
+bool        record_start(const char *path) {
+    record_stop();
+
+    FILE *stream = fopen(path, "w");
+    if (!stream) {
+        fprintf(stderr, "record_start: fopen: %s\n", strerror(errno));
+        return false;
+    }
+
+    setvbuf(stream, NULL, _IOFBF, RECORD_BUFFER);
+
+    RecordHeader header = {RECORD_MAGIC, RECORD_VERSION};
+    if (fwrite(&header, sizeof(header), 1, stream) != 1) {
+        fprintf(stderr, "record_start: fwrite: %s\n", strerror(errno));
+        fclose(stream);
+        return false;
+    }
+
+    pthread_mutex_lock(&RecordLock);
+    __atomic_store_n(&RecordStream, stream, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&RecordLock);
+    return true;
+}
+
+/**
+ * Stop recording (if any) and close the record file.
+ *
+ * @return      Whether or not every recorded call reached the record file.
+ **/
+bool        record_stop(void) {
+    pthread_mutex_lock(&RecordLock);
+    FILE *stream = RecordStream;
+    __atomic_store_n(&RecordStream, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&RecordLock);
+
+    if (!stream) {
+        return true;
+    }
+
+    bool success = !ferror(stream);
+    return (fclose(stream) == 0) && success;
+}
+
+/**
+ * Return whether or not calls are being recorded.
+ **/
+bool        record_active(void) {
+    return __atomic_load_n(&RecordStream, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/**
+ * Record a completed call (only costs a load when not recording).
+ *
+ * @param       op          Operation (RECORD_*).
+ * @param       timer       Timer started when the call began.
+ * @param       inode       Inode number argument (0 if none).
+ * @param       length      Length argument (0 if none).
+ * @param       offset      Offset argument (0 if none).
+ * @param       advice      Access advice argument (0 if none).
+ * @param       result      Return value of call (-1 on failure).
+ **/
+void        record_op(int op, StatsTimer *timer, size_t inode, size_t length, size_t offset, int advice, ssize_t result) {
+    if (!record_active()) {
+        return;
+    }
+
+    uint64_t now = stats_now();
+    RecordEntry entry = {
+        .timestamp = timer->start,
+        .duration  = min(now - timer->start, UINT32_MAX),
+        .op        = op,
+        .advice    = advice,
+        .inode     = min(inode, UINT32_MAX),
+        .length    = min(length, UINT32_MAX),
+        .offset    = min(offset, UINT32_MAX),
+        .result    = max(min(result, INT32_MAX), -1),
+    };
+
+    pthread_mutex_lock(&RecordLock);
+    if (!RecordLocal) {
+        RecordLocal = ++RecordThreads;
+    }
+    entry.thread = RecordLocal - 1;
+
+    if (RecordStream) {
+        fwrite(&entry, sizeof(entry), 1, RecordStream);
+    }
+    pthread_mutex_unlock(&RecordLock);
+}
+
+/**
+ * Return name of operation.
+ *
+ * @param       op          Operation (RECORD_*).
+ * @return      Name of operation ("unknown" if invalid).
+ **/
+const char *record_name(int op) {
+    static const char *names[RECORD_OPS] = {
+        [RECORD_FORMAT]          = "format",
+        [RECORD_MOUNT]           = "mount",
+        [RECORD_UNMOUNT]         = "unmount",
+        [RECORD_CREATE]          = "create",
+        [RECORD_REMOVE]          = "remove",
+        [RECORD_STAT]            = "stat",
+        [RECORD_READ]            = "read",
+        [RECORD_WRITE]           = "write",
+        [RECORD_ADVISE]          = "advise",
+        [RECORD_COMPRESS]        = "compress",
+        [RECORD_CLONE]           = "clone",
+        [RECORD_SNAPSHOT]        = "snapshot",
+        [RECORD_SNAPSHOT_DELETE] = "snapdel",
+        [RECORD_SNAPSHOT_MOUNT]  = "snapmnt",
+    };
+
+    return (op >= 0 && op < RECORD_OPS) ? names[op] : "unknown";
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
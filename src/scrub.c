@@ -0,0 +1,293 @@
+/* scrub.c: SimpleFS background integrity scrubber */
+
+#include "sfs/fs.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/* Internal Prototypes */
+
+void *  scrub_thread(void *arg);
+void    scrub_run(FileSystem *fs, Scrub *scrub);
+size_t  scrub_verify(FileSystem *fs, size_t first, size_t count, char *buffer);
+bool    scrub_allocated(FileSystem *fs, size_t block);
+void    scrub_load(FileSystem *fs, Scrub *scrub);
+bool    scrub_save(Scrub *scrub);
+
+/* External Functions */
+
+/**
+ * Verify every allocated block of the FileSystem by doing the following:
+ *
+ *  1. Resume from the checkpoint file (if any) left by an earlier run.
+ *
+ *  2. Read runs of allocated blocks (superblock, inodes, indirect and data
+ *  blocks) in physical order with large reads straight from the disk,
+ *  bypassing the cache.  With checksums attached to the disk a read fails on
+ *  a corrupted block, which is then located by re-reading block by block.
+ *
+ *  3. Sleep between reads to stay below rate, and record progress in the
+ *  checkpoint file every SCRUB_CHECKPOINT seconds and when stopped.
+ *
+ * The scrub runs at idle I/O priority, either in a background thread (until
+ * the pass completes or fs_scrub_stop is called) or synchronously.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       path        Path to checkpoint file (NULL for none).
+ * @param       rate        Bytes per second (0 for unlimited).
+ * @param       background  Whether or not to scrub in a background thread.
+ * @return      Whether or not the scrub was started.
+ **/
+bool    fs_scrub_start(FileSystem *fs, const char *path, uint64_t rate, bool background) {
+    if (!fs || !fs->disk || !fs->free_blocks) {
+        return false;
+    }
+
+    fs_scrub_stop(fs);
+
+    Scrub *scrub = calloc(1, sizeof(Scrub));
+    if (!scrub) {
+        return false;
+    }
+
+    // rate limiting sleeps until a stats_now() time, so use its clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scrub->wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&scrub->lock, NULL);
+
+    scrub->path          = path ? strdup(path) : NULL;
+    scrub->rate          = rate;
+    scrub->stats.blocks  = fs->meta_data.blocks;
+    scrub->stats.running = true;
+    scrub_load(fs, scrub);
+    fs->scrub = scrub;
+
+    if (background && pthread_create(&scrub->thread, NULL, scrub_thread, fs) == 0) {
+        scrub->threaded = true;
+        return true;
+    }
+
+    scrub_run(fs, scrub);
+    return true;
+}
+
+/**
+ * Stop scrubbing (if any), checkpoint its progress and release its state.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ **/
+void    fs_scrub_stop(FileSystem *fs) {
+    Scrub *scrub = fs ? fs->scrub : NULL;
+    if (!scrub) {
+        return;
+    }
+
+    if (scrub->threaded) {
+        pthread_mutex_lock(&scrub->lock);
+        scrub->stop = true;
+        pthread_cond_signal(&scrub->wakeup);
+        pthread_mutex_unlock(&scrub->lock);
+        pthread_join(scrub->thread, NULL);
+    }
+
+    pthread_cond_destroy(&scrub->wakeup);
+    pthread_mutex_destroy(&scrub->lock);
+    free(scrub->path);
+    free(scrub);
+    fs->scrub = NULL;
+}
+
+/**
+ * Copy progress and statistics of the current (or last) scrub.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       stats   ScrubStats structure to fill.
+ * @return      Whether or not a scrub was started.
+ **/
+bool    fs_scrub_stats(FileSystem *fs, ScrubStats *stats) {
+    Scrub *scrub = fs ? fs->scrub : NULL;
+    if (!scrub) {
+        return false;
+    }
+
+    pthread_mutex_lock(&scrub->lock);
+    *stats = scrub->stats;
+    pthread_mutex_unlock(&scrub->lock);
+    return true;
+}
+
+/* Internal Functions */
+
+// helper function to run scrub in the background
+void *  scrub_thread(void *arg) {
+    FileSystem *fs = arg;
+    scrub_run(fs, fs->scrub);
+    return NULL;
+}
+
+// helper function to scrub from the current position to the end of the file system
+void    scrub_run(FileSystem *fs, Scrub *scrub) {
+    char *buffer = malloc(SCRUB_BATCH * BLOCK_SIZE);
+    if (!buffer) {
+        pthread_mutex_lock(&scrub->lock);
+        scrub->stats.running = false;
+        pthread_mutex_unlock(&scrub->lock);
+        return;
+    }
+
+    int      previous   = queue_set_priority(QUEUE_CLASS_IDLE);
+    uint64_t start      = stats_now();
+    uint64_t checkpoint = start;
+    uint64_t bytes      = 0;
+
+    pthread_mutex_lock(&scrub->lock);
+    while (!scrub->stop && scrub->stats.position < scrub->stats.blocks) {
+        size_t blocks = scrub->stats.blocks;
+        size_t first  = scrub->stats.position;
+        size_t count  = 0;
+
+        // next run of allocated blocks
+        while (first < blocks && !scrub_allocated(fs, first)) {
+            first++;
+        }
+        while (first + count < blocks && count < SCRUB_BATCH && scrub_allocated(fs, first + count)) {
+            count++;
+        }
+
+        pthread_mutex_unlock(&scrub->lock);
+        size_t errors = count ? scrub_verify(fs, first, count, buffer) : 0;
+        pthread_mutex_lock(&scrub->lock);
+
+        bytes += count * BLOCK_SIZE;
+        scrub->stats.position    = first + count;
+        scrub->stats.scanned    += count;
+        scrub->stats.errors     += errors;
+        scrub->stats.elapsed_ns  = stats_now() - start;
+
+        if (stats_now() - checkpoint >= SCRUB_CHECKPOINT * 1000000000ULL) {
+            scrub_save(scrub);
+            checkpoint = stats_now();
+        }
+
+        // sleep until the bytes read so far are due at rate (or until stopped)
+        if (scrub->rate) {
+            uint64_t        due   = start + (uint64_t)(bytes * 1e9 / scrub->rate);
+            struct timespec until = {due / 1000000000ULL, due % 1000000000ULL};
+            while (!scrub->stop && stats_now() < due) {
+                if (pthread_cond_timedwait(&scrub->wakeup, &scrub->lock, &until) != 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (scrub->stats.position >= scrub->stats.blocks) {
+        scrub->stats.position = 0;
+        scrub->stats.passes++;
+    }
+    scrub->stats.running    = false;
+    scrub->stats.elapsed_ns = stats_now() - start;
+    scrub_save(scrub);
+    pthread_mutex_unlock(&scrub->lock);
+
+    queue_set_priority(previous);
+    free(buffer);
+}
+
+// helper function to read run of blocks and count those that fail verification
+size_t  scrub_verify(FileSystem *fs, size_t first, size_t count, char *buffer) {
+    if (disk_readv(fs->disk, first, count, buffer) != DISK_FAILURE) {
+        return 0;
+    }
+
+    // locate the bad blocks: a block freed since the run was found is no
+    // longer checked, and one read while it was being written (between its
+    // data and its checksum) passes once the write is done
+    size_t errors = 0;
+    for (size_t block = first; block < first + count; block++) {
+        bool failed = false;
+        for (size_t attempt = 0; attempt < SCRUB_RETRIES && scrub_allocated(fs, block); attempt++) {
+            failed = disk_read(fs->disk, block, buffer) == DISK_FAILURE;
+            if (!failed) {
+                break;
+            }
+            usleep(1000);
+        }
+
+        if (failed && scrub_allocated(fs, block)) {
+            fprintf(stderr, "fs_scrub: block %lu failed verification\n", block);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+// helper function to check if block is allocated (the foreground allocates and frees concurrently)
+bool    scrub_allocated(FileSystem *fs, size_t block) {
+    return !__atomic_load_n(&fs->free_blocks[block], __ATOMIC_ACQUIRE);
+}
+
+// helper function to resume from checkpoint file if it matches the file system
+void    scrub_load(FileSystem *fs, Scrub *scrub) {
+    FILE *stream = scrub->path ? fopen(scrub->path, "r") : NULL;
+    if (!stream) {
+        return;
+    }
+
+    ScrubCheckpoint checkpoint;
+    if (fread(&checkpoint, sizeof(checkpoint), 1, stream) == 1 &&
+        checkpoint.magic    == SCRUB_MAGIC &&
+        checkpoint.blocks   == fs->meta_data.blocks &&
+        checkpoint.position <  checkpoint.blocks) {
+        scrub->stats.position = checkpoint.position;
+        scrub->stats.passes   = checkpoint.passes;
+    } else {
+        fprintf(stderr, "fs_scrub_start: %s is not a scrub checkpoint for this file system\n", scrub->path);
+    }
+    fclose(stream);
+}
+
+// helper function to atomically write checkpoint file (caller holds lock)
+bool    scrub_save(Scrub *scrub) {
+    if (!scrub->path) {
+        return true;
+    }
+
+    ScrubCheckpoint checkpoint = {
+        .magic    = SCRUB_MAGIC,
+        .blocks   = scrub->stats.blocks,
+        .position = scrub->stats.position,
+        .passes   = scrub->stats.passes,
+    };
+
+    char temp[BUFSIZ];
+    snprintf(temp, sizeof(temp), "%s.tmp", scrub->path);
+
+    FILE *stream = fopen(temp, "w");
+    if (!stream) {
+        fprintf(stderr, "fs_scrub: fopen: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool success = fwrite(&checkpoint, sizeof(checkpoint), 1, stream) == 1;
+    success = (fclose(stream) == 0) && success;
+    if (success && rename(temp, scrub->path) < 0) {
+        fprintf(stderr, "fs_scrub: rename: %s\n", strerror(errno));
+        success = false;
+    }
+
+    if (!success) {
+        unlink(temp);
+    }
+    return success;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
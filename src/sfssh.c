@@ -1,7 +1,10 @@
 /* sfssh.c: SimpleFS shell */
 
+#include "sfs/crc32c.h"
 #include "sfs/disk.h"
 #include "sfs/fs.h"
+#include "sfs/record.h"
+#include "sfs/trace.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -23,6 +26,22 @@ void do_stat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyout(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_cat(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_cache(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_warmup(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_trace(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_metrics(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_record(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_queue(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_checksum(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_scrub(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_compress(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_dedup(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_clone(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_snapshot(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_track(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_checkpoint(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
+void do_changed(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2);
 
 /* Utility Prototypes */
@@ -33,12 +52,13 @@ bool copyin(FileSystem *fs, const char *path, size_t inode_number);
 /* Main Execution */
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-	fprintf(stderr, "Usage: %s <diskfile> <nblocks>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+	fprintf(stderr, "Usage: %s <diskfile> <nblocks> [<baseimage>]\n", argv[0]);
 	return EXIT_FAILURE;
     }
 
-    Disk *disk = disk_open(argv[1], atoi(argv[2]));
+    // with a base image, diskfile is the delta file of an overlay on it
+    Disk *disk = argc == 4 ? disk_overlay(argv[3], argv[1], atoi(argv[2])) : disk_open(argv[1], atoi(argv[2]));
     if (!disk) {
     	return EXIT_FAILURE;
     }
@@ -77,6 +97,38 @@ int main(int argc, char *argv[]) {
 	    do_cat(disk, &fs, args, arg1, arg2);
         } else if (streq(cmd, "copyin")) {
 	    do_copyin(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "cache")) {
+	    do_cache(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "warmup")) {
+	    do_warmup(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "stats")) {
+	    do_stats(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "trace")) {
+	    do_trace(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "metrics")) {
+	    do_metrics(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "record")) {
+	    do_record(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "queue")) {
+	    do_queue(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "checksum")) {
+	    do_checksum(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "scrub")) {
+	    do_scrub(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "compress")) {
+	    do_compress(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "dedup")) {
+	    do_dedup(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "clone")) {
+	    do_clone(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "snapshot")) {
+	    do_snapshot(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "track")) {
+	    do_track(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "checkpoint")) {
+	    do_checkpoint(disk, &fs, args, arg1, arg2);
+        } else if (streq(cmd, "changed")) {
+	    do_changed(disk, &fs, args, arg1, arg2);
         } else if (streq(cmd, "help")) {
 	    do_help(disk, &fs, args, arg1, arg2);
 	} else if (streq(cmd, "exit") || streq(cmd, "quit")) {
@@ -88,6 +140,7 @@ int main(int argc, char *argv[]) {
     }
 
     fs_unmount(&fs);
+    record_stop();
     assert(fs.disk == NULL);
     assert(fs.free_blocks == NULL);
     disk_close(disk);
@@ -118,11 +171,20 @@ void do_format(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
 }
 
 void do_mount(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
-    if (args != 1) {
-	printf("Usage: mount\n");
+    if (args > 2) {
+	printf("Usage: mount [<snapshot>]\n");
 	return;
     }
 
+    if (args == 2) {
+        if (fs_snapshot_mount(fs, disk, atoi(arg1))) {
+            printf("snapshot %s mounted read-only.\n", arg1);
+        } else {
+            printf("mount failed!\n");
+        }
+        return;
+    }
+
     if (fs_mount(fs, disk)) {
         printf("disk mounted.\n");
     } else {
@@ -206,10 +268,405 @@ void do_copyin(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     }
 }
 
+void do_cache(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    static const char *classes[] = {"super", "inode", "indirect", "data"};
+
+    if (args != 1) {
+        printf("Usage: cache\n");
+        return;
+    }
+
+    if (!fs->cache) {
+        printf("cache failed!\n");
+        return;
+    }
+
+    printf("cache capacity %lu blocks\n", fs->cache->capacity);
+    for (int c = 0; c < CACHE_CLASSES; c++) {
+        printf("    %-8s %6lu resident %8lu hits %8lu misses %6.2f%% hit rate\n",
+            classes[c], fs->cache->stats[c].resident, fs->cache->stats[c].hits,
+            fs->cache->stats[c].misses, 100.0 * cache_hit_rate(fs->cache, c));
+    }
+}
+
+void do_warmup(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    static char path[BUFSIZ];
+
+    if (args != 2) {
+        printf("Usage: warmup <file>\n");
+        return;
+    }
+
+    strncpy(path, arg1, sizeof(path) - 1);
+    fs->warmup_path = path;
+
+    // an already mounted file system starts warming up right away
+    if (fs->disk && !fs_warmup_load(fs, path, true)) {
+        printf("warmup file %s not loaded, recording on unmount.\n", path);
+    } else {
+        printf("warmup file set to %s.\n", path);
+    }
+}
+
+void do_stats(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 2 || (args == 2 && !streq(arg1, "reset"))) {
+        printf("Usage: stats [reset]\n");
+        return;
+    }
+
+    if (args == 2) {
+        stats_reset();
+        printf("stats reset.\n");
+        return;
+    }
+
+    Stats stats;
+    fs_stats(fs, &stats);
+
+    printf("%-10s %8s %6s %10s %10s %10s %10s %10s %8s %8s\n",
+        "op", "count", "errors", "bytes", "avg(us)", "p50(us)", "p99(us)", "max(us)", "reads/op", "writes/op");
+    for (int op = 0; op < STATS_OPS; op++) {
+        StatsOp *stat = &stats.ops[op];
+        if (!stat->count) {
+            continue;
+        }
+
+        printf("%-10s %8lu %6lu %10lu %10.1f %10.1f %10.1f %10.1f %8.2f %8.2f\n",
+            stats_name(op), stat->count, stat->errors, stat->bytes,
+            stat->total_ns / 1000.0 / stat->count,
+            stats_percentile(stat, 50) / 1000.0,
+            stats_percentile(stat, 99) / 1000.0,
+            stat->max_ns / 1000.0,
+            (double)stat->disk_reads  / stat->count,
+            (double)stat->disk_writes / stat->count);
+    }
+}
+
+void do_trace(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: trace <file>\n");
+        return;
+    }
+
+    if (trace_save(arg1)) {
+        printf("trace saved to %s.\n", arg1);
+    } else {
+        printf("trace failed!\n");
+    }
+}
+
+void do_metrics(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args < 2 || args > 3) {
+        printf("Usage: metrics <file> [seconds] | off\n");
+        return;
+    }
+
+    if (args == 2 && streq(arg1, "off")) {
+        fs_metrics_stop(fs);
+        printf("metrics export stopped.\n");
+        return;
+    }
+
+    if (args == 2) {
+        if (fs_metrics_write(fs, arg1)) {
+            printf("metrics written to %s.\n", arg1);
+        } else {
+            printf("metrics failed!\n");
+        }
+        return;
+    }
+
+    if (!fs->disk) {
+        printf("metrics failed!\n");
+        return;
+    }
+
+    if (fs_metrics_start(fs, arg1, atoi(arg2))) {
+        printf("metrics exported to %s every %u seconds.\n", arg1, fs->metrics->interval);
+    } else {
+        printf("metrics failed!\n");
+    }
+}
+
+void do_record(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: record <file> | off\n");
+        return;
+    }
+
+    if (streq(arg1, "off")) {
+        if (record_stop()) {
+            printf("recording stopped.\n");
+        } else {
+            printf("record failed!\n");
+        }
+        return;
+    }
+
+    if (record_start(arg1)) {
+        printf("recording to %s.\n", arg1);
+    } else {
+        printf("record failed!\n");
+    }
+}
+
+void do_queue(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+        printf("Usage: queue [fifo | merge | cscan | deadline | off]\n");
+        return;
+    }
+
+    // the disk must be idle while its queue changes
+    if (args == 2) {
+        fs_warmup_wait(fs);
+        if (streq(arg1, "off")) {
+            disk_queue(disk, NULL);
+            printf("queue disabled.\n");
+        } else {
+            DiskQueue *queue = queue_parse(arg1);
+            if (!queue) {
+                printf("queue failed!\n");
+                return;
+            }
+            disk_queue(disk, queue);
+            printf("queue policy %s.\n", arg1);
+        }
+        return;
+    }
+
+    if (!disk->queue) {
+        printf("queue disabled.\n");
+        return;
+    }
+
+    QueueStats stats;
+    queue_stats(disk->queue, &stats);
+    printf("queue policy %s\n", queue_name(disk->queue->policy));
+    printf("    %lu submitted %lu dispatched %lu merges %lu reorders %lu expired\n",
+        stats.submitted, stats.dispatched, stats.merges, stats.reorders, stats.expired);
+    printf("    %lu max depth %.1f us avg wait %.1f us max wait %.3f ms throttled\n",
+        stats.max_depth, stats.submitted ? stats.total_wait_ns / 1e3 / stats.submitted : 0.0,
+        stats.max_wait_ns / 1e3, stats.throttled_ns / 1e6);
+    for (int c = 0; c < QUEUE_CLASSES; c++) {
+        QueueClassStats *class = &stats.classes[c];
+        if (!class->submitted) {
+            continue;
+        }
+        printf("    %-4s %lu submitted %lu dispatched %lu throttled %.1f us avg wait %.1f us max wait\n",
+            queue_class_name(c), class->submitted, class->dispatched, class->throttled,
+            class->total_wait_ns / 1e3 / class->submitted, class->max_wait_ns / 1e3);
+    }
+}
+
+void do_checksum(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 3 || (args == 3 && !streq(arg2, "rebuild"))) {
+        printf("Usage: checksum [<file> [rebuild] | off]\n");
+        return;
+    }
+
+    if (args == 1) {
+        printf("checksums %s, %lu corrupted blocks read (crc32c %s)\n",
+            disk->checksums ? "enabled" : "disabled", disk->corrupted,
+            crc32c_accelerated() ? "sse4.2" : "slicing-by-8");
+        return;
+    }
+
+    // the disk must be idle while its checksums change
+    fs_warmup_wait(fs);
+    if (streq(arg1, "off")) {
+        disk_checksum(disk, NULL, false);
+        printf("checksums disabled.\n");
+    } else if (disk_checksum(disk, arg1, args == 3)) {
+        printf("checksums in %s.\n", arg1);
+    } else {
+        printf("checksum failed!\n");
+    }
+}
+
+void do_scrub(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 3 || (args == 3 && streq(arg1, "stop"))) {
+        printf("Usage: scrub [<file> [MB/s] | stop]\n");
+        return;
+    }
+
+    if (args == 1) {
+        ScrubStats stats;
+        if (!fs_scrub_stats(fs, &stats)) {
+            printf("scrub not started.\n");
+            return;
+        }
+        printf("scrub %s: block %lu of %lu, %lu passes\n",
+            stats.running ? "running" : "idle", stats.position, stats.blocks, stats.passes);
+        printf("    %lu blocks scanned %lu errors %.3f seconds %.1f MB/s\n",
+            stats.scanned, stats.errors, stats.elapsed_ns / 1e9,
+            stats.elapsed_ns ? stats.scanned * BLOCK_SIZE * 1e9 / stats.elapsed_ns / (1 << 20) : 0.0);
+        return;
+    }
+
+    if (streq(arg1, "stop")) {
+        fs_scrub_stop(fs);
+        printf("scrub stopped.\n");
+        return;
+    }
+
+    uint64_t rate = args == 3 ? strtoull(arg2, NULL, 10) << 20 : 0;
+    if (fs_scrub_start(fs, arg1, rate, true)) {
+        printf("scrub started.\n");
+    } else {
+        printf("scrub failed!\n");
+    }
+}
+
+void do_compress(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: compress <inode>\n");
+        return;
+    }
+
+    ssize_t inode_number = atoi(arg1);
+    if (fs_compress(fs, inode_number)) {
+        printf("inode %ld is compressed.\n", inode_number);
+    } else {
+        printf("compress failed!\n");
+    }
+}
+
+void do_dedup(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+        printf("Usage: dedup [<file> | off]\n");
+        return;
+    }
+
+    if (args == 1) {
+        DedupStats stats;
+        if (!fs_dedup_stats(fs, &stats)) {
+            printf("dedup off.\n");
+            return;
+        }
+        printf("dedup on: %lu blocks indexed\n", stats.entries);
+        printf("    %lu lookups %lu filtered %lu hits %lu mismatches\n",
+            stats.lookups, stats.filtered, stats.hits, stats.mismatches);
+        return;
+    }
+
+    if (streq(arg1, "off")) {
+        fs_dedup_stop(fs);
+        printf("dedup off.\n");
+        return;
+    }
+
+    if (fs_dedup_start(fs, arg1)) {
+        printf("dedup on.\n");
+    } else {
+        printf("dedup failed!\n");
+    }
+}
+
+void do_clone(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: clone <inode>\n");
+        return;
+    }
+
+    ssize_t inode_number = atoi(arg1);
+    ssize_t clone_number = fs_clone(fs, inode_number);
+    if (clone_number >= 0) {
+        printf("cloned inode %ld to %ld.\n", inode_number, clone_number);
+    } else {
+        printf("clone failed!\n");
+    }
+}
+
+void do_snapshot(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args == 3 && streq(arg1, "delete")) {
+        if (fs_snapshot_delete(fs, atoi(arg2))) {
+            printf("snapshot %s deleted.\n", arg2);
+        } else {
+            printf("snapshot delete failed!\n");
+        }
+        return;
+    }
+
+    if (args != 1) {
+        printf("Usage: snapshot [delete <snapshot>]\n");
+        return;
+    }
+
+    ssize_t snapshot = fs_snapshot(fs);
+    if (snapshot >= 0) {
+        printf("snapshot %ld taken.\n", snapshot);
+    } else {
+        printf("snapshot failed!\n");
+    }
+}
+
+void do_track(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args > 2) {
+        printf("Usage: track [<file> | off]\n");
+        return;
+    }
+
+    if (args == 1) {
+        if (disk->generations) {
+            printf("tracking enabled, generation %lu\n", disk->generation);
+        } else {
+            printf("tracking disabled\n");
+        }
+        return;
+    }
+
+    // the disk must be idle while its tracking changes
+    fs_warmup_wait(fs);
+    if (streq(arg1, "off")) {
+        disk_track(disk, NULL);
+        printf("tracking disabled.\n");
+    } else if (disk_track(disk, arg1)) {
+        printf("tracking in %s.\n", arg1);
+    } else {
+        printf("track failed!\n");
+    }
+}
+
+void do_checkpoint(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 1) {
+        printf("Usage: checkpoint\n");
+        return;
+    }
+
+    uint64_t checkpoint = disk_checkpoint(disk);
+    if (checkpoint) {
+        printf("checkpoint %lu.\n", checkpoint);
+    } else {
+        printf("checkpoint failed!\n");
+    }
+}
+
+void do_changed(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
+    if (args != 2) {
+        printf("Usage: changed <checkpoint>\n");
+        return;
+    }
+
+    uint32_t *blocks = calloc(disk->blocks + 1, sizeof(uint32_t));
+    ssize_t   count  = blocks ? disk_changed(disk, strtoull(arg1, NULL, 10), blocks) : DISK_FAILURE;
+    if (count < 0) {
+        printf("changed failed!\n");
+        free(blocks);
+        return;
+    }
+
+    printf("%ld blocks changed since checkpoint %s:", count, arg1);
+    for (ssize_t b = 0; b < count; b++) {
+        printf(" %u", blocks[b]);
+    }
+    printf("\n");
+    free(blocks);
+}
+
 void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     printf("Commands are:\n");
     printf("    format\n");
-    printf("    mount\n");
+    printf("    mount   [<snapshot>]\n");
     printf("    debug\n");
     printf("    create\n");
     printf("    remove  <inode>\n");
@@ -217,6 +674,22 @@ void do_help(Disk *disk, FileSystem *fs, int args, char *arg1, char *arg2) {
     printf("    stat    <inode>\n");
     printf("    copyin  <file> <inode>\n");
     printf("    copyout <inode> <file>\n");
+    printf("    cache\n");
+    printf("    warmup  <file>\n");
+    printf("    stats   [reset]\n");
+    printf("    trace   <file>\n");
+    printf("    metrics <file> [seconds] | off\n");
+    printf("    record  <file> | off\n");
+    printf("    queue   [fifo | merge | cscan | deadline | off]\n");
+    printf("    checksum [<file> [rebuild] | off]\n");
+    printf("    scrub   [<file> [MB/s] | stop]\n");
+    printf("    compress <inode>\n");
+    printf("    dedup   [<file> | off]\n");
+    printf("    clone   <inode>\n");
+    printf("    snapshot [delete <snapshot>]\n");
+    printf("    track   [<file> | off]\n");
+    printf("    checkpoint\n");
+    printf("    changed <checkpoint>\n");
     printf("    help\n");
     printf("    quit\n");
     printf("    exit\n");
@@ -0,0 +1,56 @@
+/* sfstrace.c: SimpleFS trace decoder */
+
+#include "sfs/trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <tracefile>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *stream = fopen(argv[1], "r");
+    if (!stream) {
+        fprintf(stderr, "Unable to open %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, stream) != 1 || header.magic != TRACE_MAGIC) {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        fclose(stream);
+        return EXIT_FAILURE;
+    }
+
+    // timestamps are printed relative to the first event
+    TraceEvent event;
+    uint64_t   first = 0;
+    uint32_t   count = 0;
+
+    printf("%12s %6s %-16s %8s %8s\n", "time(us)", "thread", "event", "inode", "block");
+    while (count < header.count && fread(&event, sizeof(event), 1, stream) == 1) {
+        if (count++ == 0) {
+            first = event.timestamp;
+        }
+
+        printf("%12.3f %6u %-16s %8u %8u\n",
+            (event.timestamp - first) / 1000.0, event.thread, trace_name(event.event),
+            event.inode, event.block);
+    }
+
+    fclose(stream);
+
+    if (count != header.count) {
+        fprintf(stderr, "%s is truncated: %u of %u events\n", argv[1], count, header.count);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
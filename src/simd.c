@@ -0,0 +1,590 @@
+/* simd.c: SimpleFS vectorized block kernels */
+
+#include "sfs/simd.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Internal Structures */
+
+typedef struct SimdKernels SimdKernels;
+struct SimdKernels {
+    bool      (*zero)(const void *, size_t);
+    bool      (*equal)(const void *, const void *, size_t);
+    void      (*clear)(void *, size_t);
+    size_t    (*nonzero)(const uint32_t *, size_t, size_t, uint32_t *);
+    size_t    (*mark)(bool *, const uint32_t *, size_t, uint32_t, bool);
+};
+
+/* Internal Prototypes */
+
+void    simd_init(void);
+size_t  simd_expand(uint32_t mask, size_t base, uint32_t *indices);
+size_t  simd_mark_bits(bool *bitmap, const uint32_t *pointers, uint32_t mask, bool value);
+
+bool    simd_zero_scalar(const void *data, size_t length);
+bool    simd_equal_scalar(const void *a, const void *b, size_t length);
+void    simd_clear_scalar(void *data, size_t length);
+size_t  simd_nonzero_scalar(const uint32_t *words, size_t count, size_t stride, uint32_t *indices);
+size_t  simd_mark_scalar(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value);
+
+bool    simd_zero_sse2(const void *data, size_t length);
+bool    simd_equal_sse2(const void *a, const void *b, size_t length);
+void    simd_clear_sse2(void *data, size_t length);
+size_t  simd_nonzero_sse2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices);
+size_t  simd_mark_sse2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value);
+
+bool    simd_zero_avx2(const void *data, size_t length);
+bool    simd_equal_avx2(const void *a, const void *b, size_t length);
+void    simd_clear_avx2(void *data, size_t length);
+size_t  simd_nonzero_avx2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices);
+size_t  simd_mark_avx2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value);
+
+/* Internal Globals */
+
+static const SimdKernels Kernels[SIMD_LEVELS] = {
+    [SIMD_SCALAR] = {simd_zero_scalar, simd_equal_scalar, simd_clear_scalar, simd_nonzero_scalar, simd_mark_scalar},
+    [SIMD_SSE2]   = {simd_zero_sse2,   simd_equal_sse2,   simd_clear_sse2,   simd_nonzero_sse2,   simd_mark_sse2},
+    [SIMD_AVX2]   = {simd_zero_avx2,   simd_equal_avx2,   simd_clear_avx2,   simd_nonzero_avx2,   simd_mark_avx2},
+};
+
+static int                  Supported = SIMD_SCALAR;    /* Best level the processor supports */
+static int                  Level     = SIMD_SCALAR;    /* Level in use */
+static const SimdKernels   *Active    = &Kernels[SIMD_SCALAR];
+static pthread_once_t       Once      = PTHREAD_ONCE_INIT;
+
+/* External Functions */
+
+/**
+ * Return whether length bytes of data are all zero.
+ *
+ * @param       data        Data buffer.
+ * @param       length      Number of bytes in data buffer.
+ * @return      Whether every byte is zero.
+ **/
+bool    simd_zero(const void *data, size_t length) {
+    pthread_once(&Once, simd_init);
+    return Active->zero(data, length);
+}
+
+/**
+ * Return whether two buffers of length bytes hold the same data.
+ *
+ * @param       a           First buffer.
+ * @param       b           Second buffer.
+ * @param       length      Number of bytes to compare.
+ * @return      Whether the buffers are equal.
+ **/
+bool    simd_equal(const void *a, const void *b, size_t length) {
+    pthread_once(&Once, simd_init);
+    return Active->equal(a, b, length);
+}
+
+/**
+ * Set length bytes of data to zero.
+ *
+ * @param       data        Data buffer.
+ * @param       length      Number of bytes to clear.
+ **/
+void    simd_clear(void *data, size_t length) {
+    pthread_once(&Once, simd_init);
+    Active->clear(data, length);
+}
+
+/**
+ * Find the nonzero elements among count 32-bit words spaced stride words
+ * apart (stride 1 for a pointer array, the Inode size in words for the
+ * valid fields of an Inode table block).
+ *
+ * @param       words       First word.
+ * @param       count       Number of elements.
+ * @param       stride      Distance between elements in words.
+ * @param       indices     Output array of element indices (count entries),
+ *                          in increasing order.
+ * @return      Number of nonzero elements.
+ **/
+size_t  simd_nonzero(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) {
+    pthread_once(&Once, simd_init);
+    return Active->nonzero(words, count, stride, indices);
+}
+
+/**
+ * Set bitmap[pointer] to value for every pointer that is nonzero and below
+ * limit (so holes and corrupt pointers are skipped).
+ *
+ * @param       bitmap      Block bitmap (limit entries).
+ * @param       pointers    Array of block pointers.
+ * @param       count       Number of pointers.
+ * @param       limit       Number of entries in bitmap.
+ * @param       value       Value to store.
+ * @return      Number of pointers marked.
+ **/
+size_t  simd_mark(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) {
+    pthread_once(&Once, simd_init);
+    return Active->mark(bitmap, pointers, count, limit, value);
+}
+
+/**
+ * Return the kernel level in use.
+ *
+ * @return      SIMD level (SIMD_*).
+ **/
+int     simd_level(void) {
+    pthread_once(&Once, simd_init);
+    return Level;
+}
+
+/**
+ * Return the best kernel level the processor supports.
+ *
+ * @return      SIMD level (SIMD_*).
+ **/
+int     simd_supported(void) {
+    pthread_once(&Once, simd_init);
+    return Supported;
+}
+
+/**
+ * Switch kernels to the specified level (limited to what the processor
+ * supports), e.g. to compare levels in tests and benchmarks.
+ *
+ * Note: Not thread safe; switch only while no other thread uses the kernels.
+ *
+ * @param       level       SIMD level (SIMD_*).
+ * @return      Previous level.
+ **/
+int     simd_use(int level) {
+    pthread_once(&Once, simd_init);
+
+    int previous = Level;
+    if (level < SIMD_SCALAR) {
+        level = SIMD_SCALAR;
+    }
+    if (level > Supported) {
+        level = Supported;
+    }
+    Level  = level;
+    Active = &Kernels[level];
+    return previous;
+}
+
+/**
+ * Return the name of a kernel level.
+ *
+ * @param       level       SIMD level (SIMD_*).
+ * @return      Level name ("avx2", "sse2" or "scalar").
+ **/
+const char *simd_level_name(int level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE2: return "sse2";
+        default:        return "scalar";
+    }
+}
+
+/* Internal Functions */
+
+// helper function to detect processor features and pick kernels
+void    simd_init(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    Supported = SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2")) {
+        Supported = SIMD_AVX2;
+    }
+#endif
+    Level  = Supported;
+    Active = &Kernels[Supported];
+}
+
+// helper function to append the index of every set bit of a lane mask
+size_t  simd_expand(uint32_t mask, size_t base, uint32_t *indices) {
+    size_t n = 0;
+    for (; mask; mask &= mask - 1) {
+        indices[n++] = base + __builtin_ctz(mask);
+    }
+    return n;
+}
+
+// helper function to mark the pointers selected by a lane mask
+size_t  simd_mark_bits(bool *bitmap, const uint32_t *pointers, uint32_t mask, bool value) {
+    size_t n = 0;
+    for (; mask; mask &= mask - 1, n++) {
+        bitmap[pointers[__builtin_ctz(mask)]] = value;
+    }
+    return n;
+}
+
+/* Scalar Kernels */
+
+// helper function to test for zero eight 64-bit words at a time
+bool    simd_zero_scalar(const void *data, size_t length) {
+    const uint8_t *bytes = data;
+
+    while (length >= 64) {
+        uint64_t words[8];
+        memcpy(words, bytes, sizeof(words));
+        if (words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]) {
+            return false;
+        }
+        bytes  += 64;
+        length -= 64;
+    }
+
+    uint8_t any = 0;
+    while (length--) {
+        any |= *bytes++;
+    }
+    return !any;
+}
+
+// helper function to compare eight 64-bit words at a time
+bool    simd_equal_scalar(const void *a, const void *b, size_t length) {
+    const uint8_t *x = a;
+    const uint8_t *y = b;
+
+    while (length >= 64) {
+        uint64_t u[8], v[8], diff = 0;
+        memcpy(u, x, sizeof(u));
+        memcpy(v, y, sizeof(v));
+        for (size_t i = 0; i < 8; i++) {
+            diff |= u[i] ^ v[i];
+        }
+        if (diff) {
+            return false;
+        }
+        x      += 64;
+        y      += 64;
+        length -= 64;
+    }
+
+    uint8_t diff = 0;
+    while (length--) {
+        diff |= *x++ ^ *y++;
+    }
+    return !diff;
+}
+
+// helper function to clear 64-bit words at a time
+void    simd_clear_scalar(void *data, size_t length) {
+    uint8_t *bytes = data;
+    uint64_t zero  = 0;
+
+    while (length >= 8) {
+        memcpy(bytes, &zero, sizeof(zero));
+        bytes  += 8;
+        length -= 8;
+    }
+    while (length--) {
+        *bytes++ = 0;
+    }
+}
+
+// helper function to find nonzero elements one at a time
+size_t  simd_nonzero_scalar(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (words[i * stride]) {
+            indices[n++] = i;
+        }
+    }
+    return n;
+}
+
+// helper function to mark pointers one at a time
+size_t  simd_mark_scalar(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (pointers[i] && pointers[i] < limit) {
+            bitmap[pointers[i]] = value;
+            n++;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+
+/* SSE2 Kernels */
+
+// helper function to test for zero 64 bytes at a time with 128-bit loads
+bool    simd_zero_sse2(const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    const __m128i  zero  = _mm_setzero_si128();
+
+    while (length >= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(bytes));
+        __m128i b = _mm_loadu_si128((const __m128i *)(bytes + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(bytes + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(bytes + 48));
+        __m128i v = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            return false;
+        }
+        bytes  += 64;
+        length -= 64;
+    }
+
+    return simd_zero_scalar(bytes, length);
+}
+
+// helper function to compare 64 bytes at a time with 128-bit loads
+bool    simd_equal_sse2(const void *a, const void *b, size_t length) {
+    const uint8_t *x = a;
+    const uint8_t *y = b;
+
+    while (length >= 64) {
+        __m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(x)),      _mm_loadu_si128((const __m128i *)(y)));
+        __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(x + 16)), _mm_loadu_si128((const __m128i *)(y + 16)));
+        __m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(x + 32)), _mm_loadu_si128((const __m128i *)(y + 32)));
+        __m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(x + 48)), _mm_loadu_si128((const __m128i *)(y + 48)));
+        __m128i v  = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+        x      += 64;
+        y      += 64;
+        length -= 64;
+    }
+
+    return simd_equal_scalar(x, y, length);
+}
+
+// helper function to clear 64 bytes at a time with 128-bit stores
+void    simd_clear_sse2(void *data, size_t length) {
+    uint8_t      *bytes = data;
+    const __m128i zero  = _mm_setzero_si128();
+
+    while (length >= 64) {
+        _mm_storeu_si128((__m128i *)(bytes),      zero);
+        _mm_storeu_si128((__m128i *)(bytes + 16), zero);
+        _mm_storeu_si128((__m128i *)(bytes + 32), zero);
+        _mm_storeu_si128((__m128i *)(bytes + 48), zero);
+        bytes  += 64;
+        length -= 64;
+    }
+
+    simd_clear_scalar(bytes, length);
+}
+
+// helper function to find nonzero elements four at a time
+size_t  simd_nonzero_sse2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t        n    = 0;
+    size_t        i    = 0;
+
+    // strided elements: gather the first word of four 16-byte loads
+    for (; i + 4 <= count && (stride == 1 || stride >= 4); i += 4) {
+        __m128i v;
+        if (stride == 1) {
+            v = _mm_loadu_si128((const __m128i *)(words + i));
+        } else {
+            __m128i a = _mm_loadu_si128((const __m128i *)(words + (i + 0) * stride));
+            __m128i b = _mm_loadu_si128((const __m128i *)(words + (i + 1) * stride));
+            __m128i c = _mm_loadu_si128((const __m128i *)(words + (i + 2) * stride));
+            __m128i d = _mm_loadu_si128((const __m128i *)(words + (i + 3) * stride));
+            v = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+        }
+        uint32_t mask = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero))) & 0xF;
+        n += simd_expand(mask, i, indices + n);
+    }
+
+    for (; i < count; i++) {
+        if (words[i * stride]) {
+            indices[n++] = i;
+        }
+    }
+    return n;
+}
+
+// helper function to mark pointers four at a time (skipping empty groups)
+size_t  simd_mark_sse2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) {
+    // unsigned p - 1 < limit - 1 selects 0 < p < limit; SSE2 compares signed,
+    // so both sides are biased by 2^31
+    const __m128i bias  = _mm_set1_epi32(INT32_MIN);
+    const __m128i one   = _mm_set1_epi32(1);
+    const __m128i bound = _mm_xor_si128(_mm_set1_epi32(limit - 1), bias);
+    size_t        n     = 0;
+    size_t        i     = 0;
+
+    if (!limit) {
+        return 0;
+    }
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(pointers + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(pointers + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i *)(pointers + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i *)(pointers + i + 12));
+        __m128i v = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xFFFF) {
+            continue;
+        }
+
+        __m128i  lanes[4] = {a, b, c, d};
+        for (size_t l = 0; l < 4; l++) {
+            __m128i  key  = _mm_xor_si128(_mm_sub_epi32(lanes[l], one), bias);
+            uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(key, bound)));
+            n += simd_mark_bits(bitmap, pointers + i + 4 * l, mask, value);
+        }
+    }
+
+    return n + simd_mark_scalar(bitmap, pointers + i, count - i, limit, value);
+}
+
+/* AVX2 Kernels */
+
+// helper function to test for zero 128 bytes at a time with 256-bit loads
+__attribute__((target("avx2")))
+bool    simd_zero_avx2(const void *data, size_t length) {
+    const uint8_t *bytes = data;
+
+    while (length >= 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(bytes));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(bytes + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(bytes + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(bytes + 96));
+        __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(v, v)) {
+            return false;
+        }
+        bytes  += 128;
+        length -= 128;
+    }
+
+    while (length >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)bytes);
+        if (!_mm256_testz_si256(v, v)) {
+            return false;
+        }
+        bytes  += 32;
+        length -= 32;
+    }
+
+    return simd_zero_scalar(bytes, length);
+}
+
+// helper function to compare 128 bytes at a time with 256-bit loads
+__attribute__((target("avx2")))
+bool    simd_equal_avx2(const void *a, const void *b, size_t length) {
+    const uint8_t *x = a;
+    const uint8_t *y = b;
+
+    while (length >= 128) {
+        __m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x)),      _mm256_loadu_si256((const __m256i *)(y)));
+        __m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + 32)), _mm256_loadu_si256((const __m256i *)(y + 32)));
+        __m256i d2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + 64)), _mm256_loadu_si256((const __m256i *)(y + 64)));
+        __m256i d3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + 96)), _mm256_loadu_si256((const __m256i *)(y + 96)));
+        __m256i v  = _mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3));
+        if (!_mm256_testz_si256(v, v)) {
+            return false;
+        }
+        x      += 128;
+        y      += 128;
+        length -= 128;
+    }
+
+    return simd_equal_scalar(x, y, length);
+}
+
+// helper function to clear 128 bytes at a time with 256-bit stores
+__attribute__((target("avx2")))
+void    simd_clear_avx2(void *data, size_t length) {
+    uint8_t      *bytes = data;
+    const __m256i zero  = _mm256_setzero_si256();
+
+    while (length >= 128) {
+        _mm256_storeu_si256((__m256i *)(bytes),      zero);
+        _mm256_storeu_si256((__m256i *)(bytes + 32), zero);
+        _mm256_storeu_si256((__m256i *)(bytes + 64), zero);
+        _mm256_storeu_si256((__m256i *)(bytes + 96), zero);
+        bytes  += 128;
+        length -= 128;
+    }
+
+    simd_clear_scalar(bytes, length);
+}
+
+// helper function to find nonzero elements eight at a time (gathering strided ones)
+__attribute__((target("avx2")))
+size_t  simd_nonzero_avx2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) {
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    size_t        n     = 0;
+    size_t        i     = 0;
+
+    for (; i + 8 <= count && stride <= INT32_MAX / 8; i += 8) {
+        __m256i v;
+        if (stride == 1) {
+            v = _mm256_loadu_si256((const __m256i *)(words + i));
+        } else {
+            v = _mm256_i32gather_epi32((const int *)(words + i * stride), index, 4);
+        }
+        uint32_t mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero))) & 0xFF;
+        n += simd_expand(mask, i, indices + n);
+    }
+
+    for (; i < count; i++) {
+        if (words[i * stride]) {
+            indices[n++] = i;
+        }
+    }
+    return n;
+}
+
+// helper function to mark pointers eight at a time (skipping empty groups)
+__attribute__((target("avx2")))
+size_t  simd_mark_avx2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) {
+    // unsigned p - 1 < limit - 1 selects 0 < p < limit, as max(p - 1, limit - 2) == limit - 2
+    const __m256i one   = _mm256_set1_epi32(1);
+    const __m256i bound = _mm256_set1_epi32(limit - 2);
+    size_t        n     = 0;
+    size_t        i     = 0;
+
+    if (limit < 2) {
+        return 0;
+    }
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(pointers + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(pointers + i + 8));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(pointers + i + 16));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(pointers + i + 24));
+        __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (_mm256_testz_si256(v, v)) {
+            continue;
+        }
+
+        __m256i lanes[4] = {a, b, c, d};
+        for (size_t l = 0; l < 4; l++) {
+            __m256i  key  = _mm256_sub_epi32(lanes[l], one);
+            __m256i  in   = _mm256_cmpeq_epi32(_mm256_max_epu32(key, bound), bound);
+            uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+            n += simd_mark_bits(bitmap, pointers + i + 8 * l, mask, value);
+        }
+    }
+
+    return n + simd_mark_scalar(bitmap, pointers + i, count - i, limit, value);
+}
+
+#else
+
+bool    simd_zero_sse2(const void *data, size_t length) { return simd_zero_scalar(data, length); }
+bool    simd_equal_sse2(const void *a, const void *b, size_t length) { return simd_equal_scalar(a, b, length); }
+void    simd_clear_sse2(void *data, size_t length) { simd_clear_scalar(data, length); }
+size_t  simd_nonzero_sse2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) { return simd_nonzero_scalar(words, count, stride, indices); }
+size_t  simd_mark_sse2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) { return simd_mark_scalar(bitmap, pointers, count, limit, value); }
+
+bool    simd_zero_avx2(const void *data, size_t length) { return simd_zero_scalar(data, length); }
+bool    simd_equal_avx2(const void *a, const void *b, size_t length) { return simd_equal_scalar(a, b, length); }
+void    simd_clear_avx2(void *data, size_t length) { simd_clear_scalar(data, length); }
+size_t  simd_nonzero_avx2(const uint32_t *words, size_t count, size_t stride, uint32_t *indices) { return simd_nonzero_scalar(words, count, stride, indices); }
+size_t  simd_mark_avx2(bool *bitmap, const uint32_t *pointers, size_t count, uint32_t limit, bool value) { return simd_mark_scalar(bitmap, pointers, count, limit, value); }
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
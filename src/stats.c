@@ -0,0 +1,284 @@
+/* stats.c: SimpleFS operation statistics */
+
+#include "sfs/stats.h"
+#include "sfs/logging.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* Internal Structures */
+
+typedef struct StatsThread StatsThread;
+struct StatsThread {
+    Stats        stats;                         /* Counters owned by a single thread */
+    uint64_t     disk_reads;                    /* Disk reads issued by thread */
+    uint64_t     disk_writes;                   /* Disk writes issued by thread */
+    StatsThread *next;                          /* Next registered thread */
+};
+
+/* Internal Variables */
+
+static pthread_mutex_t  StatsLock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   StatsOnce    = PTHREAD_ONCE_INIT;
+static pthread_key_t    StatsKey;
+static StatsThread     *StatsThreads = NULL;    /* Registered live threads */
+static Stats            StatsRetired;           /* Counters of exited threads */
+static Stats            StatsBaseline;          /* Counters at last reset */
+static __thread StatsThread *StatsLocal = NULL; /* Counters of calling thread */
+
+/* Internal Prototypes */
+
+void            stats_init(void);
+void            stats_retire(void *arg);
+StatsThread *   stats_local(void);
+void            stats_merge(Stats *dst, const Stats *src);
+
+/* External Functions */
+
+/**
+ * Start timing an operation on the calling thread.
+ *
+ * @return      Timer to pass to stats_stop.
+ **/
+StatsTimer  stats_start(void) {
+    StatsThread *local = stats_local();
+    StatsTimer timer = {
+        .start       = stats_now(),
+        .disk_reads  = local ? local->disk_reads  : 0,
+        .disk_writes = local ? local->disk_writes : 0,
+    };
+    return timer;
+}
+
+/**
+ * Finish timing an operation by doing the following:
+ *
+ *  1. Record call, error, and latency (in a log2 bucket) for operation.
+ *
+ *  2. Record bytes moved for data operations.
+ *
+ *  3. Attribute disk I/Os issued by the thread since the timer started.
+ *
+ * Counters are only written by their owning thread, so no locking or atomic
+ * operations are needed on this path.
+ *
+ * @param       op          Operation (STATS_*).
+ * @param       timer       Timer returned by stats_start.
+ * @param       result      Result of operation (negative on failure; bytes
+ *                          moved for data operations).
+ **/
+void        stats_stop(int op, StatsTimer *timer, ssize_t result) {
+    StatsThread *local = stats_local();
+    if (!local || op < 0 || op >= STATS_OPS) {
+        return;
+    }
+
+    uint64_t elapsed = stats_now() - timer->start;
+    StatsOp *stat    = &local->stats.ops[op];
+
+    stat->count++;
+    stat->total_ns += elapsed;
+    if (elapsed > stat->max_ns) {
+        stat->max_ns = elapsed;
+    }
+
+    size_t bucket = elapsed ? 63 - __builtin_clzll(elapsed) : 0;
+    stat->histogram[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1]++;
+
+    if (result < 0) {
+        stat->errors++;
+    }
+
+    switch (op) {
+        case STATS_DISK_READ:
+            local->disk_reads++;
+            break;
+        case STATS_DISK_WRITE:
+            local->disk_writes++;
+            break;
+        default:
+            stat->disk_reads  += local->disk_reads  - timer->disk_reads;
+            stat->disk_writes += local->disk_writes - timer->disk_writes;
+            break;
+    }
+
+    if (result > 0 && (op == STATS_READ || op == STATS_WRITE || op == STATS_DISK_READ || op == STATS_DISK_WRITE)) {
+        stat->bytes += result;
+    }
+}
+
+/**
+ * Merge counters of all threads (live and exited) since the last reset.
+ *
+ * @param       stats       Stats structure to fill.
+ **/
+void        stats_collect(Stats *stats) {
+    pthread_once(&StatsOnce, stats_init);
+    memset(stats, 0, sizeof(Stats));
+
+    pthread_mutex_lock(&StatsLock);
+    stats_merge(stats, &StatsRetired);
+    for (StatsThread *thread = StatsThreads; thread; thread = thread->next) {
+        stats_merge(stats, &thread->stats);
+    }
+
+    // subtract baseline (maximum latency is kept since process start)
+    for (int op = 0; op < STATS_OPS; op++) {
+        StatsOp *dst = &stats->ops[op];
+        StatsOp *src = &StatsBaseline.ops[op];
+
+        dst->count       -= src->count;
+        dst->errors      -= src->errors;
+        dst->bytes       -= src->bytes;
+        dst->disk_reads  -= src->disk_reads;
+        dst->disk_writes -= src->disk_writes;
+        dst->total_ns    -= src->total_ns;
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            dst->histogram[b] -= src->histogram[b];
+        }
+    }
+    pthread_mutex_unlock(&StatsLock);
+}
+
+/**
+ * Reset counters (by recording the current totals as the new baseline).
+ **/
+void        stats_reset(void) {
+    Stats stats;
+    stats_collect(&stats);
+
+    pthread_mutex_lock(&StatsLock);
+    stats_merge(&StatsBaseline, &stats);
+    pthread_mutex_unlock(&StatsLock);
+}
+
+/**
+ * Return name of operation.
+ *
+ * @param       op          Operation (STATS_*).
+ * @return      Name of operation ("unknown" if invalid).
+ **/
+const char *stats_name(int op) {
+    static const char *names[STATS_OPS] = {
+        [STATS_CREATE]          = "create",
+        [STATS_REMOVE]          = "remove",
+        [STATS_STAT]            = "stat",
+        [STATS_READ]            = "read",
+        [STATS_WRITE]           = "write",
+        [STATS_MOUNT]           = "mount",
+        [STATS_DISK_READ]       = "disk_read",
+        [STATS_DISK_WRITE]      = "disk_write",
+        [STATS_CLONE]           = "clone",
+        [STATS_COMPRESS]        = "compress",
+        [STATS_SNAPSHOT]        = "snapshot",
+        [STATS_SNAPSHOT_DELETE] = "snapdel",
+    };
+
+    return (op >= 0 && op < STATS_OPS) ? names[op] : "unknown";
+}
+
+/**
+ * Estimate latency percentile from histogram.
+ *
+ * @param       op          Operation statistics.
+ * @param       percentile  Percentile to compute (0 to 100).
+ * @return      Upper bound (ns) of bucket containing the percentile (0 if
+ *              there were no calls).
+ **/
+uint64_t    stats_percentile(const StatsOp *op, double percentile) {
+    if (op->count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(op->count * percentile / 100.0);
+    uint64_t seen   = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += op->histogram[b];
+        if (seen > target || seen == op->count) {
+            return (2ULL << b) - 1;
+        }
+    }
+    return op->max_ns;
+}
+
+/**
+ * Return monotonic time.
+ *
+ * @return      Current monotonic time in nanoseconds.
+ **/
+uint64_t    stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Internal Functions */
+
+// helper function to create thread exit key
+void    stats_init(void) {
+    pthread_key_create(&StatsKey, stats_retire);
+}
+
+// helper function to fold counters of exiting thread into retired totals
+void    stats_retire(void *arg) {
+    StatsThread *thread = arg;
+
+    pthread_mutex_lock(&StatsLock);
+    for (StatsThread **link = &StatsThreads; *link; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
+        }
+    }
+    stats_merge(&StatsRetired, &thread->stats);
+    pthread_mutex_unlock(&StatsLock);
+
+    free(thread);
+}
+
+// helper function to get (registering on first use) counters of calling thread
+StatsThread *   stats_local(void) {
+    if (StatsLocal) {
+        return StatsLocal;
+    }
+
+    pthread_once(&StatsOnce, stats_init);
+
+    StatsThread *thread = calloc(1, sizeof(StatsThread));
+    if (!thread) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&StatsLock);
+    thread->next = StatsThreads;
+    StatsThreads = thread;
+    pthread_mutex_unlock(&StatsLock);
+
+    pthread_setspecific(StatsKey, thread);
+    StatsLocal = thread;
+    return thread;
+}
+
+// helper function to add counters of src to dst
+void    stats_merge(Stats *dst, const Stats *src) {
+    for (int op = 0; op < STATS_OPS; op++) {
+        StatsOp       *d = &dst->ops[op];
+        const StatsOp *s = &src->ops[op];
+
+        d->count       += s->count;
+        d->errors      += s->errors;
+        d->bytes       += s->bytes;
+        d->disk_reads  += s->disk_reads;
+        d->disk_writes += s->disk_writes;
+        d->total_ns    += s->total_ns;
+        if (s->max_ns > d->max_ns) {
+            d->max_ns = s->max_ns;
+        }
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            d->histogram[b] += s->histogram[b];
+        }
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,198 @@
+/* trace.c: SimpleFS binary event tracing */
+
+#include "sfs/trace.h"
+#include "sfs/logging.h"
+#include "sfs/stats.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/* Internal Structures */
+
+typedef struct TraceRing TraceRing;
+struct TraceRing {
+    TraceEvent  events[TRACE_RING_EVENTS];      /* Most recent events of thread */
+    uint64_t    head;                           /* Number of events ever recorded */
+    uint32_t    thread;                         /* Thread number */
+    TraceRing  *next;                           /* Next registered ring */
+};
+
+/* Internal Variables */
+
+static pthread_mutex_t  TraceLock    = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing       *TraceRings   = NULL;    /* Registered rings (kept after thread exit) */
+static uint32_t         TraceThreads = 0;       /* Number of registered rings */
+static __thread TraceRing *TraceLocal = NULL;   /* Ring of calling thread */
+
+/* Internal Prototypes */
+
+TraceRing * trace_local(void);
+size_t      trace_copy(TraceRing *ring, TraceEvent *events);
+int         trace_compare(const void *a, const void *b);
+
+/* External Functions */
+
+/**
+ * Record event into the ring buffer of the calling thread.
+ *
+ * Each ring has a single writer (its thread), so recording only needs a
+ * release store of the head; the oldest event is overwritten when full.
+ *
+ * @param       event       Event type (TRACE_*).
+ * @param       inode       Inode number (0 if none).
+ * @param       block       Block number (0 if none).
+ **/
+void        trace_record(uint32_t event, uint32_t inode, uint32_t block) {
+    TraceRing *ring = trace_local();
+    if (!ring) {
+        return;
+    }
+
+    uint64_t    head  = ring->head;
+    TraceEvent *entry = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+
+    entry->timestamp = stats_now();
+    entry->event     = event;
+    entry->thread    = ring->thread;
+    entry->inode     = inode;
+    entry->block     = block;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Save recorded events to a trace file by doing the following:
+ *
+ *  1. Copy the events of every ring (dropping any overwritten while copying).
+ *
+ *  2. Sort events by timestamp.
+ *
+ *  3. Write header and events to a temporary file and rename it over path.
+ *
+ * @param       path        Path to trace file.
+ * @return      Whether or not the trace file was written.
+ **/
+bool        trace_save(const char *path) {
+    pthread_mutex_lock(&TraceLock);
+
+    TraceEvent *events = calloc((size_t)TraceThreads * TRACE_RING_EVENTS + 1, sizeof(TraceEvent));
+    if (!events) {
+        pthread_mutex_unlock(&TraceLock);
+        return false;
+    }
+
+    size_t count = 0;
+    for (TraceRing *ring = TraceRings; ring; ring = ring->next) {
+        count += trace_copy(ring, events + count);
+    }
+    pthread_mutex_unlock(&TraceLock);
+
+    qsort(events, count, sizeof(TraceEvent), trace_compare);
+
+    char temp[BUFSIZ];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE *stream = fopen(temp, "w");
+    if (!stream) {
+        fprintf(stderr, "trace_save: fopen: %s\n", strerror(errno));
+        free(events);
+        return false;
+    }
+
+    TraceHeader header = {TRACE_MAGIC, count};
+    bool success = fwrite(&header, sizeof(header), 1, stream) == 1 &&
+                   fwrite(events, sizeof(TraceEvent), count, stream) == count;
+
+    success = (fclose(stream) == 0) && success;
+    if (success && rename(temp, path) < 0) {
+        fprintf(stderr, "trace_save: rename: %s\n", strerror(errno));
+        success = false;
+    }
+
+    if (!success) {
+        unlink(temp);
+    }
+
+    free(events);
+    return success;
+}
+
+/**
+ * Return name of event.
+ *
+ * @param       event       Event type (TRACE_*).
+ * @return      Name of event ("unknown" if invalid).
+ **/
+const char *trace_name(uint32_t event) {
+    static const char *names[TRACE_EVENTS] = {
+        [TRACE_INODE_INVALID]  = "inode_invalid",
+        [TRACE_INODE_REMOVE]   = "inode_remove",
+        [TRACE_READ_BLOCK]     = "read_block",
+        [TRACE_READ_RANGE]     = "read_range",
+        [TRACE_WRITE_BLOCK]    = "write_block",
+        [TRACE_WRITE_INDIRECT] = "write_indirect",
+        [TRACE_ALLOC_SCAN]     = "alloc_scan",
+        [TRACE_ALLOC_BLOCK]    = "alloc_block",
+        [TRACE_ALLOC_FAIL]     = "alloc_fail",
+    };
+
+    return (event < TRACE_EVENTS && names[event]) ? names[event] : "unknown";
+}
+
+/* Internal Functions */
+
+// helper function to get (registering on first use) ring of calling thread
+TraceRing * trace_local(void) {
+    if (TraceLocal) {
+        return TraceLocal;
+    }
+
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (!ring) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&TraceLock);
+    ring->thread = TraceThreads++;
+    ring->next   = TraceRings;
+    TraceRings   = ring;
+    pthread_mutex_unlock(&TraceLock);
+
+    TraceLocal = ring;
+    return ring;
+}
+
+// helper function to copy events of ring that were not overwritten during the copy
+size_t      trace_copy(TraceRing *ring, TraceEvent *events) {
+    uint64_t end   = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t start = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+
+    for (uint64_t i = start; i < end; i++) {
+        events[i - start] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    }
+
+    // the writer may have lapped the oldest slots (and be writing the next one)
+    uint64_t after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t valid = after >= TRACE_RING_EVENTS ? after - TRACE_RING_EVENTS + 1 : 0;
+    if (valid <= start) {
+        return end - start;
+    }
+    if (valid >= end) {
+        return 0;
+    }
+
+    memmove(events, events + (valid - start), (end - valid) * sizeof(TraceEvent));
+    return end - valid;
+}
+
+// helper function to order events by timestamp
+int         trace_compare(const void *a, const void *b) {
+    uint64_t x = ((const TraceEvent *)a)->timestamp;
+    uint64_t y = ((const TraceEvent *)b)->timestamp;
+    return (x > y) - (x < y);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,225 @@
+/* warmup.c: SimpleFS cache warm-up across remounts */
+
+#include "sfs/fs.h"
+#include "sfs/logging.h"
+#include "sfs/utils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/* Internal Prototypes */
+
+int     warmup_compare(const void *a, const void *b);
+void *  warmup_thread(void *arg);
+void    warmup_prefetch(FileSystem *fs, Warmup *warmup);
+
+/* External Functions */
+
+/**
+ * Record the hot block set of the FileSystem cache to a sidecar file by doing
+ * the following:
+ *
+ *  1. Collect metadata and frequently used data block ids from the cache.
+ *
+ *  2. Write header and records to a temporary file.
+ *
+ *  3. Atomically rename temporary file over the sidecar file.
+ *
+ * Only block ids (and their cache class) are recorded, never block contents.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ * @param       path    Path to warm-up sidecar file.
+ * @return      Whether or not the hot block set was recorded.
+ **/
+bool    fs_warmup_save(FileSystem *fs, const char *path) {
+    if (!fs || !fs->cache || !path) {
+        return false;
+    }
+
+    size_t    max     = fs->cache->capacity;
+    uint32_t *blocks  = calloc(max, sizeof(uint32_t));
+    uint8_t  *classes = calloc(max, sizeof(uint8_t));
+    if (!blocks || !classes) {
+        free(blocks);
+        free(classes);
+        return false;
+    }
+
+    WarmupHeader header = {
+        .magic  = WARMUP_MAGIC,
+        .blocks = fs->meta_data.blocks,
+        .count  = cache_hot(fs->cache, blocks, classes, max),
+    };
+
+    char temp[BUFSIZ];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE *stream = fopen(temp, "w");
+    if (!stream) {
+        fprintf(stderr, "fs_warmup_save: fopen: %s\n", strerror(errno));
+        free(blocks);
+        free(classes);
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, stream) == 1;
+    for (uint32_t i = 0; success && i < header.count; i++) {
+        WarmupRecord record = {blocks[i], classes[i]};
+        success = fwrite(&record, sizeof(record), 1, stream) == 1;
+    }
+
+    success = (fclose(stream) == 0) && success;
+    if (success && rename(temp, path) < 0) {
+        fprintf(stderr, "fs_warmup_save: rename: %s\n", strerror(errno));
+        success = false;
+    }
+
+    if (!success) {
+        unlink(temp);
+    }
+
+    free(blocks);
+    free(classes);
+    return success;
+}
+
+/**
+ * Prefetch a previously recorded hot block set into the FileSystem cache by
+ * doing the following:
+ *
+ *  1. Read and verify the sidecar file against the mounted FileSystem.
+ *
+ *  2. Sort the recorded blocks by block number.
+ *
+ *  3. Read them in large batches (bridging small holes) either in a
+ *  background thread or synchronously.
+ *
+ * @param       fs          Pointer to FileSystem structure.
+ * @param       path        Path to warm-up sidecar file.
+ * @param       background  Whether or not to prefetch in a background thread.
+ * @return      Whether or not prefetching was started.
+ **/
+bool    fs_warmup_load(FileSystem *fs, const char *path, bool background) {
+    if (!fs || !fs->disk || !fs->cache || !path || fs->warmup) {
+        return false;
+    }
+
+    FILE *stream = fopen(path, "r");
+    if (!stream) {
+        return false;
+    }
+
+    WarmupHeader header;
+    if (fread(&header, sizeof(header), 1, stream) != 1 ||
+        header.magic  != WARMUP_MAGIC ||
+        header.blocks != fs->meta_data.blocks ||
+        header.count  >  header.blocks) {
+        fprintf(stderr, "fs_warmup_load: %s is not a warm-up file for this file system\n", path);
+        fclose(stream);
+        return false;
+    }
+
+    Warmup *warmup  = calloc(1, sizeof(Warmup));
+    warmup->records = calloc(header.count + 1, sizeof(WarmupRecord));
+    warmup->count   = fread(warmup->records, sizeof(WarmupRecord), header.count, stream);
+    fclose(stream);
+
+    qsort(warmup->records, warmup->count, sizeof(WarmupRecord), warmup_compare);
+    fs->warmup = warmup;
+
+    if (background && pthread_create(&warmup->thread, NULL, warmup_thread, fs) == 0) {
+        warmup->running = true;
+        return true;
+    }
+
+    warmup_prefetch(fs, warmup);
+    fs_warmup_wait(fs);
+    return true;
+}
+
+/**
+ * Stop background warm-up prefetching (if any) and release its state.
+ *
+ * @param       fs      Pointer to FileSystem structure.
+ **/
+void    fs_warmup_wait(FileSystem *fs) {
+    Warmup *warmup = fs ? fs->warmup : NULL;
+    if (!warmup) {
+        return;
+    }
+
+    if (warmup->running) {
+        warmup->stop = true;
+        pthread_join(warmup->thread, NULL);
+    }
+
+    free(warmup->records);
+    free(warmup);
+    fs->warmup = NULL;
+}
+
+/* Internal Functions */
+
+// helper function to order records by block number
+int     warmup_compare(const void *a, const void *b) {
+    uint32_t x = ((const WarmupRecord *)a)->block;
+    uint32_t y = ((const WarmupRecord *)b)->block;
+    return (x > y) - (x < y);
+}
+
+// helper function to run prefetch in the background
+void *  warmup_thread(void *arg) {
+    FileSystem *fs = arg;
+    queue_set_priority(QUEUE_CLASS_IDLE);
+    warmup_prefetch(fs, fs->warmup);
+    return NULL;
+}
+
+// helper function to read sorted records in large batches
+void    warmup_prefetch(FileSystem *fs, Warmup *warmup) {
+    char *buffer = malloc(WARMUP_BATCH * BLOCK_SIZE);
+    if (!buffer) {
+        return;
+    }
+
+    for (size_t i = 0; i < warmup->count && !warmup->stop; ) {
+        size_t first = warmup->records[i].block;
+        if (first >= fs->meta_data.blocks || warmup->records[i].class >= CACHE_CLASSES) {
+            i++;
+            continue;
+        }
+
+        // extend batch while the next block is close enough to bridge
+        size_t end = i + 1;
+        while (end < warmup->count &&
+               warmup->records[end].block < fs->meta_data.blocks &&
+               warmup->records[end].block - warmup->records[end - 1].block <= WARMUP_GAP &&
+               warmup->records[end].block - first < WARMUP_BATCH) {
+            end++;
+        }
+
+        // blocks written while the batch is read must not be filled with it
+        size_t   count = warmup->records[end - 1].block - first + 1;
+        uint64_t since = cache_sequence(fs->cache);
+        if (disk_readv(fs->disk, first, count, buffer) != DISK_FAILURE) {
+            for (size_t j = i; j < end; j++) {
+                WarmupRecord *record = &warmup->records[j];
+                if (record->class >= CACHE_CLASSES) {
+                    continue;
+                }
+
+                if (cache_fill(fs->cache, record->block, record->class, buffer + (record->block - first) * BLOCK_SIZE, since)) {
+                    warmup->loaded++;
+                }
+            }
+        }
+
+        i = end;
+    }
+
+    free(buffer);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
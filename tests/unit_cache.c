@@ -0,0 +1,272 @@
+/* unit_cache.c: Unit tests for SimpleFS block cache */
+
+#include "sfs/cache.h"
+#include "sfs/logging.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include <unistd.h>
+
+/* Constants */
+
+#define CACHE_CAPACITY  (16)
+
+/* Functions */
+
+void fill_block(char *data, size_t block) {
+    memset(data, block & 0xff, BLOCK_SIZE);
+}
+
+int test_00_cache_create() {
+    debug("Check bad capacity");
+    assert(cache_create(0) == NULL);
+
+    debug("Check cache attributes");
+    Cache *cache = cache_create(CACHE_CAPACITY);
+    assert(cache);
+    assert(cache->capacity == CACHE_CAPACITY);
+    assert(cache->nbuckets >= CACHE_CAPACITY);
+    for (int c = 0; c < CACHE_CLASSES; c++) {
+        assert(cache->stats[c].hits     == 0);
+        assert(cache->stats[c].misses   == 0);
+        assert(cache->stats[c].resident == 0);
+    }
+
+    cache_delete(cache);
+    cache_delete(NULL);
+    return EXIT_SUCCESS;
+}
+
+int test_01_cache_lookup() {
+    Cache *cache = cache_create(CACHE_CAPACITY);
+    assert(cache);
+
+    char data[BLOCK_SIZE];
+    char copy[BLOCK_SIZE];
+
+    debug("Check lookup miss");
+    assert(cache_lookup(cache, 3, CACHE_DATA, copy) == false);
+    assert(cache->stats[CACHE_DATA].misses == 1);
+
+    debug("Check lookup hit");
+    fill_block(data, 3);
+    cache_insert(cache, 3, CACHE_DATA, data);
+    assert(cache_contains(cache, 3));
+    assert(cache_lookup(cache, 3, CACHE_DATA, copy));
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+    assert(cache->stats[CACHE_DATA].hits     == 1);
+    assert(cache->stats[CACHE_DATA].resident == 1);
+    assert(cache_hit_rate(cache, CACHE_DATA) == 0.5);
+
+    debug("Check update");
+    fill_block(data, 7);
+    cache_insert(cache, 3, CACHE_DATA, data);
+    assert(cache_lookup(cache, 3, CACHE_DATA, copy));
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+    assert(cache->stats[CACHE_DATA].resident == 1);
+
+    debug("Check invalidate");
+    cache_invalidate(cache, 3);
+    assert(cache_contains(cache, 3) == false);
+    assert(cache->stats[CACHE_DATA].resident == 0);
+
+    debug("Check capacity");
+    for (size_t b = 0; b < 4 * CACHE_CAPACITY; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_DATA, data);
+    }
+    size_t resident = 0;
+    for (size_t b = 0; b < 4 * CACHE_CAPACITY; b++) {
+        resident += cache_contains(cache, b);
+    }
+    assert(resident == CACHE_CAPACITY);
+    assert(cache->stats[CACHE_DATA].resident == CACHE_CAPACITY);
+
+    cache_delete(cache);
+    return EXIT_SUCCESS;
+}
+
+int test_02_cache_scan() {
+    Cache *cache = cache_create(CACHE_CAPACITY);
+    assert(cache);
+
+    char data[BLOCK_SIZE];
+
+    debug("Check metadata survives streaming data");
+    fill_block(data, 0);
+    cache_insert(cache, 0, CACHE_SUPER, data);
+    for (size_t b = 1; b <= 3; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_INODE, data);
+    }
+    fill_block(data, 4);
+    cache_insert(cache, 4, CACHE_INDIRECT, data);
+
+    for (size_t b = 100; b < 100 + 10 * CACHE_CAPACITY; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_DATA, data);
+    }
+
+    for (size_t b = 0; b <= 4; b++) {
+        assert(cache_contains(cache, b));
+    }
+
+    debug("Check hot data survives a scan");
+    Cache *hot = cache_create(CACHE_CAPACITY);
+    assert(hot);
+
+    // reference a block twice (second time after it left A1in) so it reaches Am
+    fill_block(data, 1);
+    cache_insert(hot, 1, CACHE_DATA, data);
+    for (size_t b = 100; b < 100 + CACHE_CAPACITY; b++) {
+        cache_insert(hot, b, CACHE_DATA, data);
+    }
+    assert(cache_contains(hot, 1) == false);
+    cache_insert(hot, 1, CACHE_DATA, data);
+
+    for (size_t b = 1000; b < 1000 + 10 * CACHE_CAPACITY; b++) {
+        cache_insert(hot, b, CACHE_DATA, data);
+    }
+    assert(cache_contains(hot, 1));
+
+    debug("Check cold inserts are evicted first");
+    cache_insert_cold(hot, 5000, CACHE_DATA, data);
+    cache_insert(hot, 5001, CACHE_DATA, data);
+    assert(cache_contains(hot, 5000) == false);
+    assert(cache_contains(hot, 1));
+
+    cache_delete(hot);
+    cache_delete(cache);
+    return EXIT_SUCCESS;
+}
+
+int test_03_cache_fill() {
+    Cache *cache = cache_create(CACHE_CAPACITY);
+    assert(cache);
+
+    char data[BLOCK_SIZE];
+    char copy[BLOCK_SIZE];
+
+    debug("Check fill of uncached block");
+    fill_block(data, 3);
+    assert(cache_fill(cache, 3, CACHE_DATA, data, cache_sequence(cache)));
+    assert(cache_lookup(cache, 3, CACHE_DATA, copy));
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+
+    debug("Check fill does not replace cached block");
+    fill_block(copy, 4);
+    assert(cache_fill(cache, 3, CACHE_DATA, copy, cache_sequence(cache)) == false);
+    assert(cache_lookup(cache, 3, CACHE_DATA, copy));
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+
+    debug("Check fill refuses block written (and evicted) while batch was read");
+    uint64_t since = cache_sequence(cache);
+    fill_block(data, 7);
+    cache_insert(cache, 7, CACHE_DATA, data);
+    cache_invalidate(cache, 7);
+    assert(cache_contains(cache, 7) == false);
+    fill_block(copy, 8);
+    assert(cache_fill(cache, 7, CACHE_DATA, copy, since) == false);
+    assert(cache_contains(cache, 7) == false);
+
+    debug("Check fill refuses block invalidated while batch was read");
+    since = cache_sequence(cache);
+    cache_invalidate(cache, 3);
+    assert(cache_fill(cache, 3, CACHE_DATA, copy, since) == false);
+
+    debug("Check fill of block read after the write");
+    assert(cache_fill(cache, 7, CACHE_DATA, data, cache_sequence(cache)));
+    assert(cache_lookup(cache, 7, CACHE_DATA, copy));
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+
+    assert(cache_fill(NULL, 7, CACHE_DATA, data, 0) == false);
+    cache_delete(cache);
+    return EXIT_SUCCESS;
+}
+
+int test_04_cache_evict() {
+    Cache *cache = cache_create(CACHE_CAPACITY);
+    assert(cache);
+
+    char data[BLOCK_SIZE];
+    char copy[BLOCK_SIZE];
+
+    debug("Check data seen once is evicted in insertion order");
+    for (size_t b = 0; b <= CACHE_CAPACITY; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_DATA, data);
+    }
+    assert(cache_contains(cache, 0) == false);
+    assert(cache_lookup(cache, 0, CACHE_DATA, copy) == false);
+    assert(cache_lookup(cache, 1, CACHE_DATA, copy));
+    fill_block(data, 1);
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+    assert(cache_lookup(cache, CACHE_CAPACITY, CACHE_DATA, copy));
+    assert(cache->stats[CACHE_DATA].hits     == 2);
+    assert(cache->stats[CACHE_DATA].misses   == 1);
+    assert(cache->stats[CACHE_DATA].resident == CACHE_CAPACITY);
+
+    debug("Check evicted block inserted again outlives blocks seen once");
+    fill_block(data, 0);
+    cache_insert(cache, 0, CACHE_DATA, data);
+    assert(cache_contains(cache, 1) == false);
+    for (size_t b = 100; b < 100 + 2 * CACHE_CAPACITY; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_DATA, data);
+    }
+    assert(cache_lookup(cache, 0, CACHE_DATA, copy));
+    fill_block(data, 0);
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+    assert(cache_contains(cache, CACHE_CAPACITY) == false);
+
+    debug("Check metadata beyond its share evicts least recently used metadata");
+    for (size_t b = 1000; b < 1000 + CACHE_CAPACITY / CACHE_META_SHARE + 2; b++) {
+        fill_block(data, b);
+        cache_insert(cache, b, CACHE_INODE, data);
+    }
+    assert(cache_contains(cache, 1000) == false);
+    assert(cache->stats[CACHE_INODE].resident == CACHE_CAPACITY / CACHE_META_SHARE + 1);
+    assert(cache->stats[CACHE_DATA].resident  == CACHE_CAPACITY - CACHE_CAPACITY / CACHE_META_SHARE - 1);
+
+    assert(cache_lookup(cache, 1001, CACHE_INODE, copy));
+    cache_insert(cache, 2000, CACHE_INODE, data);
+    assert(cache_contains(cache, 1001));
+    assert(cache_contains(cache, 1002) == false);
+    assert(cache->stats[CACHE_INODE].hits == 1 && cache->stats[CACHE_INODE].misses == 0);
+
+    cache_delete(cache);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test cache_create\n");
+        fprintf(stderr, "    1. Test cache_lookup\n");
+        fprintf(stderr, "    2. Test cache_scan\n");
+        fprintf(stderr, "    3. Test cache_fill\n");
+        fprintf(stderr, "    4. Test cache_evict\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_cache_create(); break;
+        case 1:  status = test_01_cache_lookup(); break;
+        case 2:  status = test_02_cache_scan(); break;
+        case 3:  status = test_03_cache_fill(); break;
+        case 4:  status = test_04_cache_evict(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -1,23 +1,37 @@
 /* unit_disk.c: Unit tests for SimpleFS disk emulator */
 
+#include "sfs/crc32c.h"
 #include "sfs/disk.h"
 #include "sfs/logging.h"
+#include "sfs/stats.h"
 
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <sys/stat.h>
 #include <unistd.h>
 
 /* Constants */
 
 #define DISK_PATH   "unit_disk.image"
+#define DISK_CRC    "unit_disk.image.crc"
+#define DISK_TRACK  "unit_disk.image.cbt"
+#define DISK_DELTA  "unit_disk.image.delta"
+#define DISK_DELTA2 "unit_disk.image.delta2"
+#define DISK_CLONE  "unit_disk.image.clone"
 #define DISK_BLOCKS (4)
 
 /* Functions */
 
 void test_cleanup() {
     unlink(DISK_PATH);
+    unlink(DISK_CRC);
+    unlink(DISK_TRACK);
+    unlink(DISK_DELTA);
+    unlink(DISK_DELTA2);
+    unlink(DISK_CLONE);
 }
 
 int test_00_disk_open() {
@@ -106,6 +120,470 @@ int test_02_disk_write() {
     return EXIT_SUCCESS;
 }
 
+int test_03_disk_model() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+
+    char data[DISK_BLOCKS*BLOCK_SIZE] = {0};
+
+    debug("Check bad model");
+    assert(model_parse("tape") == NULL);
+    assert(model_parse("ssd:channels=0") == NULL);
+    assert(model_parse("hdd:speed=1") == NULL);
+
+    debug("Check ssd pages are spread over channels");
+    disk_model(disk, model_parse("ssd:read=50,write=200,channels=2"));
+    assert(disk->model && disk->model->blocks == DISK_BLOCKS);
+    assert(disk_readv(disk, 0, 4, data) == 4*BLOCK_SIZE);
+    assert(disk->model->busy_ns == 100000);
+    assert(disk_write(disk, 1, data) == BLOCK_SIZE);
+    assert(disk->model->busy_ns == 300000);
+    assert(disk->model->requests == 2 && disk->model->blocks_moved == 5);
+
+    debug("Check ssd bandwidth cap");
+    disk_model(disk, model_parse("ssd:read=1,bandwidth=1"));
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    assert(disk->model->busy_ns == (uint64_t)BLOCK_SIZE * 1000000000ULL / (1 << 20));
+
+    debug("Check hdd sequential access does not wait for rotation");
+    disk_model(disk, model_parse("hdd:rpm=7200,track=256"));
+    uint64_t period = 60000000000ULL / 7200;
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    assert(disk_read(disk, 1, data) == BLOCK_SIZE);
+    assert(disk->model->rotation_ns == 0);
+    assert(disk->model->busy_ns == 2 * (period / 256));
+
+    debug("Check hdd backward access waits for rotation");
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE);
+    assert(disk->model->rotation_ns == period - 2 * (period / 256));
+    assert(disk->model->seeks == 0);
+
+    disk_model(disk, NULL);
+    assert(disk->model == NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_04_disk_queue() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+
+    char        data[DISK_BLOCKS][BLOCK_SIZE];
+    DiskRequest requests[DISK_BLOCKS];
+    size_t      order[DISK_BLOCKS] = {3, 1, 2, 0};
+    QueueStats  stats;
+
+    debug("Check bad policy");
+    assert(queue_parse("elevator") == NULL);
+
+    debug("Check cscan merges out of order writes into one I/O");
+    disk_queue(disk, queue_parse("cscan"));
+    assert(disk->queue && disk->queue->disk == disk);
+    for (size_t i = 0; i < DISK_BLOCKS; i++) {
+        memset(data[i], 'a' + order[i], BLOCK_SIZE);
+        requests[i] = (DiskRequest){.block = order[i], .count = 1, .data = data[i], .write = true};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    for (size_t i = 0; i < DISK_BLOCKS; i++) {
+        assert(queue_wait(disk->queue, &requests[i]) == BLOCK_SIZE);
+    }
+    queue_stats(disk->queue, &stats);
+    assert(stats.submitted == 4 && stats.dispatched == 1 && stats.merges == 3);
+    assert(stats.reorders == 1 && stats.max_depth == 4);
+    assert(disk->writes == 4);
+
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        assert(disk_read(disk, b, data[0]) == BLOCK_SIZE);
+        assert(data[0][0] == 'a' + b && data[0][BLOCK_SIZE - 1] == 'a' + b);
+    }
+
+    debug("Check reads are not moved ahead of an older write to the same block");
+    memset(data[0], 'z', BLOCK_SIZE);
+    requests[0] = (DiskRequest){.block = 1, .count = 1, .data = data[1], .write = false};
+    requests[1] = (DiskRequest){.block = 0, .count = 1, .data = data[0], .write = true};
+    requests[2] = (DiskRequest){.block = 0, .count = 1, .data = data[2], .write = false};
+    for (size_t i = 0; i < 3; i++) {
+        queue_submit(disk->queue, &requests[i]);
+    }
+    assert(queue_wait(disk->queue, &requests[2]) == BLOCK_SIZE);
+    assert(requests[0].done && requests[1].done);
+    assert(data[2][0] == 'z' && data[1][0] == 'b');
+
+    debug("Check fifo dispatches in arrival order");
+    disk_queue(disk, queue_parse("fifo"));
+    for (size_t i = 0; i < DISK_BLOCKS; i++) {
+        requests[i] = (DiskRequest){.block = order[i], .count = 1, .data = data[i], .write = false};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    assert(queue_wait(disk->queue, &requests[0]) == BLOCK_SIZE);
+
+    debug("Check dispatcher returns once its own request is done");
+    assert(!requests[1].done && disk->queue->count == DISK_BLOCKS - 1 && !disk->queue->dispatching);
+    for (size_t i = 1; i < DISK_BLOCKS; i++) {
+        assert(queue_wait(disk->queue, &requests[i]) == BLOCK_SIZE);
+    }
+    queue_stats(disk->queue, &stats);
+    assert(stats.dispatched == 4 && stats.merges == 0 && stats.reorders == 0);
+    assert(data[1][0] == 'b' && data[3][0] == 'z');
+
+    debug("Check deadline dispatches expired reads before writes");
+    disk_queue(disk, queue_parse("deadline"));
+    disk->queue->read_deadline_ns = 0;
+    requests[0] = (DiskRequest){.block = 0, .count = 1, .data = data[0], .write = true};
+    requests[1] = (DiskRequest){.block = 3, .count = 1, .data = data[3], .write = false};
+    queue_submit(disk->queue, &requests[0]);
+    queue_submit(disk->queue, &requests[1]);
+    assert(queue_wait(disk->queue, &requests[0]) == BLOCK_SIZE);
+    queue_stats(disk->queue, &stats);
+    assert(stats.expired == 1 && stats.reorders == 1 && stats.dispatched == 2);
+
+    disk_queue(disk, NULL);
+    assert(disk->queue == NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_05_disk_priority() {
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+
+    char        data[DISK_BLOCKS][BLOCK_SIZE];
+    DiskRequest requests[30];
+    int         classes[3] = {QUEUE_CLASS_IDLE, QUEUE_CLASS_BE, QUEUE_CLASS_RT};
+    QueueStats  stats;
+
+    debug("Check thread priority");
+    assert(queue_priority() == QUEUE_CLASS_BE);
+    assert(queue_set_priority(QUEUE_CLASSES) == -1);
+    assert(queue_set_priority(QUEUE_CLASS_IDLE) == QUEUE_CLASS_BE);
+    assert(queue_set_priority(QUEUE_CLASS_BE) == QUEUE_CLASS_IDLE);
+
+    debug("Check higher classes are dispatched first");
+    disk_queue(disk, queue_parse("fifo"));
+    for (size_t i = 0; i < 3; i++) {
+        requests[i] = (DiskRequest){.block = i, .count = 1, .data = data[i], .write = false, .priority = classes[i]};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    assert(queue_wait(disk->queue, &requests[0]) == BLOCK_SIZE);
+    assert(requests[1].done && requests[2].done);
+    queue_stats(disk->queue, &stats);
+    assert(stats.dispatched == 3 && stats.reorders == 2);
+    for (size_t c = 0; c < QUEUE_CLASSES; c++) {
+        assert(stats.classes[c].submitted == 1 && stats.classes[c].dispatched == 1);
+    }
+    assert(stats.classes[QUEUE_CLASS_RT].total_wait_ns <= stats.classes[QUEUE_CLASS_BE].total_wait_ns);
+    assert(stats.classes[QUEUE_CLASS_BE].total_wait_ns <= stats.classes[QUEUE_CLASS_IDLE].total_wait_ns);
+
+    debug("Check merging stays within a class");
+    disk_queue(disk, queue_parse("cscan"));
+    for (size_t i = 0; i < 2; i++) {
+        requests[i] = (DiskRequest){.block = i, .count = 1, .data = data[i], .write = false, .priority = classes[i]};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    assert(queue_wait(disk->queue, &requests[0]) == BLOCK_SIZE);
+    queue_stats(disk->queue, &stats);
+    assert(stats.dispatched == 2 && stats.merges == 0);
+
+    debug("Check token bucket throttles a class");
+    disk_queue(disk, queue_parse("fifo"));
+    queue_limit(disk->queue, QUEUE_CLASS_IDLE, 100, 0);
+    uint64_t start = stats_now();
+    for (size_t i = 0; i < 30; i++) {
+        requests[i] = (DiskRequest){.block = i % DISK_BLOCKS, .count = 1, .data = data[i % DISK_BLOCKS], .priority = QUEUE_CLASS_IDLE};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    for (size_t i = 0; i < 30; i++) {
+        assert(queue_wait(disk->queue, &requests[i]) == BLOCK_SIZE);
+    }
+    uint64_t elapsed = stats_now() - start;
+    queue_stats(disk->queue, &stats);
+
+    // a burst of 10 I/Os, then 20 more at 100 per second
+    assert(elapsed >= 190000000ULL);
+    assert(stats.throttled_ns > 0 && stats.classes[QUEUE_CLASS_IDLE].throttled > 0);
+    assert(stats.classes[QUEUE_CLASS_IDLE].dispatched == 30);
+
+    debug("Check queue_transfer uses thread priority");
+    queue_set_priority(QUEUE_CLASS_RT);
+    assert(disk_read(disk, 0, data[0]) == BLOCK_SIZE);
+    queue_set_priority(QUEUE_CLASS_BE);
+    queue_stats(disk->queue, &stats);
+    assert(stats.classes[QUEUE_CLASS_RT].dispatched == 1);
+
+    disk_queue(disk, NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_06_disk_checksum() {
+    char data[BLOCK_SIZE];
+    char copy[BLOCK_SIZE];
+
+    debug("Check known CRC32C values");
+    assert(crc32c(0, "123456789", 9) == 0xE3069283);
+    assert(crc32c_software(0, "123456789", 9) == 0xE3069283);
+    assert(crc32c_hardware(0, "123456789", 9) == 0xE3069283);
+    assert(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xE3069283);
+    assert(crc32c(0, "", 0) == 0);
+
+    debug("Check implementations agree at every alignment and length");
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        data[i] = i * 31 + (i >> 7);
+    }
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t length = 0; length < 64; length++) {
+            assert(crc32c_software(0, data + offset, length) == crc32c_hardware(0, data + offset, length));
+        }
+    }
+    for (size_t length = BLOCK_SIZE - 3 * 1024 - 16; length <= BLOCK_SIZE; length += 8) {
+        assert(crc32c_software(0, data, length) == crc32c_hardware(0, data, length));
+    }
+
+    debug("Check attaching checksums to an image");
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+    assert(disk_checksum(disk, "/asdf/NOPE", false) == false);
+    assert(disk->checksums == NULL && disk->checksum_fd < 0);
+    assert(disk_checksum(disk, DISK_CRC, false));
+
+    debug("Check writes update checksums and reads verify them");
+    assert(disk_write(disk, 2, data) == BLOCK_SIZE);
+    assert(disk->checksums[2] == crc32c(0, data, BLOCK_SIZE));
+    assert(disk_read(disk, 2, copy) == BLOCK_SIZE);
+    assert(memcmp(data, copy, BLOCK_SIZE) == 0);
+    char *blocks = malloc(DISK_BLOCKS * BLOCK_SIZE);
+    assert(disk_readv(disk, 0, DISK_BLOCKS, blocks) == DISK_BLOCKS * BLOCK_SIZE);
+    assert(memcmp(blocks + 2 * BLOCK_SIZE, data, BLOCK_SIZE) == 0);
+    free(blocks);
+
+    debug("Check corruption behind the disk is detected");
+    assert(pwrite(disk->fd, "!", 1, 2 * BLOCK_SIZE + 100) == 1);
+    assert(disk_read(disk, 2, copy) == DISK_FAILURE);
+    assert(disk->corrupted == 1);
+    assert(disk_read(disk, 1, copy) == BLOCK_SIZE);
+
+    debug("Check checksums persist in sidecar file");
+    disk_close(disk);
+    disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk && disk_checksum(disk, DISK_CRC, false));
+    assert(disk_read(disk, 2, copy) == DISK_FAILURE);
+
+    debug("Check rebuild accepts current contents");
+    assert(disk_checksum(disk, DISK_CRC, true));
+    assert(disk_read(disk, 2, copy) == BLOCK_SIZE);
+    assert(copy[100] == '!');
+
+    debug("Check detaching checksums");
+    assert(disk_checksum(disk, NULL, false));
+    assert(disk->checksums == NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_07_disk_track() {
+    char     data[BLOCK_SIZE];
+    uint32_t blocks[DISK_BLOCKS];
+
+    memset(data, 'x', BLOCK_SIZE);
+
+    debug("Check attaching changed-block tracking to an image");
+    Disk *disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk);
+    assert(disk_checkpoint(disk) == 0);
+    assert(disk_changed(disk, 0, blocks) == DISK_FAILURE);
+    assert(disk_track(disk, "/asdf/NOPE") == false);
+    assert(disk->generations == NULL && disk->track_fd < 0);
+    assert(disk_track(disk, DISK_TRACK));
+    assert(disk_changed(disk, 0, blocks) == 0);
+
+    debug("Check writes are reported since each checkpoint");
+    assert(disk_write(disk, 1, data) == BLOCK_SIZE);
+    uint64_t first = disk_checkpoint(disk);
+    assert(first > 0);
+    assert(disk_write(disk, 3, data) == BLOCK_SIZE);
+    assert(disk_write(disk, 3, data) == BLOCK_SIZE);
+    char *range = calloc(2, BLOCK_SIZE);
+    assert(disk_transferv(disk, 0, &(struct iovec){range, 2 * BLOCK_SIZE}, 1, true) == 2 * BLOCK_SIZE);
+    free(range);
+    uint64_t second = disk_checkpoint(disk);
+    assert(second > first);
+
+    assert(disk_changed(disk, 0, blocks) == 3);
+    assert(disk_changed(disk, first, blocks) == 3);
+    assert(blocks[0] == 0 && blocks[1] == 1 && blocks[2] == 3);
+    assert(disk_changed(disk, second, blocks) == 0);
+    assert(disk_changed(disk, second + 1, blocks) == DISK_FAILURE);
+
+    debug("Check reads do not count as changes");
+    assert(disk_read(disk, 2, data) == BLOCK_SIZE);
+    assert(disk_changed(disk, second, blocks) == 0);
+
+    debug("Check generations persist in sidecar file");
+    assert(disk_write(disk, 2, data) == BLOCK_SIZE);
+    disk_close(disk);
+    disk = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk && disk_track(disk, DISK_TRACK));
+    assert(disk_changed(disk, second, blocks) == 1 && blocks[0] == 2);
+    assert(disk_changed(disk, first, blocks) == 4);
+
+    debug("Check detaching changed-block tracking");
+    assert(disk_track(disk, NULL));
+    assert(disk->generations == NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_08_disk_overlay() {
+    char  data[BLOCK_SIZE];
+    char *blocks = malloc(DISK_BLOCKS * BLOCK_SIZE);
+    char *image  = malloc(DISK_BLOCKS * BLOCK_SIZE);
+
+    debug("Check overlay needs a base image of the right size");
+    Disk *base = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(base);
+    for (size_t b = 0; b < DISK_BLOCKS; b++) {
+        memset(image + b * BLOCK_SIZE, 'a' + b, BLOCK_SIZE);
+        assert(disk_write(base, b, image + b * BLOCK_SIZE) == BLOCK_SIZE);
+    }
+    disk_close(base);
+    assert(disk_overlay("/asdf/NOPE", DISK_DELTA, DISK_BLOCKS) == NULL);
+    assert(disk_overlay(DISK_PATH, DISK_DELTA, DISK_BLOCKS + 1) == NULL);
+
+    debug("Check reads fall through to the base image");
+    Disk *disk = disk_overlay(DISK_PATH, DISK_DELTA, DISK_BLOCKS);
+    assert(disk);
+    assert(disk_readv(disk, 0, DISK_BLOCKS, blocks) == DISK_BLOCKS * BLOCK_SIZE);
+    assert(memcmp(blocks, image, DISK_BLOCKS * BLOCK_SIZE) == 0);
+
+    debug("Check writes go to the delta file only");
+    memset(data, 'x', BLOCK_SIZE);
+    assert(disk_write(disk, 2, data) == BLOCK_SIZE);
+    assert(disk_write(disk, 0, data) == BLOCK_SIZE);
+    memset(data, 'y', BLOCK_SIZE);
+    assert(disk_write(disk, 2, data) == BLOCK_SIZE);
+    assert(disk->overlay_slots == 2);
+    assert(disk_readv(disk, 0, DISK_BLOCKS, blocks) == DISK_BLOCKS * BLOCK_SIZE);
+    assert(blocks[0] == 'x' && blocks[BLOCK_SIZE] == 'b' && blocks[2 * BLOCK_SIZE] == 'y' && blocks[3 * BLOCK_SIZE] == 'd');
+
+    Disk *other = disk_overlay(DISK_PATH, DISK_DELTA2, DISK_BLOCKS);
+    assert(other);
+    assert(disk_read(other, 2, data) == BLOCK_SIZE && data[0] == 'c');
+    disk_close(other);
+
+    base = disk_open(DISK_PATH, DISK_BLOCKS);
+    assert(disk_readv(base, 0, DISK_BLOCKS, blocks) == DISK_BLOCKS * BLOCK_SIZE);
+    assert(memcmp(blocks, image, DISK_BLOCKS * BLOCK_SIZE) == 0);
+    disk_close(base);
+
+    debug("Check delta file persists its map");
+    disk_close(disk);
+    disk = disk_overlay(DISK_PATH, DISK_DELTA, DISK_BLOCKS);
+    assert(disk && disk->overlay_slots == 2);
+    assert(disk_read(disk, 2, data) == BLOCK_SIZE && data[0] == 'y');
+    assert(disk_read(disk, 1, data) == BLOCK_SIZE && data[0] == 'b');
+    assert(disk_overlay(DISK_PATH, DISK_DELTA, DISK_BLOCKS - 1) == NULL);
+
+    debug("Check checksums cover the overlay contents");
+    assert(disk_checksum(disk, DISK_CRC, true));
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE && data[0] == 'x');
+    assert(disk_read(disk, 3, data) == BLOCK_SIZE && data[0] == 'd');
+
+    free(image);
+    free(blocks);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_09_disk_clone() {
+    char        data[BLOCK_SIZE];
+    struct stat s;
+    size_t      blocks = 1024;
+
+    debug("Check bad source");
+    assert(disk_clone("/asdf/NOPE", DISK_CLONE) == false);
+    assert(access(DISK_CLONE, F_OK) < 0);
+
+    debug("Check clone copies written blocks");
+    Disk *disk = disk_open(DISK_PATH, blocks);
+    assert(disk);
+    memset(data, 'a', BLOCK_SIZE);
+    assert(disk_write(disk, 0, data) == BLOCK_SIZE);
+    memset(data, 'z', BLOCK_SIZE);
+    assert(disk_write(disk, blocks - 1, data) == BLOCK_SIZE);
+    disk_close(disk);
+
+    assert(disk_clone(DISK_PATH, DISK_CLONE));
+    disk = disk_open(DISK_CLONE, blocks);
+    assert(disk);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE && data[0] == 'a' && data[BLOCK_SIZE - 1] == 'a');
+    assert(disk_read(disk, 1, data) == BLOCK_SIZE && data[0] == 0);
+    assert(disk_read(disk, blocks - 1, data) == BLOCK_SIZE && data[0] == 'z');
+
+    debug("Check clone keeps holes sparse");
+    assert(stat(DISK_CLONE, &s) == 0);
+    assert(s.st_size == (off_t)(blocks * BLOCK_SIZE));
+    assert(s.st_blocks * 512 < s.st_size / 2);
+
+    debug("Check clone is independent of source");
+    memset(data, 'q', BLOCK_SIZE);
+    assert(disk_write(disk, 0, data) == BLOCK_SIZE);
+    disk_close(disk);
+    disk = disk_open(DISK_PATH, blocks);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE && data[0] == 'a');
+    disk_close(disk);
+
+    debug("Check clone replaces existing destination");
+    assert(disk_clone(DISK_PATH, DISK_CLONE));
+    disk = disk_open(DISK_CLONE, blocks);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE && data[0] == 'a');
+    disk_close(disk);
+
+    debug("Check clone onto itself or a hard link leaves source intact");
+    assert(unlink(DISK_CLONE) == 0 && link(DISK_PATH, DISK_CLONE) == 0);
+    assert(disk_clone(DISK_PATH, DISK_PATH) == false);
+    assert(disk_clone(DISK_PATH, DISK_CLONE) == false);
+    assert(stat(DISK_PATH, &s) == 0 && s.st_size == (off_t)(blocks * BLOCK_SIZE));
+    disk = disk_open(DISK_PATH, blocks);
+    assert(disk_read(disk, 0, data) == BLOCK_SIZE && data[0] == 'a');
+    assert(disk_read(disk, blocks - 1, data) == BLOCK_SIZE && data[0] == 'z');
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_10_disk_merge() {
+    size_t      blocks = 3 * QUEUE_MERGE_MAX;
+    char       *data   = calloc(blocks, BLOCK_SIZE);
+    DiskRequest requests[5];
+    QueueStats  stats;
+
+    Disk *disk = disk_open(DISK_PATH, blocks);
+    assert(disk && data);
+    disk_queue(disk, queue_parse("cscan"));
+
+    debug("Check merged runs stop at the merge limit");
+    size_t runs[5][2] = {
+        {0, QUEUE_MERGE_MAX - 56},                  // merged with the next request
+        {QUEUE_MERGE_MAX - 56, 56},                 // fills the run exactly
+        {QUEUE_MERGE_MAX, 1},                       // no room left
+        {QUEUE_MERGE_MAX + 1, QUEUE_MERGE_MAX + 44},// larger than the limit by itself
+        {2 * QUEUE_MERGE_MAX + 45, 1},              // no room left
+    };
+    for (size_t i = 0; i < 5; i++) {
+        requests[i] = (DiskRequest){.block = runs[i][0], .count = runs[i][1], .data = data + runs[i][0] * BLOCK_SIZE, .write = true};
+        queue_submit(disk->queue, &requests[i]);
+    }
+    for (size_t i = 0; i < 5; i++) {
+        assert(queue_wait(disk->queue, &requests[i]) == (ssize_t)(runs[i][1] * BLOCK_SIZE));
+    }
+    queue_stats(disk->queue, &stats);
+    assert(stats.submitted == 5 && stats.dispatched == 4 && stats.merges == 1);
+
+    disk_queue(disk, NULL);
+    disk_close(disk);
+    free(data);
+    return EXIT_SUCCESS;
+}
+
 /* Main execution */
 
 int main(int argc, char *argv[]) {
@@ -115,6 +593,14 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    0. Test disk_open\n");
         fprintf(stderr, "    1. Test disk_read\n");
         fprintf(stderr, "    2. Test disk_write\n");
+        fprintf(stderr, "    3. Test disk_model\n");
+        fprintf(stderr, "    4. Test disk_queue\n");
+        fprintf(stderr, "    5. Test disk_priority\n");
+        fprintf(stderr, "    6. Test disk_checksum\n");
+        fprintf(stderr, "    7. Test disk_track\n");
+        fprintf(stderr, "    8. Test disk_overlay\n");
+        fprintf(stderr, "    9. Test disk_clone\n");
+        fprintf(stderr, "    10. Test disk_merge\n");
         return EXIT_FAILURE;
     }
 
@@ -127,6 +613,14 @@ int main(int argc, char *argv[]) {
         case 0:  status = test_00_disk_open(); break;
         case 1:  status = test_01_disk_read(); break;
         case 2:  status = test_02_disk_write(); break;
+        case 3:  status = test_03_disk_model(); break;
+        case 4:  status = test_04_disk_queue(); break;
+        case 5:  status = test_05_disk_priority(); break;
+        case 6:  status = test_06_disk_checksum(); break;
+        case 7:  status = test_07_disk_track(); break;
+        case 8:  status = test_08_disk_overlay(); break;
+        case 9:  status = test_09_disk_clone(); break;
+        case 10: status = test_10_disk_merge(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 
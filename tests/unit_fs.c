@@ -2,17 +2,43 @@
 
 #include "sfs/fs.h"
 #include "sfs/logging.h"
+#include "sfs/record.h"
+#include "sfs/simd.h"
+#include "sfs/utils.h"
 
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <unistd.h>
 
 /* Functions */
 
+// helper function to count the free blocks of a mounted file system
+size_t count_free(FileSystem *fs) {
+    size_t free = 0;
+    for (size_t block = 0; block < fs->meta_data.blocks; block++) {
+        free += fs->free_blocks[block];
+    }
+    return free;
+}
+
+// helper function to mount a scratch copy (data/image.unit) of an image
+Disk *mount_copy(FileSystem *fs, const char *image, size_t blocks) {
+    assert(disk_clone(image, "data/image.unit"));
+    Disk *disk = disk_open("data/image.unit", blocks);
+    assert(disk);
+    assert(fs_mount(fs, disk));
+    return disk;
+}
+
 void test_cleanup() {
     unlink("data/image.unit");
+    unlink("data/image.unit.crc");
+    unlink("data/image.unit.scrub");
+    unlink("data/image.unit.dedup");
+    unlink("data/image.unit.record");
 }
 
 int test_00_fs_mount() {
@@ -73,15 +99,11 @@ int test_00_fs_mount() {
 }
 
 int test_01_fs_create() {
-    assert(system("cp data/image.5 data/image.unit") == EXIT_SUCCESS);
-
-    Disk *disk = disk_open("data/image.unit", 5);
-    assert(disk);
-
     FileSystem fs = {0};
-    assert(fs_mount(&fs, disk));
+    Disk *disk = mount_copy(&fs, "data/image.5", 5);
 
     debug("Check creating inodes");
+    assert(fs.free_inodes == INODES_PER_BLOCK - 1);
     assert(fs_create(&fs) == 0);
     for (size_t i = 2; i < 128; i++) {
         assert(fs_create(&fs) == i);
@@ -93,8 +115,10 @@ int test_01_fs_create() {
     }
 
     debug("Check creating inodes (table full)");
+    assert(fs.free_inodes == 0);
     assert(fs_create(&fs) < 0);
     assert(fs_create(&fs) < 0);
+    assert(fs.free_inodes == 0);
 
     fs_unmount(&fs);
     disk_close(disk);
@@ -102,19 +126,16 @@ int test_01_fs_create() {
 }
 
 int test_02_fs_remove() {
-    assert(system("cp data/image.20 data/image.unit") == EXIT_SUCCESS);
-
-    Disk *disk = disk_open("data/image.unit", 20);
-    assert(disk);
-
     FileSystem fs = {0};
-    assert(fs_mount(&fs, disk));
+    Disk *disk = mount_copy(&fs, "data/image.20", 20);
 
     debug("Check removing inode 0");
     assert(fs_remove(&fs, 0) == false);
 
     debug("Check removing inode 2");
+    size_t free_inodes = fs.free_inodes;
     assert(fs_remove(&fs, 2));
+    assert(fs.free_inodes == free_inodes + 1);
     assert(fs.free_blocks[4]);
     assert(fs.free_blocks[5]);
     assert(fs.free_blocks[6]);
@@ -131,6 +152,7 @@ int test_02_fs_remove() {
 
     debug("Check removing inode 2 (already removed)");
     assert(fs_remove(&fs, 1) == false);
+    assert(fs.free_inodes == free_inodes + 1);
 
     fs_unmount(&fs);
     disk_close(disk);
@@ -164,6 +186,761 @@ int test_03_fs_stat() {
     return EXIT_SUCCESS;
 }
 
+int test_04_fs_advise() {
+    Disk *disk = disk_open("data/image.200", 200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    assert(fs_mount(&fs, disk));
+
+    Inode inode;
+    Block block;
+    assert(disk_read(disk, 1, block.data) != DISK_FAILURE);
+    inode = block.inodes[9];
+    assert(inode.valid);
+
+    debug("Check advise on invalid inode and advice");
+    assert(fs_advise(&fs, 0, 0, 0, FS_ADVICE_WILLNEED) == false);
+    assert(fs_advise(&fs, 9, 0, 0, -1) == false);
+
+    debug("Check advise willneed");
+    assert(fs_advise(&fs, 9, 0, 0, FS_ADVICE_WILLNEED));
+    for (size_t i = 0; i < POINTERS_PER_INODE; i++) {
+        assert(cache_contains(fs.cache, inode.direct[i]));
+    }
+    assert(cache_contains(fs.cache, inode.indirect));
+
+    debug("Check advise dontneed");
+    assert(fs_advise(&fs, 9, 0, BLOCK_SIZE, FS_ADVICE_DONTNEED));
+    assert(cache_contains(fs.cache, inode.direct[0]) == false);
+    assert(cache_contains(fs.cache, inode.direct[1]));
+
+    debug("Check advise random");
+    assert(fs_advise(&fs, 9, 0, 0, FS_ADVICE_RANDOM));
+    assert(fs_advise(&fs, 9, 0, 0, FS_ADVICE_DONTNEED));
+    char data[BLOCK_SIZE + 1];
+    size_t issued = fs.readahead->issued;
+    assert(fs_read(&fs, 9, data, BLOCK_SIZE, 0) > 0);
+    assert(fs.readahead->issued == issued);
+    assert(cache_contains(fs.cache, inode.direct[1]) == false);
+
+    debug("Check advice outlives more streams than the readahead table holds");
+    for (size_t i = 0; i < 2 * READAHEAD_STREAMS; i++) {
+        readahead_access(&fs, 10 + i, &inode, 0);
+    }
+    for (size_t i = 0; i < READAHEAD_STREAMS; i++) {
+        assert(!fs.readahead->streams[i].valid || fs.readahead->streams[i].inode_number != 9);
+    }
+    assert(readahead_advice(&fs, 9) == FS_ADVICE_RANDOM);
+    assert(fs_advise(&fs, 9, 0, 0, FS_ADVICE_DONTNEED));
+    issued = fs.readahead->issued;
+    assert(fs_read(&fs, 9, data, BLOCK_SIZE, 0) > 0);
+    assert(fs.readahead->issued == issued);
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_05_fs_stats() {
+    Disk *disk = disk_open("data/image.200", 200);
+    assert(disk);
+
+    FileSystem fs = {0};
+    Stats stats;
+
+    debug("Check stats start empty");
+    stats_reset();
+    fs_stats(&fs, &stats);
+    for (int op = 0; op < STATS_OPS; op++) {
+        assert(stats.ops[op].count == 0);
+    }
+
+    debug("Check stats count operations");
+    assert(fs_mount(&fs, disk));
+    assert(fs_stat(&fs, 0) < 0);
+    assert(fs_stat(&fs, 9) > 0);
+
+    char data[BLOCK_SIZE + 1];
+    ssize_t bytes = fs_read(&fs, 9, data, BLOCK_SIZE, 0);
+    assert(bytes > 0);
+
+    fs_stats(&fs, &stats);
+    assert(stats.ops[STATS_MOUNT].count       == 1);
+    assert(stats.ops[STATS_MOUNT].disk_reads  >= 1);
+    assert(stats.ops[STATS_STAT].count        == 2);
+    assert(stats.ops[STATS_STAT].errors       == 1);
+    assert(stats.ops[STATS_READ].count        == 1);
+    assert(stats.ops[STATS_READ].bytes        == (uint64_t)bytes);
+    assert(stats.ops[STATS_DISK_READ].count   <= disk->reads);
+    assert(stats.ops[STATS_DISK_READ].bytes   == disk->reads * BLOCK_SIZE);
+
+    debug("Check stats percentiles");
+    StatsOp *read = &stats.ops[STATS_READ];
+    assert(stats_percentile(read, 50) >= read->total_ns / 2);
+    assert(stats_percentile(read, 99) >= stats_percentile(read, 50));
+
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_06_fs_scrub() {
+    assert(disk_clone("data/image.200", "data/image.unit"));
+
+    Disk *disk = disk_open("data/image.unit", 200);
+    assert(disk);
+    assert(disk_checksum(disk, "data/image.unit.crc", true));
+
+    FileSystem fs = {0};
+    ScrubStats stats;
+
+    debug("Check scrub requires mounted filesystem");
+    assert(fs_scrub_start(&fs, NULL, 0, false) == false);
+    assert(fs_scrub_stats(&fs, &stats) == false);
+
+    assert(fs_mount(&fs, disk));
+    size_t allocated = 0;
+    size_t last      = 0;
+    for (size_t block = 0; block < fs.meta_data.blocks; block++) {
+        if (!fs.free_blocks[block]) {
+            allocated++;
+            last = block;
+        }
+    }
+
+    debug("Check scrub reads every allocated block");
+    assert(fs_scrub_start(&fs, NULL, 0, false));
+    assert(fs_scrub_stats(&fs, &stats));
+    assert(!stats.running && stats.passes == 1 && stats.position == 0);
+    assert(stats.scanned == allocated && stats.errors == 0);
+
+    debug("Check scrub finds corrupted block");
+    assert(pwrite(disk->fd, "!", 1, last * BLOCK_SIZE) == 1);
+    assert(fs_scrub_start(&fs, NULL, 0, false));
+    assert(fs_scrub_stats(&fs, &stats));
+    assert(stats.scanned == allocated && stats.errors == 1);
+    assert(disk_checksum(disk, "data/image.unit.crc", true));
+
+    debug("Check rate limited scrub checkpoints and resumes");
+    assert(fs_scrub_start(&fs, "data/image.unit.scrub", BLOCK_SIZE, true));
+    usleep(100000);
+    fs_scrub_stop(&fs);
+
+    FILE *stream = fopen("data/image.unit.scrub", "r");
+    ScrubCheckpoint checkpoint;
+    assert(stream && fread(&checkpoint, sizeof(checkpoint), 1, stream) == 1);
+    fclose(stream);
+    assert(checkpoint.magic == SCRUB_MAGIC && checkpoint.blocks == fs.meta_data.blocks);
+    assert(checkpoint.position > 0 && checkpoint.position < checkpoint.blocks && checkpoint.passes == 0);
+
+    size_t remaining = 0;
+    for (size_t block = checkpoint.position; block < fs.meta_data.blocks; block++) {
+        remaining += !fs.free_blocks[block];
+    }
+    assert(fs_scrub_start(&fs, "data/image.unit.scrub", 0, false));
+    assert(fs_scrub_stats(&fs, &stats));
+    assert(stats.scanned == remaining && stats.passes == 1 && stats.errors == 0);
+
+    debug("Check background scrub while blocks are allocated and freed");
+    char data[4 * BLOCK_SIZE];
+    memset(data, 's', sizeof(data));
+    assert(fs_scrub_start(&fs, NULL, 1024 * BLOCK_SIZE, true));
+    for (size_t i = 0; i < 32; i++) {
+        ssize_t inode_number = fs_create(&fs);
+        assert(inode_number >= 0);
+        assert(fs_write(&fs, inode_number, data, sizeof(data), 0) == sizeof(data));
+        assert(fs_remove(&fs, inode_number));
+        usleep(1000);
+    }
+    while (fs_scrub_stats(&fs, &stats) && stats.running) {
+        usleep(1000);
+    }
+    assert(stats.passes == 1 && stats.errors == 0);
+
+    fs_unmount(&fs);
+    assert(fs.scrub == NULL);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_07_fs_compress() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t free_before = count_free(&fs);
+
+    debug("Check compression requires an empty file");
+    assert(fs_compress(&fs, 1) == false);
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_compress(&fs, inode_number));
+    assert(fs_compress(&fs, inode_number));
+
+    debug("Check chunked writes compress and read back");
+    size_t length = 3 * CLUSTER_SIZE + 1000;
+    char  *data   = malloc(length);
+    char  *copy   = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44] + (i / 4096) % 3;
+    }
+    for (size_t offset = 0; offset < length; offset += 16384) {
+        size_t chunk = min(16384, length - offset);
+        assert(fs_write(&fs, inode_number, data + offset, chunk, offset) == (ssize_t)chunk);
+    }
+    assert(fs_stat(&fs, inode_number) == (ssize_t)length);
+
+    size_t used = free_before - count_free(&fs);
+    assert(used > 0 && used < length / BLOCK_SIZE / 4);
+
+    assert(fs_read(&fs, inode_number, copy, length, 0) == (ssize_t)length);
+    assert(memcmp(data, copy, length) == 0);
+    assert(fs_read(&fs, inode_number, copy, 100, CLUSTER_SIZE - 50) == 100);
+    assert(memcmp(data + CLUSTER_SIZE - 50, copy, 100) == 0);
+    assert(fs_read(&fs, inode_number, copy, 100, length - 10) == 10);
+    assert(fs_read(&fs, inode_number, copy, 100, length) == 0);
+
+    debug("Check incompressible overwrite is stored raw");
+    for (size_t i = 0; i < CLUSTER_SIZE; i++) {
+        data[CLUSTER_SIZE + i] = rand();
+    }
+    assert(fs_write(&fs, inode_number, data + CLUSTER_SIZE, CLUSTER_SIZE, CLUSTER_SIZE) == CLUSTER_SIZE);
+    assert(fs_stat(&fs, inode_number) == (ssize_t)length);
+
+    Block block;
+    assert(disk_read(disk, inode_number / INODES_PER_BLOCK + 1, block.data) != DISK_FAILURE);
+    Inode inode = block.inodes[inode_number % INODES_PER_BLOCK];
+    assert(inode.valid == (INODE_VALID | INODE_COMPRESSED) && inode.indirect);
+    assert(disk_read(disk, inode.indirect, block.data) != DISK_FAILURE);
+    assert(!(block.clusters[0].flags & CLUSTER_RAW) && block.clusters[0].blocks < CLUSTER_BLOCKS);
+    assert((block.clusters[1].flags & CLUSTER_RAW) && block.clusters[1].blocks == CLUSTER_BLOCKS);
+
+    debug("Check clusters persist across remount");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    memset(copy, 0, length);
+    assert(fs_read(&fs, inode_number, copy, length, 0) == (ssize_t)length);
+    assert(memcmp(data, copy, length) == 0);
+
+    debug("Check remove releases every cluster");
+    assert(fs_remove(&fs, inode_number));
+    assert(count_free(&fs) == free_before);
+
+    free(data);
+    free(copy);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_08_fs_holes() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t free_before = count_free(&fs);
+
+    debug("Check zero blocks are stored as holes");
+    char *data = calloc(8, BLOCK_SIZE);
+    memset(data, 'a', BLOCK_SIZE);
+    memset(data + 7 * BLOCK_SIZE, 'b', BLOCK_SIZE);
+    ssize_t inode_number = fs_create(&fs);
+    assert(inode_number >= 0);
+    assert(fs_write(&fs, inode_number, data, 8 * BLOCK_SIZE, 0) == 8 * BLOCK_SIZE);
+
+    Block block;
+    assert(disk_read(disk, inode_number / INODES_PER_BLOCK + 1, block.data) != DISK_FAILURE);
+    Inode inode = block.inodes[inode_number % INODES_PER_BLOCK];
+    assert(inode.direct[0] != HOLE_BLOCK && inode.direct[1] == HOLE_BLOCK && inode.direct[4] == HOLE_BLOCK);
+    assert(disk_read(disk, inode.indirect, block.data) != DISK_FAILURE);
+    assert(block.pointers[0] == HOLE_BLOCK && block.pointers[1] == HOLE_BLOCK);
+    assert(block.pointers[2] && block.pointers[2] != HOLE_BLOCK);
+
+    size_t used = free_before - count_free(&fs);
+    assert(used == 3);
+
+    debug("Check holes survive remount and remove");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_stat(&fs, inode_number) == 8 * BLOCK_SIZE);
+    assert(fs_remove(&fs, inode_number));
+
+    debug("Check compressed holes read as zeros without I/O");
+    inode_number = fs_create(&fs);
+    assert(fs_compress(&fs, inode_number));
+    char *zeros = calloc(1, 3 * CLUSTER_SIZE);
+    memset(zeros + 2 * CLUSTER_SIZE, 'c', CLUSTER_SIZE);
+    assert(fs_write(&fs, inode_number, zeros, 3 * CLUSTER_SIZE, 0) == 3 * CLUSTER_SIZE);
+
+    size_t reads = disk->reads;
+    memset(zeros, 'x', CLUSTER_SIZE);
+    assert(fs_read(&fs, inode_number, zeros, CLUSTER_SIZE, CLUSTER_SIZE / 2) == CLUSTER_SIZE);
+    assert(simd_zero(zeros, CLUSTER_SIZE));
+    assert(disk->reads == reads);
+
+    assert(fs_remove(&fs, inode_number));
+    assert(count_free(&fs) == free_before);
+
+    free(zeros);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_09_fs_simd() {
+    char      a[BLOCK_SIZE + 1], b[BLOCK_SIZE + 1];
+    Block     block;
+    uint32_t  indices[POINTERS_PER_BLOCK];
+    bool      bitmap[1000];
+
+    for (int level = SIMD_SCALAR; level <= simd_supported(); level++) {
+        simd_use(level);
+        debug("Check %s kernels", simd_level_name(simd_level()));
+        assert(simd_level() == level);
+
+        // zero detection and comparison at every alignment and position
+        memset(a, 0, sizeof(a));
+        memset(b, 0, sizeof(b));
+        for (size_t length = 0; length <= 300; length++) {
+            assert(simd_zero(a + 1, length) && simd_equal(a + 1, b + 1, length));
+            for (size_t position = 0; position < length; position += 7) {
+                a[1 + position] = 1;
+                assert(!simd_zero(a + 1, length) && !simd_equal(a + 1, b + 1, length));
+                a[1 + position] = 0;
+            }
+        }
+        memset(a, 'x', sizeof(a));
+        simd_clear(a + 1, BLOCK_SIZE - 3);
+        assert(a[0] == 'x' && simd_zero(a + 1, BLOCK_SIZE - 3) && a[BLOCK_SIZE - 2] == 'x');
+
+        // nonzero pointers and valid inodes
+        memset(block.data, 0, BLOCK_SIZE);
+        block.pointers[0] = 7;
+        block.pointers[9] = HOLE_BLOCK;
+        block.pointers[POINTERS_PER_BLOCK - 1] = 999;
+        block.pointers[POINTERS_PER_BLOCK - 2] = 1000;
+        assert(simd_nonzero(block.pointers, POINTERS_PER_BLOCK, 1, indices) == 4);
+        assert(indices[0] == 0 && indices[1] == 9 && indices[3] == POINTERS_PER_BLOCK - 1);
+
+        memset(bitmap, 0, sizeof(bitmap));
+        assert(simd_mark(bitmap, block.pointers, POINTERS_PER_BLOCK, 1000, true) == 2);
+        assert(bitmap[7] && bitmap[999] && !bitmap[0]);
+        assert(simd_mark(bitmap, block.pointers, POINTERS_PER_BLOCK, 1000, false) == 2);
+        assert(!bitmap[7] && !bitmap[999]);
+
+        memset(block.data, 0, BLOCK_SIZE);
+        block.inodes[3].valid = INODE_VALID;
+        block.inodes[3].size  = 1;
+        block.inodes[INODES_PER_BLOCK - 1].valid = INODE_VALID | INODE_COMPRESSED;
+        assert(simd_nonzero(&block.inodes[0].valid, INODES_PER_BLOCK, sizeof(Inode) / sizeof(uint32_t), indices) == 2);
+        assert(indices[0] == 3 && indices[1] == INODES_PER_BLOCK - 1);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int test_10_fs_dedup() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+    assert(fs_dedup_start(&fs, "data/image.unit.dedup"));
+
+    size_t free_before = count_free(&fs);
+
+    debug("Check identical blocks are shared");
+    size_t length = (POINTERS_PER_INODE + 3) * BLOCK_SIZE;
+    char  *data   = calloc(1, length);
+    char  *copy   = calloc(1, length);
+    for (size_t b = 0; b < length / BLOCK_SIZE; b++) {
+        memset(data + b * BLOCK_SIZE, 'a' + (b % 2), BLOCK_SIZE);
+    }
+    ssize_t first  = fs_create(&fs);
+    ssize_t second = fs_create(&fs);
+    assert(fs_write(&fs, first, data, length, 0) == length);
+    assert(fs_write(&fs, second, data, length, 0) == length);
+
+    size_t used = free_before - count_free(&fs);
+    assert(used == 2 + 2);     // two distinct data blocks and two pointer blocks
+
+    DedupStats stats;
+    assert(fs_dedup_stats(&fs, &stats));
+    assert(stats.entries == 2 && stats.hits == 2 * (length / BLOCK_SIZE) - 2);
+
+    debug("Check shared blocks survive remount and remove");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_dedup_start(&fs, "data/image.unit.dedup"));
+    assert(fs_dedup_stats(&fs, &stats) && stats.entries == 2);
+    assert(fs_remove(&fs, first));
+    assert(fs_read(&fs, second, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+
+    debug("Check index drops blocks freed with their last reference");
+    assert(fs_remove(&fs, second));
+    assert(fs_dedup_stats(&fs, &stats) && stats.entries == 0);
+    assert(count_free(&fs) == free_before);
+
+    debug("Check reloaded index drops data blocks reused as metadata");
+    length = (POINTERS_PER_INODE + 2) * BLOCK_SIZE;
+    for (size_t b = 0; b < length / BLOCK_SIZE; b++) {
+        memset(data + b * BLOCK_SIZE, 'c' + b, BLOCK_SIZE);
+    }
+    first = fs_create(&fs);
+    assert(fs_write(&fs, first, data, length, 0) == length);
+    assert(fs_dedup_stats(&fs, &stats) && stats.entries == POINTERS_PER_INODE + 2);
+    fs_dedup_stop(&fs);
+
+    // without the index, a shifted write turns an indexed data block into a pointer block
+    assert(fs_remove(&fs, first));
+    memset(data, 'z', BLOCK_SIZE);
+    first  = fs_create(&fs);
+    second = fs_create(&fs);
+    assert(fs_write(&fs, first, data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_write(&fs, second, data + BLOCK_SIZE, length - BLOCK_SIZE, 0) == length - BLOCK_SIZE);
+
+    assert(fs_dedup_start(&fs, "data/image.unit.dedup"));
+    assert(fs_dedup_stats(&fs, &stats) && stats.entries == POINTERS_PER_INODE + 1);
+
+    debug("Check lookups probe past blocks whose hash collides");
+    assert(fs_remove(&fs, first));
+    assert(fs_remove(&fs, second));
+
+    // xor-ing the CRC32C polynomial into both halves keeps the hash of a block
+    const unsigned char polynomial[] = {0xF1, 0x76, 0xEC, 0x05, 0x01};
+    memset(data, 'y', BLOCK_SIZE);
+    memcpy(copy, data, BLOCK_SIZE);
+    for (size_t i = 0; i < sizeof(polynomial); i++) {
+        copy[i]                  ^= polynomial[i];
+        copy[BLOCK_SIZE / 2 + i] ^= polynomial[i];
+    }
+    assert(dedup_hash(data) == dedup_hash(copy));
+
+    free_before = count_free(&fs);
+    DedupStats before;
+    assert(fs_dedup_stats(&fs, &before));
+    ssize_t inodes[3] = {fs_create(&fs), fs_create(&fs), fs_create(&fs)};
+    assert(fs_write(&fs, inodes[0], data, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_write(&fs, inodes[1], copy, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_write(&fs, inodes[2], copy, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(free_before - count_free(&fs) == 2);
+
+    assert(fs_dedup_stats(&fs, &stats));
+    assert(stats.entries == before.entries + 2);
+    assert(stats.hits == before.hits + 1);
+    assert(stats.mismatches == before.mismatches + 2);
+    fs_dedup_stop(&fs);
+
+    free(copy);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_11_fs_clone() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t free_before = count_free(&fs);
+
+    debug("Check clone shares blocks for one inode write");
+    size_t length = 40 * BLOCK_SIZE;
+    char  *data   = malloc(length);
+    char  *copy   = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = 'a' + (i * 7 + i / BLOCK_SIZE) % 26;
+    }
+    ssize_t source = fs_create(&fs);
+    assert(fs_write(&fs, source, data, length, 0) == length);
+
+    size_t writes = disk->writes;
+    ssize_t clone = fs_clone(&fs, source);
+    assert(clone >= 0 && clone != source);
+    assert(disk->writes == writes + 1);
+    assert(fs_read(&fs, clone, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+
+    debug("Check writes to a clone leave the source unchanged");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    memset(copy, 'z', BLOCK_SIZE);
+    assert(fs_write(&fs, clone, copy, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs_stat(&fs, clone) == BLOCK_SIZE);
+    assert(fs_read(&fs, source, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+
+    debug("Check compressed clones copy clusters on write");
+    ssize_t packed = fs_create(&fs);
+    assert(fs_compress(&fs, packed));
+    assert(fs_write(&fs, packed, data, length, 0) == length);
+    ssize_t packed_clone = fs_clone(&fs, packed);
+    assert(packed_clone >= 0);
+    memset(copy, 'z', 100);
+    assert(fs_write(&fs, packed_clone, copy, 100, CLUSTER_SIZE + 10) == 100);
+    assert(fs_read(&fs, packed, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+    assert(fs_read(&fs, packed_clone, copy, length, 0) == length);
+    assert(memcmp(copy, data, CLUSTER_SIZE + 10) == 0 && copy[CLUSTER_SIZE + 10] == 'z');
+    assert(memcmp(copy + CLUSTER_SIZE + 110, data + CLUSTER_SIZE + 110, length - CLUSTER_SIZE - 110) == 0);
+
+    debug("Check blocks are freed with their last reference");
+    assert(fs_remove(&fs, source));
+    assert(fs_remove(&fs, packed));
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_read(&fs, packed_clone, copy, length, 0) == length);
+    assert(memcmp(copy + CLUSTER_SIZE + 110, data + CLUSTER_SIZE + 110, length - CLUSTER_SIZE - 110) == 0);
+    assert(fs_remove(&fs, clone));
+    assert(fs_remove(&fs, packed_clone));
+
+    assert(count_free(&fs) == free_before);
+
+    free(copy);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_12_fs_snapshot() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t free_before = count_free(&fs);
+
+    size_t length = 12 * BLOCK_SIZE;
+    char  *data   = malloc(length);
+    char  *copy   = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = 'a' + (i * 3 + i / BLOCK_SIZE) % 26;
+    }
+    ssize_t plain  = fs_create(&fs);
+    ssize_t packed = fs_create(&fs);
+    assert(fs_compress(&fs, packed));
+    assert(fs_write(&fs, plain, data, length, 0) == length);
+    assert(fs_write(&fs, packed, data, length, 0) == length);
+
+    debug("Check snapshot costs two block writes");
+    size_t writes = disk->writes;
+    ssize_t snapshot = fs_snapshot(&fs);
+    assert(snapshot == 0);
+    assert(disk->writes == writes + 2);
+
+    debug("Check snapshot is frozen while the live file system changes");
+    FileSystem backup = {0};
+    assert(fs_snapshot_mount(&backup, disk, snapshot));
+    memset(copy, 'z', BLOCK_SIZE);
+    assert(fs_write(&fs, packed, copy, BLOCK_SIZE, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(fs_remove(&fs, plain));
+    ssize_t added = fs_create(&fs);
+    assert(fs_write(&fs, added, copy, BLOCK_SIZE, 0) == BLOCK_SIZE);
+
+    assert(fs_read(&backup, plain, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+    assert(fs_read(&backup, packed, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+    assert(fs_stat(&backup, added) == (added == plain ? (ssize_t)length : -1));
+    assert(fs_write(&backup, packed, data, BLOCK_SIZE, 0) < 0);
+    assert(fs_create(&backup) < 0 && !fs_remove(&backup, packed));
+    fs_unmount(&backup);
+
+    debug("Check snapshot survives remount");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_read(&fs, packed, copy, length, 0) == length);
+    assert(copy[BLOCK_SIZE] == 'z');
+    assert(fs_snapshot_mount(&backup, disk, snapshot));
+    assert(fs_read(&backup, plain, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+    assert(backup.free_inodes == fs.free_inodes);
+    fs_remove(&fs, added);
+    assert(backup.free_inodes == fs.free_inodes - 1);
+    added = fs_create(&fs);
+    fs_unmount(&backup);
+
+    debug("Check deleting the snapshot frees its blocks");
+    assert(fs_remove(&fs, packed));
+    assert(fs_remove(&fs, added));
+    assert(fs_snapshot_delete(&fs, snapshot));
+    assert(!fs_snapshot_mount(&backup, disk, snapshot));
+
+    assert(count_free(&fs) == free_before);
+
+    free(copy);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_13_fs_record() {
+    assert(disk_clone("data/image.200", "data/image.unit"));
+    Disk *disk = disk_open("data/image.unit", 200);
+    assert(disk);
+
+    FileSystem fs     = {0};
+    FileSystem backup = {0};
+    Stats      stats;
+
+    debug("Check clone, compress and snapshot calls are recorded");
+    stats_reset();
+    assert(record_start("data/image.unit.record"));
+    assert(fs_mount(&fs, disk));
+    ssize_t source = fs_create(&fs);
+    assert(fs_compress(&fs, source));
+    ssize_t clone = fs_clone(&fs, source);
+    assert(clone >= 0);
+    ssize_t snapshot = fs_snapshot(&fs);
+    assert(snapshot >= 0);
+    fs_unmount(&fs);
+    assert(fs_snapshot_mount(&backup, disk, snapshot));
+    fs_unmount(&backup);
+    assert(!fs_snapshot_mount(&backup, disk, SNAPSHOTS_MAX));
+    assert(fs_mount(&fs, disk));
+    assert(fs_snapshot_delete(&fs, snapshot));
+    assert(record_stop());
+
+    RecordEntry expected[] = {
+        {.op = RECORD_MOUNT,           .inode = 0,             .result = 0},
+        {.op = RECORD_CREATE,          .inode = 0,             .result = source},
+        {.op = RECORD_COMPRESS,        .inode = source,        .result = 0},
+        {.op = RECORD_CLONE,           .inode = source,        .result = clone},
+        {.op = RECORD_SNAPSHOT,        .inode = 0,             .result = snapshot},
+        {.op = RECORD_UNMOUNT,         .inode = 0,             .result = 0},
+        {.op = RECORD_SNAPSHOT_MOUNT,  .inode = snapshot,      .result = 0},
+        {.op = RECORD_UNMOUNT,         .inode = 0,             .result = 0},
+        {.op = RECORD_SNAPSHOT_MOUNT,  .inode = SNAPSHOTS_MAX, .result = -1},
+        {.op = RECORD_MOUNT,           .inode = 0,             .result = 0},
+        {.op = RECORD_SNAPSHOT_DELETE, .inode = snapshot,      .result = 0},
+    };
+    size_t count = sizeof(expected) / sizeof(expected[0]);
+
+    FILE *stream = fopen("data/image.unit.record", "r");
+    assert(stream);
+    RecordHeader header;
+    assert(fread(&header, sizeof(header), 1, stream) == 1);
+    assert(header.magic == RECORD_MAGIC && header.version == RECORD_VERSION);
+    for (size_t e = 0; e < count; e++) {
+        RecordEntry entry;
+        assert(fread(&entry, sizeof(entry), 1, stream) == 1);
+        assert(entry.op     == expected[e].op);
+        assert(entry.inode  == expected[e].inode);
+        assert(entry.result == expected[e].result);
+    }
+    RecordEntry extra;
+    assert(fread(&extra, sizeof(extra), 1, stream) == 0);
+    fclose(stream);
+
+    debug("Check clone, compress and snapshot calls are counted");
+    fs_stats(&fs, &stats);
+    assert(stats.ops[STATS_CLONE].count           == 1);
+    assert(stats.ops[STATS_COMPRESS].count        == 1);
+    assert(stats.ops[STATS_SNAPSHOT].count        == 1);
+    assert(stats.ops[STATS_SNAPSHOT_DELETE].count == 1);
+    assert(stats.ops[STATS_MOUNT].count           == 4);
+    assert(stats.ops[STATS_MOUNT].errors          == 1);
+
+    assert(fs_remove(&fs, clone));
+    assert(fs_remove(&fs, source));
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_14_fs_read() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t length = (POINTERS_PER_INODE + 3) * BLOCK_SIZE;
+    char  *data   = malloc(length);
+    char  *copy   = malloc(length + 1);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = 'a' + (i / BLOCK_SIZE) % 26;
+    }
+    ssize_t inode = fs_create(&fs);
+    assert(fs_write(&fs, inode, data, length, 0) == length);
+
+    debug("Check read at offset of first indirect block");
+    size_t offset = POINTERS_PER_INODE * BLOCK_SIZE;
+    memset(copy, 0, length + 1);
+    assert(fs_read(&fs, inode, copy, BLOCK_SIZE, offset) == BLOCK_SIZE);
+    assert(memcmp(copy, data + offset, BLOCK_SIZE) == 0);
+    assert(copy[BLOCK_SIZE] == 0);
+
+    debug("Check read across the direct and indirect blocks");
+    assert(fs_read(&fs, inode, copy, 2 * BLOCK_SIZE, offset - BLOCK_SIZE) == 2 * BLOCK_SIZE);
+    assert(memcmp(copy, data + offset - BLOCK_SIZE, 2 * BLOCK_SIZE) == 0);
+    assert(fs_read(&fs, inode, copy, length, 0) == length);
+    assert(memcmp(copy, data, length) == 0);
+
+    assert(fs_remove(&fs, inode));
+    free(copy);
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
+int test_15_fs_readahead() {
+    FileSystem fs = {0};
+    Disk *disk = mount_copy(&fs, "data/image.200", 200);
+
+    size_t blocks = 40;
+    char  *data   = malloc(blocks * BLOCK_SIZE);
+    char   copy[BLOCK_SIZE + 1];
+    for (size_t b = 0; b < blocks; b++) {
+        memset(data + b * BLOCK_SIZE, 'A' + b, BLOCK_SIZE);
+    }
+    ssize_t inode_number = fs_create(&fs);
+    assert(fs_write(&fs, inode_number, data, blocks * BLOCK_SIZE, 0) == blocks * BLOCK_SIZE);
+
+    Block block;
+    assert(disk_read(disk, inode_number / INODES_PER_BLOCK + 1, block.data) != DISK_FAILURE);
+    Inode inode = block.inodes[inode_number % INODES_PER_BLOCK];
+    assert(disk_read(disk, inode.indirect, block.data) != DISK_FAILURE);
+
+    debug("Check first sequential read prefetches the initial window");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    assert(fs_read(&fs, inode_number, copy, BLOCK_SIZE, 0) == BLOCK_SIZE);
+    assert(fs.readahead->issued == READAHEAD_MIN);
+    for (size_t b = 1; b <= READAHEAD_MIN; b++) {
+        assert(cache_contains(fs.cache, inode.direct[b]));
+    }
+    assert(cache_contains(fs.cache, block.pointers[0]) == false);
+
+    debug("Check window grows and reads ahead through the indirect block");
+    assert(fs_read(&fs, inode_number, copy, BLOCK_SIZE, BLOCK_SIZE) == BLOCK_SIZE);
+    for (size_t b = READAHEAD_MIN + 1; b < 2 + 2 * READAHEAD_MIN; b++) {
+        assert(cache_contains(fs.cache, block.pointers[b - POINTERS_PER_INODE]));
+    }
+
+    debug("Check sequential reads miss only on the first block");
+    for (size_t b = 2; b < blocks; b++) {
+        assert(fs_read(&fs, inode_number, copy, BLOCK_SIZE, b * BLOCK_SIZE) == BLOCK_SIZE);
+        assert(memcmp(copy, data + b * BLOCK_SIZE, BLOCK_SIZE) == 0);
+    }
+    assert(fs.readahead->issued == blocks - 1);
+    assert(fs.cache->stats[CACHE_DATA].misses == 1);
+    assert(fs.cache->stats[CACHE_DATA].hits   == blocks - 1);
+
+    debug("Check random reads do not read ahead");
+    fs_unmount(&fs);
+    assert(fs_mount(&fs, disk));
+    size_t order[] = {30, 10, 20, 35, 7};
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        assert(fs_read(&fs, inode_number, copy, BLOCK_SIZE, order[i] * BLOCK_SIZE) == BLOCK_SIZE);
+        assert(memcmp(copy, data + order[i] * BLOCK_SIZE, BLOCK_SIZE) == 0);
+    }
+    assert(fs.readahead->issued == 0);
+    assert(fs.cache->stats[CACHE_DATA].misses == sizeof(order) / sizeof(order[0]));
+
+    assert(fs_remove(&fs, inode_number));
+    free(data);
+    fs_unmount(&fs);
+    disk_close(disk);
+    return EXIT_SUCCESS;
+}
+
 /* Main execution */
 
 int main(int argc, char *argv[]) {
@@ -174,6 +951,18 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    1. Test fs_create\n");
         fprintf(stderr, "    2. Test fs_remove\n");
         fprintf(stderr, "    3. Test fs_stat\n");
+        fprintf(stderr, "    4. Test fs_advise\n");
+        fprintf(stderr, "    5. Test fs_stats\n");
+        fprintf(stderr, "    6. Test fs_scrub\n");
+        fprintf(stderr, "    7. Test fs_compress\n");
+        fprintf(stderr, "    8. Test fs_holes\n");
+        fprintf(stderr, "    9. Test fs_simd\n");
+        fprintf(stderr, "    10. Test fs_dedup\n");
+        fprintf(stderr, "    11. Test fs_clone\n");
+        fprintf(stderr, "    12. Test fs_snapshot\n");
+        fprintf(stderr, "    13. Test fs_record\n");
+        fprintf(stderr, "    14. Test fs_read\n");
+        fprintf(stderr, "    15. Test fs_readahead\n");
         return EXIT_FAILURE;
     }
 
@@ -187,6 +976,18 @@ int main(int argc, char *argv[]) {
         case 1:  status = test_01_fs_create(); break;
         case 2:  status = test_02_fs_remove(); break;
         case 3:  status = test_03_fs_stat(); break;
+        case 4:  status = test_04_fs_advise(); break;
+        case 5:  status = test_05_fs_stats(); break;
+        case 6:  status = test_06_fs_scrub(); break;
+        case 7:  status = test_07_fs_compress(); break;
+        case 8:  status = test_08_fs_holes(); break;
+        case 9:  status = test_09_fs_simd(); break;
+        case 10: status = test_10_fs_dedup(); break;
+        case 11: status = test_11_fs_clone(); break;
+        case 12: status = test_12_fs_snapshot(); break;
+        case 13: status = test_13_fs_record(); break;
+        case 14: status = test_14_fs_read(); break;
+        case 15: status = test_15_fs_readahead(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 